@@ -830,6 +830,16 @@ bool Channel::msgControl(Message& msg)
     return false;
 }
 
+bool Channel::msgDataFlow(Message& msg)
+{
+    bool reset = msg.getBoolValue(YSTRING("reset"));
+    String text;
+    for (ObjList* o = m_data.skipNull(); o; o = o->skipNext())
+	static_cast<DataEndpoint*>(o->get())->dumpFlow(msg,text,reset);
+    msg.retValue() << text;
+    return true;
+}
+
 void Channel::statusParams(String& str)
 {
     if (m_driver)
@@ -1078,6 +1088,7 @@ TokenDict Module::s_messages[] = {
     { "chan.transfer",   Module::Transfer },
     { "chan.control",	 Module::Control },
     { "msg.execute",     Module::MsgExecute },
+    { "chan.dataflow",   Module::DataFlow },
     { 0, 0 }
 };
 
@@ -1411,6 +1422,7 @@ void Driver::setup(const char* prefix, bool minimal)
     installRelay(Drop,60);
     installRelay(Execute,90);
     installRelay(Control,90);
+    installRelay(DataFlow,90);
     if (minimal)
 	return;
     installRelay(Tone);
@@ -1478,6 +1490,7 @@ bool Driver::received(Message &msg, int id)
 	case Drop:
 	case Masquerade:
 	case Locate:
+	case DataFlow:
 	    dest = msg.getValue(YSTRING("id"));
 	    break;
 	default:
@@ -1557,6 +1570,8 @@ bool Driver::received(Message &msg, int id)
 	    return true;
 	case Control:
 	    return chan->msgControl(msg);
+	case DataFlow:
+	    return chan->msgDataFlow(msg);
     }
     return false;
 }
@@ -22,6 +22,13 @@
 #include <string.h>
 #include <stdlib.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(NO_DATA_SIMD)
+#define G711_X86
+#include <immintrin.h>
+#define G711_SSE41 __attribute__((target("sse4.1")))
+#define G711_AVX2 __attribute__((target("avx2")))
+#endif
+
 using namespace TelEngine;
 
 namespace { // anonymous
@@ -73,6 +80,222 @@ public:
 
 static InitG711 s_initG711;
 
+// Convert G.711 to or from native endian slin, any length
+typedef void (*G711Decode)(unsigned short* dst, const unsigned char* src, unsigned int len);
+typedef void (*G711Encode)(unsigned char* dst, const unsigned short* src, unsigned int len);
+
+static void alawDecodeGeneric(unsigned short* dst, const unsigned char* src, unsigned int len)
+{
+    while (len--)
+	*dst++ = a2s[*src++];
+}
+
+static void mulawDecodeGeneric(unsigned short* dst, const unsigned char* src, unsigned int len)
+{
+    while (len--)
+	*dst++ = u2s[*src++];
+}
+
+static void alawEncodeGeneric(unsigned char* dst, const unsigned short* src, unsigned int len)
+{
+    while (len--)
+	*dst++ = s2a[*src++];
+}
+
+static void mulawEncodeGeneric(unsigned char* dst, const unsigned short* src, unsigned int len)
+{
+    while (len--)
+	*dst++ = s2u[*src++];
+}
+
+#ifdef G711_X86
+// The vector code computes exactly what the tables hold, without gathers.
+// Magnitude index k (0-127) of a code has the level base(seg) + m * step(seg),
+//  seg = k / 16 and m = k % 16, step a power of 2. The tables built above map
+//  a sample to the count of levels below a threshold: x-3 or |x|+12 for mu-law,
+//  x-7 or |x|+8 for A-law. The count is 16 * seg plus the mantissa from an
+//  exact power of 2 scaling in floating point.
+
+// Float with value 2^e for each integer lane
+G711_SSE41 static inline __m128 pow2Sse(__m128i e)
+{
+    return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(e,_mm_set1_epi32(127)),23));
+}
+
+G711_SSE41 static inline __m128i mulawDecodeSse(__m128i c)
+{
+    __m128i k = _mm_andnot_si128(c,_mm_set1_epi32(0x7f));
+    __m128i m = _mm_add_epi32(_mm_slli_epi32(_mm_and_si128(k,_mm_set1_epi32(15)),3),_mm_set1_epi32(132));
+    __m128i v = _mm_sub_epi32(_mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(m),pow2Sse(_mm_srli_epi32(k,4)))),
+	_mm_set1_epi32(132));
+    __m128i neg = _mm_cmpgt_epi32(_mm_set1_epi32(0x80),c);
+    return _mm_sub_epi32(_mm_xor_si128(v,neg),neg);
+}
+
+G711_SSE41 static inline __m128i alawDecodeSse(__m128i c)
+{
+    c = _mm_xor_si128(c,_mm_set1_epi32(0xd5));
+    __m128i k = _mm_and_si128(c,_mm_set1_epi32(0x7f));
+    __m128i e = _mm_srli_epi32(k,4);
+    __m128i m = _mm_add_epi32(_mm_slli_epi32(_mm_and_si128(k,_mm_set1_epi32(15)),4),_mm_set1_epi32(8));
+    m = _mm_add_epi32(m,_mm_and_si128(_mm_cmpgt_epi32(e,_mm_setzero_si128()),_mm_set1_epi32(256)));
+    e = _mm_max_epi32(_mm_sub_epi32(e,_mm_set1_epi32(1)),_mm_setzero_si128());
+    __m128i v = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(m),pow2Sse(e)));
+    __m128i neg = _mm_cmpgt_epi32(c,_mm_set1_epi32(0x7f));
+    return _mm_sub_epi32(_mm_xor_si128(v,neg),neg);
+}
+
+#define G711_DECODE_SSE(name,kernel,generic) \
+G711_SSE41 static void name(unsigned short* dst, const unsigned char* src, unsigned int len) \
+{ \
+    for (; len >= 8; len -= 8, src += 8, dst += 8) { \
+	__m128i c = _mm_loadl_epi64((const __m128i*)src); \
+	_mm_storeu_si128((__m128i*)dst,_mm_packs_epi32(kernel(_mm_cvtepu8_epi32(c)), \
+	    kernel(_mm_cvtepu8_epi32(_mm_srli_si128(c,4))))); \
+    } \
+    generic(dst,src,len); \
+}
+
+G711_DECODE_SSE(mulawDecodeSse41,mulawDecodeSse,mulawDecodeGeneric)
+G711_DECODE_SSE(alawDecodeSse41,alawDecodeSse,alawDecodeGeneric)
+
+G711_AVX2 static inline __m256 pow2Avx(__m256i e)
+{
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(e,_mm256_set1_epi32(127)),23));
+}
+
+// Number of segments whose first level is below the threshold
+G711_AVX2 static inline __m256i segmentAvx(__m256i t, int first)
+{
+    __m256i seg = _mm256_setzero_si256();
+    for (int i = 1; i < 8; i++, first <<= 1)
+	seg = _mm256_sub_epi32(seg,_mm256_cmpgt_epi32(t,_mm256_set1_epi32(first)));
+    return seg;
+}
+
+G711_AVX2 static inline __m256i mulawEncodeAvx(__m256i x)
+{
+    __m256i neg = _mm256_cmpgt_epi32(_mm256_setzero_si256(),x);
+    __m256i t = _mm256_add_epi32(_mm256_abs_epi32(x),
+	_mm256_add_epi32(_mm256_set1_epi32(-3),_mm256_and_si256(neg,_mm256_set1_epi32(15))));
+    __m256i seg = segmentAvx(_mm256_add_epi32(t,_mm256_set1_epi32(132)),264);
+    __m256i base = _mm256_sub_epi32(_mm256_sllv_epi32(_mm256_set1_epi32(132),seg),_mm256_set1_epi32(132));
+    __m256i m = _mm256_cvtps_epi32(_mm256_ceil_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(t,base)),
+	pow2Avx(_mm256_sub_epi32(_mm256_set1_epi32(-3),seg)))));
+    m = _mm256_min_epi32(_mm256_max_epi32(m,_mm256_setzero_si256()),_mm256_set1_epi32(16));
+    __m256i one = _mm256_and_si256(neg,_mm256_set1_epi32(1));
+    __m256i k = _mm256_sub_epi32(_mm256_add_epi32(_mm256_slli_epi32(seg,4),m),one);
+    k = _mm256_min_epi32(_mm256_max_epi32(k,one),_mm256_set1_epi32(127));
+    return _mm256_sub_epi32(_mm256_xor_si256(_mm256_set1_epi32(0xff),
+	_mm256_and_si256(neg,_mm256_set1_epi32(0x80))),k);
+}
+
+G711_AVX2 static inline __m256i alawEncodeAvx(__m256i x)
+{
+    __m256i neg = _mm256_cmpgt_epi32(_mm256_setzero_si256(),x);
+    __m256i t = _mm256_add_epi32(_mm256_abs_epi32(x),
+	_mm256_add_epi32(_mm256_set1_epi32(-7),_mm256_and_si256(neg,_mm256_set1_epi32(15))));
+    __m256i seg = segmentAvx(t,264);
+    __m256i zero = _mm256_cmpeq_epi32(seg,_mm256_setzero_si256());
+    __m256i base = _mm256_sub_epi32(_mm256_sllv_epi32(_mm256_set1_epi32(132),seg),
+	_mm256_and_si256(zero,_mm256_set1_epi32(124)));
+    __m256i m = _mm256_cvtps_epi32(_mm256_ceil_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(t,base)),
+	pow2Avx(_mm256_sub_epi32(_mm256_set1_epi32(-3),_mm256_max_epi32(seg,_mm256_set1_epi32(1)))))));
+    m = _mm256_min_epi32(_mm256_max_epi32(m,_mm256_setzero_si256()),_mm256_set1_epi32(16));
+    __m256i k = _mm256_sub_epi32(_mm256_add_epi32(_mm256_slli_epi32(seg,4),m),
+	_mm256_and_si256(neg,_mm256_set1_epi32(1)));
+    k = _mm256_min_epi32(_mm256_max_epi32(k,_mm256_setzero_si256()),_mm256_set1_epi32(127));
+    return _mm256_xor_si256(_mm256_add_epi32(k,_mm256_and_si256(neg,_mm256_set1_epi32(0x80))),
+	_mm256_set1_epi32(0xd5));
+}
+
+G711_AVX2 static inline __m256i mulawDecodeAvx(__m256i c)
+{
+    __m256i k = _mm256_andnot_si256(c,_mm256_set1_epi32(0x7f));
+    __m256i m = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(k,_mm256_set1_epi32(15)),3),
+	_mm256_set1_epi32(132));
+    __m256i v = _mm256_sub_epi32(_mm256_sllv_epi32(m,_mm256_srli_epi32(k,4)),_mm256_set1_epi32(132));
+    __m256i neg = _mm256_cmpgt_epi32(_mm256_set1_epi32(0x80),c);
+    return _mm256_sub_epi32(_mm256_xor_si256(v,neg),neg);
+}
+
+G711_AVX2 static inline __m256i alawDecodeAvx(__m256i c)
+{
+    c = _mm256_xor_si256(c,_mm256_set1_epi32(0xd5));
+    __m256i k = _mm256_and_si256(c,_mm256_set1_epi32(0x7f));
+    __m256i e = _mm256_srli_epi32(k,4);
+    __m256i m = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(k,_mm256_set1_epi32(15)),4),
+	_mm256_set1_epi32(8));
+    m = _mm256_add_epi32(m,_mm256_and_si256(_mm256_cmpgt_epi32(e,_mm256_setzero_si256()),
+	_mm256_set1_epi32(256)));
+    e = _mm256_max_epi32(_mm256_sub_epi32(e,_mm256_set1_epi32(1)),_mm256_setzero_si256());
+    __m256i v = _mm256_sllv_epi32(m,e);
+    __m256i neg = _mm256_cmpgt_epi32(c,_mm256_set1_epi32(0x7f));
+    return _mm256_sub_epi32(_mm256_xor_si256(v,neg),neg);
+}
+
+#define G711_ENCODE_AVX(name,kernel,generic) \
+G711_AVX2 static void name(unsigned char* dst, const unsigned short* src, unsigned int len) \
+{ \
+    for (; len >= 16; len -= 16, src += 16, dst += 16) { \
+	__m256i c = _mm256_packs_epi32( \
+	    kernel(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)src))), \
+	    kernel(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + 8))))); \
+	c = _mm256_permute4x64_epi64(c,0xd8); \
+	_mm_storeu_si128((__m128i*)dst,_mm_packus_epi16(_mm256_castsi256_si128(c), \
+	    _mm256_extracti128_si256(c,1))); \
+    } \
+    generic(dst,src,len); \
+}
+
+#define G711_DECODE_AVX(name,kernel,generic) \
+G711_AVX2 static void name(unsigned short* dst, const unsigned char* src, unsigned int len) \
+{ \
+    for (; len >= 16; len -= 16, src += 16, dst += 16) { \
+	__m128i c = _mm_loadu_si128((const __m128i*)src); \
+	__m256i v = _mm256_packs_epi32(kernel(_mm256_cvtepu8_epi32(c)), \
+	    kernel(_mm256_cvtepu8_epi32(_mm_srli_si128(c,8)))); \
+	_mm256_storeu_si256((__m256i*)dst,_mm256_permute4x64_epi64(v,0xd8)); \
+    } \
+    generic(dst,src,len); \
+}
+
+G711_ENCODE_AVX(mulawEncodeAvx2,mulawEncodeAvx,mulawEncodeGeneric)
+G711_ENCODE_AVX(alawEncodeAvx2,alawEncodeAvx,alawEncodeGeneric)
+G711_DECODE_AVX(mulawDecodeAvx2,mulawDecodeAvx,mulawDecodeGeneric)
+G711_DECODE_AVX(alawDecodeAvx2,alawDecodeAvx,alawDecodeGeneric)
+#endif
+
+static G711Decode s_alawDecode = alawDecodeGeneric;
+static G711Decode s_mulawDecode = mulawDecodeGeneric;
+static G711Encode s_alawEncode = alawEncodeGeneric;
+static G711Encode s_mulawEncode = mulawEncodeGeneric;
+
+// Pick the best conversion code the CPU can run
+class InitG711Simd
+{
+public:
+    InitG711Simd()
+    {
+#ifdef G711_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+	    s_alawDecode = alawDecodeAvx2;
+	    s_mulawDecode = mulawDecodeAvx2;
+	    s_alawEncode = alawEncodeAvx2;
+	    s_mulawEncode = mulawEncodeAvx2;
+	}
+	else if (__builtin_cpu_supports("sse4.1")) {
+	    // 4 lanes encode slower than the s2a/s2u table lookups
+	    s_alawDecode = alawDecodeSse41;
+	    s_mulawDecode = mulawDecodeSse41;
+	}
+#endif
+    }
+};
+
+static InitG711Simd s_initG711Simd;
+
 }; // anonymous namespace
 
 static const DataBlock s_empty;
@@ -90,31 +313,62 @@ const DataBlock& DataBlock::empty()
     return s_empty;
 }
 
+
+DataBuffer::DataBuffer(unsigned int size)
+    : m_data(0), m_size(0)
+{
+    if (!size)
+	return;
+    m_data = static_cast<unsigned char*>(::malloc(size));
+    if (m_data)
+	m_size = size;
+    else
+	Debug("DataBuffer",DebugFail,"malloc(%u) returned NULL!",size);
+}
+
+DataBuffer::~DataBuffer()
+{
+    if (m_data)
+	::free(m_data);
+}
+
+
 DataBlock::DataBlock(unsigned int overAlloc)
-    : m_data(0), m_length(0), m_allocated(0), m_overAlloc(overAlloc)
+    : m_data(0), m_length(0), m_allocated(0), m_overAlloc(overAlloc), m_buffer(0)
 {
 }
 
 DataBlock::DataBlock(const DataBlock& value)
     : GenObject(),
-      m_data(0), m_length(0), m_allocated(0), m_overAlloc(value.overAlloc())
+      m_data(0), m_length(0), m_allocated(0), m_overAlloc(value.overAlloc()), m_buffer(0)
 {
     assign(value.data(),value.length());
 }
 
 DataBlock::DataBlock(const DataBlock& value, unsigned int overAlloc)
     : GenObject(),
-      m_data(0), m_length(0), m_allocated(0), m_overAlloc(overAlloc)
+      m_data(0), m_length(0), m_allocated(0), m_overAlloc(overAlloc), m_buffer(0)
 {
     assign(value.data(),value.length());
 }
 
 DataBlock::DataBlock(void* value, unsigned int len, bool copyData, unsigned int overAlloc)
-    : m_data(0), m_length(0), m_allocated(0), m_overAlloc(overAlloc)
+    : m_data(0), m_length(0), m_allocated(0), m_overAlloc(overAlloc), m_buffer(0)
 {
     assign(value,len,copyData);
 }
 
+DataBlock::DataBlock(DataBuffer* buffer, unsigned int offs, unsigned int len)
+    : m_data(0), m_length(0), m_allocated(0), m_overAlloc(0), m_buffer(0)
+{
+    if (!(buffer && buffer->data() && (offs < buffer->size()) && buffer->ref()))
+	return;
+    m_buffer = buffer;
+    m_data = buffer->data() + offs;
+    m_allocated = buffer->size() - offs;
+    m_length = (len < m_allocated) ? len : m_allocated;
+}
+
 DataBlock::~DataBlock()
 {
     clear();
@@ -131,7 +385,14 @@ void DataBlock::clear(bool deleteData)
 {
     m_length = 0;
     m_allocated = 0;
-    if (m_data) {
+    if (m_buffer) {
+	// Data belongs to the shared buffer, just drop our reference
+	DataBuffer* buf = m_buffer;
+	m_buffer = 0;
+	m_data = 0;
+	buf->deref();
+    }
+    else if (m_data) {
 	void *data = m_data;
 	m_data = 0;
 	if (deleteData)
@@ -155,6 +416,20 @@ bool DataBlock::change(unsigned int pos, const void* buf, unsigned int bufLen,
     }
     if (pos > m_length)
 	pos = m_length;
+    if (m_buffer) {
+	// Append in place if we are the only user and the buffer has room
+	if (pos == m_length && addLen <= tailroom() && !shared()) {
+	    if (bufLen)
+		::memmove((uint8_t*)m_data + pos,buf,bufLen);
+	    if (extra)
+		::memset((uint8_t*)m_data + pos + bufLen,extraVal,extra);
+	    m_length += addLen;
+	    return true;
+	}
+	unshare();
+	if (m_buffer)
+	    return false;
+    }
     unsigned int newLen = m_length + addLen;
     void* data = 0;
     unsigned int aLen = 0;
@@ -228,6 +503,11 @@ DataBlock& DataBlock::assign(void* value, unsigned int len, bool copyData, unsig
 {
     if ((value != m_data) || (len != m_length)) {
 	void *odata = m_data;
+	// Keep the shared buffer referenced until data was copied out of it
+	DataBuffer* obuf = m_buffer;
+	m_buffer = 0;
+	if (obuf)
+	    odata = 0;
 	m_length = 0;
 	m_allocated = 0;
 	m_data = 0;
@@ -257,6 +537,8 @@ DataBlock& DataBlock::assign(void* value, unsigned int len, bool copyData, unsig
 	}
 	if (odata && (odata != m_data))
 	    ::free(odata);
+	if (obuf)
+	    obuf->deref();
     }
     return *this;
 }
@@ -265,8 +547,12 @@ void DataBlock::truncate(unsigned int len)
 {
     if (!len)
 	clear();
-    else if (len < m_length)
-	assign(m_data,len);
+    else if (len < m_length) {
+	if (m_buffer)
+	    m_length = len;
+	else
+	    assign(m_data,len);
+    }
 }
 
 void DataBlock::cut(int len)
@@ -283,9 +569,86 @@ void DataBlock::cut(int len)
 	return;
     }
 
+    if (m_buffer) {
+	// Just move the view inside the shared buffer
+	m_data = ofs + (char*)m_data;
+	m_allocated -= ofs;
+	m_length -= len;
+	return;
+    }
     assign(ofs+(char *)m_data,m_length - len);
 }
 
+unsigned int DataBlock::headroom() const
+{
+    return m_buffer ? (unsigned int)((unsigned char*)m_data - m_buffer->data()) : 0;
+}
+
+bool DataBlock::slice(const DataBlock& value, unsigned int offs, unsigned int len)
+{
+    if (offs > value.length())
+	offs = value.length();
+    if (len > value.length() - offs)
+	len = value.length() - offs;
+    if (this == &value) {
+	cut(-(int)offs);
+	truncate(len);
+	return m_buffer != 0;
+    }
+    if (!(value.m_buffer && len && value.m_buffer->ref())) {
+	assign((char*)value.data() + offs,len);
+	return false;
+    }
+    clear();
+    m_buffer = value.m_buffer;
+    m_data = (char*)value.m_data + offs;
+    m_allocated = value.m_allocated - offs;
+    m_length = len;
+    return true;
+}
+
+void DataBlock::unshare()
+{
+    if (!m_buffer)
+	return;
+    if (!m_length) {
+	clear();
+	return;
+    }
+    unsigned int aLen = allocLen(m_length);
+    void* data = dbAlloc(aLen);
+    if (!data)
+	return;
+    ::memcpy(data,m_data,m_length);
+    unsigned int len = m_length;
+    clear();
+    m_data = data;
+    m_length = len;
+    m_allocated = aLen;
+}
+
+bool DataBlock::push(unsigned int len)
+{
+    if (!len)
+	return true;
+    if (shared() || headroom() < len)
+	return false;
+    m_data = (char*)m_data - len;
+    m_length += len;
+    m_allocated += len;
+    return true;
+}
+
+bool DataBlock::put(unsigned int len)
+{
+    if (!len)
+	return true;
+    if (!m_buffer || shared() || tailroom() < len)
+	return false;
+    m_length += len;
+    return true;
+}
+
 DataBlock& DataBlock::operator=(const DataBlock& value)
 {
     assign(value.data(),value.length());
@@ -364,16 +727,18 @@ bool DataBlock::convert(const DataBlock& src, const String& sFormat,
     else if ((sl == 1) && (dl == 2)) {
 	unsigned char *s = (unsigned char *) src.data();
 	unsigned short *d = (unsigned short *) data();
-	unsigned short *c = (unsigned short *) ctable;
-	while (len--)
-	    *d++ = c[*s++];
+	if (ctable == a2s)
+	    s_alawDecode(d,s,len);
+	else
+	    s_mulawDecode(d,s,len);
     }
     else if ((sl == 2) && (dl == 1)) {
 	unsigned short *s = (unsigned short *) src.data();
 	unsigned char *d = (unsigned char *) data();
-	unsigned char *c = (unsigned char *) ctable;
-	while (len--)
-	    *d++ = c[*s++];
+	if (ctable == s2a)
+	    s_alawEncode(d,s,len);
+	else
+	    s_mulawEncode(d,s,len);
     }
     return true;
 }
@@ -21,6 +21,19 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(NO_DATA_SIMD)
+#define FORMAT_X86
+#include <immintrin.h>
+#define FORMAT_SSE2 __attribute__((target("sse2")))
+#define FORMAT_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Filter taps per phase when not decimating, the dot products take 16 at a time
+#define RESAMP_TAPS 32
+// Largest interpolation or decimation factor of a polyphase filter bank
+#define RESAMP_MAX_FACTOR 1024
 
 namespace TelEngine {
 
@@ -46,6 +59,8 @@ static const FormatInfo s_formats[] = {
     FormatInfo("g729", 10, 10000),
     FormatInfo("plain", 0, 0, "text", 0),
     FormatInfo("raw", 0, 0, "data", 0),
+    FormatInfo("slin/44100", 882, 10000, "audio", 44100, 1, true),
+    FormatInfo("slin/48000", 960, 10000, "audio", 48000, 1, true),
 };
 
 // FIXME: put proper conversion costs everywhere below
@@ -96,6 +111,30 @@ static TranslatorCaps s_resampCaps[] = {
     { 0, 0, 0 }
 };
 
+static TranslatorCaps s_polyCaps[] = {
+    { s_formats+0, s_formats+3, 1 },
+    { s_formats+0, s_formats+6, 1 },
+    { s_formats+0, s_formats+20, 1 },
+    { s_formats+0, s_formats+21, 1 },
+    { s_formats+3, s_formats+0, 1 },
+    { s_formats+3, s_formats+6, 1 },
+    { s_formats+3, s_formats+20, 1 },
+    { s_formats+3, s_formats+21, 1 },
+    { s_formats+6, s_formats+0, 1 },
+    { s_formats+6, s_formats+3, 1 },
+    { s_formats+6, s_formats+20, 1 },
+    { s_formats+6, s_formats+21, 1 },
+    { s_formats+20, s_formats+0, 1 },
+    { s_formats+20, s_formats+3, 1 },
+    { s_formats+20, s_formats+6, 1 },
+    { s_formats+20, s_formats+21, 1 },
+    { s_formats+21, s_formats+0, 1 },
+    { s_formats+21, s_formats+3, 1 },
+    { s_formats+21, s_formats+6, 1 },
+    { s_formats+21, s_formats+20, 1 },
+    { 0, 0, 0 }
+};
+
 static TranslatorCaps s_stereoCaps[] = {
     { s_formats+0, s_formats+9, 1 },
     { s_formats+9, s_formats+0, 2 },
@@ -150,26 +189,54 @@ public:
 	    m_valid = true;
 	    m_sFmt = m_format;
 	    m_dFmt = getTransSource()->getFormat();
+	    m_dInfo = getTransSource()->getFormat().getInfo();
 	    if (nchan != 1) {
 		// get rid of the channel prefix
 		m_sFmt >> "*";
 		m_dFmt >> "*";
 	    }
+	    m_sSize = (m_sFmt == YSTRING("slin")) ? 2 : 1;
+	    m_dSize = (m_dFmt == YSTRING("slin")) ? 2 : 1;
 	}
     virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ return consumeBlock(data,tStamp,flags); }
+    virtual unsigned long ConsumeFrame(DataFrame& frame)
 	{
 	    if (!ref())
 		return 0;
 	    unsigned long len = 0;
-	    if (m_valid && getTransSource() && m_buffer.convert(data,m_sFmt,m_dFmt)) {
+	    if (m_valid && getTransSource()) {
+		const DataBlock& data = frame.data();
+		unsigned long tStamp = frame.timeStamp();
 		if (tStamp == invalidStamp()) {
 		    unsigned int delta = data.length();
-		    if (delta > m_buffer.length())
-			delta = m_buffer.length();
+		    if (m_dSize < m_sSize)
+			delta /= 2;
 		    tStamp = m_timestamp + delta;
 		}
 		m_timestamp = tStamp;
-		len = getTransSource()->Forward(m_buffer,tStamp,flags);
+		DataFrame* out = 0;
+		// same size conversions can be done in the frame if nobody else sees it
+		if ((m_sSize == m_dSize) && frame.writable()) {
+		    if (frame.data().convert(data,m_sFmt,m_dFmt)) {
+			out = &frame;
+			out->ref();
+		    }
+		}
+		else {
+		    out = DataFrame::build(m_dInfo,data.length() / m_sSize * m_dSize,tStamp,frame.flags());
+		    if (out->data().convert(data,m_sFmt,m_dFmt))
+			out->dtmf(frame.dtmf());
+		    else
+			TelEngine::destruct(out);
+		}
+		if (out) {
+		    out->format(m_dInfo);
+		    out->samples(frame.samples());
+		    out->timeStamp(tStamp);
+		    len = getTransSource()->ForwardFrame(*out);
+		    TelEngine::destruct(out);
+		}
 	    }
 	    deref();
 	    return len;
@@ -178,7 +245,9 @@ private:
     bool m_valid;
     String m_sFmt;
     String m_dFmt;
-    DataBlock m_buffer;
+    const FormatInfo* m_dInfo;
+    unsigned int m_sSize;
+    unsigned int m_dSize;
 };
 
 // slin basic mono resampler
@@ -246,6 +315,379 @@ public:
 	}
 };
 
+// Dot product of filter coefficients with samples, taps is a multiple of 16
+typedef int (*ResampDot)(const short* samples, const short* coef, unsigned int taps);
+
+static int resampDotGeneric(const short* samples, const short* coef, unsigned int taps)
+{
+    int acc = 0;
+    for (unsigned int j = 0; j < taps; j++)
+	acc += samples[j] * coef[j];
+    return acc;
+}
+
+#ifdef FORMAT_X86
+FORMAT_SSE2 static int resampDotSse2(const short* samples, const short* coef, unsigned int taps)
+{
+    __m128i acc = _mm_setzero_si128();
+    for (unsigned int j = 0; j < taps; j += 8)
+	acc = _mm_add_epi32(acc,_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(samples + j)),
+	    _mm_load_si128((const __m128i*)(coef + j))));
+    acc = _mm_add_epi32(acc,_mm_shuffle_epi32(acc,0x4e));
+    acc = _mm_add_epi32(acc,_mm_shuffle_epi32(acc,0xb1));
+    return _mm_cvtsi128_si32(acc);
+}
+
+FORMAT_AVX2 static int resampDotAvx2(const short* samples, const short* coef, unsigned int taps)
+{
+    __m256i acc = _mm256_setzero_si256();
+    for (unsigned int j = 0; j < taps; j += 16)
+	acc = _mm256_add_epi32(acc,_mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(samples + j)),
+	    _mm256_load_si256((const __m256i*)(coef + j))));
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc),_mm256_extracti128_si256(acc,1));
+    sum = _mm_add_epi32(sum,_mm_shuffle_epi32(sum,0x4e));
+    sum = _mm_add_epi32(sum,_mm_shuffle_epi32(sum,0xb1));
+    return _mm_cvtsi128_si32(sum);
+}
+#endif
+
+static ResampDot detectResampDot()
+{
+#ifdef FORMAT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+	return resampDotAvx2;
+    if (__builtin_cpu_supports("sse2"))
+	return resampDotSse2;
+#endif
+    return resampDotGeneric;
+}
+
+static ResampDot s_resampDot = detectResampDot();
+
+// Zero order modified Bessel function of the first kind, for the Kaiser window
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; k++) {
+	term *= (x / (2 * k)) * (x / (2 * k));
+	sum += term;
+	if (term < sum * 1e-12)
+	    break;
+    }
+    return sum;
+}
+
+// Polyphase FIR filter bank converting between two sample rates
+// Banks are built once per pair of rates and shared by all translators
+class ResampBank : public GenObject
+{
+public:
+    ResampBank(int sRate, int dRate);
+    virtual ~ResampBank();
+    static const ResampBank* get(int sRate, int dRate);
+    inline bool valid() const
+	{ return 0 != m_coef; }
+    inline unsigned int taps() const
+	{ return m_taps; }
+    inline unsigned int up() const
+	{ return m_up; }
+    inline unsigned int down() const
+	{ return m_down; }
+    inline unsigned int maxOutput(unsigned int len) const
+	{ return (unsigned int)(((u_int64_t)len * m_up) / m_down) + 2; }
+    unsigned int process(short* out, const short* in, unsigned int len,
+	unsigned int& pos, unsigned int& phase) const;
+private:
+    int m_sRate;
+    int m_dRate;
+    unsigned int m_up;
+    unsigned int m_down;
+    unsigned int m_taps;
+    char* m_alloc;
+    short* m_coef;
+    unsigned int* m_advance;
+    unsigned int* m_next;
+};
+
+static ObjList s_resampBanks;
+static Mutex s_resampMutex(false,"ResampBank");
+
+ResampBank::ResampBank(int sRate, int dRate)
+    : m_sRate(sRate), m_dRate(dRate), m_up(0), m_down(0), m_taps(0),
+      m_alloc(0), m_coef(0), m_advance(0), m_next(0)
+{
+    int a = sRate;
+    int b = dRate;
+    while (b) {
+	int t = a % b;
+	a = b;
+	b = t;
+    }
+    if (a <= 0)
+	return;
+    m_up = dRate / a;
+    m_down = sRate / a;
+    if ((m_up > RESAMP_MAX_FACTOR) || (m_down > RESAMP_MAX_FACTOR))
+	return;
+    // decimation needs proportionally longer filters for the same transition band
+    unsigned int taps = (RESAMP_TAPS * m_down + m_up - 1) / m_up;
+    if (taps < RESAMP_TAPS)
+	taps = RESAMP_TAPS;
+    // round up to whole dot product steps
+    m_taps = (taps + 15) & ~15;
+    unsigned int len = m_up * m_taps;
+    // cutoff at 0.45 of the lower rate, relative to the interpolated rate
+    double fc = 0.45 / ((m_up > m_down) ? m_up : m_down);
+    double center = (len - 1) / 2.0;
+    const double beta = 7.0;
+    double norm = besselI0(beta);
+    double* h = new double[len];
+    for (unsigned int k = 0; k < len; k++) {
+	double x = k - center;
+	double sinc = (x == 0) ? 2 * fc : ::sin(2 * M_PI * fc * x) / (M_PI * x);
+	double w = 2.0 * k / (len - 1) - 1.0;
+	h[k] = sinc * besselI0(beta * ::sqrt(1.0 - w * w)) / norm;
+    }
+    m_alloc = new char[len * sizeof(short) + 32];
+    m_coef = (short*)(m_alloc + ((32 - ((size_t)m_alloc & 31)) & 31));
+    m_advance = new unsigned int[m_up];
+    m_next = new unsigned int[m_up];
+    for (unsigned int p = 0; p < m_up; p++) {
+	// samples are in increasing time order, the newest one multiplies the first tap
+	double sum = 0;
+	for (unsigned int j = 0; j < m_taps; j++)
+	    sum += h[p + m_up * (m_taps - 1 - j)];
+	short* c = m_coef + p * m_taps;
+	for (unsigned int j = 0; j < m_taps; j++)
+	    c[j] = (short)::floor(16384.0 * h[p + m_up * (m_taps - 1 - j)] / sum + 0.5);
+	m_advance[p] = (p + m_down) / m_up;
+	m_next[p] = (p + m_down) % m_up;
+    }
+    delete[] h;
+    DDebug(DebugInfo,"Built resampler bank %d -> %d with %u phases of %u taps",
+	sRate,dRate,m_up,m_taps);
+}
+
+ResampBank::~ResampBank()
+{
+    delete[] m_next;
+    delete[] m_advance;
+    delete[] m_alloc;
+}
+
+const ResampBank* ResampBank::get(int sRate, int dRate)
+{
+    Lock lock(s_resampMutex);
+    for (ObjList* l = s_resampBanks.skipNull(); l; l = l->skipNext()) {
+	ResampBank* b = static_cast<ResampBank*>(l->get());
+	if ((b->m_sRate == sRate) && (b->m_dRate == dRate))
+	    return b->valid() ? b : 0;
+    }
+    ResampBank* b = new ResampBank(sRate,dRate);
+    s_resampBanks.append(b);
+    return b->valid() ? b : 0;
+}
+
+// Filter the samples starting at pos while a full window is available
+// Return the number of output samples, update position and phase
+unsigned int ResampBank::process(short* out, const short* in, unsigned int len,
+    unsigned int& pos, unsigned int& phase) const
+{
+    unsigned int n = 0;
+    ResampDot dot = s_resampDot;
+    while (pos + m_taps <= len) {
+	int v = (dot(in + pos,m_coef + phase * m_taps,m_taps) + 8192) >> 14;
+	if (v > 32767)
+	    v = 32767;
+	else if (v < -32768)
+	    v = -32768;
+	out[n++] = (short)v;
+	pos += m_advance[phase];
+	phase = m_next[phase];
+    }
+    return n;
+}
+
+// slin polyphase resampler for any pair of rates, keeps history between packets
+class PolyphaseTranslator : public DataTranslator
+{
+public:
+    PolyphaseTranslator(const DataFormat& sFormat, const DataFormat& dFormat, const ResampBank* bank)
+	: DataTranslator(sFormat,dFormat),
+	  m_bank(bank), m_hist(0), m_histSize(0), m_fill(0), m_pos(0), m_phase(0),
+	  m_out(0), m_outSize(0), m_delta(0)
+	{
+	    // start with silence so output begins with the first packet
+	    m_histSize = m_bank->taps() + 1024;
+	    m_hist = new short[m_histSize];
+	    m_fill = m_bank->taps() - 1;
+	    ::memset(m_hist,0,m_fill * sizeof(short));
+	}
+    virtual ~PolyphaseTranslator()
+	{
+	    delete[] m_out;
+	    delete[] m_hist;
+	}
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{
+	    unsigned int n = data.length();
+	    if (!n || (n & 1) || !ref())
+		return 0;
+	    n /= 2;
+	    // buffers only grow when a larger packet than before is received
+	    if (m_fill + n > m_histSize) {
+		m_histSize = m_fill + n;
+		short* hist = new short[m_histSize];
+		::memcpy(hist,m_hist,m_fill * sizeof(short));
+		delete[] m_hist;
+		m_hist = hist;
+	    }
+	    ::memcpy(m_hist + m_fill,data.data(),n * sizeof(short));
+	    m_fill += n;
+	    unsigned int max = m_bank->maxOutput(m_fill);
+	    if (max > m_outSize) {
+		delete[] m_out;
+		m_outSize = max;
+		m_out = new short[m_outSize];
+	    }
+	    unsigned int count = m_bank->process(m_out,m_hist,m_fill,m_pos,m_phase);
+	    m_fill -= m_pos;
+	    ::memmove(m_hist,m_hist + m_pos,m_fill * sizeof(short));
+	    m_pos = 0;
+	    unsigned long len = 0;
+	    // scale the timestamp delta, keep what was not forwarded for the next packet
+	    m_delta += (int64_t)(long)(tStamp - m_timestamp) * m_bank->up();
+	    DataSource* src = getTransSource();
+	    if (src && count) {
+		unsigned long ts = (unsigned long)(m_delta / m_bank->down());
+		m_delta %= m_bank->down();
+		if (src->timeStamp() != invalidStamp())
+		    ts += src->timeStamp();
+		DataBlock block;
+		block.assign(m_out,count * sizeof(short),false);
+		len = src->Forward(block,ts,flags);
+		block.clear(false);
+	    }
+	    deref();
+	    return len;
+	}
+private:
+    const ResampBank* m_bank;
+    short* m_hist;
+    unsigned int m_histSize;
+    unsigned int m_fill;
+    unsigned int m_pos;
+    unsigned int m_phase;
+    short* m_out;
+    unsigned int m_outSize;
+    int64_t m_delta;
+};
+
+// Convert between mono and interleaved stereo, count is in frames
+typedef void (*StereoConvert)(short* dst, const short* src, unsigned int frames);
+
+static void monoToStereoGeneric(short* dst, const short* src, unsigned int frames)
+{
+    // duplicate the sample for each channel
+    while (frames--) {
+	short v = *dst++ = *src++;
+	*dst++ = v;
+    }
+}
+
+static void stereoToMonoGeneric(short* dst, const short* src, unsigned int frames)
+{
+    // average the channels
+    while (frames--) {
+	int v = *src++;
+	v += *src++;
+	v /= 2;
+	// saturate average result
+	if (v > 32767)
+	    v = 32767;
+	if (v < -32767)
+	    v = -32767;
+	*dst++ = v;
+    }
+}
+
+#ifdef FORMAT_X86
+// Halve pairwise channel sums rounding toward zero like the integer division
+FORMAT_SSE2 static inline __m128i stereoAverageSse2(__m128i sum)
+{
+    return _mm_srai_epi32(_mm_add_epi32(sum,_mm_srli_epi32(sum,31)),1);
+}
+
+FORMAT_SSE2 static void monoToStereoSse2(short* dst, const short* src, unsigned int frames)
+{
+    for (; frames >= 8; frames -= 8, src += 8, dst += 16) {
+	__m128i v = _mm_loadu_si128((const __m128i*)src);
+	_mm_storeu_si128((__m128i*)dst,_mm_unpacklo_epi16(v,v));
+	_mm_storeu_si128((__m128i*)(dst + 8),_mm_unpackhi_epi16(v,v));
+    }
+    monoToStereoGeneric(dst,src,frames);
+}
+
+FORMAT_SSE2 static void stereoToMonoSse2(short* dst, const short* src, unsigned int frames)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    for (; frames >= 8; frames -= 8, src += 16, dst += 8) {
+	__m128i a = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)src),ones);
+	__m128i b = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(src + 8)),ones);
+	__m128i v = _mm_packs_epi32(stereoAverageSse2(a),stereoAverageSse2(b));
+	_mm_storeu_si128((__m128i*)dst,_mm_max_epi16(v,_mm_set1_epi16(-32767)));
+    }
+    stereoToMonoGeneric(dst,src,frames);
+}
+
+FORMAT_AVX2 static inline __m256i stereoAverageAvx2(__m256i sum)
+{
+    return _mm256_srai_epi32(_mm256_add_epi32(sum,_mm256_srli_epi32(sum,31)),1);
+}
+
+FORMAT_AVX2 static void monoToStereoAvx2(short* dst, const short* src, unsigned int frames)
+{
+    for (; frames >= 16; frames -= 16, src += 16, dst += 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i*)src);
+	__m256i lo = _mm256_unpacklo_epi16(v,v);
+	__m256i hi = _mm256_unpackhi_epi16(v,v);
+	_mm256_storeu_si256((__m256i*)dst,_mm256_permute2x128_si256(lo,hi,0x20));
+	_mm256_storeu_si256((__m256i*)(dst + 16),_mm256_permute2x128_si256(lo,hi,0x31));
+    }
+    monoToStereoGeneric(dst,src,frames);
+}
+
+FORMAT_AVX2 static void stereoToMonoAvx2(short* dst, const short* src, unsigned int frames)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    for (; frames >= 16; frames -= 16, src += 32, dst += 16) {
+	__m256i a = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)src),ones);
+	__m256i b = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(src + 16)),ones);
+	__m256i v = _mm256_packs_epi32(stereoAverageAvx2(a),stereoAverageAvx2(b));
+	v = _mm256_permute4x64_epi64(v,0xd8);
+	_mm256_storeu_si256((__m256i*)dst,_mm256_max_epi16(v,_mm256_set1_epi16(-32767)));
+    }
+    stereoToMonoGeneric(dst,src,frames);
+}
+#endif
+
+static StereoConvert detectStereo(bool toMono)
+{
+#ifdef FORMAT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+	return toMono ? stereoToMonoAvx2 : monoToStereoAvx2;
+    if (__builtin_cpu_supports("sse2"))
+	return toMono ? stereoToMonoSse2 : monoToStereoSse2;
+#endif
+    return toMono ? stereoToMonoGeneric : monoToStereoGeneric;
+}
+
+static StereoConvert s_monoToStereo = detectStereo(false);
+static StereoConvert s_stereoToMono = detectStereo(true);
+
 // slin simple mono-stereo converter
 class StereoTranslator : public DataTranslator
 {
@@ -257,42 +699,34 @@ public:
 	m_sChans(sFormat.numChannels()), m_dChans(dFormat.numChannels())
 	{ }
     virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ return consumeBlock(data,tStamp,flags); }
+    virtual unsigned long ConsumeFrame(DataFrame& frame)
 	{
+	    const DataBlock& data = frame.data();
 	    unsigned int n = data.length();
 	    if (!n || (n & 1) || !ref())
 		return 0;
 	    unsigned long len = 0;
 	    n /= 2;
 	    if (getTransSource()) {
-		short* s = (short*) data.data();
-		DataBlock oblock;
+		const FormatInfo* info = getTransSource()->getFormat().getInfo();
+		const short* s = (const short*) data.data();
+		DataFrame* out = 0;
 		if ((m_sChans == 1) && (m_dChans == 2)) {
-		    oblock.assign(0,n*4);
-		    short* d = (short*) oblock.data();
-		    // duplicate the sample for each channel
-		    while (n--) {
-			short v = *d++ = *s++;
-			*d++ = v;
-		    }
+		    out = DataFrame::build(info,n*4,frame.timeStamp(),frame.flags());
+		    s_monoToStereo((short*) out->data().data(),s,n);
 		}
 		else if ((m_sChans == 2) && (m_dChans == 1)) {
 		    n /= 2;
-		    oblock.assign(0,2*n);
-		    short* d = (short*) oblock.data();
-		    // average the channels
-		    while (n--) {
-			int v = *s++;
-			v += *s++;
-			v /= 2;
-			// saturate average result
-			if (v > 32767)
-			    v = 32767;
-			if (v < -32767)
-			    v = -32767;
-			*d++ = v;
-		    }
+		    out = DataFrame::build(info,2*n,frame.timeStamp(),frame.flags());
+		    s_stereoToMono((short*) out->data().data(),s,n);
 		}
-		len = getTransSource()->Forward(oblock, tStamp, flags);
+		else
+		    out = DataFrame::build(info,DataBlock::empty(),frame.timeStamp(),frame.flags());
+		out->samples(frame.samples());
+		out->dtmf(frame.dtmf());
+		len = getTransSource()->ForwardFrame(*out);
+		TelEngine::destruct(out);
 	    }
 	    deref();
 	    return len;
@@ -324,6 +758,22 @@ public:
 	{ return s_resampCaps; }
 };
 
+class PolyphaseFactory : public TranslatorFactory
+{
+public:
+    PolyphaseFactory() : TranslatorFactory("polyphase")
+	{ }
+    virtual DataTranslator* create(const DataFormat& sFormat, const DataFormat& dFormat)
+	{
+	    if (!converts(sFormat,dFormat))
+		return 0;
+	    const ResampBank* bank = ResampBank::get(sFormat.sampleRate(),dFormat.sampleRate());
+	    return bank ? new PolyphaseTranslator(sFormat,dFormat,bank) : 0;
+	}
+    virtual const TranslatorCaps* getCapabilities() const
+	{ return s_polyCaps; }
+};
+
 class StereoFactory : public TranslatorFactory
 {
 public:
@@ -362,6 +812,171 @@ private:
     const TranslatorCaps* m_capabilities;
 };
 
+// Immutable snapshot of the cheapest cost and the factory providing it
+//  for each pair of formats known to the installed translators
+class TranslatorTable
+{
+public:
+    TranslatorTable(const ObjList& factories, unsigned int version);
+    ~TranslatorTable();
+    int index(const FormatInfo* info) const;
+    inline int cost(const FormatInfo* src, const FormatInfo* dest) const
+	{
+	    int s = index(src);
+	    int d = index(dest);
+	    return ((s >= 0) && (d >= 0)) ? m_cost[s * m_count + d] : -1;
+	}
+    inline TranslatorFactory* factory(const FormatInfo* src, const FormatInfo* dest) const
+	{
+	    int s = index(src);
+	    int d = index(dest);
+	    return ((s >= 0) && (d >= 0)) ? m_factory[s * m_count + d] : 0;
+	}
+    inline unsigned int count() const
+	{ return m_count; }
+    inline unsigned int version() const
+	{ return m_version; }
+private:
+    int insert(const FormatInfo* info);
+    unsigned int m_version;
+    unsigned int m_count;
+    unsigned int m_mask;
+    const FormatInfo** m_formats;
+    int* m_hash;
+    int* m_cost;
+    TranslatorFactory** m_factory;
+};
+
+// Access to the current translator table for the lifetime of the object
+// Readers do not lock, writers wait for them before freeing anything
+class TranslatorReader
+{
+public:
+    TranslatorReader();
+    inline ~TranslatorReader()
+	{ done(); }
+    const TranslatorTable* table();
+    void done();
+    static TranslatorTable* retire();
+    static void resume();
+    static void synchronize(TranslatorTable* old);
+    static void publish(TranslatorTable* table);
+private:
+    unsigned int m_epoch;
+    const TranslatorTable* m_table;
+    TranslatorTable* m_own;
+    bool m_reading;
+    bool m_locked;
+};
+
+// Statistics and translators with queued data for a source>destination pair
+class TranscodeCodec : public GenObject
+{
+public:
+    inline TranscodeCodec(const String& name)
+	: m_name(name), m_blocks(0), m_bytes(0), m_usec(0), m_wait(0),
+	  m_batches(0), m_dropped(0), m_queued(0), m_maxQueued(0)
+	{ }
+    virtual const String& toString() const
+	{ return m_name; }
+    String m_name;
+    // translators waiting for a worker, not owned
+    ObjList m_ready;
+    u_int64_t m_blocks;
+    u_int64_t m_bytes;
+    u_int64_t m_usec;
+    u_int64_t m_wait;
+    u_int64_t m_batches;
+    u_int64_t m_dropped;
+    unsigned int m_queued;
+    unsigned int m_maxQueued;
+};
+
+// A block of data waiting to be processed by a translator
+class TranscodeBlock : public GenObject
+{
+public:
+    inline TranscodeBlock(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	: m_tStamp(tStamp), m_flags(flags), m_time(Time::now())
+	{ m_data.share(data); }
+    DataBlock m_data;
+    unsigned long m_tStamp;
+    unsigned long m_flags;
+    u_int64_t m_time;
+};
+
+// Blocks queued by one translator
+class TranscodeQueue
+{
+public:
+    inline TranscodeQueue(TranscodeCodec* codec)
+	: m_codec(codec), m_count(0), m_scheduled(false)
+	{ }
+    TranscodeCodec* m_codec;
+    ObjList m_blocks;
+    unsigned int m_count;
+    // translator is referenced and either in the ready list or being processed
+    bool m_scheduled;
+};
+
+// Thread of the shared transcoding pool
+class TranscodeWorker : public Thread
+{
+public:
+    inline TranscodeWorker()
+	: Thread("Transcoder",Thread::High)
+	{ }
+    virtual void run();
+    static void process(DataTranslator* trans);
+};
+
+// Resolution of the media clock wheel in microseconds
+#define CLOCK_SLOT 1000
+// Slots in the wheel, sources due later wait for the wheel to come around
+#define CLOCK_SLOTS 64
+// Sources running later than this are resynchronized instead of catching up
+#define CLOCK_MAX_LAG 100000
+// Maximum number of media clock threads
+#define CLOCK_MAX_THREADS 64
+
+// A source attached to the shared media clock
+class MediaClockEntry
+{
+public:
+    inline MediaClockEntry(ThreadedSource* source, u_int64_t due)
+	: m_source(source), m_due(due), m_next(0)
+	{ }
+    RefPointer<ThreadedSource> m_source;
+    u_int64_t m_due;
+    MediaClockEntry* m_next;
+};
+
+// Thread of the shared media clock, calls sources from a timer wheel
+class MediaClock : public Thread
+{
+public:
+    MediaClock(unsigned int index);
+    virtual void run();
+    static bool attach(ThreadedSource* source);
+    static void wait(ThreadedSource* source);
+    void add(MediaClockEntry* entry);
+    unsigned int m_sources;
+    u_int64_t m_ticks;
+    u_int64_t m_usec;
+    unsigned int m_late;
+    unsigned int m_maxLag;
+private:
+    bool tick(MediaClockEntry* entry);
+    bool handOver();
+    void release(MediaClockEntry* list);
+    unsigned int m_index;
+    // source being ticked, changed with the clock mutex locked
+    ThreadedSource* m_ticking;
+    // next slot to process, in CLOCK_SLOT units since the epoch
+    u_int64_t m_pos;
+    MediaClockEntry* m_slots[CLOCK_SLOTS];
+};
+
 };
 
 using namespace TelEngine;
@@ -448,6 +1063,16 @@ const FormatInfo* DataFormat::getInfo() const
 }
 
 
+void DataNode::resetStats()
+{
+    m_statPackets = 0;
+    m_statDrops = 0;
+    m_statBytes = 0;
+    m_statTime = 0;
+    m_statMaxTime = 0;
+}
+
+
 void DataConsumer::destroyed()
 {
     if (m_source || m_override) {
@@ -469,21 +1094,201 @@ void* DataConsumer::getObject(const String& name) const
     return DataNode::getObject(name);
 }
 
+// Frames kept in the pool for reuse
+#define FRAME_POOL 512
+// Payload memory is allocated in multiples of this
+#define FRAME_ALIGN 64
+
+static Mutex s_frameMutex(false,"DataFrame");
+static DataFrame* s_framePool = 0;
+static unsigned int s_framePooled = 0;
+static unsigned int s_frameAllocated = 0;
+
+DataFrame::DataFrame()
+    : m_format(0), m_samples(0), m_timeStamp(DataNode::invalidStamp()),
+      m_flags(0), m_dtmf(0), m_next(0)
+{
+}
+
+DataFrame* DataFrame::take()
+{
+    s_frameMutex.lock();
+    DataFrame* f = s_framePool;
+    if (f) {
+	s_framePool = f->m_next;
+	s_framePooled--;
+    }
+    else
+	s_frameAllocated++;
+    s_frameMutex.unlock();
+    if (!f)
+	return new DataFrame;
+    f->m_next = 0;
+    f->resurrect();
+    return f;
+}
+
+DataFrame* DataFrame::build(const FormatInfo* format, unsigned int length,
+    unsigned long tStamp, unsigned long flags)
+{
+    DataFrame* f = take();
+    f->m_format = format;
+    f->m_timeStamp = tStamp;
+    f->m_flags = flags;
+    f->m_dtmf = 0;
+    f->resize(length);
+    f->m_samples = format ? format->guessSamples(length) : 0;
+    return f;
+}
+
+// Set the payload length reusing the memory left from a previous use if possible
+void DataFrame::resize(unsigned int length)
+{
+    DataBuffer* buf = m_data.buffer();
+    if (buf && !m_data.shared()) {
+	if (length <= m_data.length()) {
+	    m_data.truncate(length);
+	    return;
+	}
+	if (m_data.put(length - m_data.length()))
+	    return;
+	if (buf->size() >= length) {
+	    DataBlock tmp(buf,0,length);
+	    m_data.slice(tmp,0,length);
+	    return;
+	}
+    }
+    buf = new DataBuffer((length + FRAME_ALIGN - 1) & ~(FRAME_ALIGN - 1));
+    DataBlock tmp(buf,0,length);
+    buf->deref();
+    m_data.slice(tmp,0,length);
+}
+
+DataFrame* DataFrame::build(const FormatInfo* format, const DataBlock& data,
+    unsigned long tStamp, unsigned long flags)
+{
+    DataFrame* f = take();
+    f->m_format = format;
+    f->m_timeStamp = tStamp;
+    f->m_flags = flags;
+    f->m_dtmf = 0;
+    if (data.buffer())
+	f->m_data.share(data);
+    else {
+	f->resize(data.length());
+	if (data.length())
+	    ::memcpy(f->m_data.data(),data.data(),data.length());
+    }
+    f->m_samples = format ? format->guessSamples(data.length()) : 0;
+    return f;
+}
+
+DataFrame* DataFrame::copy(unsigned long tStamp) const
+{
+    DataFrame* f = take();
+    f->m_format = m_format;
+    f->m_samples = m_samples;
+    f->m_timeStamp = tStamp;
+    f->m_flags = m_flags;
+    f->m_dtmf = m_dtmf;
+    f->m_data.share(m_data);
+    return f;
+}
+
+void DataFrame::dtmf(char tone)
+{
+    m_dtmf = tone;
+    if (tone)
+	m_flags |= DataNode::DataDtmf;
+    else
+	m_flags &= ~DataNode::DataDtmf;
+}
+
+void DataFrame::getStats(unsigned int& pooled, unsigned int& allocated)
+{
+    Lock lck(s_frameMutex);
+    pooled = s_framePooled;
+    allocated = s_frameAllocated;
+}
+
+void DataFrame::zeroRefs()
+{
+    // keep payload memory only if it is our own
+    if (!m_data.buffer() || m_data.shared())
+	m_data.clear();
+    s_frameMutex.lock();
+    if (s_framePooled < FRAME_POOL) {
+	m_next = s_framePool;
+	s_framePool = this;
+	s_framePooled++;
+	s_frameMutex.unlock();
+	return;
+    }
+    s_frameAllocated--;
+    s_frameMutex.unlock();
+    RefObject::zeroRefs();
+}
+
+
 unsigned long DataConsumer::Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags, DataSource* source)
 {
     if (source == m_override)
 	tStamp += m_overrideTsDelta;
-    else if (m_override || (source != m_source))
+    else if (m_override || (source != m_source)) {
+	statDrop();
 	return 0;
+    }
     else
 	tStamp += m_regularTsDelta;
     u_int64_t tsTime = Time::now();
     unsigned long len = Consume(data,tStamp,flags);
+    statData(data.length(),Time::now() - tsTime);
     m_timestamp = tStamp;
     m_lastTsTime = tsTime;
     return len;
 }
 
+unsigned long DataConsumer::ConsumeFrame(DataFrame& frame)
+{
+    return Consume(frame.data(),frame.timeStamp(),frame.flags());
+}
+
+unsigned long DataConsumer::ConsumeFrame(DataFrame& frame, DataSource* source)
+{
+    long delta = 0;
+    if (source == m_override)
+	delta = m_overrideTsDelta;
+    else if (m_override || (source != m_source)) {
+	statDrop();
+	return 0;
+    }
+    else
+	delta = m_regularTsDelta;
+    u_int64_t tsTime = Time::now();
+    unsigned long tStamp = frame.timeStamp() + delta;
+    unsigned long len = 0;
+    if (delta) {
+	// other consumers may see the same frame, this one gets its own timestamp
+	DataFrame* f = frame.copy(tStamp);
+	len = ConsumeFrame(*f);
+	TelEngine::destruct(f);
+    }
+    else
+	len = ConsumeFrame(frame);
+    statData(frame.data().length(),Time::now() - tsTime);
+    m_timestamp = tStamp;
+    m_lastTsTime = tsTime;
+    return len;
+}
+
+unsigned long DataConsumer::consumeBlock(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+{
+    DataFrame* f = DataFrame::build(getFormat().getInfo(),data,tStamp,flags);
+    unsigned long len = ConsumeFrame(*f);
+    TelEngine::destruct(f);
+    return len;
+}
+
 bool DataConsumer::synchronize(DataSource* source)
 {
     if (!source)
@@ -542,10 +1347,12 @@ bool DataSource::control(NamedList& params)
 
 unsigned long DataSource::Forward(const DataBlock& data, unsigned long tStamp, unsigned long flags)
 {
+    u_int64_t start = Time::now();
     Lock mylock(this,100000);
     // we DON'T refcount here, we rely on the mutex to keep us safe
     if (!(mylock.locked() && alive())) {
 	DDebug(DebugInfo,"Forwarding on a dead DataSource! [%p]",this);
+	statDrop();
 	return 0;
     }
 
@@ -576,7 +1383,8 @@ unsigned long DataSource::Forward(const DataBlock& data, unsigned long tStamp, u
 	    empty = false;
 	}
 	else {
-	    DDebug(DebugInfo,"Consumer %p becomes invalid [%p]",c,this);
+	    Debug(DebugInfo,"Consumer %p becomes invalid, detaching it [%p]",c,this);
+	    statDrop();
 	    detachInternal(c);
 	    // do not advance in list, we just removed the current element
 	    l = l->skipNull();
@@ -584,6 +1392,64 @@ unsigned long DataSource::Forward(const DataBlock& data, unsigned long tStamp, u
     }
     if (empty)
 	len = 0;
+    statData(data.length(),Time::now() - start);
+    m_timestamp = tStamp;
+    m_nextStamp = nSamp ? (tStamp + nSamp) : invalidStamp();
+    return len;
+}
+
+unsigned long DataSource::ForwardFrame(DataFrame& frame)
+{
+    u_int64_t start = Time::now();
+    Lock mylock(this,100000);
+    if (!(mylock.locked() && alive())) {
+	DDebug(DebugInfo,"Forwarding frame on a dead DataSource! [%p]",this);
+	statDrop();
+	return 0;
+    }
+
+    if (!frame.format())
+	frame.format(m_format.getInfo());
+    if (!frame.samples() && frame.format())
+	frame.samples(frame.format()->guessSamples(frame.data().length()));
+    unsigned long nSamp = frame.samples();
+    unsigned long tStamp = frame.timeStamp();
+    if (tStamp == invalidStamp())
+	tStamp = m_nextStamp;
+    if (tStamp == invalidStamp()) {
+	DDebug(DebugNote,"Unknown frame timestamp - assuming %lu + %lu [%p]",
+	    m_timestamp,nSamp,this);
+	tStamp = m_timestamp + nSamp;
+    }
+    frame.timeStamp(tStamp);
+    // consumers must not change a frame that the next one will see
+    ObjList* l = m_consumers.skipNull();
+    bool shared = l && l->skipNext();
+    if (shared)
+	frame.ref();
+    unsigned long len = invalidStamp();
+    bool empty = true;
+    while (l) {
+	DataConsumer* c = static_cast<DataConsumer *>(l->get());
+	unsigned long ll = c->ConsumeFrame(frame,this);
+	if (ll || c->valid()) {
+	    if (len > ll)
+		len = ll;
+	    l = l->skipNext();
+	    empty = false;
+	}
+	else {
+	    Debug(DebugInfo,"Consumer %p becomes invalid, detaching it [%p]",c,this);
+	    statDrop();
+	    detachInternal(c);
+	    l = l->skipNull();
+	}
+    }
+    if (shared)
+	frame.deref();
+    if (empty)
+	len = 0;
+    statData(frame.data().length(),Time::now() - start);
     m_timestamp = tStamp;
     m_nextStamp = nSamp ? (tStamp + nSamp) : invalidStamp();
     return len;
@@ -656,8 +1522,79 @@ bool DataSource::detachInternal(DataConsumer* consumer)
 	temp->deref();
 	return true;
     }
-    DDebug(DebugInfo,"DataSource [%p] has no consumer [%p]",this,consumer);
-    return false;
+    DDebug(DebugInfo,"DataSource [%p] has no consumer [%p]",this,consumer);
+    return false;
+}
+
+// Add one node of a data flow graph, for translators the output side is in out
+static int addFlowNode(NamedList& params, String& text, const char* role, const String& format,
+    const DataNode* node, const DataNode* out, int parent, unsigned int level)
+{
+    int idx = params.getIntValue(YSTRING("nodes"));
+    params.setParam("nodes",String(idx + 1));
+    String prefix("node.");
+    prefix << idx;
+    params.setParam(prefix,role);
+    prefix << ".";
+    params.setParam(prefix + "format",format);
+    if (parent >= 0)
+	params.setParam(prefix + "parent",String(parent));
+    unsigned int packets = node->statPackets();
+    unsigned int drops = node->statDrops();
+    u_int64_t spent = node->statTime();
+    params.setParam(prefix + "packets",String(packets));
+    params.setParam(prefix + "bytes",String(node->statBytes()));
+    if (out) {
+	// time spent downstream is accounted by the nodes fed by the translator
+	drops += out->statDrops();
+	spent = (spent > out->statTime()) ? (spent - out->statTime()) : 0;
+	params.setParam(prefix + "outpackets",String(out->statPackets()));
+	params.setParam(prefix + "outbytes",String(out->statBytes()));
+    }
+    // packets mostly take less than a microsecond, keep the fraction of the average
+    unsigned int avg = packets ? (unsigned int)(spent * 1000 / packets) : 0;
+    String tmp;
+    tmp.printf("%u.%03u",avg / 1000,avg % 1000);
+    params.setParam(prefix + "drops",String(drops));
+    params.setParam(prefix + "avgtime",tmp);
+    params.setParam(prefix + "maxtime",String(node->statMaxTime()));
+    String line;
+    line.assign(' ',2 * level + 2);
+    line << role << " " << format << ": packets=" << packets << " bytes=" << node->statBytes();
+    line << " drops=" << drops << " avg=" << tmp << "us max=" << node->statMaxTime() << "us";
+    text << line << "\r\n";
+    return idx;
+}
+
+void DataSource::dumpFlow(NamedList& params, String& text, bool reset, int parent, unsigned int level)
+{
+    Lock mylock(this,100000);
+    if (!(mylock.locked() && alive()))
+	return;
+    // the source of a translator is reported along with its consumer side
+    if (!m_translator) {
+	parent = addFlowNode(params,text,"source",m_format,this,0,parent,level++);
+	if (reset)
+	    resetStats();
+    }
+    for (ObjList* l = m_consumers.skipNull(); l; l = l->skipNext()) {
+	DataConsumer* c = static_cast<DataConsumer*>(l->get());
+	DataSource* s = c->getTransSource();
+	if (!s) {
+	    addFlowNode(params,text,"consumer",c->getFormat(),c,0,parent,level);
+	    if (reset)
+		c->resetStats();
+	    continue;
+	}
+	String fmt;
+	fmt << c->getFormat() << ">" << s->getFormat();
+	int idx = addFlowNode(params,text,"translator",fmt,c,s,parent,level);
+	if (reset) {
+	    c->resetStats();
+	    s->resetStats();
+	}
+	s->dumpFlow(params,text,reset,idx,level + 1);
+    }
 }
 
 void DataSource::destroyed()
@@ -1076,16 +2013,58 @@ bool DataEndpoint::control(NamedList& params)
 }
 
 
+// Find the original source feeding a consumer through any translators
+static DataSource* flowRoot(DataSource* source)
+{
+    for (unsigned int i = 0; source && source->getTranslator() && (i < 16); i++)
+	source = source->getTranslator()->getConnSource();
+    return source;
+}
+
+void DataEndpoint::dumpFlow(NamedList& params, String& text, bool reset)
+{
+    Lock lock(s_dataMutex);
+    int first = params.getIntValue(YSTRING("nodes"));
+    text << m_name << ":\r\n";
+    ObjList roots;
+    if (m_source) {
+	roots.append(m_source)->setDelete(false);
+	m_source->dumpFlow(params,text,reset);
+    }
+    DataConsumer* cons[3] = { m_consumer, m_peerRecord, m_callRecord };
+    for (unsigned int i = 0; i < 3; i++) {
+	if (!cons[i])
+	    continue;
+	for (int o = 0; o < 2; o++) {
+	    RefPointer<DataSource> s = flowRoot(o ? cons[i]->getOverSource() : cons[i]->getConnSource());
+	    if (!s || roots.find(s))
+		continue;
+	    roots.append(s)->setDelete(false);
+	    s->dumpFlow(params,text,reset);
+	}
+    }
+    int last = params.getIntValue(YSTRING("nodes"));
+    for (int i = first; i < last; i++)
+	params.setParam("node." + String(i) + ".media",m_name);
+}
+
+
 void ThreadedSource::destroyed()
 {
     if (m_thread)
 	Debug(DebugFail,"ThreadedSource destroyed holding thread %p [%p]",m_thread,this);
+    if (m_clock)
+	Debug(DebugFail,"ThreadedSource destroyed attached to clock %p [%p]",m_clock,this);
     DataSource::destroyed();
 }
 
-bool ThreadedSource::start(const char* name, Thread::Priority prio)
+bool ThreadedSource::start(const char* name, Thread::Priority prio, bool clocked)
 {
     Lock mylock(this);
+    if (m_clock)
+	return true;
+    if (clocked && !m_thread && MediaClock::attach(this))
+	return true;
     if (!m_thread) {
 	ThreadedSourcePrivate* thread = new ThreadedSourcePrivate(this,name,prio);
 	if (thread->startup()) {
@@ -1101,6 +2080,14 @@ bool ThreadedSource::start(const char* name, Thread::Priority prio)
 void ThreadedSource::stop()
 {
     Lock mylock(this);
+    if (m_clock) {
+	// the clock thread notices and releases the source
+	m_clock = 0;
+	mylock.drop();
+	// a tick that already started may still be using the source
+	MediaClock::wait(this);
+	mylock.acquire(this);
+    }
     ThreadedSourcePrivate* tmp = m_thread;
     m_thread = 0;
     if (!tmp || tmp->running())
@@ -1125,6 +2112,8 @@ Thread* ThreadedSource::thread() const
 bool ThreadedSource::running() const
 {
     Lock mylock(const_cast<ThreadedSource*>(this));
+    if (m_clock)
+	return true;
     return m_thread && m_thread->running();
 }
 
@@ -1133,13 +2122,312 @@ bool ThreadedSource::looping(bool runConsumers) const
     Lock mylock(const_cast<ThreadedSource*>(this));
     if ((refcount() <= 1) && !(runConsumers && alive() && m_consumers.count()))
 	return false;
+    if (m_clock)
+	return !Engine::exiting();
     return m_thread && !m_thread->check(false) &&
 	m_thread->isCurrent() && !Engine::exiting();
 }
 
+void ThreadedSource::run()
+{
+    u_int64_t when = Time::now();
+    for (;;) {
+	lock();
+	bool ok = m_thread && m_thread->isCurrent();
+	unlock();
+	if (!ok || Thread::check(false) || Engine::exiting())
+	    break;
+	unsigned int delay = tick(when);
+	if (!delay)
+	    break;
+	when += delay;
+	int64_t dly = when - Time::now();
+	if (dly > 0)
+	    Thread::usleep((unsigned long)dly);
+	else if (dly < -CLOCK_MAX_LAG)
+	    when = Time::now();
+    }
+}
+
+unsigned int ThreadedSource::tick(u_int64_t when)
+{
+    return 0;
+}
+
+
+static Mutex s_clockMutex(false,"MediaClock");
+static MediaClock* s_clocks[CLOCK_MAX_THREADS];
+static unsigned int s_clockThreads = 0;
+static unsigned int s_clockRunning = 0;
+
+MediaClock::MediaClock(unsigned int index)
+    : Thread("Media Clock",Thread::High),
+      m_sources(0), m_ticks(0), m_usec(0), m_late(0), m_maxLag(0),
+      m_index(index), m_ticking(0), m_pos(Time::now() / CLOCK_SLOT)
+{
+    for (unsigned int i = 0; i < CLOCK_SLOTS; i++)
+	m_slots[i] = 0;
+}
+
+// Attach a source to the least loaded clock thread, fails if there is none
+// Called with the source locked
+bool MediaClock::attach(ThreadedSource* source)
+{
+    Lock lck(s_clockMutex);
+    MediaClock* clock = 0;
+    for (unsigned int i = 0; i < s_clockThreads; i++) {
+	MediaClock* c = s_clocks[i];
+	if (c && !(clock && (clock->m_sources <= c->m_sources)))
+	    clock = c;
+    }
+    if (!clock)
+	return false;
+    MediaClockEntry* entry = new MediaClockEntry(source,Time::now());
+    source->m_clock = entry;
+    clock->add(entry);
+    clock->m_sources++;
+    return true;
+}
+
+// Wait until no clock thread is calling a source, unless called from its tick
+// The source must be already detached so it is not called again
+void MediaClock::wait(ThreadedSource* source)
+{
+    for (;;) {
+	bool busy = false;
+	s_clockMutex.lock();
+	for (unsigned int i = 0; i < CLOCK_MAX_THREADS; i++) {
+	    MediaClock* c = s_clocks[i];
+	    if (c && (c->m_ticking == source)) {
+		busy = !c->isCurrent();
+		break;
+	    }
+	}
+	s_clockMutex.unlock();
+	if (!busy)
+	    break;
+	Thread::idle();
+    }
+}
+
+// Insert an entry in the wheel, called with the clock mutex locked
+void MediaClock::add(MediaClockEntry* entry)
+{
+    u_int64_t slot = entry->m_due / CLOCK_SLOT;
+    if (slot < m_pos)
+	slot = m_pos;
+    MediaClockEntry*& head = m_slots[slot % CLOCK_SLOTS];
+    entry->m_next = head;
+    head = entry;
+}
+
+// Call a source, returns false if it must be released
+bool MediaClock::tick(MediaClockEntry* entry)
+{
+    ThreadedSource* source = entry->m_source;
+    // mark the source busy before checking it so stop() can wait for us
+    s_clockMutex.lock();
+    m_ticking = source;
+    s_clockMutex.unlock();
+    source->lock();
+    bool ok = (source->m_clock == entry) && !Engine::exiting();
+    source->unlock();
+    u_int64_t start = Time::now();
+    unsigned int delay = ok ? source->tick(entry->m_due) : 0;
+    u_int64_t end = Time::now();
+    s_clockMutex.lock();
+    m_ticking = 0;
+    s_clockMutex.unlock();
+    if (!ok)
+	return false;
+    m_ticks++;
+    m_usec += end - start;
+    if (start > entry->m_due) {
+	u_int64_t lag = start - entry->m_due;
+	if (lag > m_maxLag)
+	    m_maxLag = (unsigned int)lag;
+    }
+    if (!delay)
+	return false;
+    entry->m_due += delay;
+    if (entry->m_due + CLOCK_MAX_LAG < end) {
+	DDebug(DebugNote,"Media clock resynchronizing source %p late by " FMT64U " usec",
+	    source,end - entry->m_due);
+	entry->m_due = end;
+	m_late++;
+    }
+    return true;
+}
+
+// Detach sources from the clock and let them clean up, called unlocked
+void MediaClock::release(MediaClockEntry* list)
+{
+    while (list) {
+	MediaClockEntry* entry = list;
+	list = entry->m_next;
+	ThreadedSource* source = entry->m_source;
+	source->lock();
+	if (source->m_clock == entry)
+	    source->m_clock = 0;
+	source->unlock();
+	source->cleanup();
+	delete entry;
+    }
+}
+
+// Move all sources to the remaining threads, called with the clock mutex locked
+bool MediaClock::handOver()
+{
+    for (unsigned int i = 0; i < CLOCK_SLOTS; i++) {
+	while (MediaClockEntry* entry = m_slots[i]) {
+	    MediaClock* clock = 0;
+	    for (unsigned int j = 0; j < s_clockThreads; j++) {
+		MediaClock* c = s_clocks[j];
+		if (c && (c != this) && !(clock && (clock->m_sources <= c->m_sources)))
+		    clock = c;
+	    }
+	    if (!clock)
+		return false;
+	    m_slots[i] = entry->m_next;
+	    clock->add(entry);
+	    clock->m_sources++;
+	    m_sources--;
+	}
+    }
+    return true;
+}
+
+void MediaClock::run()
+{
+    for (;;) {
+	Lock lck(s_clockMutex);
+	if ((m_index >= s_clockThreads) && (handOver() || !m_sources)) {
+	    s_clocks[m_index] = 0;
+	    s_clockRunning--;
+	    break;
+	}
+	u_int64_t now = Time::now();
+	// nothing is in the wheel, skip over the time spent idle
+	if (!m_sources)
+	    m_pos = now / CLOCK_SLOT;
+	while (m_pos <= now / CLOCK_SLOT) {
+	    // detach the entries due in this slot
+	    MediaClockEntry* due = 0;
+	    MediaClockEntry** tail = &due;
+	    MediaClockEntry** p = &m_slots[m_pos % CLOCK_SLOTS];
+	    while (MediaClockEntry* entry = *p) {
+		if (entry->m_due / CLOCK_SLOT > m_pos) {
+		    p = &entry->m_next;
+		    continue;
+		}
+		*p = entry->m_next;
+		entry->m_next = 0;
+		*tail = entry;
+		tail = &entry->m_next;
+	    }
+	    m_pos++;
+	    if (!due)
+		continue;
+	    lck.drop();
+	    MediaClockEntry* keep = 0;
+	    MediaClockEntry* drop = 0;
+	    while (MediaClockEntry* entry = due) {
+		due = entry->m_next;
+		if (tick(entry)) {
+		    entry->m_next = keep;
+		    keep = entry;
+		}
+		else {
+		    entry->m_next = drop;
+		    drop = entry;
+		}
+	    }
+	    lck.acquire(s_clockMutex);
+	    while (MediaClockEntry* entry = keep) {
+		keep = entry->m_next;
+		add(entry);
+	    }
+	    for (MediaClockEntry* entry = drop; entry; entry = entry->m_next)
+		m_sources--;
+	    if (drop) {
+		lck.drop();
+		release(drop);
+		lck.acquire(s_clockMutex);
+	    }
+	    now = Time::now();
+	}
+	bool idle = !m_sources;
+	lck.drop();
+	if (idle)
+	    Thread::idle();
+	else {
+	    int64_t dly = m_pos * CLOCK_SLOT - Time::now();
+	    if (dly > 0)
+		Thread::usleep((unsigned long)dly);
+	}
+    }
+}
+
+void ThreadedSource::setClockThreads(unsigned int threads)
+{
+    if (threads > CLOCK_MAX_THREADS)
+	threads = CLOCK_MAX_THREADS;
+    Lock lck(s_clockMutex);
+    if (threads != s_clockThreads)
+	Debug(DebugInfo,"Media clock changed from %u to %u threads",s_clockThreads,threads);
+    s_clockThreads = threads;
+    for (unsigned int i = 0; i < threads; i++) {
+	if (s_clocks[i])
+	    continue;
+	MediaClock* c = new MediaClock(i);
+	if (!c->startup()) {
+	    Debug(DebugWarn,"Failed to start a media clock thread");
+	    delete c;
+	    break;
+	}
+	s_clocks[i] = c;
+	s_clockRunning++;
+    }
+}
+
+unsigned int ThreadedSource::clockThreads()
+{
+    return s_clockThreads;
+}
+
+void ThreadedSource::getClockStats(NamedList& dest)
+{
+    Lock lck(s_clockMutex);
+    dest.setParam("threads",String(s_clockRunning));
+    for (unsigned int i = 0; i < CLOCK_MAX_THREADS; i++) {
+	const MediaClock* c = s_clocks[i];
+	if (!c)
+	    continue;
+	String tmp;
+	tmp << c->m_sources << "|" << c->m_ticks << "|" << c->m_usec;
+	tmp << "|" << c->m_late << "|" << c->m_maxLag;
+	dest.addParam("clock" + String(i),tmp);
+    }
+}
+
+void ThreadedSource::stopClock()
+{
+    s_clockMutex.lock();
+    s_clockThreads = 0;
+    s_clockMutex.unlock();
+    // sources stop on their own once the engine is exiting
+    for (int i = 0; i < 100; i++) {
+	Lock lck(s_clockMutex);
+	if (!s_clockRunning)
+	    break;
+	lck.drop();
+	Thread::msleep(10);
+    }
+}
+
 
 DataTranslator::DataTranslator(const char* sFormat, const char* dFormat)
-    : DataConsumer(sFormat)
+    : DataConsumer(sFormat), m_transcode(0)
 {
     DDebug(DebugAll,"DataTranslator::DataTranslator('%s','%s') [%p]",sFormat,dFormat,this);
     m_tsource = new DataSource(dFormat);
@@ -1147,7 +2435,7 @@ DataTranslator::DataTranslator(const char* sFormat, const char* dFormat)
 }
 
 DataTranslator::DataTranslator(const char* sFormat, DataSource* source)
-    : DataConsumer(sFormat), m_tsource(source)
+    : DataConsumer(sFormat), m_tsource(source), m_transcode(0)
 {
     DDebug(DebugAll,"DataTranslator::DataTranslator('%s',%p) [%p]",sFormat,source,this);
     m_tsource->setTranslator(this);
@@ -1162,6 +2450,7 @@ DataTranslator::~DataTranslator()
 	temp->setTranslator(0);
 	temp->deref();
     }
+    delete m_transcode;
 }
 
 void* DataTranslator::getObject(const String& name) const
@@ -1202,13 +2491,205 @@ Mutex DataTranslator::s_mutex(true,"DataTranslator");
 ObjList DataTranslator::s_factories;
 unsigned int DataTranslator::s_maxChain = 3;
 static ObjList s_compose;
+// Current translator table, NULL while it must be rebuilt
+static TranslatorTable* volatile s_table = 0;
+static AtomicUInt s_tableVersion;
+// Readers are counted by the parity of the epoch they started in
+static AtomicUInt s_epoch;
+static AtomicInt s_readers[2];
+// Writers that retired the table and are still changing the factories
+static unsigned int s_writers = 0;
+// Serializes writers waiting for readers
+static Mutex s_syncMutex(false,"TranslatorSync");
 static SimpleFactory s_sFactory(s_simpleCaps,"g711");
 static SimpleFactory s_sFactory16k(s_simpleCaps16k,"g711wb");
 static SimpleFactory s_sFactory32k(s_simpleCaps32k,"g711uwb");
 // FIXME
 static ResampFactory s_rFactory;
+static PolyphaseFactory s_pFactory;
 static StereoFactory s_stereoFactory;
 
+TranslatorTable::TranslatorTable(const ObjList& factories, unsigned int version)
+    : m_version(version), m_count(0), m_mask(0),
+      m_formats(0), m_hash(0), m_cost(0), m_factory(0)
+{
+    unsigned int caps = 0;
+    const ObjList* l;
+    for (l = factories.skipNull(); l; l = l->skipNext()) {
+	const TranslatorCaps* c = static_cast<TranslatorFactory*>(l->get())->getCapabilities();
+	for (; c && c->src && c->dest; c++)
+	    caps++;
+    }
+    // keep the hash at most half full even if all formats are distinct
+    unsigned int size = 16;
+    while (size < 4 * caps)
+	size <<= 1;
+    m_mask = size - 1;
+    m_hash = new int[size];
+    for (unsigned int i = 0; i < size; i++)
+	m_hash[i] = -1;
+    m_formats = new const FormatInfo*[2 * caps + 1];
+    for (l = factories.skipNull(); l; l = l->skipNext()) {
+	const TranslatorCaps* c = static_cast<TranslatorFactory*>(l->get())->getCapabilities();
+	for (; c && c->src && c->dest; c++) {
+	    insert(c->src);
+	    insert(c->dest);
+	}
+    }
+    unsigned int n = m_count * m_count;
+    m_cost = new int[n + 1];
+    m_factory = new TranslatorFactory*[n + 1];
+    for (unsigned int i = 0; i < n; i++) {
+	m_cost[i] = -1;
+	m_factory[i] = 0;
+    }
+    // the cheapest factory creates translators, the first one in list order on equal cost
+    for (l = factories.skipNull(); l; l = l->skipNext()) {
+	TranslatorFactory* f = static_cast<TranslatorFactory*>(l->get());
+	const TranslatorCaps* c = f->getCapabilities();
+	for (; c && c->src && c->dest; c++) {
+	    unsigned int i = index(c->src) * m_count + index(c->dest);
+	    if ((m_cost[i] == -1) || (m_cost[i] > c->cost)) {
+		m_cost[i] = c->cost;
+		m_factory[i] = f;
+	    }
+	}
+    }
+}
+
+TranslatorTable::~TranslatorTable()
+{
+    delete[] m_factory;
+    delete[] m_cost;
+    delete[] m_formats;
+    delete[] m_hash;
+}
+
+// Open addressing on the FormatInfo address, formats are never freed
+int TranslatorTable::index(const FormatInfo* info) const
+{
+    if (!info)
+	return -1;
+    unsigned int h = (unsigned int)(((size_t)info) >> 3);
+    for (h ^= (h >> 9); ; h++) {
+	int i = m_hash[h & m_mask];
+	if ((i < 0) || (m_formats[i] == info))
+	    return i;
+    }
+}
+
+int TranslatorTable::insert(const FormatInfo* info)
+{
+    unsigned int h = (unsigned int)(((size_t)info) >> 3);
+    for (h ^= (h >> 9); ; h++) {
+	int& i = m_hash[h & m_mask];
+	if (i < 0) {
+	    m_formats[m_count] = info;
+	    i = m_count++;
+	    return i;
+	}
+	if (m_formats[i] == info)
+	    return i;
+    }
+}
+
+
+TranslatorReader::TranslatorReader()
+    : m_epoch(0), m_table(0), m_own(0), m_reading(true), m_locked(false)
+{
+    // the table must be taken in the epoch we are counted in
+    // a writer that changed the epoch meanwhile may not have seen us
+    for (;;) {
+	m_epoch = s_epoch.valueAtomic();
+	s_readers[m_epoch & 1].inc();
+	m_table = s_table;
+	if (m_epoch == s_epoch.valueAtomic())
+	    break;
+	s_readers[m_epoch & 1].dec();
+    }
+}
+
+// Get the current table, rebuild it under the global lock if missing
+const TranslatorTable* TranslatorReader::table()
+{
+    if (m_table)
+	return m_table;
+    // never wait for the lock while counted as reader
+    done();
+    DataTranslator::s_mutex.lock();
+    m_locked = true;
+    DataTranslator::refresh();
+    m_table = s_table;
+    if (!m_table) {
+	// a writer is waiting for readers, use a private table while locked
+	m_own = new TranslatorTable(DataTranslator::s_factories,s_tableVersion.valueAtomic());
+	m_table = m_own;
+    }
+    return m_table;
+}
+
+void TranslatorReader::done()
+{
+    m_table = 0;
+    if (m_reading) {
+	m_reading = false;
+	s_readers[m_epoch & 1].dec();
+    }
+    if (m_own) {
+	delete m_own;
+	m_own = 0;
+    }
+    if (m_locked) {
+	m_locked = false;
+	DataTranslator::s_mutex.unlock();
+    }
+}
+
+// Remove the current table and stop publishing new ones until resume()
+// Must be called with the translators mutex locked
+TranslatorTable* TranslatorReader::retire()
+{
+    TranslatorTable* old = s_table;
+    s_table = 0;
+    s_writers++;
+    return old;
+}
+
+// Allow publishing tables again, must be called with the translators mutex locked
+void TranslatorReader::resume()
+{
+    if (s_writers)
+	s_writers--;
+}
+
+// Wait for the readers that may still use a retired table then free it
+// Readers holding a published table may need the translators mutex so it must
+//  not be held here unless no table was published since the last wait
+void TranslatorReader::synchronize(TranslatorTable* old)
+{
+    Lock lock(s_syncMutex);
+    unsigned int epoch = s_epoch.valueAtomic();
+    s_epoch.inc();
+    u_int64_t warn = Time::now() + 5000000;
+    while (s_readers[epoch & 1].valueAtomic()) {
+	if (warn && (Time::now() > warn)) {
+	    Debug(DebugFail,"Still waiting for translator readers, factory changed while translating?");
+	    warn = 0;
+	}
+	Thread::yield();
+    }
+    delete old;
+}
+
+// Make a table current, must be called with the translators mutex locked
+void TranslatorReader::publish(TranslatorTable* table)
+{
+    // atomic operations are full barriers, the table is complete before it is visible
+    s_tableVersion.valueAtomic();
+    s_table = table;
+}
+
+
 void DataTranslator::setMaxChain(unsigned int maxChain)
 {
     if (maxChain < 1)
@@ -1218,6 +2699,212 @@ void DataTranslator::setMaxChain(unsigned int maxChain)
     s_maxChain = maxChain;
 }
 
+// Blocks queued per translator, the oldest ones are dropped past this
+#define TRANSCODE_MAX_QUEUE 16
+// Translators of the same codec a worker processes at once
+#define TRANSCODE_MAX_BATCH 16
+
+static Mutex s_transMutex(false,"Transcoder");
+static Semaphore s_transSem(1024,"Transcoder");
+static ObjList s_transCodecs;
+static unsigned int s_transThreads = 0;
+static unsigned int s_transRunning = 0;
+static unsigned int s_transNext = 0;
+
+void TranscodeWorker::run()
+{
+    DataTranslator* batch[TRANSCODE_MAX_BATCH];
+    for (;;) {
+	unsigned int n = 0;
+	s_transMutex.lock();
+	if (s_transRunning > s_transThreads) {
+	    s_transRunning--;
+	    s_transMutex.unlock();
+	    break;
+	}
+	// pick codecs in turn so a busy one does not starve the others
+	unsigned int codecs = s_transCodecs.count();
+	for (unsigned int i = 0; i < codecs; i++) {
+	    TranscodeCodec* c = static_cast<TranscodeCodec*>(s_transCodecs.at(s_transNext++ % codecs));
+	    if (!(c && c->m_ready.skipNull()))
+		continue;
+	    while (n < TRANSCODE_MAX_BATCH) {
+		DataTranslator* t = static_cast<DataTranslator*>(c->m_ready.remove(false));
+		if (!t)
+		    break;
+		batch[n++] = t;
+	    }
+	    c->m_batches++;
+	    break;
+	}
+	s_transMutex.unlock();
+	if (!n) {
+	    s_transSem.lock(Thread::idleUsec() * 10);
+	    continue;
+	}
+	for (unsigned int i = 0; i < n; i++)
+	    process(batch[i]);
+    }
+}
+
+// Process all blocks queued by a translator, including ones added meanwhile
+void TranscodeWorker::process(DataTranslator* trans)
+{
+    TranscodeQueue* q = trans->m_transcode;
+    TranscodeCodec* c = q->m_codec;
+    for (;;) {
+	s_transMutex.lock();
+	TranscodeBlock* b = static_cast<TranscodeBlock*>(q->m_blocks.remove(false));
+	if (!b) {
+	    q->m_scheduled = false;
+	    s_transMutex.unlock();
+	    break;
+	}
+	q->m_count--;
+	c->m_queued--;
+	s_transMutex.unlock();
+	u_int64_t start = Time::now();
+	trans->process(b->m_data,b->m_tStamp,b->m_flags);
+	u_int64_t end = Time::now();
+	s_transMutex.lock();
+	c->m_blocks++;
+	c->m_bytes += b->m_data.length();
+	c->m_usec += end - start;
+	c->m_wait += start - b->m_time;
+	s_transMutex.unlock();
+	TelEngine::destruct(b);
+    }
+    trans->deref();
+}
+
+void DataTranslator::setTranscodeThreads(unsigned int threads)
+{
+    if (threads > 64)
+	threads = 64;
+    Lock lck(s_transMutex);
+    if (threads != s_transThreads)
+	Debug(DebugInfo,"Transcoding pool changed from %u to %u threads",s_transThreads,threads);
+    s_transThreads = threads;
+    while (s_transRunning < s_transThreads) {
+	TranscodeWorker* w = new TranscodeWorker;
+	if (!w->startup()) {
+	    Debug(DebugWarn,"Failed to start a transcoding thread");
+	    delete w;
+	    break;
+	}
+	s_transRunning++;
+    }
+    lck.drop();
+    // wake up idle workers so the extra ones exit
+    for (unsigned int i = 0; i < 64; i++)
+	s_transSem.unlock();
+}
+
+unsigned int DataTranslator::transcodeThreads()
+{
+    return s_transThreads;
+}
+
+void DataTranslator::getTranscodeStats(NamedList& dest)
+{
+    Lock lck(s_transMutex);
+    dest.setParam("threads",String(s_transRunning));
+    for (ObjList* l = s_transCodecs.skipNull(); l; l = l->skipNext()) {
+	const TranscodeCodec* c = static_cast<const TranscodeCodec*>(l->get());
+	String tmp;
+	tmp << c->m_blocks << "|" << c->m_bytes << "|" << c->m_usec << "|" << c->m_batches;
+	tmp << "|" << c->m_queued << "|" << c->m_maxQueued;
+	tmp << "|" << (c->m_blocks ? (c->m_wait / c->m_blocks) : (u_int64_t)0);
+	tmp << "|" << c->m_dropped;
+	dest.addParam(c->m_name,tmp);
+    }
+}
+
+void DataTranslator::stopTranscoding()
+{
+    s_transMutex.lock();
+    s_transThreads = 0;
+    s_transMutex.unlock();
+    for (unsigned int i = 0; i < 64; i++)
+	s_transSem.unlock();
+    for (int i = 0; i < 100; i++) {
+	Lock lck(s_transMutex);
+	if (!s_transRunning)
+	    break;
+	lck.drop();
+	Thread::msleep(10);
+    }
+    // release translators still holding queued data
+    Lock lck(s_transMutex);
+    for (ObjList* l = s_transCodecs.skipNull(); l; l = l->skipNext()) {
+	TranscodeCodec* c = static_cast<TranscodeCodec*>(l->get());
+	while (DataTranslator* t = static_cast<DataTranslator*>(c->m_ready.remove(false))) {
+	    TranscodeQueue* q = t->m_transcode;
+	    c->m_dropped += q->m_count;
+	    c->m_queued -= q->m_count;
+	    q->m_blocks.clear();
+	    q->m_count = 0;
+	    q->m_scheduled = false;
+	    lck.drop();
+	    t->deref();
+	    lck.acquire(s_transMutex);
+	}
+    }
+}
+
+unsigned long DataTranslator::process(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+{
+    return 0;
+}
+
+unsigned long DataTranslator::transcode(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+{
+    Lock lck(s_transMutex);
+    // keep order, once data is queued everything must go through the queue
+    if (!(s_transThreads || (m_transcode && m_transcode->m_scheduled))) {
+	lck.drop();
+	return process(data,tStamp,flags);
+    }
+    if (!m_transcode) {
+	String name;
+	name << getFormat() << ">" << (m_tsource ? m_tsource->getFormat().c_str() : "");
+	TranscodeCodec* c = static_cast<TranscodeCodec*>(s_transCodecs[name]);
+	if (!c) {
+	    c = new TranscodeCodec(name);
+	    s_transCodecs.append(c);
+	}
+	m_transcode = new TranscodeQueue(c);
+    }
+    TranscodeQueue* q = m_transcode;
+    TranscodeCodec* c = q->m_codec;
+    if (!(q->m_scheduled || ref()))
+	return 0;
+    if (q->m_count >= TRANSCODE_MAX_QUEUE) {
+	// workers fell behind, drop the oldest block
+	q->m_blocks.remove();
+	q->m_count--;
+	c->m_queued--;
+	c->m_dropped++;
+	statDrop();
+    }
+    q->m_blocks.append(new TranscodeBlock(data,tStamp,flags));
+    q->m_count++;
+    if (++c->m_queued > c->m_maxQueued)
+	c->m_maxQueued = c->m_queued;
+    // report the samples queued like process() reports those it converted
+    const FormatInfo* fi = getFormat().getInfo();
+    unsigned long samples = fi ? fi->guessSamples(data.length()) : 0;
+    if (!samples)
+	samples = invalidStamp();
+    if (q->m_scheduled)
+	return samples;
+    q->m_scheduled = true;
+    c->m_ready.append(this)->setDelete(false);
+    lck.drop();
+    s_transSem.unlock();
+    return samples;
+}
+
 void DataTranslator::install(TranslatorFactory* factory)
 {
     if (!factory)
@@ -1225,8 +2912,26 @@ void DataTranslator::install(TranslatorFactory* factory)
     Lock lock(s_mutex);
     if (s_factories.find(factory))
 	return;
+    TranslatorTable* old = TranslatorReader::retire();
     s_factories.append(factory)->setDelete(false);
     s_compose.append(factory)->setDelete(false);
+    TranslatorReader::resume();
+    lock.drop();
+    if (old)
+	TranslatorReader::synchronize(old);
+}
+
+// Compose new factories and rebuild the translator table if needed
+// Must be called with the translators mutex locked
+void DataTranslator::refresh()
+{
+    compose();
+    if (s_table || s_writers)
+	return;
+    TranslatorTable* table = new TranslatorTable(s_factories,s_tableVersion.inc());
+    DDebug(DebugInfo,"Built translator table version %u with %u formats",
+	table->version(),table->count());
+    TranslatorReader::publish(table);
 }
 
 void DataTranslator::compose()
@@ -1328,12 +3033,19 @@ void DataTranslator::uninstall(TranslatorFactory* factory)
     if (!factory)
 	return;
     s_mutex.lock();
+    TranslatorTable* old = TranslatorReader::retire();
     s_compose.remove(factory,false);
     s_factories.remove(factory,false);
+    s_mutex.unlock();
+    // no table is published until resume() so after this wait
+    //  only locked readers can reach the factory or its chains
+    TranslatorReader::synchronize(old);
+    s_mutex.lock();
     // notify chained factories about the removal
     ListIterator iter(s_factories);
     while (TranslatorFactory* f = static_cast<TranslatorFactory*>(iter.get()))
 	f->removed(factory);
+    TranslatorReader::resume();
     s_mutex.unlock();
 }
 
@@ -1479,9 +3191,9 @@ bool DataTranslator::canConvert(const DataFormat& fmt1, const DataFormat& fmt2)
     const FormatInfo* fi2 = fmt2.getInfo();
     if (!(fi1 && fi2))
 	return false;
-    Lock lock(s_mutex);
-    compose();
-    return canConvert(fi1,fi2);
+    TranslatorReader rd;
+    const TranslatorTable* t = rd.table();
+    return (t->cost(fi1,fi2) >= 0) && (t->cost(fi2,fi1) >= 0);
 }
 
 bool DataTranslator::canConvert(const FormatInfo* fmt1, const FormatInfo* fmt2)
@@ -1507,26 +3219,12 @@ bool DataTranslator::canConvert(const FormatInfo* fmt1, const FormatInfo* fmt2)
 
 int DataTranslator::cost(const DataFormat& sFormat, const DataFormat& dFormat)
 {
-    int c = -1;
     const FormatInfo* src = sFormat.getInfo();
     const FormatInfo* dest = dFormat.getInfo();
     if (!(src && dest))
-	return c;
-    s_mutex.lock();
-    compose();
-    ObjList* l = s_factories.skipNull();
-    for (; l; l=l->skipNext()) {
-	TranslatorFactory* f = static_cast<TranslatorFactory*>(l->get());
-	const TranslatorCaps* caps = f->getCapabilities();
-	for (; caps && caps->src && caps->dest; caps++) {
-	    if ((c == -1) || (c > caps->cost)) {
-		if ((caps->src == src) && (caps->dest == dest))
-		    c = caps->cost;
-	    }
-	}
-    }
-    s_mutex.unlock();
-    return c;
+	return -1;
+    TranslatorReader rd;
+    return rd.table()->cost(src,dest);
 }
 
 DataTranslator* DataTranslator::create(const DataFormat& sFormat, const DataFormat& dFormat)
@@ -1540,21 +3238,34 @@ DataTranslator* DataTranslator::create(const DataFormat& sFormat, const DataForm
     bool counting = getObjCounting();
     NamedCounter* saved = Thread::getCurrentObjCounter(counting);
 
-    s_mutex.lock();
-    compose();
-    ObjList *l = s_factories.skipNull();
-    for (; l; l=l->skipNext()) {
-	TranslatorFactory* f = static_cast<TranslatorFactory*>(l->get());
+    TranslatorReader rd;
+    TranslatorFactory* f = rd.table()->factory(sFormat.getInfo(),dFormat.getInfo());
+    if (f) {
 	if (counting)
 	    Thread::setCurrentObjCounter(f->objectsCounter());
 	trans = f->create(sFormat,dFormat);
-	if (trans) {
+	if (trans)
 	    Debug(DebugAll,"Created DataTranslator %p for '%s' -> '%s' by factory %p (len=%u)",
 		trans,sFormat.c_str(),dFormat.c_str(),f,f->length());
-	    break;
+    }
+    rd.done();
+    if (f && !trans) {
+	// the factory refused, try all of them like before the table existed
+	s_mutex.lock();
+	ObjList *l = s_factories.skipNull();
+	for (; l; l=l->skipNext()) {
+	    f = static_cast<TranslatorFactory*>(l->get());
+	    if (counting)
+		Thread::setCurrentObjCounter(f->objectsCounter());
+	    trans = f->create(sFormat,dFormat);
+	    if (trans) {
+		Debug(DebugAll,"Created DataTranslator %p for '%s' -> '%s' by factory %p (len=%u)",
+		    trans,sFormat.c_str(),dFormat.c_str(),f,f->length());
+		break;
+	    }
 	}
+	s_mutex.unlock();
     }
-    s_mutex.unlock();
     if (counting)
 	Thread::setCurrentObjCounter(saved);
 
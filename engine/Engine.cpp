@@ -18,6 +18,7 @@
  */
 
 #include "yatengine.h"
+#include "yatephone.h"
 #include "yateversn.h"
 
 #ifdef _WINDOWS
@@ -546,6 +547,52 @@ bool EngineStatusHandler::received(Message &msg)
 		objects(msg.retValue(),details);
 	    return true;
 	}
+	if (sel == YSTRING("resolver")) {
+	    NamedList stats("");
+	    Resolver::getStats(stats);
+	    msg.retValue() << "name=resolver,type=system;";
+	    String tmp;
+	    for (ObjList* o = stats.paramList()->skipNull(); o; o = o->skipNext()) {
+		NamedString* ns = static_cast<NamedString*>(o->get());
+		tmp.append(ns->name(),",") << "=" << *ns;
+	    }
+	    msg.retValue() << tmp << "\r\n";
+	    return true;
+	}
+	if (sel == YSTRING("transcoder")) {
+	    NamedList stats("");
+	    DataTranslator::getTranscodeStats(stats);
+	    msg.retValue() << "name=transcoder,type=system,format=Blocks|Bytes|Usec|Batches|Queued|MaxQueued|AvgWait|Dropped";
+	    msg.retValue() << ";threads=" << stats.getValue("threads");
+	    String tmp;
+	    for (ObjList* o = stats.paramList()->skipNull(); o; o = o->skipNext()) {
+		NamedString* ns = static_cast<NamedString*>(o->get());
+		if (ns->name() == YSTRING("threads"))
+		    continue;
+		tmp.append(ns->name(),",") << "=" << *ns;
+	    }
+	    if (details && tmp)
+		msg.retValue() << ";" << tmp;
+	    msg.retValue() << "\r\n";
+	    return true;
+	}
+	if (sel == YSTRING("mediaclock")) {
+	    NamedList stats("");
+	    ThreadedSource::getClockStats(stats);
+	    msg.retValue() << "name=mediaclock,type=system,format=Sources|Ticks|Usec|Late|MaxLag";
+	    msg.retValue() << ";threads=" << stats.getValue("threads");
+	    String tmp;
+	    for (ObjList* o = stats.paramList()->skipNull(); o; o = o->skipNext()) {
+		NamedString* ns = static_cast<NamedString*>(o->get());
+		if (ns->name() == YSTRING("threads"))
+		    continue;
+		tmp.append(ns->name(),",") << "=" << *ns;
+	    }
+	    if (details && tmp)
+		msg.retValue() << ";" << tmp;
+	    msg.retValue() << "\r\n";
+	    return true;
+	}
 	if (sel.startSkip("dispatcher")) {
 	    bool byMsg = sel.startSkip("handlers");
 	    if ((byMsg || sel.startSkip("handlers-trackname")) && sel) {
@@ -794,6 +841,7 @@ void EngineCommand::doCompletion(Message &msg, const String& partLine, const Str
 	completeOne(msg.retValue(),YSTRING("engine"),partWord);
 	completeOne(msg.retValue(),YSTRING("objects"),partWord);
 	completeOne(msg.retValue(),YSTRING("dispatcher"),partWord);
+	completeOne(msg.retValue(),YSTRING("resolver"),partWord);
     }
     else if (partLine == YSTRING("status objects")) {
 	for (ObjList* l = getObjCounters().skipNull();l;l = l->skipNext())
@@ -1673,6 +1721,11 @@ int Engine::engineInit()
     }
 #endif
     Thread::idleMsec(s_cfg.getIntValue("general","idlemsec",(clientMode() ? 2 * Thread::idleMsec() : 0)));
+    SocketReactor::setGlobalThreads(s_cfg.getIntValue("general","reactorthreads",1,1,64));
+    DataTranslator::setTranscodeThreads(s_cfg.getIntValue("general","transcodethreads",0,0,64));
+    ThreadedSource::setClockThreads(s_cfg.getIntValue("general","clockthreads",0,0,64));
+    const NamedList* res = s_cfg.getSection("resolver");
+    Resolver::setup(res ? *res : NamedList::empty());
     SysUsage::init();
 
     s_runid = Time::secNow();
@@ -1932,6 +1985,10 @@ int Engine::run()
 	    s_params.setParam("maxevents",String((s_maxevents
 		= s_cfg.getIntValue("general","maxevents",s_maxevents,0,1000))));
 	    s_timejump = s_cfg.getIntValue("general","timejump",s_timejump,0,MAX_TIME_JUMP);
+	    DataTranslator::setTranscodeThreads(s_cfg.getIntValue("general","transcodethreads",
+		DataTranslator::transcodeThreads(),0,64));
+	    ThreadedSource::setClockThreads(s_cfg.getIntValue("general","clockthreads",
+		ThreadedSource::clockThreads(),0,64));
 	    if (s_timejump && (s_timejump < MIN_TIME_JUMP))
 		s_timejump = MIN_TIME_JUMP;
 	    s_timejump *= 1000;
@@ -2090,6 +2147,10 @@ int Engine::engineCleanup()
     Thread::msleep(200);
     m_dispatcher.dequeue();
     checkPoint();
+    SocketReactor::destroyGlobal();
+    ThreadedSource::stopClock();
+    DataTranslator::stopTranscoding();
+    Resolver::cleanup();
     // We are occasionally doing things that can cause crashes so don't abort
     abortOnBug(s_sigabrt && s_lateabrt);
     Thread::killall();
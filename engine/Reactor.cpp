@@ -0,0 +1,827 @@
+/**
+ * Reactor.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "yateclass.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#ifndef EPOLLRDHUP
+#define EPOLLRDHUP 0
+#endif
+#else
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+#endif
+
+// Maximum number of events retrieved in one loop run
+#define REACTOR_MAX_EVENTS 256
+// Maximum time to wait for events, the loops need to check for cancellation
+#define REACTOR_MAX_WAIT 500
+// Time in milliseconds after which a wait for a notification to end is reported
+#define REACTOR_WAIT_WARN 5000
+
+namespace TelEngine {
+
+class ReactorThread;
+
+// A socket registered in an event loop
+class ReactorEntry : public GenObject
+{
+public:
+    inline ReactorEntry(SocketRef* ref, Socket** sock, ReactorClient* client, unsigned int events)
+	: m_ref(ref), m_sock(sock), m_client(client), m_events(events),
+	  m_handle((*sock)->handle()), m_removed(false)
+	{ }
+    virtual ~ReactorEntry()
+	{ TelEngine::destruct(m_ref); }
+    SocketRef* m_ref;
+    Socket** m_sock;
+    ReactorClient* m_client;
+    unsigned int m_events;
+    SOCKET m_handle;
+    bool m_removed;
+};
+
+// A timer kept in the heap of an event loop
+class ReactorTimer
+{
+public:
+    inline ReactorTimer(unsigned int id, ReactorClient* client, u_int64_t interval, bool repeat)
+	: m_id(id), m_client(client), m_interval(interval), m_repeat(repeat),
+	  m_when(Time::now() + interval), m_index(0)
+	{ }
+    unsigned int m_id;
+    ReactorClient* m_client;
+    u_int64_t m_interval;
+    bool m_repeat;
+    u_int64_t m_when;
+    unsigned int m_index;
+};
+
+// One event loop: an epoll descriptor, the sockets watched by it and a timer heap
+class ReactorLoop : public Mutex
+{
+    friend class ReactorThread;
+public:
+    ReactorLoop(SocketReactor* reactor, unsigned int index);
+    ~ReactorLoop();
+    bool start(Thread::Priority prio);
+    bool stop();
+    void orphan();
+    void run();
+    bool addSocket(ReactorEntry* entry);
+    bool updateSocket(SocketRef* ref, unsigned int events);
+    bool removeSocket(SocketRef* ref);
+    bool addTimer(ReactorTimer* timer);
+    bool removeTimer(unsigned int id);
+    void removeClient(ReactorClient* client);
+    void getStats(NamedList& dest);
+    inline bool running() const
+	{ return m_thread != 0; }
+    inline bool valid() const
+	{ return m_epoll >= 0; }
+    inline unsigned int sockets() const
+	{ return m_sockets; }
+    inline unsigned int timers() const
+	{ return m_heapLen; }
+private:
+    void wake();
+    void attach(ReactorClient* client);
+    void detach(ReactorClient* client);
+    void waitCallback(ReactorClient* client);
+    bool ctlSocket(int op, ReactorEntry* entry);
+    void runTimers(u_int64_t now);
+    void heapUp(unsigned int pos);
+    void heapDown(unsigned int pos);
+    void heapRemove(unsigned int pos);
+    const char* m_name;
+    unsigned int m_index;
+    ReactorThread* m_thread;
+    bool m_stop;
+    bool m_orphan;
+    int m_epoll;
+    int m_wake;
+    ObjList m_entries;
+    ObjList m_dead;
+    unsigned int m_sockets;
+    ReactorTimer** m_heap;
+    unsigned int m_heapLen;
+    unsigned int m_heapSize;
+    ReactorClient* m_callback;
+    u_int64_t m_runs;
+    u_int64_t m_events;
+    u_int64_t m_fired;
+};
+
+class ReactorThread : public Thread
+{
+public:
+    inline ReactorThread(ReactorLoop* loop, const char* name, Priority prio)
+	: Thread(name,prio), m_loop(loop)
+	{ }
+    virtual void run()
+	{ m_loop->run(); }
+    virtual void cleanup();
+private:
+    ReactorLoop* m_loop;
+};
+
+};
+
+using namespace TelEngine;
+
+static SocketReactor* s_global = 0;
+static unsigned int s_globalThreads = 1;
+static Mutex s_globalMutex(false,"SocketReactor");
+static Mutex s_timerMutex(false,"ReactorTimer");
+static Mutex s_clientMutex(false,"ReactorClient");
+
+
+void ReactorThread::cleanup()
+{
+    m_loop->lock();
+    if (m_loop->m_thread == this)
+	m_loop->m_thread = 0;
+    bool orphan = m_loop->m_orphan;
+    m_loop->unlock();
+    // the reactor was destroyed from this thread, nobody else owns the loop
+    if (orphan)
+	delete m_loop;
+}
+
+
+ReactorLoop::ReactorLoop(SocketReactor* reactor, unsigned int index)
+    : Mutex(true,"ReactorLoop"),
+      m_name(reactor->name()), m_index(index), m_thread(0), m_stop(false), m_orphan(false),
+      m_epoll(-1), m_wake(-1), m_sockets(0),
+      m_heap(0), m_heapLen(0), m_heapSize(0), m_callback(0),
+      m_runs(0), m_events(0), m_fired(0)
+{
+#ifdef HAVE_EPOLL
+    m_epoll = ::epoll_create(1024);
+    if (m_epoll < 0) {
+	Alarm("engine","socket",DebugWarn,"Reactor '%s' failed to create epoll: %d %s",
+	    m_name,errno,::strerror(errno));
+	return;
+    }
+    m_wake = ::eventfd(0,EFD_NONBLOCK);
+    if (m_wake >= 0) {
+	struct epoll_event ev;
+	::memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = 0;
+	if (::epoll_ctl(m_epoll,EPOLL_CTL_ADD,m_wake,&ev) == 0)
+	    return;
+	::close(m_wake);
+	m_wake = -1;
+    }
+    Alarm("engine","socket",DebugWarn,"Reactor '%s' failed to create wake event: %d %s",
+	m_name,errno,::strerror(errno));
+    ::close(m_epoll);
+    m_epoll = -1;
+#endif
+}
+
+ReactorLoop::~ReactorLoop()
+{
+    stop();
+    m_entries.clear();
+    m_dead.clear();
+    for (unsigned int i = 0; i < m_heapLen; i++)
+	delete m_heap[i];
+    ::free(m_heap);
+#ifdef HAVE_EPOLL
+    if (m_wake >= 0)
+	::close(m_wake);
+    if (m_epoll >= 0)
+	::close(m_epoll);
+#endif
+}
+
+bool ReactorLoop::start(Thread::Priority prio)
+{
+    Lock lck(this);
+    if (m_thread)
+	return true;
+    if (!valid())
+	return false;
+    m_stop = false;
+    m_thread = new ReactorThread(this,m_name,prio);
+    if (m_thread->startup())
+	return true;
+    Debug(DebugWarn,"Reactor '%s' failed to start loop %u",m_name,m_index);
+    delete m_thread;
+    m_thread = 0;
+    return false;
+}
+
+// Stop the loop and wait for its thread to exit
+// Returns false if called from the loop thread, it will exit after returning
+//  from the current notification
+bool ReactorLoop::stop()
+{
+    Lock lck(this);
+    m_stop = true;
+    if (!m_thread)
+	return true;
+    if (Thread::current() == m_thread)
+	return false;
+    wake();
+    // Wait for the thread to notice and exit, it will reset m_thread
+    // Nothing can be freed while it runs so keep waiting, only report it
+    u_int64_t warn = Time::msecNow() + REACTOR_WAIT_WARN;
+    while (m_thread) {
+	lck.drop();
+	Thread::msleep(1);
+	lck.acquire(this);
+	if (warn && (Time::msecNow() >= warn)) {
+	    Debug(DebugFail,"Reactor '%s' loop %u did not stop in %u ms, still waiting",
+		m_name,m_index,REACTOR_WAIT_WARN);
+	    warn = 0;
+	}
+    }
+    return true;
+}
+
+// Leave a loop that could not be stopped to be destroyed by its own thread
+void ReactorLoop::orphan()
+{
+    Lock lck(this);
+    if (m_thread)
+	m_orphan = true;
+    else {
+	lck.drop();
+	delete this;
+    }
+}
+
+void ReactorLoop::wake()
+{
+#ifdef HAVE_EPOLL
+    if (m_wake >= 0) {
+	u_int64_t val = 1;
+	if (::write(m_wake,&val,sizeof(val)) < 0 && (errno != EAGAIN))
+	    Debug(DebugMild,"Reactor '%s' failed to wake loop %u: %d %s",
+		m_name,m_index,errno,::strerror(errno));
+    }
+#endif
+}
+
+// Remember the loop holding a client's registrations so adding more is fast
+// Registrations forced in other loops are not tracked
+void ReactorLoop::attach(ReactorClient* client)
+{
+    Lock lck(s_clientMutex);
+    if (!client->m_reactorLoop) {
+	client->m_reactorLoop = this;
+	client->m_reactorRegs = 0;
+    }
+    if (client->m_reactorLoop == this)
+	client->m_reactorRegs++;
+}
+
+void ReactorLoop::detach(ReactorClient* client)
+{
+    Lock lck(s_clientMutex);
+    if ((client->m_reactorLoop == this) && !--client->m_reactorRegs)
+	client->m_reactorLoop = 0;
+}
+
+// Wait for a client notification in progress on another thread to complete
+// Must be called with the mutex locked exactly once, returns with the mutex locked
+// The loop thread must be able to lock the mutex to finish the notification
+//  so waiting while holding it recursively (or holding any lock the
+//  notification needs) would never end, such waits are reported
+void ReactorLoop::waitCallback(ReactorClient* client)
+{
+    u_int64_t warn = 0;
+    while (client && m_callback == client && m_thread && Thread::current() != m_thread) {
+	unlock();
+	Thread::yield();
+	lock();
+	u_int64_t now = Time::msecNow();
+	if (!warn)
+	    warn = now + REACTOR_WAIT_WARN;
+	else if (now >= warn) {
+	    Debug(DebugFail,"Reactor '%s' loop %u waited %u ms for client %p notification, possible deadlock",
+		m_name,m_index,REACTOR_WAIT_WARN,client);
+	    warn = (u_int64_t)-1;
+	}
+    }
+}
+
+bool ReactorLoop::ctlSocket(int op, ReactorEntry* entry)
+{
+#ifdef HAVE_EPOLL
+    struct epoll_event ev;
+    ::memset(&ev,0,sizeof(ev));
+    ev.events = EPOLLET | EPOLLERR | EPOLLHUP;
+    if (entry->m_events & SocketReactor::Readable)
+	ev.events |= EPOLLIN | EPOLLRDHUP;
+    if (entry->m_events & SocketReactor::Writable)
+	ev.events |= EPOLLOUT;
+    ev.data.ptr = entry;
+    if (::epoll_ctl(m_epoll,op,entry->m_handle,&ev) == 0)
+	return true;
+    if (op != EPOLL_CTL_DEL)
+	Debug(DebugWarn,"Reactor '%s' failed to %s socket %d: %d %s",m_name,
+	    ((op == EPOLL_CTL_ADD) ? "add" : "modify"),entry->m_handle,errno,::strerror(errno));
+#endif
+    return false;
+}
+
+bool ReactorLoop::addSocket(ReactorEntry* entry)
+{
+    Lock lck(this);
+    if (!ctlSocket(EPOLL_CTL_ADD,entry))
+	return false;
+    m_entries.append(entry);
+    m_sockets++;
+    attach(entry->m_client);
+    return true;
+}
+
+bool ReactorLoop::updateSocket(SocketRef* ref, unsigned int events)
+{
+    Lock lck(this);
+    for (ObjList* o = m_entries.skipNull(); o; o = o->skipNext()) {
+	ReactorEntry* e = static_cast<ReactorEntry*>(o->get());
+	if (e->m_ref != ref)
+	    continue;
+	e->m_events = events;
+	return ctlSocket(EPOLL_CTL_MOD,e);
+    }
+    return false;
+}
+
+bool ReactorLoop::removeSocket(SocketRef* ref)
+{
+    Lock lck(this);
+    for (ObjList* o = m_entries.skipNull(); o; o = o->skipNext()) {
+	ReactorEntry* e = static_cast<ReactorEntry*>(o->get());
+	if (e->m_ref != ref)
+	    continue;
+	ctlSocket(EPOLL_CTL_DEL,e);
+	// Events already retrieved may still point to the entry
+	// Keep it until the loop starts a new run
+	o->remove(false);
+	e->m_removed = true;
+	m_dead.append(e);
+	m_sockets--;
+	detach(e->m_client);
+	waitCallback(e->m_client);
+	return true;
+    }
+    return false;
+}
+
+void ReactorLoop::removeClient(ReactorClient* client)
+{
+    Lock lck(this);
+    ObjList* o = m_entries.skipNull();
+    while (o) {
+	ReactorEntry* e = static_cast<ReactorEntry*>(o->get());
+	if (e->m_client != client) {
+	    o = o->skipNext();
+	    continue;
+	}
+	ctlSocket(EPOLL_CTL_DEL,e);
+	o->remove(false);
+	e->m_removed = true;
+	m_dead.append(e);
+	m_sockets--;
+	detach(client);
+	o = o->skipNull();
+    }
+    for (unsigned int i = 0; i < m_heapLen; ) {
+	if (m_heap[i]->m_client == client)
+	    heapRemove(i);
+	else
+	    i++;
+    }
+    waitCallback(client);
+}
+
+bool ReactorLoop::addTimer(ReactorTimer* timer)
+{
+    Lock lck(this);
+    if (m_heapLen >= m_heapSize) {
+	unsigned int size = m_heapSize ? (2 * m_heapSize) : 64;
+	ReactorTimer** heap = (ReactorTimer**)::realloc(m_heap,size * sizeof(ReactorTimer*));
+	if (!heap) {
+	    Debug(DebugFail,"Reactor '%s' failed to grow timer heap to %u",m_name,size);
+	    return false;
+	}
+	m_heap = heap;
+	m_heapSize = size;
+    }
+    timer->m_index = m_heapLen;
+    m_heap[m_heapLen++] = timer;
+    heapUp(timer->m_index);
+    attach(timer->m_client);
+    // Wake the loop if the new timer expires before all others
+    if (!timer->m_index && Thread::current() != m_thread)
+	wake();
+    return true;
+}
+
+bool ReactorLoop::removeTimer(unsigned int id)
+{
+    Lock lck(this);
+    for (unsigned int i = 0; i < m_heapLen; i++) {
+	if (m_heap[i]->m_id != id)
+	    continue;
+	ReactorClient* client = m_heap[i]->m_client;
+	heapRemove(i);
+	waitCallback(client);
+	return true;
+    }
+    return false;
+}
+
+void ReactorLoop::heapUp(unsigned int pos)
+{
+    ReactorTimer* t = m_heap[pos];
+    while (pos) {
+	unsigned int parent = (pos - 1) / 2;
+	if (m_heap[parent]->m_when <= t->m_when)
+	    break;
+	m_heap[pos] = m_heap[parent];
+	m_heap[pos]->m_index = pos;
+	pos = parent;
+    }
+    m_heap[pos] = t;
+    t->m_index = pos;
+}
+
+void ReactorLoop::heapDown(unsigned int pos)
+{
+    ReactorTimer* t = m_heap[pos];
+    while (true) {
+	unsigned int child = 2 * pos + 1;
+	if (child >= m_heapLen)
+	    break;
+	if ((child + 1 < m_heapLen) && (m_heap[child + 1]->m_when < m_heap[child]->m_when))
+	    child++;
+	if (t->m_when <= m_heap[child]->m_when)
+	    break;
+	m_heap[pos] = m_heap[child];
+	m_heap[pos]->m_index = pos;
+	pos = child;
+    }
+    m_heap[pos] = t;
+    t->m_index = pos;
+}
+
+void ReactorLoop::heapRemove(unsigned int pos)
+{
+    detach(m_heap[pos]->m_client);
+    delete m_heap[pos];
+    m_heapLen--;
+    if (pos == m_heapLen)
+	return;
+    m_heap[pos] = m_heap[m_heapLen];
+    m_heap[pos]->m_index = pos;
+    heapDown(pos);
+    heapUp(m_heap[pos]->m_index);
+}
+
+void ReactorLoop::runTimers(u_int64_t now)
+{
+    Time when(now);
+    lock();
+    while (m_heapLen && !m_stop) {
+	ReactorTimer* t = m_heap[0];
+	if (t->m_when > now)
+	    break;
+	unsigned int id = t->m_id;
+	ReactorClient* client = t->m_client;
+	if (t->m_repeat) {
+	    t->m_when += t->m_interval;
+	    // Don't try to catch up if we are seriously late
+	    if (t->m_when <= now)
+		t->m_when = now + t->m_interval;
+	    heapDown(0);
+	}
+	else
+	    heapRemove(0);
+	m_fired++;
+	m_callback = client;
+	unlock();
+	client->timerEvent(id,when);
+	lock();
+	m_callback = 0;
+    }
+    unlock();
+}
+
+void ReactorLoop::run()
+{
+#ifdef HAVE_EPOLL
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    while (true) {
+	lock();
+	// Safe to release removed entries, no retrieved event points to them
+	m_dead.clear();
+	if (m_stop) {
+	    unlock();
+	    break;
+	}
+	int tout = REACTOR_MAX_WAIT;
+	if (m_heapLen) {
+	    u_int64_t now = Time::now();
+	    u_int64_t when = m_heap[0]->m_when;
+	    if (when <= now)
+		tout = 0;
+	    else if (when - now < 1000 * REACTOR_MAX_WAIT)
+		tout = (int)((when - now + 999) / 1000);
+	}
+	unlock();
+	int n = ::epoll_wait(m_epoll,events,REACTOR_MAX_EVENTS,tout);
+	if (n < 0) {
+	    if (errno != EINTR) {
+		Debug(DebugWarn,"Reactor '%s' loop %u wait error: %d %s",
+		    m_name,m_index,errno,::strerror(errno));
+		Thread::idle();
+	    }
+	    n = 0;
+	}
+	m_runs++;
+	for (int i = 0; i < n; i++) {
+	    ReactorEntry* e = static_cast<ReactorEntry*>(events[i].data.ptr);
+	    if (!e) {
+		u_int64_t val;
+		while (::read(m_wake,&val,sizeof(val)) > 0)
+		    ;
+		continue;
+	    }
+	    unsigned int ev = 0;
+	    if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+		ev |= SocketReactor::Readable;
+	    if (events[i].events & EPOLLOUT)
+		ev |= SocketReactor::Writable;
+	    if (events[i].events & (EPOLLERR | EPOLLHUP))
+		ev |= SocketReactor::Failure;
+	    lock();
+	    // Entry may have been removed after events were retrieved
+	    Socket* sock = e->m_removed ? 0 : *e->m_sock;
+	    if (!sock || m_stop) {
+		unlock();
+		continue;
+	    }
+	    ReactorClient* client = e->m_client;
+	    m_callback = client;
+	    m_events++;
+	    unlock();
+	    client->socketEvent(*sock,ev);
+	    lock();
+	    m_callback = 0;
+	    unlock();
+	}
+	runTimers(Time::now());
+	if (Thread::check(false))
+	    break;
+    }
+#endif
+}
+
+void ReactorLoop::getStats(NamedList& dest)
+{
+    Lock lck(this);
+    String prefix;
+    prefix << "loop" << m_index << ".";
+    dest.setParam(prefix + "sockets",String(m_sockets));
+    dest.setParam(prefix + "timers",String(m_heapLen));
+    dest.setParam(prefix + "runs",String(m_runs));
+    dest.setParam(prefix + "events",String(m_events));
+    dest.setParam(prefix + "fired",String(m_fired));
+}
+
+
+ReactorClient::ReactorClient()
+    : m_reactorLoop(0), m_reactorRegs(0)
+{
+}
+
+ReactorClient::~ReactorClient()
+{
+}
+
+void ReactorClient::timerEvent(unsigned int id, const Time& when)
+{
+}
+
+
+SocketReactor::SocketReactor(const char* name, unsigned int threads, Thread::Priority prio)
+    : m_name(name), m_priority(prio), m_count(threads ? threads : 1), m_loops(0), m_timerId(0)
+{
+    m_loops = new ReactorLoop*[m_count];
+    for (unsigned int i = 0; i < m_count; i++)
+	m_loops[i] = new ReactorLoop(this,i);
+}
+
+SocketReactor::~SocketReactor()
+{
+    for (unsigned int i = 0; i < m_count; i++) {
+	// a loop destroying the reactor from a notification frees itself on exit
+	if (m_loops[i]->stop())
+	    delete m_loops[i];
+	else
+	    m_loops[i]->orphan();
+    }
+    delete[] m_loops;
+}
+
+bool SocketReactor::supported()
+{
+#ifdef HAVE_EPOLL
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool SocketReactor::start()
+{
+    bool ok = true;
+    for (unsigned int i = 0; i < m_count; i++)
+	ok = m_loops[i]->start(m_priority) && ok;
+    return ok;
+}
+
+void SocketReactor::stop()
+{
+    for (unsigned int i = 0; i < m_count; i++)
+	m_loops[i]->stop();
+}
+
+bool SocketReactor::running() const
+{
+    for (unsigned int i = 0; i < m_count; i++)
+	if (m_loops[i]->running())
+	    return true;
+    return false;
+}
+
+ReactorLoop* SocketReactor::pickLoop(ReactorClient* client, int thread, bool timers) const
+{
+    if (thread >= 0)
+	return ((unsigned int)thread < m_count) ? m_loops[thread] : 0;
+    if (m_count == 1)
+	return m_loops[0];
+    // Keep all registrations of a client in the same loop
+    s_clientMutex.lock();
+    ReactorLoop* loop = client->m_reactorLoop;
+    s_clientMutex.unlock();
+    if (loop) {
+	// The client may be registered in another reactor
+	for (unsigned int i = 0; i < m_count; i++)
+	    if (m_loops[i] == loop)
+		return loop;
+    }
+    ReactorLoop* best = m_loops[0];
+    for (unsigned int i = 1; i < m_count; i++) {
+	ReactorLoop* l = m_loops[i];
+	if (timers ? (l->timers() < best->timers()) : (l->sockets() < best->sockets()))
+	    best = l;
+    }
+    return best;
+}
+
+bool SocketReactor::addSocket(SocketRef* sock, ReactorClient* client, unsigned int events, int thread)
+{
+    if (!(sock && client))
+	return false;
+    Socket** ptr = static_cast<Socket**>(sock->getObject(YATOM("Socket*")));
+    if (!(ptr && *ptr && (*ptr)->valid()))
+	return false;
+    ReactorLoop* loop = pickLoop(client,thread,false);
+    if (!(loop && loop->valid()) || !sock->ref())
+	return false;
+    ReactorEntry* entry = new ReactorEntry(sock,ptr,client,events);
+    if (loop->addSocket(entry))
+	return true;
+    TelEngine::destruct(entry);
+    return false;
+}
+
+bool SocketReactor::updateSocket(SocketRef* sock, unsigned int events)
+{
+    if (!sock)
+	return false;
+    for (unsigned int i = 0; i < m_count; i++)
+	if (m_loops[i]->updateSocket(sock,events))
+	    return true;
+    return false;
+}
+
+bool SocketReactor::removeSocket(SocketRef* sock)
+{
+    if (!sock)
+	return false;
+    for (unsigned int i = 0; i < m_count; i++)
+	if (m_loops[i]->removeSocket(sock))
+	    return true;
+    return false;
+}
+
+unsigned int SocketReactor::addTimer(ReactorClient* client, u_int64_t interval, bool repeat, int thread)
+{
+    if (!client || (repeat && !interval))
+	return 0;
+    ReactorLoop* loop = pickLoop(client,thread,true);
+    if (!(loop && loop->valid()))
+	return 0;
+    s_timerMutex.lock();
+    unsigned int id = ++m_timerId;
+    if (!id)
+	id = ++m_timerId;
+    s_timerMutex.unlock();
+    ReactorTimer* timer = new ReactorTimer(id,client,interval,repeat);
+    if (loop->addTimer(timer))
+	return id;
+    delete timer;
+    return 0;
+}
+
+bool SocketReactor::removeTimer(unsigned int id)
+{
+    if (!id)
+	return false;
+    for (unsigned int i = 0; i < m_count; i++)
+	if (m_loops[i]->removeTimer(id))
+	    return true;
+    return false;
+}
+
+void SocketReactor::removeClient(ReactorClient* client)
+{
+    if (!client)
+	return;
+    for (unsigned int i = 0; i < m_count; i++)
+	m_loops[i]->removeClient(client);
+}
+
+void SocketReactor::getStats(NamedList& dest) const
+{
+    dest.setParam("threads",String(m_count));
+    for (unsigned int i = 0; i < m_count; i++)
+	m_loops[i]->getStats(dest);
+}
+
+SocketReactor* SocketReactor::global()
+{
+    if (!supported())
+	return 0;
+    Lock lck(s_globalMutex);
+    if (!s_global) {
+	s_global = new SocketReactor("Reactor",s_globalThreads,Thread::High);
+	Debug(DebugInfo,"Starting shared socket reactor with %u threads",s_globalThreads);
+    }
+    s_global->start();
+    return s_global;
+}
+
+void SocketReactor::setGlobalThreads(unsigned int threads)
+{
+    if (threads < 1)
+	threads = 1;
+    Lock lck(s_globalMutex);
+    if (s_global && (threads != s_global->threads()))
+	Debug(DebugMild,"Shared socket reactor already running with %u threads",
+	    s_global->threads());
+    s_globalThreads = threads;
+}
+
+void SocketReactor::destroyGlobal()
+{
+    s_globalMutex.lock();
+    SocketReactor* r = s_global;
+    s_global = 0;
+    s_globalMutex.unlock();
+    if (r)
+	delete r;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
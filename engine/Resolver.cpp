@@ -26,10 +26,19 @@
  Non Windows
    NO_RESOLV: Defined if the resolver is not available at compile time
    NO_DN_SKIPNAME: Define it if __dn_skipname() is not available at link time
+   HAVE_POLL: Define it to wait for answers using poll() instead of select()
 */
 
 #include "yateclass.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_POLL
+#include <poll.h>
+#endif
+
 #ifdef _WINDOWS
 #include <windns.h>
 #elif !defined(NO_RESOLV)
@@ -848,4 +857,1246 @@ int Resolver::txtQuery(const char* dname, ObjList& result, String* error)
     return printResult(Txt,code,dname,result,error);
 }
 
+
+/*
+ * Asynchronous resolver engine
+ */
+
+// Default name server port
+#define RESOLVER_PORT 53
+// UDP payload size advertised using EDNS0 and read buffer length
+#define RESOLVER_UDP_SIZE 1232
+// Maximum interval the resolver thread waits for data (usec)
+#define RESOLVER_IDLE 50000
+// Attempts to bind a query socket to a random port before letting the system pick one
+#define RESOLVER_BIND_TRIES 8
+// Lowest port used as random query source port
+#define RESOLVER_PORT_MIN 1024
+
+// Error codes, compatible with h_errno values
+#ifdef HOST_NOT_FOUND
+#define RESOLVER_ERR_NXDOMAIN HOST_NOT_FOUND
+#else
+#define RESOLVER_ERR_NXDOMAIN 1
+#endif
+#ifdef TRY_AGAIN
+#define RESOLVER_ERR_TRYAGAIN TRY_AGAIN
+#else
+#define RESOLVER_ERR_TRYAGAIN 2
+#endif
+#ifdef NO_RECOVERY
+#define RESOLVER_ERR_NORECOVERY NO_RECOVERY
+#else
+#define RESOLVER_ERR_NORECOVERY 3
+#endif
+#ifdef NO_DATA
+#define RESOLVER_ERR_NODATA NO_DATA
+#else
+#define RESOLVER_ERR_NODATA 4
+#endif
+
+// DNS record types
+#define DNS_TYPE_A_REC 1
+#define DNS_TYPE_CNAME_REC 5
+#define DNS_TYPE_SOA_REC 6
+#define DNS_TYPE_TXT_REC 16
+#define DNS_TYPE_AAAA_REC 28
+#define DNS_TYPE_SRV_REC 33
+#define DNS_TYPE_NAPTR_REC 35
+#define DNS_TYPE_OPT_REC 41
+
+namespace { // anonymous
+
+// A client waiting for an asynchronous query
+class ResolverWaiter : public GenObject
+{
+public:
+    inline ResolverWaiter(ResolverClient* client, void* userData)
+	: m_client(client), m_userData(userData)
+	{ }
+    ResolverClient* m_client;
+    void* m_userData;
+};
+
+// A cached answer. The raw response is kept and parsed on each hit
+class ResolverAnswer : public String
+{
+public:
+    inline ResolverAnswer(const String& key, int code, const DataBlock& data,
+	u_int64_t now, unsigned int ttl)
+	: String(key), m_code(code), m_data(data),
+	  m_time(now), m_expires(now + (u_int64_t)ttl * 1000000)
+	{ }
+    int m_code;
+    DataBlock m_data;
+    u_int64_t m_time;
+    u_int64_t m_expires;
+};
+
+// A query in progress
+class ResolverQuery : public String
+{
+public:
+    inline ResolverQuery(const String& key, int type, const String& dname)
+	: String(key), m_type(type), m_dname(dname), m_id(0), m_server(0), m_tries(0),
+	  m_timeout(0), m_sock(0), m_tcp(0), m_tcpOffs(0), m_tcpLen(0), m_tcpRecv(false), m_wait(-1),
+	  m_code(RESOLVER_ERR_TRYAGAIN)
+	{ }
+    virtual ~ResolverQuery()
+	{ closeUdp(); closeTcp(); }
+    inline void closeUdp()
+	{ delete m_sock; m_sock = 0; }
+    inline void closeTcp()
+	{ delete m_tcp; m_tcp = 0; m_tcpData.clear(); m_tcpOffs = m_tcpLen = 0; m_tcpRecv = false; }
+    int m_type;                          // Resolver::Type
+    String m_dname;                      // Queried domain
+    u_int16_t m_id;                      // Query id
+    unsigned int m_server;               // Index of server to use in next attempt
+    unsigned int m_tries;                // Attempts made
+    u_int64_t m_timeout;                 // Current attempt timeout
+    SocketAddr m_addr;                   // Server used in current attempt
+    DataBlock m_packet;                  // Request packet
+    Socket* m_sock;                      // UDP socket of the query, bound to a random port
+    Socket* m_tcp;                       // TCP connection used after a truncated answer
+    DataBlock m_tcpData;                 // Request being sent or response being received
+    unsigned int m_tcpOffs;              // Bytes of TCP data sent or received
+    unsigned int m_tcpLen;               // Length of the TCP response, 0 while reading it
+    bool m_tcpRecv;                      // TCP request was sent, receiving response
+    int m_wait;                          // Index in the thread's wait set, negative if none
+    ObjList m_waiters;                   // Clients waiting for the answer
+    int m_code;                          // Final result code
+    DataBlock m_answer;                  // Final response
+};
+
+// Set of sockets the resolver thread waits on
+class ResolverWait
+{
+public:
+    ResolverWait();
+    ~ResolverWait();
+    void clear();
+    int add(Socket* sock, bool write);
+    void wait(int64_t usec);
+    bool ready(int index) const;
+private:
+    unsigned int m_count;
+    unsigned int m_size;
+#ifdef HAVE_POLL
+    struct pollfd* m_fds;
+#else
+    SOCKET* m_handles;
+    fd_set m_read;
+    fd_set m_write;
+    SOCKET m_max;
+    bool m_forced;                       // Some sockets could not be waited on
+#endif
+};
+
+// Resolver thread: reads answers and handles retransmissions
+class ResolverThread : public Thread
+{
+public:
+    inline ResolverThread()
+	: Thread("Resolver")
+	{ }
+    virtual void run();
+    virtual void cleanup();
+};
+
+// Client used to implement the blocking query on top of the asynchronous engine
+class ResolverSync : public ResolverClient
+{
+public:
+    inline ResolverSync()
+	: m_sem(1,"ResolverSync",0), m_code(RESOLVER_ERR_TRYAGAIN), m_done(false)
+	{ }
+    virtual void resolved(Resolver::Type type, const String& dname, int code,
+	ObjList& result, void* userData);
+    Semaphore m_sem;
+    int m_code;
+    bool m_done;
+    ObjList m_result;
+};
+
+}; // anonymous namespace
+
+static Mutex s_asyncMutex(true,"Resolver");
+static bool s_asyncSetup = false;        // Configuration was loaded
+static ObjList s_servers;                // Name servers (SocketAddr)
+static unsigned int s_timeout = 2000;    // Attempt timeout (msec)
+static unsigned int s_retries = 2;       // Retransmissions to each server
+static unsigned int s_cacheSize = 4096;  // Maximum cached answers
+static unsigned int s_minTtl = 0;        // Minimum TTL of cached answers
+static unsigned int s_maxTtl = 86400;    // Maximum TTL of cached answers
+static unsigned int s_negTtl = 60;       // TTL of negative answers without SOA
+static HashList s_cache(64);             // Cached answers
+static ObjList s_pending;                // Queries waiting for answers
+static ObjList s_delivering;             // Finished queries being notified
+static ResolverThread* s_thread = 0;
+static ResolverClient* s_callback = 0;   // Client being notified from the thread
+static Socket* s_wakeRecv = 0;           // Socket pair used to wake the thread
+static Socket* s_wakeSend = 0;
+static u_int16_t s_queryId = 0;
+// Statistics
+static u_int64_t s_statQueries = 0;
+static u_int64_t s_statHits = 0;
+static u_int64_t s_statNegHits = 0;
+static u_int64_t s_statCoalesced = 0;
+static u_int64_t s_statSent = 0;
+static u_int64_t s_statTcp = 0;
+static u_int64_t s_statForged = 0;
+static u_int64_t s_statTimeouts = 0;
+static u_int64_t s_statFailed = 0;
+
+// Fill an error string from code
+static void asyncError(int code, String* error)
+{
+    if (!(error && code))
+	return;
+#ifdef _WINDOWS
+    Thread::errorString(*error,code);
+#elif defined(__RES)
+    *error = hstrerror(code);
+#else
+    switch (code) {
+	case RESOLVER_ERR_NXDOMAIN:
+	    *error = "Unknown host";
+	    break;
+	case RESOLVER_ERR_TRYAGAIN:
+	    *error = "Host name lookup failure";
+	    break;
+	case RESOLVER_ERR_NODATA:
+	    *error = "No address associated with name";
+	    break;
+	default:
+	    *error = "Unknown server error";
+    }
+#endif
+}
+
+// Retrieve the DNS record type of a query type
+static int dnsType(int type)
+{
+    switch (type) {
+	case Resolver::Srv:
+	    return DNS_TYPE_SRV_REC;
+	case Resolver::Naptr:
+	    return DNS_TYPE_NAPTR_REC;
+	case Resolver::A4:
+	    return DNS_TYPE_A_REC;
+	case Resolver::A6:
+	    return DNS_TYPE_AAAA_REC;
+	case Resolver::Txt:
+	    return DNS_TYPE_TXT_REC;
+    }
+    return 0;
+}
+
+static inline unsigned int getU16(const unsigned char* p)
+{
+    return ((unsigned int)p[0] << 8) | p[1];
+}
+
+static inline unsigned int getU32(const unsigned char* p)
+{
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+	((unsigned int)p[2] << 8) | p[3];
+}
+
+static inline void putU16(unsigned char* p, unsigned int val)
+{
+    p[0] = (unsigned char)(val >> 8);
+    p[1] = (unsigned char)val;
+}
+
+// Read a domain name, handle compression
+// Return the offset after the name at its original location, -1 on error
+static int readName(const unsigned char* buf, int len, int offs, String* name)
+{
+    int ret = -1;
+    int jumps = 0;
+    int pos = offs;
+    String tmp;
+    while (true) {
+	if (pos >= len)
+	    return -1;
+	unsigned int c = buf[pos];
+	if (!c) {
+	    if (ret < 0)
+		ret = pos + 1;
+	    break;
+	}
+	if ((c & 0xc0) == 0xc0) {
+	    if (pos + 1 >= len || ++jumps > 32)
+		return -1;
+	    if (ret < 0)
+		ret = pos + 2;
+	    pos = ((c & 0x3f) << 8) | buf[pos + 1];
+	    continue;
+	}
+	// Extended label types are not supported
+	if (c & 0xc0)
+	    return -1;
+	if (pos + 1 + (int)c > len)
+	    return -1;
+	if (name) {
+	    if (tmp)
+		tmp << ".";
+	    tmp.append((const char*)buf + pos + 1,c);
+	}
+	pos += c + 1;
+    }
+    if (name)
+	*name = tmp;
+    return ret;
+}
+
+// Read a character string
+// Return the offset after it, -1 on error
+static int readString(const unsigned char* buf, int end, int offs, String& str)
+{
+    if (offs >= end)
+	return -1;
+    int n = buf[offs++];
+    if (offs + n > end)
+	return -1;
+    str.assign((const char*)buf + offs,n);
+    return offs + n;
+}
+
+// Build a query packet
+static bool buildQuery(int type, const String& dname, u_int16_t id, DataBlock& packet)
+{
+    unsigned char buf[300];
+    putU16(buf,id);
+    // Recursion desired
+    putU16(buf + 2,0x0100);
+    putU16(buf + 4,1);
+    putU16(buf + 6,0);
+    putU16(buf + 8,0);
+    putU16(buf + 10,1);
+    unsigned int pos = 12;
+    const char* s = dname.c_str();
+    while (*s) {
+	const char* dot = ::strchr(s,'.');
+	unsigned int n = dot ? (unsigned int)(dot - s) : ::strlen(s);
+	if (!n || n > 63 || pos + n + 1 > 12 + 255)
+	    return false;
+	buf[pos++] = (unsigned char)n;
+	::memcpy(buf + pos,s,n);
+	pos += n;
+	s += n;
+	if (*s)
+	    s++;
+    }
+    buf[pos++] = 0;
+    putU16(buf + pos,dnsType(type));
+    putU16(buf + pos + 2,1);
+    pos += 4;
+    // EDNS0 OPT record advertising our UDP payload size
+    buf[pos++] = 0;
+    putU16(buf + pos,DNS_TYPE_OPT_REC);
+    putU16(buf + pos + 2,RESOLVER_UDP_SIZE);
+    ::memset(buf + pos + 4,0,6);
+    pos += 10;
+    packet.assign(buf,pos);
+    return true;
+}
+
+// Parse a response. Fill records if a list is given
+// Retrieve the response code, the minimum TTL of the answers and
+//  the TTL of negative answers given by SOA (0 if not present)
+// Return false if the response is malformed
+static bool parseAnswer(int type, const unsigned char* buf, int len, ObjList* result,
+    unsigned int age, int& rcode, unsigned int& count, unsigned int& ttl, unsigned int& negTtl)
+{
+    rcode = -1;
+    count = 0;
+    ttl = 0xffffffff;
+    negTtl = 0;
+    if (len < 12)
+	return false;
+    int qtype = dnsType(type);
+    rcode = buf[3] & 0x0f;
+    int qd = getU16(buf + 4);
+    int an = getU16(buf + 6);
+    int ns = getU16(buf + 8);
+    int pos = 12;
+    for (; qd > 0; qd--) {
+	pos = readName(buf,len,pos,0);
+	if (pos < 0 || pos + 4 > len)
+	    return false;
+	pos += 4;
+    }
+    for (int i = 0; i < an + ns; i++) {
+	pos = readName(buf,len,pos,0);
+	if (pos < 0 || pos + 10 > len)
+	    return false;
+	int rrType = getU16(buf + pos);
+	unsigned int rrTtl = getU32(buf + pos + 4);
+	int rdLen = getU16(buf + pos + 8);
+	int rd = pos + 10;
+	pos = rd + rdLen;
+	if (pos > len)
+	    return false;
+	if (i >= an) {
+	    // Authority section: SOA gives the negative caching TTL (RFC 2308)
+	    if (rrType != DNS_TYPE_SOA_REC)
+		continue;
+	    int p = readName(buf,pos,rd,0);
+	    if (p >= 0)
+		p = readName(buf,pos,p,0);
+	    if (p < 0 || p + 20 > pos)
+		continue;
+	    unsigned int min = getU32(buf + p + 16);
+	    negTtl = (rrTtl < min) ? rrTtl : min;
+	    if (!negTtl)
+		negTtl = 1;
+	    continue;
+	}
+	if (rrType != qtype && rrType != DNS_TYPE_CNAME_REC)
+	    continue;
+	if (rrTtl < ttl)
+	    ttl = rrTtl;
+	if (rrType != qtype)
+	    continue;
+	count++;
+	if (!result)
+	    continue;
+	int recTtl = (rrTtl > age) ? (int)(rrTtl - age) : 0;
+	switch (type) {
+	    case Resolver::A4:
+	    case Resolver::A6:
+		if (rdLen == (type == Resolver::A4 ? 4 : 16)) {
+		    SocketAddr addr(type == Resolver::A4 ? SocketAddr::IPv4 : SocketAddr::IPv6,buf + rd);
+		    result->append(new TxtRecord(recTtl,addr.host()));
+		}
+		break;
+	    case Resolver::Txt:
+		{
+		    String txt;
+		    if (readString(buf,pos,rd,txt) >= 0)
+			result->append(new TxtRecord(recTtl,txt));
+		}
+		break;
+	    case Resolver::Srv:
+		{
+		    String target;
+		    if (rdLen > 6 && readName(buf,len,rd + 6,&target) >= 0)
+			insertRecord(*result,new SrvRecord(recTtl,getU16(buf + rd),
+			    getU16(buf + rd + 2),target,getU16(buf + rd + 4)),false,"asyncQuery");
+		}
+		break;
+	    case Resolver::Naptr:
+		{
+		    if (rdLen < 4)
+			break;
+		    String fla, ser, reg, rep;
+		    int p = readString(buf,pos,rd + 4,fla);
+		    if (p >= 0)
+			p = readString(buf,pos,p,ser);
+		    if (p >= 0)
+			p = readString(buf,pos,p,reg);
+		    if (p >= 0)
+			p = readName(buf,len,p,&rep);
+		    if (p >= 0)
+			insertRecord(*result,new NaptrRecord(recTtl,getU16(buf + rd),
+			    getU16(buf + rd + 2),fla,ser,reg,rep),true,"asyncQuery");
+		}
+		break;
+	}
+    }
+    if (!count)
+	ttl = 0;
+    return true;
+}
+
+// Notify a client, parse the answer if successful
+static void notifyClient(ResolverClient* client, int type, const String& dname, int code,
+    const DataBlock& data, unsigned int age, void* userData)
+{
+    ObjList result;
+    if (!code) {
+	int rcode = 0;
+	unsigned int count = 0, ttl = 0, negTtl = 0;
+	parseAnswer(type,data.data(0),data.length(),&result,age,rcode,count,ttl,negTtl);
+    }
+    XDebug(DebugAll,"Resolver notifying client (%p) %s query for '%s' code=%d records=%u",
+	client,lookup(type,Resolver::s_types),dname.c_str(),code,result.count());
+    client->resolved((Resolver::Type)type,dname,code,result,userData);
+}
+
+// Load name servers from system configuration
+static void loadSystemServers()
+{
+#ifndef _WINDOWS
+    FILE* f = ::fopen("/etc/resolv.conf","r");
+    if (!f)
+	return;
+    char line[256];
+    while (::fgets(line,sizeof(line),f)) {
+	String tmp(line);
+	tmp.trimBlanks();
+	if (!tmp.startSkip("nameserver"))
+	    continue;
+	SocketAddr* addr = new SocketAddr;
+	if (addr->host(tmp)) {
+	    addr->port(RESOLVER_PORT);
+	    s_servers.append(addr);
+	}
+	else
+	    TelEngine::destruct(addr);
+    }
+    ::fclose(f);
+#endif
+}
+
+// Load defaults if setup was not called
+static inline void checkSetup()
+{
+    if (s_asyncSetup)
+	return;
+    s_asyncSetup = true;
+    loadSystemServers();
+}
+
+// Total number of attempts for a query
+static inline unsigned int maxTries()
+{
+    return (s_retries + 1) * s_servers.count();
+}
+
+// Create an UDP socket bound to a random port
+// Together with the random query id this makes forged answers hard to match (RFC 5452)
+static Socket* createUdp(int family)
+{
+    Socket* s = new Socket(family,SOCK_DGRAM,IPPROTO_UDP);
+    if (s->valid() && s->setBlocking(false)) {
+	SocketAddr addr(family);
+	for (int i = 0; i < RESOLVER_BIND_TRIES; i++) {
+	    addr.port(RESOLVER_PORT_MIN + Random::random() % (65536 - RESOLVER_PORT_MIN));
+	    if (s->bind(addr))
+		return s;
+	}
+	addr.port(0);
+	if (s->bind(addr))
+	    return s;
+    }
+    Debug(DebugWarn,"Resolver failed to create %s socket: %d",
+	SocketAddr::lookupFamily(family),s->error());
+    delete s;
+    return 0;
+}
+
+// Send (retransmit) a query to the next server
+static void sendQuery(ResolverQuery* q, u_int64_t now)
+{
+    unsigned int n = s_servers.count();
+    SocketAddr* srv = n ? static_cast<SocketAddr*>(s_servers[q->m_server % n]) : 0;
+    q->m_server++;
+    q->m_tries++;
+    q->m_timeout = now + (u_int64_t)s_timeout * 1000;
+    q->closeTcp();
+    if (!srv)
+	return;
+    if (q->m_addr.family() != srv->family())
+	q->closeUdp();
+    q->m_addr = *srv;
+    if (!q->m_sock)
+	q->m_sock = createUdp(q->m_addr.family());
+    if (!q->m_sock)
+	return;
+    s_statSent++;
+    if (q->m_sock->sendTo(q->m_packet.data(),q->m_packet.length(),*srv) < 0 && !q->m_sock->canRetry())
+	Debug(DebugNote,"Resolver failed to send %s query for '%s' to %s: %d",
+	    lookup(q->m_type,Resolver::s_types),q->m_dname.c_str(),srv->addr().c_str(),q->m_sock->error());
+}
+
+// Repeat a query over TCP to the server that sent a truncated answer
+static bool startTcp(ResolverQuery* q, u_int64_t now)
+{
+    q->closeTcp();
+    q->m_tcp = new Socket(q->m_addr.family(),SOCK_STREAM,IPPROTO_TCP);
+    if (!(q->m_tcp->valid() && q->m_tcp->setBlocking(false)
+	&& (q->m_tcp->connect(q->m_addr) || q->m_tcp->inProgress()))) {
+	Debug(DebugNote,"Resolver failed to connect to %s for %s query '%s': %d",
+	    q->m_addr.addr().c_str(),lookup(q->m_type,Resolver::s_types),
+	    q->m_dname.c_str(),q->m_tcp->error());
+	q->closeTcp();
+	return false;
+    }
+    // TCP messages are preceded by their length
+    unsigned char len[2];
+    putU16(len,q->m_packet.length());
+    q->m_tcpData.assign(len,2);
+    q->m_tcpData += q->m_packet;
+    q->m_timeout = now + (u_int64_t)s_timeout * 1000;
+    s_statTcp++;
+    return true;
+}
+
+// Add an answer to cache
+static void addCache(const String& key, int code, const DataBlock& data, u_int64_t now,
+    unsigned int ttl)
+{
+    if (!(s_cacheSize && ttl))
+	return;
+    GenObject* old = s_cache[key];
+    if (old)
+	s_cache.remove(old,true,true);
+    if (s_cache.count() >= s_cacheSize) {
+	// Remove expired answers, then arbitrary ones until we have room
+	for (unsigned int i = 0; i < s_cache.length(); i++) {
+	    ObjList* l = s_cache.getList(i);
+	    for (ObjList* o = l ? l->skipNull() : 0; o; ) {
+		if (static_cast<ResolverAnswer*>(o->get())->m_expires <= now) {
+		    o->remove();
+		    o = o->skipNull();
+		}
+		else
+		    o = o->skipNext();
+	    }
+	}
+	for (unsigned int i = 0; s_cache.count() >= s_cacheSize && i < s_cache.length(); i++) {
+	    ObjList* l = s_cache.getList(i);
+	    if (l)
+		l->clear();
+	}
+    }
+    s_cache.append(new ResolverAnswer(key,code,data,now,ttl));
+}
+
+// Find a pending query by id
+static ResolverQuery* findQuery(unsigned int id)
+{
+    for (ObjList* o = s_pending.skipNull(); o; o = o->skipNext()) {
+	ResolverQuery* q = static_cast<ResolverQuery*>(o->get());
+	if (q->m_id == id)
+	    return q;
+    }
+    return 0;
+}
+
+// Move a query from pending to delivering list
+static void finishQuery(ResolverQuery* q, int code)
+{
+    q->m_code = code;
+    if (code)
+	s_statFailed++;
+    q->closeUdp();
+    q->closeTcp();
+    s_pending.remove(q,false);
+    s_delivering.append(q);
+}
+
+// Try the next attempt of a query or fail it
+static void retryQuery(ResolverQuery* q, u_int64_t now, int code)
+{
+    if (q->m_tries < maxTries())
+	sendQuery(q,now);
+    else
+	finishQuery(q,code);
+}
+
+// Handle a response received for a query
+static void processAnswer(ResolverQuery* q, const unsigned char* buf, int len,
+    const SocketAddr& from, bool tcp)
+{
+    // Answers must come from the server we asked, on its port, with our id
+    if (len < 12 || !(buf[2] & 0x80) || getU16(buf) != q->m_id || !(from == q->m_addr)) {
+	s_statForged++;
+	DDebug(DebugMild,"Resolver ignoring unexpected answer for '%s' from %s",
+	    q->m_dname.c_str(),from.addr().c_str());
+	return;
+    }
+    String name;
+    int pos = (getU16(buf + 4) == 1) ? readName(buf,len,12,&name) : -1;
+    if (pos < 0 || pos + 4 > len || (int)getU16(buf + pos) != dnsType(q->m_type)
+	|| !(name &= q->m_dname)) {
+	s_statForged++;
+	DDebug(DebugMild,"Resolver got mismatched answer id=%u from %s",q->m_id,from.addr().c_str());
+	return;
+    }
+    u_int64_t now = Time::now();
+    if (buf[2] & 0x02) {
+	// Truncated answers are incomplete and never cached, ask again over TCP
+	DDebug(DebugInfo,"Resolver got truncated %s answer for '%s' from %s over %s",
+	    lookup(q->m_type,Resolver::s_types),q->m_dname.c_str(),from.addr().c_str(),
+	    tcp ? "TCP" : "UDP");
+	if (tcp || !startTcp(q,now))
+	    retryQuery(q,now,RESOLVER_ERR_NORECOVERY);
+	return;
+    }
+    int rcode = -1;
+    unsigned int count = 0, ttl = 0, negTtl = 0;
+    bool ok = parseAnswer(q->m_type,buf,len,0,0,rcode,count,ttl,negTtl);
+    if (ok && (rcode == 0 || rcode == 3)) {
+	if (count) {
+	    if (ttl < s_minTtl)
+		ttl = s_minTtl;
+	    if (ttl > s_maxTtl)
+		ttl = s_maxTtl;
+	    q->m_answer.assign((void*)buf,len);
+	    addCache(*q,0,q->m_answer,now,ttl);
+	    finishQuery(q,0);
+	}
+	else {
+	    int code = rcode ? RESOLVER_ERR_NXDOMAIN : RESOLVER_ERR_NODATA;
+	    if (!negTtl)
+		negTtl = s_negTtl;
+	    if (negTtl > s_maxTtl)
+		negTtl = s_maxTtl;
+	    addCache(*q,code,DataBlock::empty(),now,negTtl);
+	    finishQuery(q,code);
+	}
+	return;
+    }
+    DDebug(DebugInfo,"Resolver %s query for '%s' got rcode=%d from %s",
+	lookup(q->m_type,Resolver::s_types),q->m_dname.c_str(),rcode,from.addr().c_str());
+    // Server failure, refused or bad response: try the next server
+    retryQuery(q,now,(rcode == 2) ? RESOLVER_ERR_TRYAGAIN : RESOLVER_ERR_NORECOVERY);
+}
+
+// Read all datagrams received on the UDP socket of a query
+static void readUdp(ResolverQuery* q, unsigned char* buf, int len)
+{
+    Socket* sock = q->m_sock;
+    while (sock && sock == q->m_sock && !q->m_tcp) {
+	SocketAddr from;
+	int r = sock->recvFrom(buf,len,from);
+	if (r <= 0)
+	    break;
+	processAnswer(q,buf,r,from,false);
+    }
+}
+
+// Send the request or read the response on the TCP connection of a query
+static void processTcp(ResolverQuery* q)
+{
+    Socket* sock = q->m_tcp;
+    const char* error = "connection closed";
+    if (!q->m_tcpRecv) {
+	int r = sock->send(q->m_tcpData.data(q->m_tcpOffs),q->m_tcpData.length() - q->m_tcpOffs);
+	if (r < 0) {
+	    if (sock->canRetry())
+		return;
+	    error = "send failed";
+	}
+	else {
+	    q->m_tcpOffs += r;
+	    if (q->m_tcpOffs < q->m_tcpData.length())
+		return;
+	    // Request sent, read the response length first
+	    q->m_tcpRecv = true;
+	    q->m_tcpOffs = 0;
+	    q->m_tcpData.assign(0,2);
+	}
+    }
+    while (q->m_tcpRecv) {
+	int r = sock->recv(q->m_tcpData.data(q->m_tcpOffs),q->m_tcpData.length() - q->m_tcpOffs);
+	if (r < 0 && sock->canRetry())
+	    return;
+	if (r <= 0) {
+	    if (r < 0)
+		error = "receive failed";
+	    break;
+	}
+	q->m_tcpOffs += r;
+	if (q->m_tcpOffs < q->m_tcpData.length())
+	    continue;
+	if (!q->m_tcpLen) {
+	    q->m_tcpLen = getU16(q->m_tcpData.data(0,2));
+	    if (q->m_tcpLen < 12) {
+		error = "invalid length";
+		break;
+	    }
+	    q->m_tcpOffs = 0;
+	    q->m_tcpData.assign(0,q->m_tcpLen);
+	    continue;
+	}
+	DataBlock data(q->m_tcpData);
+	q->closeTcp();
+	processAnswer(q,data.data(0,data.length()),data.length(),q->m_addr,true);
+	return;
+    }
+    Debug(DebugNote,"Resolver TCP %s query for '%s' to %s failed: %s",
+	lookup(q->m_type,Resolver::s_types),q->m_dname.c_str(),q->m_addr.addr().c_str(),error);
+    q->closeTcp();
+    retryQuery(q,Time::now(),RESOLVER_ERR_NORECOVERY);
+}
+
+// Notify clients of finished queries
+static void deliverAnswers()
+{
+    Lock lck(s_asyncMutex);
+    while (true) {
+	ObjList* o = s_delivering.skipNull();
+	if (!o)
+	    break;
+	ResolverQuery* q = static_cast<ResolverQuery*>(o->get());
+	ObjList* w = q->m_waiters.skipNull();
+	if (!w) {
+	    o->remove();
+	    continue;
+	}
+	ResolverWaiter* waiter = static_cast<ResolverWaiter*>(w->remove(false));
+	ResolverClient* client = waiter->m_client;
+	void* userData = waiter->m_userData;
+	TelEngine::destruct(waiter);
+	if (!client)
+	    continue;
+	int type = q->m_type;
+	String dname = q->m_dname;
+	int code = q->m_code;
+	DataBlock data = q->m_answer;
+	s_callback = client;
+	lck.drop();
+	notifyClient(client,type,dname,code,data,0,userData);
+	lck.acquire(s_asyncMutex);
+	s_callback = 0;
+    }
+}
+
+ResolverWait::ResolverWait()
+    : m_count(0), m_size(0),
+#ifdef HAVE_POLL
+      m_fds(0)
+#else
+      m_handles(0), m_max(0), m_forced(false)
+#endif
+{
+    clear();
+}
+
+ResolverWait::~ResolverWait()
+{
+#ifdef HAVE_POLL
+    ::free(m_fds);
+#else
+    ::free(m_handles);
+#endif
+}
+
+void ResolverWait::clear()
+{
+    m_count = 0;
+#ifndef HAVE_POLL
+    FD_ZERO(&m_read);
+    FD_ZERO(&m_write);
+    m_max = 0;
+    m_forced = false;
+#endif
+}
+
+// Add a socket to wait for reading (and writing), return its index
+int ResolverWait::add(Socket* sock, bool write)
+{
+    if (m_count >= m_size) {
+	unsigned int size = m_size ? 2 * m_size : 16;
+#ifdef HAVE_POLL
+	void* tmp = ::realloc(m_fds,size * sizeof(struct pollfd));
+	if (!tmp)
+	    return -1;
+	m_fds = (struct pollfd*)tmp;
+#else
+	void* tmp = ::realloc(m_handles,size * sizeof(SOCKET));
+	if (!tmp)
+	    return -1;
+	m_handles = (SOCKET*)tmp;
+#endif
+	m_size = size;
+    }
+    SOCKET h = sock->handle();
+#ifdef HAVE_POLL
+    m_fds[m_count].fd = h;
+    m_fds[m_count].events = write ? (POLLIN | POLLOUT) : POLLIN;
+    m_fds[m_count].revents = 0;
+#else
+#ifdef _WINDOWS
+    bool fits = m_count < FD_SETSIZE;
+#else
+    bool fits = h < (SOCKET)FD_SETSIZE;
+#endif
+    if (fits) {
+	FD_SET(h,&m_read);
+	if (write)
+	    FD_SET(h,&m_write);
+	if (h > m_max)
+	    m_max = h;
+	m_handles[m_count] = h;
+    }
+    else {
+	// Will be checked without waiting
+	m_handles[m_count] = Socket::invalidHandle();
+	m_forced = true;
+    }
+#endif
+    return m_count++;
+}
+
+// Wait for any of the sockets to become ready
+void ResolverWait::wait(int64_t usec)
+{
+    if (usec < 0)
+	usec = 0;
+#ifdef HAVE_POLL
+    if (::poll(m_fds,m_count,(int)((usec + 999) / 1000)) < 0)
+	for (unsigned int i = 0; i < m_count; i++)
+	    m_fds[i].revents = 0;
+#else
+    if (m_forced && usec > (int64_t)Thread::idleUsec())
+	usec = Thread::idleUsec();
+    if (!m_count) {
+	Thread::usleep(usec);
+	return;
+    }
+    struct timeval tv;
+    Time::toTimeval(&tv,usec);
+    if (::select(m_max + 1,&m_read,&m_write,0,&tv) < 0) {
+	FD_ZERO(&m_read);
+	FD_ZERO(&m_write);
+    }
+#endif
+}
+
+// Check if a socket added to the set is ready after waiting
+bool ResolverWait::ready(int index) const
+{
+    if (index < 0 || (unsigned int)index >= m_count)
+	return false;
+#ifdef HAVE_POLL
+    return 0 != m_fds[index].revents;
+#else
+    SOCKET h = m_handles[index];
+    return (h == Socket::invalidHandle()) || FD_ISSET(h,&m_read) || FD_ISSET(h,&m_write);
+#endif
+}
+
+
+// Wake the resolver thread so it waits on sockets of new queries
+static void wakeThread()
+{
+    if (s_wakeSend && Thread::current() != s_thread)
+	s_wakeSend->send("",1);
+}
+
+void ResolverThread::run()
+{
+    unsigned char buf[RESOLVER_UDP_SIZE];
+    ResolverWait waitSet;
+    while (!Thread::check(false)) {
+	Lock lck(s_asyncMutex);
+	u_int64_t now = Time::now();
+	u_int64_t next = now + RESOLVER_IDLE;
+	for (ObjList* o = s_pending.skipNull(); o; ) {
+	    ResolverQuery* q = static_cast<ResolverQuery*>(o->get());
+	    if (q->m_timeout > now) {
+		if (q->m_timeout < next)
+		    next = q->m_timeout;
+		o = o->skipNext();
+		continue;
+	    }
+	    if (q->m_tries < maxTries()) {
+		sendQuery(q,now);
+		if (q->m_timeout < next)
+		    next = q->m_timeout;
+		o = o->skipNext();
+		continue;
+	    }
+	    Debug(DebugNote,"Resolver %s query for '%s' timed out",
+		lookup(q->m_type,Resolver::s_types),q->m_dname.c_str());
+	    s_statTimeouts++;
+	    finishQuery(q,RESOLVER_ERR_TRYAGAIN);
+	    o = o->skipNull();
+	}
+	// Wait on the socket of each query, new ones will wake us up
+	waitSet.clear();
+	int wake = s_wakeRecv ? waitSet.add(s_wakeRecv,false) : -1;
+	for (ObjList* o = s_pending.skipNull(); o; o = o->skipNext()) {
+	    ResolverQuery* q = static_cast<ResolverQuery*>(o->get());
+	    if (q->m_tcp)
+		q->m_wait = waitSet.add(q->m_tcp,!q->m_tcpRecv);
+	    else if (q->m_sock)
+		q->m_wait = waitSet.add(q->m_sock,false);
+	    else
+		q->m_wait = -1;
+	}
+	int64_t wait = next - now;
+	if (!s_wakeRecv && wait > (int64_t)Thread::idleUsec())
+	    wait = Thread::idleUsec();
+	lck.drop();
+	deliverAnswers();
+	waitSet.wait(wait);
+	lck.acquire(s_asyncMutex);
+	if (waitSet.ready(wake)) {
+	    char tmp[16];
+	    while (s_wakeRecv->recv(tmp,sizeof(tmp)) > 0)
+		;
+	}
+	// Queries added while waiting were not in the set, don't use their index
+	for (ObjList* o = s_pending.skipNull(); o; ) {
+	    ResolverQuery* q = static_cast<ResolverQuery*>(o->get());
+	    int idx = q->m_wait;
+	    q->m_wait = -1;
+	    if (waitSet.ready(idx)) {
+		if (q->m_tcp)
+		    processTcp(q);
+		else
+		    readUdp(q,buf,sizeof(buf));
+	    }
+	    // The query may have finished and left the list
+	    if (o->get() == q)
+		o = o->skipNext();
+	    else
+		o = o->skipNull();
+	}
+    }
+}
+
+void ResolverThread::cleanup()
+{
+    Lock lck(s_asyncMutex);
+    if (s_thread == this)
+	s_thread = 0;
+}
+
+void ResolverSync::resolved(Resolver::Type type, const String& dname, int code,
+    ObjList& result, void* userData)
+{
+    m_code = code;
+    for (ObjList* o = result.skipNull(); o; o = o->skipNull())
+	m_result.append(o->remove(false));
+    m_done = true;
+    m_sem.unlock();
+}
+
+// Configure the asynchronous resolver engine
+void Resolver::setup(const NamedList& params)
+{
+    Lock lck(s_asyncMutex);
+    s_asyncSetup = true;
+    s_timeout = params.getIntValue(YSTRING("timeout"),2000,100,30000);
+    s_retries = params.getIntValue(YSTRING("retries"),2,0,10);
+    s_cacheSize = params.getIntValue(YSTRING("cache_size"),4096,0);
+    s_maxTtl = params.getIntValue(YSTRING("max_ttl"),86400,1);
+    s_minTtl = params.getIntValue(YSTRING("min_ttl"),0,0,s_maxTtl);
+    s_negTtl = params.getIntValue(YSTRING("negative_ttl"),60,0);
+    if (!s_cacheSize)
+	s_cache.clear();
+    s_servers.clear();
+    ObjList* list = params[YSTRING("servers")].split(',',false);
+    for (ObjList* o = list->skipNull(); o; o = o->skipNext()) {
+	String* str = static_cast<String*>(o->get());
+	str->trimBlanks();
+	String host;
+	int port = RESOLVER_PORT;
+	SocketAddr::split(*str,host,port);
+	SocketAddr* addr = new SocketAddr;
+	if (host && addr->host(host) && port > 0 && port < 65536) {
+	    addr->port(port);
+	    s_servers.append(addr);
+	}
+	else {
+	    Debug(DebugConf,"Resolver ignoring invalid name server '%s'",str->c_str());
+	    TelEngine::destruct(addr);
+	}
+    }
+    TelEngine::destruct(list);
+    if (!s_servers.skipNull())
+	loadSystemServers();
+    Debug(DebugAll,"Resolver configured servers=%u timeout=%u retries=%u cache_size=%u",
+	s_servers.count(),s_timeout,s_retries,s_cacheSize);
+}
+
+// Check if the asynchronous resolver engine can be used
+bool Resolver::asyncAvailable()
+{
+    Lock lck(s_asyncMutex);
+    checkSetup();
+    return 0 != s_servers.skipNull();
+}
+
+// Start an asynchronous query
+bool Resolver::asyncQuery(Type type, const char* dname, ResolverClient* client, void* userData)
+{
+    if (!(client && dnsType(type)) || TelEngine::null(dname))
+	return false;
+    String name(dname);
+    if (name.endsWith("."))
+	name = name.substr(0,name.length() - 1);
+    String key;
+    key << type << ":" << name;
+    key.toLower();
+    Lock lck(s_asyncMutex);
+    checkSetup();
+    s_statQueries++;
+    u_int64_t now = Time::now();
+    ResolverAnswer* ans = s_cacheSize ? static_cast<ResolverAnswer*>(s_cache[key]) : 0;
+    if (ans) {
+	if (ans->m_expires > now) {
+	    int code = ans->m_code;
+	    if (code)
+		s_statNegHits++;
+	    else
+		s_statHits++;
+	    DataBlock data = ans->m_data;
+	    unsigned int age = (unsigned int)((now - ans->m_time) / 1000000);
+	    lck.drop();
+	    notifyClient(client,type,name,code,data,age,userData);
+	    return true;
+	}
+	s_cache.remove(ans,true,true);
+    }
+    ResolverQuery* q = static_cast<ResolverQuery*>(s_pending[key]);
+    if (q) {
+	s_statCoalesced++;
+	q->m_waiters.append(new ResolverWaiter(client,userData));
+	return true;
+    }
+    if (!s_servers.skipNull())
+	return false;
+    if (!s_thread) {
+	if (!s_wakeRecv) {
+	    s_wakeRecv = new Socket;
+	    s_wakeSend = new Socket;
+	    if (!(Socket::createPair(*s_wakeRecv,*s_wakeSend)
+		&& s_wakeRecv->setBlocking(false) && s_wakeSend->setBlocking(false))) {
+		// The thread will poll for new queries
+		delete s_wakeRecv;
+		s_wakeRecv = 0;
+		delete s_wakeSend;
+		s_wakeSend = 0;
+	    }
+	}
+	s_thread = new ResolverThread;
+	if (!s_thread->startup()) {
+	    Debug(DebugWarn,"Resolver failed to start thread");
+	    delete s_thread;
+	    s_thread = 0;
+	    return false;
+	}
+    }
+    q = new ResolverQuery(key,type,name);
+    // Use an id not in use by other pending queries
+    do {
+	q->m_id = (u_int16_t)((Random::random() ^ ++s_queryId) & 0xffff);
+    } while (s_pending.count() < 65535 && findQuery(q->m_id));
+    if (!buildQuery(type,name,q->m_id,q->m_packet)) {
+	Debug(DebugNote,"Resolver can't build %s query for invalid name '%s'",
+	    lookup(type,s_types),name.c_str());
+	TelEngine::destruct(q);
+	return false;
+    }
+    q->m_waiters.append(new ResolverWaiter(client,userData));
+    s_pending.append(q);
+    sendQuery(q,now);
+    wakeThread();
+    return true;
+}
+
+// Cancel all pending notifications of a client
+unsigned int Resolver::cancelQuery(ResolverClient* client)
+{
+    if (!client)
+	return 0;
+    unsigned int n = 0;
+    Lock lck(s_asyncMutex);
+    for (int i = 0; i < 2; i++) {
+	ObjList& list = i ? s_delivering : s_pending;
+	for (ObjList* o = list.skipNull(); o; o = o->skipNext()) {
+	    ResolverQuery* q = static_cast<ResolverQuery*>(o->get());
+	    for (ObjList* w = q->m_waiters.skipNull(); w; w = w->skipNext()) {
+		ResolverWaiter* waiter = static_cast<ResolverWaiter*>(w->get());
+		if (waiter->m_client == client) {
+		    waiter->m_client = 0;
+		    n++;
+		}
+	    }
+	}
+    }
+    // Wait for a notification in progress to end
+    while (s_callback == client && s_thread && Thread::current() != s_thread) {
+	lck.drop();
+	Thread::idle();
+	lck.acquire(s_asyncMutex);
+    }
+    return n;
+}
+
+// Make a blocking query using the asynchronous engine and its cache
+int Resolver::resolve(Type type, const char* dname, ObjList& result, String* error)
+{
+    if (!asyncAvailable())
+	return query(type,dname,result,error);
+    ResolverSync sync;
+    if (!asyncQuery(type,dname,&sync))
+	return query(type,dname,result,error);
+    if (!sync.m_done) {
+	s_asyncMutex.lock();
+	long wait = (long)s_timeout * 1000 * maxTries() + 1000000;
+	s_asyncMutex.unlock();
+	sync.m_sem.lock(wait);
+	cancelQuery(&sync);
+    }
+    int code = sync.m_done ? sync.m_code : RESOLVER_ERR_TRYAGAIN;
+    for (ObjList* o = sync.m_result.skipNull(); o; o = o->skipNull())
+	result.append(o->remove(false));
+    asyncError(code,error);
+    return printResult(type,code,dname,result,error);
+}
+
+// Remove all answers from cache
+void Resolver::flushCache()
+{
+    Lock lck(s_asyncMutex);
+    s_cache.clear();
+}
+
+// Retrieve asynchronous resolver statistics
+void Resolver::getStats(NamedList& params)
+{
+    Lock lck(s_asyncMutex);
+    params.setParam("servers",String(s_servers.count()));
+    params.setParam("pending",String(s_pending.count()));
+    params.setParam("cached",String(s_cache.count()));
+    params.setParam("queries",String(s_statQueries));
+    params.setParam("cachehits",String(s_statHits));
+    params.setParam("negativehits",String(s_statNegHits));
+    params.setParam("coalesced",String(s_statCoalesced));
+    params.setParam("sent",String(s_statSent));
+    params.setParam("tcp",String(s_statTcp));
+    params.setParam("forged",String(s_statForged));
+    params.setParam("timeouts",String(s_statTimeouts));
+    params.setParam("failed",String(s_statFailed));
+}
+
+// Stop the asynchronous resolver engine
+void Resolver::cleanup()
+{
+    Lock lck(s_asyncMutex);
+    if (s_thread) {
+	s_thread->cancel();
+	for (unsigned int n = 100; s_thread && n; n--) {
+	    lck.drop();
+	    Thread::idle();
+	    lck.acquire(s_asyncMutex);
+	}
+	if (s_thread)
+	    Debug(DebugWarn,"Resolver thread did not terminate");
+    }
+    // Fail all pending queries
+    while (ObjList* o = s_pending.skipNull())
+	finishQuery(static_cast<ResolverQuery*>(o->get()),RESOLVER_ERR_TRYAGAIN);
+    lck.drop();
+    deliverAnswers();
+    lck.acquire(s_asyncMutex);
+    s_cache.clear();
+    if (!s_thread) {
+	delete s_wakeRecv;
+	s_wakeRecv = 0;
+	delete s_wakeSend;
+	s_wakeSend = 0;
+    }
+}
+
 /* vi: set ts=8 sw=4 sts=4 noet: */
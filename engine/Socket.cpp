@@ -73,6 +73,9 @@
 #define MAX_SOCKLEN 1024
 #define MAX_RESWAIT 5000000
 
+// Maximum number of datagrams transferred by one batch system call
+#define MAX_BATCH 64
+
 using namespace TelEngine;
 
 static Mutex s_mutex(false,"SocketAddr");
@@ -1640,6 +1643,9 @@ unsigned int Socket::s_features = 0
 #ifdef SO_EXCLUSIVEADDRUSE
     | FExclusiveAddrUse
 #endif
+#ifdef HAVE_MMSG
+    | FBatchIO
+#endif
 ;
 
 Socket::Socket()
@@ -2078,6 +2084,111 @@ int Socket::readData(void* buffer, int length)
 #endif
 }
 
+int Socket::recvBatch(SocketDatagram* dgrams, unsigned int count, int flags)
+{
+    if (!(dgrams && count))
+	return 0;
+#ifdef HAVE_MMSG
+    if (count > MAX_BATCH)
+	count = MAX_BATCH;
+    struct mmsghdr msgs[MAX_BATCH];
+    struct iovec iovs[MAX_BATCH];
+    ::memset(msgs,0,count * sizeof(struct mmsghdr));
+    for (unsigned int i = 0; i < count; i++) {
+	iovs[i].iov_base = dgrams[i].buffer;
+	iovs[i].iov_len = dgrams[i].buffer ? dgrams[i].length : 0;
+	msgs[i].msg_hdr.msg_iov = &iovs[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+	if (dgrams[i].addr) {
+	    msgs[i].msg_hdr.msg_name = dgrams[i].addr;
+	    msgs[i].msg_hdr.msg_namelen = dgrams[i].addrLen;
+	}
+    }
+    int res = ::recvmmsg(m_handle,msgs,count,flags | MSG_WAITFORONE,0);
+    if (!checkError(res,true))
+	return res;
+    for (int i = 0; i < res; i++) {
+	dgrams[i].result = msgs[i].msg_len;
+	if (dgrams[i].addr)
+	    dgrams[i].addrLen = msgs[i].msg_hdr.msg_namelen;
+    }
+#else
+    // Receive only one datagram, we don't know if next call would block
+    SocketDatagram& d = dgrams[0];
+    if (!d.addr)
+	d.addrLen = 0;
+    int res = ::recvfrom(m_handle,(char*)d.buffer,d.buffer ? d.length : 0,flags,
+	d.addr,(d.addr ? &d.addrLen : 0));
+    if (!checkError(res,true))
+	return res;
+    d.result = res;
+    res = 1;
+#endif
+    if (m_filters.skipNull()) {
+	// Keep datagrams not claimed by filters at start, preserving their order
+	int n = 0;
+	for (int i = 0; i < res; i++) {
+	    SocketDatagram& d = dgrams[i];
+	    if (applyFilters(d.buffer,d.result,flags,d.addr,(d.addr ? d.addrLen : 0)))
+		continue;
+	    if (i != n) {
+		SocketDatagram tmp = dgrams[n];
+		dgrams[n] = d;
+		d = tmp;
+	    }
+	    n++;
+	}
+	if (!n) {
+	    m_error = EAGAIN;
+	    return socketError();
+	}
+	res = n;
+    }
+    return res;
+}
+
+int Socket::sendBatch(SocketDatagram* dgrams, unsigned int count, int flags)
+{
+    if (!(dgrams && count))
+	return 0;
+#ifdef HAVE_MMSG
+    if (count > MAX_BATCH)
+	count = MAX_BATCH;
+    struct mmsghdr msgs[MAX_BATCH];
+    struct iovec iovs[MAX_BATCH];
+    ::memset(msgs,0,count * sizeof(struct mmsghdr));
+    for (unsigned int i = 0; i < count; i++) {
+	iovs[i].iov_base = dgrams[i].buffer;
+	iovs[i].iov_len = dgrams[i].buffer ? dgrams[i].length : 0;
+	msgs[i].msg_hdr.msg_iov = &iovs[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+	if (dgrams[i].addr) {
+	    msgs[i].msg_hdr.msg_name = dgrams[i].addr;
+	    msgs[i].msg_hdr.msg_namelen = dgrams[i].addrLen;
+	}
+    }
+    int res = ::sendmmsg(m_handle,msgs,count,flags);
+    if (!checkError(res,true))
+	return res;
+    for (int i = 0; i < res; i++) {
+	SocketDatagram& d = dgrams[i];
+	d.result = msgs[i].msg_len;
+	applyFilters(d.buffer,d.result,flags,d.addr,(d.addr ? d.addrLen : 0),false);
+    }
+    return res;
+#else
+    int res = 0;
+    for (; res < (int)count; res++) {
+	SocketDatagram& d = dgrams[res];
+	int len = sendTo(d.buffer,d.length,d.addr,d.addrLen,flags);
+	if (len == socketError())
+	    return res ? res : len;
+	d.result = len;
+    }
+    return res;
+#endif
+}
+
 bool Socket::efficientSelect()
 {
 #if defined(_WINDOWS) || defined(HAVE_POLL)
@@ -2289,6 +2400,20 @@ bool Socket::setReuse(bool reuse, bool exclusive)
     return true;
 }
 
+bool Socket::setReusePort(bool reuse)
+{
+#ifdef SO_REUSEPORT
+    int i = reuse ? 1 : 0;
+    return setOption(SOL_SOCKET,SO_REUSEPORT,&i,sizeof(i));
+#else
+    if (reuse) {
+	Debug(DebugMild,"Socket SO_REUSEPORT not supported on this platform");
+	return false;
+    }
+    return true;
+#endif
+}
+
 bool Socket::setLinger(int seconds)
 {
 #ifdef SO_DONTLINGER
@@ -19,42 +19,48 @@
  */
 
 #include <yatertp.h>
+#include <string.h>
+
+// Ring size limits, in packets
+#define RING_MIN 16
+#define RING_MAX 512
+// Shortest packet duration the ring is sized for, in microseconds
+#define PACKET_MIN 5000
+// Timestamp difference after which the playout reference is moved
+#define REBASE_STAMP 0x10000000
+// Initial payload space of each slot, grown for the first larger packet
+#define SLOT_DATA 256
 
 using namespace TelEngine;
 
-namespace { // anonymous
+namespace TelEngine {
 
-class RTPDelayedData : public DataBlock
+// One packet waiting in the dejitter ring, its data is in the ring storage
+class RTPDejitterSlot
 {
 public:
-    inline RTPDelayedData(u_int64_t when, bool mark, int payload,
-	unsigned int tstamp, const void* data, int len)
-	: DataBlock(const_cast<void*>(data),len), m_scheduled(when),
-	  m_marker(mark), m_payload(payload), m_timestamp(tstamp)
+    inline RTPDejitterSlot()
+	: length(0), scheduled(0), timestamp(0), payload(0), marker(false), used(false)
 	{ }
-    inline u_int64_t scheduled() const
-	{ return m_scheduled; }
-    inline bool marker() const
-	{ return m_marker; }
-    int payload() const
-	{ return m_payload; }
-    inline unsigned int timestamp() const
-	{ return m_timestamp; }
-private:
-    u_int64_t m_scheduled;
-    bool m_marker;
-    int m_payload;
-    unsigned int m_timestamp;
+    int length;
+    u_int64_t scheduled;
+    unsigned int timestamp;
+    int payload;
+    bool marker;
+    bool used;
 };
 
-}; // anonymous namespace
+}; // namespace TelEngine
 
 
 RTPDejitter::RTPDejitter(RTPReceiver* receiver, unsigned int mindelay, unsigned int maxdelay,
     DebugEnabler* dbg, const char* traceId)
     : RTPProcessor(dbg,traceId),
-      m_receiver(receiver), m_minDelay(mindelay), m_maxDelay(maxdelay),
-      m_headStamp(0), m_tailStamp(0), m_headTime(0), m_sampRate(125000), m_fastRate(10)
+      m_slots(0), m_storage(0), m_slotSize(SLOT_DATA), m_mask(0), m_count(0),
+      m_receiver(receiver), m_minDelay(mindelay), m_maxDelay(maxdelay), m_delay(0),
+      m_started(false), m_headSeq(0), m_nextSeq(0),
+      m_refValid(false), m_refStamp(0), m_refTime(0), m_headTime(0),
+      m_late(0), m_lost(0)
 {
     if (m_maxDelay > 1000000)
 	m_maxDelay = 1000000;
@@ -64,126 +70,216 @@ RTPDejitter::RTPDejitter(RTPReceiver* receiver, unsigned int mindelay, unsigned
 	m_minDelay = 5000;
     if (m_minDelay > m_maxDelay - 30000)
 	m_minDelay = m_maxDelay - 30000;
+    m_delay = m_minDelay;
+    // ring must hold the maximum delay worth of the shortest packets we expect
+    unsigned int size = RING_MIN;
+    while ((size < RING_MAX) && (size * PACKET_MIN < m_maxDelay))
+	size <<= 1;
+    m_slots = new RTPDejitterSlot[size];
+    m_storage = new unsigned char[size * m_slotSize];
+    m_mask = size - 1;
 }
 
 RTPDejitter::~RTPDejitter()
 {
-    DDebug(dbg(),DebugInfo,"Dejitter destroyed with %u packets [%p]",m_packets.count(),this);
+    DDebug(dbg(),DebugInfo,"Dejitter destroyed with %u packets, %u late, %u lost [%p]",
+	m_count,m_late,m_lost,this);
+    delete[] m_slots;
+    delete[] m_storage;
+}
+
+// Make room in each slot for a packet, copying the queued ones
+// Packets only get longer when the codec or packetization changes
+void RTPDejitter::grow(unsigned int len)
+{
+    unsigned int size = m_slotSize;
+    while (size < len)
+	size <<= 1;
+    DDebug(dbg(),DebugInfo,"Dejitter growing slots from %u to %u bytes [%p]",m_slotSize,size,this);
+    unsigned char* storage = new unsigned char[(m_mask + 1) * size];
+    for (unsigned int i = 0; i <= m_mask; i++) {
+	if (m_slots[i].used)
+	    ::memcpy(storage + i * size,m_storage + i * m_slotSize,m_slots[i].length);
+    }
+    delete[] m_storage;
+    m_storage = storage;
+    m_slotSize = size;
+}
+
+// Drop queued packets and restart sequencing
+void RTPDejitter::reset()
+{
+    // slot being delivered is no longer marked used so it's left alone
+    for (unsigned int i = 0; m_count && (i <= m_mask); i++) {
+	if (!m_slots[i].used)
+	    continue;
+	m_slots[i].used = false;
+	m_count--;
+    }
+    m_count = 0;
+    m_started = false;
 }
 
 void RTPDejitter::clear()
 {
-    m_packets.clear();
-    m_headStamp = m_tailStamp = 0;
+    reset();
+    m_refValid = false;
+}
+
+// Account packets that will never be delivered
+void RTPDejitter::lose(unsigned int count)
+{
+    m_lost += count;
+    if (m_receiver) {
+	m_receiver->m_ioLostPkt += count;
+	m_receiver->m_quality.lost(count);
+    }
 }
 
 bool RTPDejitter::rtpRecv(bool marker, int payload, unsigned int timestamp, const void* data, int len)
 {
-    u_int64_t when = 0;
-    bool insert = false;
-
-    if (m_headStamp) {
-	// at least one packet got out of the queue
-	int dTs = timestamp - m_headStamp;
-	if (dTs == 0)
-	    return true;
-	else if (dTs < 0) {
-	    DDebug(dbg(),DebugNote,"Dejitter dropping TS %u, last delivered was %u [%p]",
-		timestamp,m_headStamp,this);
-	    return false;
-	}
-	u_int64_t now = Time::now();
-	int64_t rate = 1000 * (now - m_headTime) / dTs;
-	if (rate > 0) {
-	    if (m_sampRate) {
-		if (m_fastRate) {
-		    m_fastRate--;
-		    rate = (7 * m_sampRate + rate) >> 3;
-		}
-		else
-		    rate = (31 * m_sampRate + rate) >> 5;
-	    }
-	    if (rate > 150000)
-		rate = 150000; // 6.67 kHz
-	    else if (rate < 20000)
-		rate = 20000; // 50 kHz
-	    m_sampRate = rate;
-	    XDebug(dbg(),DebugAll,"Time per sample " FMT64, rate);
-	}
-	else
-	    rate = m_sampRate;
-	if (rate > 0)
-	    when = m_headTime + (dTs * rate / 1000) + m_minDelay;
-	else
-	    when = now + m_minDelay;
-	if (m_tailStamp) {
-	    if (timestamp == m_tailStamp)
-		return true;
-	    if (((int)(timestamp - m_tailStamp)) < 0)
-		insert = true;
-	    else if (when > now + m_maxDelay) {
-		DDebug(dbg(),DebugNote,"Packet with TS %u falls after max buffer [%p]",timestamp,this);
-		return false;
-	    }
-	}
+    return rtpRecv(m_nextSeq,marker,payload,timestamp,data,len);
+}
+
+bool RTPDejitter::rtpRecv(u_int16_t seq, bool marker, int payload, unsigned int timestamp,
+    const void* data, int len)
+{
+    m_nextSeq = seq + 1;
+    int64_t now = Time::now();
+    unsigned int rate = m_receiver ? m_receiver->clockRate() : 8000;
+    int dTs = timestamp - m_refStamp;
+    if (!m_refValid) {
+	m_refValid = true;
+	m_refStamp = timestamp;
+	m_refTime = now;
+	dTs = 0;
     }
-    else {
-	if (m_tailStamp && ((int)(timestamp - m_tailStamp)) < 0) {
-	    // until we get some statistics don't attempt to reorder packets
-	    DDebug(dbg(),DebugNote,"Dejitter got TS %u while last queued was %u [%p]",timestamp,m_tailStamp,this);
-	    return false;
-	}
-	// we got no packets out yet so use a fixed interval
-	when = Time::now() + m_minDelay;
+    else if ((dTs > REBASE_STAMP) || (dTs < -REBASE_STAMP)) {
+	// keep timestamp differences small
+	m_refTime += (int64_t)dTs * 1000000 / rate;
+	m_refStamp = timestamp;
+	dTs = 0;
     }
+    int64_t offs = (int64_t)dTs * 1000000 / rate;
+    // track the fastest transit, follow slowly any clock drift
+    int64_t base = now - offs;
+    if (base < m_refTime)
+	m_refTime = base;
+    else
+	m_refTime += (base - m_refTime) >> 8;
 
-    if (insert) {
-	for (ObjList* l = m_packets.skipNull(); l; l = l->skipNext()) {
-	    RTPDelayedData* pkt = static_cast<RTPDelayedData*>(l->get());
-	    if (pkt->timestamp() == timestamp)
-		return true;
-	    if (pkt->timestamp() > timestamp && pkt->scheduled() > when) {
-		l->insert(new RTPDelayedData(when,marker,payload,timestamp,data,len));
-		return true;
-	    }
-	}
+    // playout delay grows at once, shrinks slowly or at start of talkspurt
+    unsigned int target = m_receiver ? 3 * m_receiver->jitterUsec() : 0;
+    if (target < m_minDelay)
+	target = m_minDelay;
+    else if (target > m_maxDelay)
+	target = m_maxDelay;
+    if (marker || (target > m_delay))
+	m_delay = target;
+    else
+	m_delay -= (m_delay - target) >> 6;
+
+    int64_t when = m_refTime + offs + m_delay;
+    if (when > now + m_maxDelay) {
+	// timestamps jumped ahead of time, start over from this packet
+	DDebug(dbg(),DebugNote,"Dejitter TS %u falls after max buffer, resyncing [%p]",timestamp,this);
+	m_refStamp = timestamp;
+	m_refTime = now;
+	when = now + m_delay;
     }
-    m_tailStamp = timestamp;
-    m_packets.append(new RTPDelayedData(when,marker,payload,timestamp,data,len));
+
+    if (!m_started) {
+	m_started = true;
+	m_headSeq = seq;
+    }
+    int off = (int16_t)(seq - m_headSeq);
+    if (off < 0) {
+	m_late++;
+	if (m_receiver)
+	    m_receiver->m_quality.discarded();
+	DDebug(dbg(),DebugNote,"Dejitter got late SEQ %u, next to deliver is %u [%p]",
+	    seq,m_headSeq,this);
+	return false;
+    }
+    if ((unsigned int)off > m_mask) {
+	TraceDebug(m_traceId,dbg(),DebugNote,"Dejitter SEQ jumped from %u to %u, dropping %u packets [%p]",
+	    m_headSeq,seq,m_count,this);
+	lose(m_count);
+	reset();
+	m_started = true;
+	m_headSeq = seq;
+    }
+    if (len < 0)
+	len = 0;
+    else if ((unsigned int)len > m_slotSize)
+	grow(len);
+    unsigned int index = seq & m_mask;
+    RTPDejitterSlot& slot = m_slots[index];
+    if (slot.used)
+	return true;
+    // copy in the preallocated slot so no receive buffer is held
+    if (len)
+	::memcpy(m_storage + index * m_slotSize,data,len);
+    slot.length = len;
+    slot.scheduled = when;
+    slot.timestamp = timestamp;
+    slot.payload = payload;
+    slot.marker = marker;
+    slot.used = true;
+    m_count++;
     return true;
 }
 
 void RTPDejitter::timerTick(const Time& when)
 {
-    RTPDelayedData* packet = static_cast<RTPDelayedData*>(m_packets.get());
-    if (!packet) {
-	m_tailStamp = 0;
-	if (m_headStamp && (m_headTime + m_maxDelay < when))
-	    m_headStamp = 0;
+    if (!m_count) {
+	// restart sequencing after a long silence
+	if (m_started && (m_headTime + m_maxDelay < when))
+	    m_started = false;
 	return;
     }
-    if (packet->scheduled() > when)
-	return;
-    m_packets.remove(packet,false);
-    // remember the last delivered
-    m_headStamp = packet->timestamp();
-    m_headTime = packet->scheduled();
-    if (m_receiver)
-	m_receiver->rtpRecv(packet->marker(),packet->payload(),
-	    packet->timestamp(),packet->data(),packet->length());
-    TelEngine::destruct(packet);
-    unsigned int count = 0;
-    while ((packet = static_cast<RTPDelayedData*>(m_packets.get()))) {
-	long int delayed = (long int)(when - packet->scheduled());
-	if (delayed <= 0 || delayed <= (long)m_minDelay)
+    unsigned int dropped = 0;
+    while (m_count) {
+	unsigned int index = m_headSeq & m_mask;
+	RTPDejitterSlot* slot = m_slots + index;
+	if (!slot->used) {
+	    // skip over missing packets only when the next queued one is due
+	    unsigned int gap = 1;
+	    for (; gap <= m_mask; gap++) {
+		index = (m_headSeq + gap) & m_mask;
+		slot = m_slots + index;
+		if (slot->used)
+		    break;
+	    }
+	    if (slot->scheduled > when)
+		break;
+	    lose(gap);
+	    m_headSeq += gap;
+	}
+	else if (slot->scheduled > when)
 	    break;
-	// we are too delayed - probably rtpRecv() took too long to complete...
-	m_packets.remove(packet,true);
-	count++;
+	m_headSeq++;
+	m_count--;
+	slot->used = false;
+	m_headTime = slot->scheduled;
+	if (when.usec() - slot->scheduled > m_maxDelay) {
+	    // we are too delayed - probably rtpRecv() took too long to complete...
+	    // the packet was received so it is discarded, not lost
+	    m_late++;
+	    if (m_receiver)
+		m_receiver->m_quality.lost(1,true);
+	    dropped++;
+	    continue;
+	}
+	if (m_receiver) {
+	    m_receiver->m_quality.received(slot->timestamp);
+	    m_receiver->rtpRecv(slot->marker,slot->payload,
+		slot->timestamp,m_storage + index * m_slotSize,slot->length);
+	}
     }
-    if (count)
-	TraceDebug(m_traceId,dbg(),(count > 1) ? DebugMild : DebugNote,
-	    "Dropped %u delayed packet%s from buffer [%p]",count,((count > 1) ? "s" : ""),this);
+    if (dropped)
+	TraceDebug(m_traceId,dbg(),(dropped > 1) ? DebugMild : DebugNote,
+	    "Dropped %u delayed packet%s from buffer [%p]",dropped,((dropped > 1) ? "s" : ""),this);
 }
 
 /* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,388 @@
+/**
+ * dtls.cpp
+ * Yet Another RTP Stack
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatertp.h>
+
+#include <string.h>
+
+// Longest the handshake thread sleeps when no retransmission is due
+#define DTLS_IDLE_MSEC 100
+
+// Maximum number of received datagrams queued for one endpoint
+#define DTLS_QUEUE 32
+
+// Length of the AES_CM_128 master key and salt
+#define DTLS_KEY_LEN 16
+#define DTLS_SALT_LEN 14
+
+using namespace TelEngine;
+
+namespace TelEngine {
+
+// DTLS endpoint of a session, owned by the session and the handshake thread
+// The media thread only touches the queues, the endpoint is used by the
+//  handshake thread alone so the expensive public key operations never
+//  delay media processing
+class RTPDtlsLink : public RefObject, public Mutex
+{
+public:
+    RTPDtlsLink(RTPDtls* dtls, bool client);
+    ~RTPDtlsLink();
+    inline RTPDtls::State state() const
+	{ return m_state; }
+    inline const String& fingerprint() const
+	{ return m_fingerprint; }
+    inline bool client() const
+	{ return m_client; }
+    void input(const void* data, int len);
+    DataBlock* output();
+    bool keys(String& suite, DataBlock& material);
+    int process();
+private:
+    RTPDtls* m_dtls;
+    ObjList m_in;
+    ObjList m_out;
+    unsigned int m_inCount;
+    RTPDtls::State m_state;
+    String m_fingerprint;
+    String m_suite;
+    DataBlock m_keys;
+    bool m_client;
+    bool m_started;
+};
+
+}; // namespace TelEngine
+
+// Thread running the handshakes of all sessions
+class RTPDtlsThread : public Thread
+{
+public:
+    inline RTPDtlsThread()
+	: Thread("RTP DTLS")
+	{ }
+    ~RTPDtlsThread();
+    virtual void run();
+};
+
+static ObjList s_links;
+static RTPDtlsThread* s_thread = 0;
+static Mutex s_dtlsMutex(true,"RTPDtls");
+static Semaphore s_dtlsWake(1,"RTPDtls");
+
+// Add a link to the handshake thread, start the thread if needed
+static bool addLink(RTPDtlsLink* link)
+{
+    Lock lck(s_dtlsMutex);
+    if (!link->ref())
+	return false;
+    s_links.append(link);
+    if (!s_thread) {
+	s_thread = new RTPDtlsThread;
+	if (!s_thread->startup()) {
+	    Debug(DebugWarn,"Failed to start the RTP DTLS thread");
+	    s_links.remove(link);
+	    delete s_thread;
+	    s_thread = 0;
+	    return false;
+	}
+    }
+    lck.drop();
+    s_dtlsWake.unlock();
+    return true;
+}
+
+
+RTPDtlsThread::~RTPDtlsThread()
+{
+    Lock lck(s_dtlsMutex);
+    if (s_thread == this)
+	s_thread = 0;
+}
+
+void RTPDtlsThread::run()
+{
+    for (;;) {
+	// hold references so links can be processed without the list lock
+	ObjList work;
+	s_dtlsMutex.lock();
+	for (ObjList* l = s_links.skipNull(); l; ) {
+	    RTPDtlsLink* link = static_cast<RTPDtlsLink*>(l->get());
+	    // if the session let go of the link we are its last owner
+	    if (link->refcount() <= 1) {
+		l->remove();
+		l = l->skipNull();
+		continue;
+	    }
+	    if (link->ref())
+		work.append(link);
+	    l = l->skipNext();
+	}
+	s_dtlsMutex.unlock();
+	int wait = DTLS_IDLE_MSEC;
+	for (ObjList* l = work.skipNull(); l; l = l->skipNext()) {
+	    int t = static_cast<RTPDtlsLink*>(l->get())->process();
+	    if ((t >= 0) && (t < wait))
+		wait = t;
+	}
+	work.clear();
+	if (Thread::check(false))
+	    break;
+	s_dtlsWake.lock(1000 * (long)wait);
+    }
+}
+
+
+RTPDtlsLink::RTPDtlsLink(RTPDtls* dtls, bool client)
+    : Mutex(false,"RTPDtlsLink"),
+      m_dtls(dtls), m_inCount(0), m_state(RTPDtls::Idle),
+      m_fingerprint(dtls->fingerprint()),
+      m_client(client), m_started(false)
+{
+}
+
+RTPDtlsLink::~RTPDtlsLink()
+{
+    TelEngine::destruct(m_dtls);
+}
+
+// Queue a datagram received by the media thread
+void RTPDtlsLink::input(const void* data, int len)
+{
+    Lock lck(this);
+    if (m_state == RTPDtls::Failed || m_inCount >= DTLS_QUEUE)
+	return;
+    m_in.append(new DataBlock(const_cast<void*>(data),len));
+    m_inCount++;
+    lck.drop();
+    s_dtlsWake.unlock();
+}
+
+// Retrieve a datagram to be sent by the media thread
+DataBlock* RTPDtlsLink::output()
+{
+    Lock lck(this);
+    return static_cast<DataBlock*>(m_out.remove(false));
+}
+
+bool RTPDtlsLink::keys(String& suite, DataBlock& material)
+{
+    Lock lck(this);
+    if (m_suite.null())
+	return false;
+    suite = m_suite;
+    material = m_keys;
+    return true;
+}
+
+// Run the handshake, return msec until the endpoint needs attention again
+int RTPDtlsLink::process()
+{
+    RTPDtls::State st = m_state;
+    if (!m_started) {
+	m_started = true;
+	if (m_client)
+	    st = m_dtls->start();
+    }
+    for (;;) {
+	lock();
+	DataBlock* d = static_cast<DataBlock*>(m_in.remove(false));
+	if (d)
+	    m_inCount--;
+	unlock();
+	if (!d)
+	    break;
+	st = m_dtls->received(d->data(),d->length());
+	TelEngine::destruct(d);
+    }
+    int t = m_dtls->timeout();
+    if (t == 0) {
+	st = m_dtls->timer();
+	t = m_dtls->timeout();
+    }
+    ObjList out;
+    ObjList* o = &out;
+    DataBlock pkt;
+    while (m_dtls->output(pkt)) {
+	o = o->append(new DataBlock(pkt));
+	pkt.clear();
+    }
+    String suite;
+    DataBlock material;
+    if (st == RTPDtls::Connected && m_suite.null() && !m_dtls->keys(suite,material))
+	st = RTPDtls::Failed;
+    Lock lck(this);
+    while (GenObject* g = out.remove(false))
+	m_out.append(g);
+    if (suite) {
+	m_suite = suite;
+	m_keys = material;
+    }
+    m_state = st;
+    return (st == RTPDtls::Failed) ? -1 : t;
+}
+
+
+RTPDtls* RTPSession::createDtls()
+{
+    return 0;
+}
+
+bool RTPSession::dtlsSetup(bool client, const String& fingerprint)
+{
+    Lock lck(this);
+    if (m_dtls)
+	return true;
+    // the certificate is self signed, only the fingerprint authenticates the peer
+    if (fingerprint.null()) {
+	TraceDebug(m_traceId,dbg(),DebugWarn,"Refusing DTLS-SRTP without a peer certificate fingerprint [%p]",this);
+	return false;
+    }
+    RTPDtls* dtls = createDtls();
+    if (!dtls)
+	return false;
+    if (!dtls->init(client,fingerprint)) {
+	TraceDebug(m_traceId,dbg(),DebugWarn,"Failed to initialize DTLS endpoint [%p]",this);
+	TelEngine::destruct(dtls);
+	return false;
+    }
+    RTPDtlsLink* link = new RTPDtlsLink(dtls,client);
+    if (!addLink(link)) {
+	TelEngine::destruct(link);
+	return false;
+    }
+    TraceDebug(m_traceId,dbg(),DebugInfo,"Starting DTLS-SRTP as %s, local fingerprint '%s' [%p]",
+	(client ? "client" : "server"),link->fingerprint().c_str(),this);
+    // drop any SDES keys, media waits for the handshake
+    security(0);
+    if (m_recv)
+	m_recv->security(0);
+    m_dtlsKeyed = false;
+    m_dtlsFailed = false;
+    m_dtls = link;
+    if (m_transport)
+	m_transport->acceptDtls(true);
+    return true;
+}
+
+bool RTPSession::dtlsFingerprint(String& buf)
+{
+    Lock lck(this);
+    if (m_dtls)
+	buf = m_dtls->fingerprint();
+    else {
+	// all endpoints share the certificate of the provider
+	RTPDtls* dtls = createDtls();
+	if (!dtls)
+	    return false;
+	buf = dtls->fingerprint();
+	TelEngine::destruct(dtls);
+    }
+    return !buf.null();
+}
+
+// Release the endpoint, the handshake thread drops it soon after
+void RTPSession::dtlsClear()
+{
+    if (m_dtls && m_transport)
+	m_transport->acceptDtls(false);
+    TelEngine::destruct(m_dtls);
+}
+
+// Called from the media thread for each packet on the RTP port
+// Return true if the packet was consumed or must be dropped
+bool RTPSession::dtlsData(const void* data, int len)
+{
+    // RFC 5764 5.1.2, DTLS records share the port with RTP
+    unsigned char first = len ? *(const unsigned char*)data : 0;
+    if ((first >= 20) && (first <= 63)) {
+	m_dtls->input(data,len);
+	return true;
+    }
+    return !m_dtlsKeyed;
+}
+
+// Called from the media thread, sends handshake datagrams and installs the keys
+void RTPSession::dtlsTick()
+{
+    if (!m_dtls)
+	return;
+    RTPProcessor* trans = UDPSession::transport();
+    while (DataBlock* d = m_dtls->output()) {
+	if (trans)
+	    trans->rtpData(d->data(),d->length());
+	TelEngine::destruct(d);
+    }
+    if (m_dtlsKeyed || m_dtlsFailed)
+	return;
+    // media stays blocked on failure, the session will eventually time out
+    switch (m_dtls->state()) {
+	case RTPDtls::Connected:
+	    if (!dtlsKeys()) {
+		m_dtlsFailed = true;
+		TraceDebug(m_traceId,dbg(),DebugWarn,"Could not install the DTLS-SRTP keys [%p]",this);
+	    }
+	    break;
+	case RTPDtls::Failed:
+	    m_dtlsFailed = true;
+	    TraceDebug(m_traceId,dbg(),DebugWarn,"DTLS handshake failed [%p]",this);
+	    break;
+	default:
+	    break;
+    }
+}
+
+// Build the sender and receiver SRTP contexts from the exported keying material
+bool RTPSession::dtlsKeys()
+{
+    String suite;
+    DataBlock material;
+    if (!m_dtls->keys(suite,material))
+	return false;
+    if (material.length() != 2 * (DTLS_KEY_LEN + DTLS_SALT_LEN))
+	return false;
+    const unsigned char* p = (const unsigned char*)material.data();
+    RTPSecure* sec[2] = { 0, 0 };
+    for (int i = 0; i < 2; i++) {
+	// index 0 is the client side, 1 the server side
+	Base64 b64;
+	b64.append(p + i * DTLS_KEY_LEN,DTLS_KEY_LEN);
+	b64.append(p + 2 * DTLS_KEY_LEN + i * DTLS_SALT_LEN,DTLS_SALT_LEN);
+	String key;
+	b64.encode(key,0,false);
+	sec[i] = new RTPSecure(dbg(),m_traceId);
+	if (!(sec[i]->supported(this) && sec[i]->setup(suite,"inline:" + key))) {
+	    TelEngine::destruct(sec[0]);
+	    TelEngine::destruct(sec[1]);
+	    return false;
+	}
+    }
+    int local = m_dtls->client() ? 0 : 1;
+    Lock lck(this);
+    security(sec[local]);
+    if (m_recv)
+	m_recv->security(sec[1 - local]);
+    else
+	TelEngine::destruct(sec[1 - local]);
+    m_dtlsKeyed = true;
+    TraceDebug(m_traceId,dbg(),DebugCall,"DTLS-SRTP negotiated suite '%s' [%p]",suite.c_str(),this);
+    return true;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,423 @@
+/**
+ * ports.cpp
+ * Yet Another RTP Stack
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatertp.h>
+
+// Time in milliseconds a released socket pair stays idle before reuse
+#define PORT_IDLE 2000
+// Maximum number of stale datagrams discarded from a socket at once
+#define PORT_DRAIN 64
+// Largest datagram expected on a RTP or RTCP socket
+#define PORT_BUF 1500
+
+using namespace TelEngine;
+
+namespace TelEngine {
+
+// A socket pair bound in advance
+struct RTPPortSpare
+{
+    SOCKET rtp;
+    SOCKET rtcp;
+    int port;
+    u_int64_t ready;
+    bool drained;
+};
+
+// Spare socket pairs of one local address, used first in first out
+class RTPPortHost : public GenObject
+{
+public:
+    RTPPortHost(const SocketAddr& addr, unsigned int size);
+    virtual ~RTPPortHost();
+    inline bool matches(const SocketAddr& addr) const
+	{ return (m_addr.family() == addr.family()) && (m_addr.host() == addr.host()); }
+    inline const SocketAddr& addr() const
+	{ return m_addr; }
+    inline unsigned int count() const
+	{ return m_count; }
+    inline unsigned int size() const
+	{ return m_size; }
+    inline bool push(const RTPPortSpare& spare)
+	{
+	    if (m_count >= m_size)
+		return false;
+	    m_ring[(m_head + m_count++) % m_size] = spare;
+	    return true;
+	}
+    bool pop(RTPPortSpare& spare, u_int64_t now);
+    void resize(unsigned int size, RTPPortAllocator* owner);
+    void drain(u_int64_t now);
+private:
+    SocketAddr m_addr;
+    RTPPortSpare* m_ring;
+    unsigned int m_size;
+    unsigned int m_head;
+    unsigned int m_count;
+};
+
+};
+
+// Close a socket handle that is not owned by any Socket object
+static void closeHandle(SOCKET handle)
+{
+    if (handle == Socket::invalidHandle())
+	return;
+    Socket sock(handle);
+    sock.terminate();
+}
+
+// Discard the datagrams waiting on a socket handle that is not owned
+static void drainHandle(SOCKET handle)
+{
+    if (handle == Socket::invalidHandle())
+	return;
+    Socket sock(handle);
+    unsigned char buf[PORT_BUF];
+    for (int i = 0; i < PORT_DRAIN; i++)
+	if (sock.recv(buf,sizeof(buf)) <= 0)
+	    break;
+    sock.detach();
+}
+
+// Bind a pair of sockets on adjacent ports, return true on success
+static bool bindPair(const SocketAddr& addr, int port, RTPPortSpare& spare)
+{
+    Socket rtp, rtcp;
+    SocketAddr a(addr);
+    a.port(port);
+    if (!(rtp.create(a.family(),SOCK_DGRAM) && rtp.bind(a)))
+	return false;
+    a.port(port + 1);
+    if (!(rtcp.create(a.family(),SOCK_DGRAM) && rtcp.bind(a)))
+	return false;
+    rtp.setBlocking(false);
+    rtcp.setBlocking(false);
+    spare.rtp = rtp.detach();
+    spare.rtcp = rtcp.detach();
+    spare.port = port;
+    spare.ready = 0;
+    spare.drained = true;
+    return true;
+}
+
+
+RTPPortHost::RTPPortHost(const SocketAddr& addr, unsigned int size)
+    : m_addr(addr), m_ring(0), m_size(size), m_head(0), m_count(0)
+{
+    m_addr.port(0);
+    if (m_size)
+	m_ring = new RTPPortSpare[m_size];
+}
+
+RTPPortHost::~RTPPortHost()
+{
+    delete[] m_ring;
+}
+
+// Take the oldest spare if it was idle long enough and drained since
+bool RTPPortHost::pop(RTPPortSpare& spare, u_int64_t now)
+{
+    if (!m_count || (m_ring[m_head].ready > now) || !m_ring[m_head].drained)
+	return false;
+    spare = m_ring[m_head];
+    m_head = (m_head + 1) % m_size;
+    m_count--;
+    return true;
+}
+
+// Change the number of spares kept, closing the ones that no longer fit
+// Must be called with the owner allocator locked
+void RTPPortHost::resize(unsigned int size, RTPPortAllocator* owner)
+{
+    RTPPortSpare* ring = size ? new RTPPortSpare[size] : 0;
+    unsigned int count = 0;
+    RTPPortSpare s;
+    // take all spares, drained or not
+    while (m_count) {
+	s = m_ring[m_head];
+	m_head = (m_head + 1) % m_size;
+	m_count--;
+	if (count < size) {
+	    ring[count++] = s;
+	    continue;
+	}
+	closeHandle(s.rtp);
+	closeHandle(s.rtcp);
+	owner->freePort(s.port);
+    }
+    delete[] m_ring;
+    m_ring = ring;
+    m_size = size;
+    m_head = 0;
+    m_count = count;
+}
+
+// Discard the media that reached the spares released by ended sessions
+//  while they were idle, before handing them to new sessions
+void RTPPortHost::drain(u_int64_t now)
+{
+    for (unsigned int i = 0; i < m_count; i++) {
+	RTPPortSpare& s = m_ring[(m_head + i) % m_size];
+	// spares are released in order, the later ones are still idle
+	if (s.ready > now)
+	    break;
+	if (s.drained)
+	    continue;
+	drainHandle(s.rtp);
+	drainHandle(s.rtcp);
+	s.drained = true;
+    }
+}
+
+
+RTPPortAllocator::RTPPortAllocator(int minPort, int maxPort, unsigned int spares)
+    : Mutex(false,"RTPPortAllocator"),
+      m_minPort(0), m_pairs(0), m_map(0), m_used(0), m_spares(spares),
+      m_binds(0), m_reused(0), m_failed(0)
+{
+    if (minPort > maxPort) {
+	int tmp = maxPort;
+	maxPort = minPort;
+	minPort = tmp;
+    }
+    if (minPort < 1024)
+	minPort = 1024;
+    if (maxPort > 65536)
+	maxPort = 65536;
+    m_minPort = (minPort + 1) & ~1;
+    if (maxPort > m_minPort)
+	m_pairs = (maxPort - m_minPort) / 2;
+    if (!m_pairs)
+	m_pairs = 1;
+    unsigned int words = (m_pairs + 31) / 32;
+    m_map = new u_int32_t[words];
+    for (unsigned int i = 0; i < words; i++)
+	m_map[i] = 0;
+    // mark the bits past the end of the range as used
+    if (m_pairs % 32)
+	m_map[words - 1] = ~((1u << (m_pairs % 32)) - 1);
+    DDebug(DebugAll,"RTPPortAllocator::RTPPortAllocator(%d,%d,%u) [%p]",
+	minPort,maxPort,spares,this);
+}
+
+RTPPortAllocator::~RTPPortAllocator()
+{
+    DDebug(DebugAll,"RTPPortAllocator::~RTPPortAllocator() used=%u [%p]",m_used,this);
+    spares(0);
+    m_hosts.clear();
+    delete[] m_map;
+}
+
+// Find a free port pair starting at a random position and mark it as used
+// Must be called with the allocator locked
+int RTPPortAllocator::findPort()
+{
+    if (m_used >= m_pairs)
+	return 0;
+    unsigned int words = (m_pairs + 31) / 32;
+    unsigned int start = (unsigned int)(Random::random() % m_pairs);
+    unsigned int w = start / 32;
+    // the first word is searched from the start position, at the end again from its first bit
+    for (unsigned int i = 0; i <= words; i++, w = (w + 1) % words) {
+	u_int32_t v = m_map[w];
+	if (!i)
+	    v |= (1u << (start % 32)) - 1;
+	if (v == 0xffffffff)
+	    continue;
+	unsigned int b = 0;
+	while (v & (1u << b))
+	    b++;
+	m_map[w] |= (1u << b);
+	m_used++;
+	return m_minPort + 2 * (w * 32 + b);
+    }
+    return 0;
+}
+
+// Mark a port pair as free, must be called with the allocator locked
+void RTPPortAllocator::freePort(int port)
+{
+    if (port < m_minPort)
+	return;
+    unsigned int idx = (port - m_minPort) / 2;
+    if (idx >= m_pairs)
+	return;
+    u_int32_t bit = 1u << (idx % 32);
+    if (!(m_map[idx / 32] & bit))
+	return;
+    m_map[idx / 32] &= ~bit;
+    if (m_used)
+	m_used--;
+}
+
+// Find the spares of a local address, must be called with the allocator locked
+RTPPortHost* RTPPortAllocator::findHost(const SocketAddr& addr, bool create)
+{
+    for (ObjList* l = m_hosts.skipNull(); l; l = l->skipNext()) {
+	RTPPortHost* h = static_cast<RTPPortHost*>(l->get());
+	if (h->matches(addr))
+	    return h;
+    }
+    if (!(create && m_spares))
+	return 0;
+    RTPPortHost* h = new RTPPortHost(addr,m_spares);
+    m_hosts.append(h);
+    return h;
+}
+
+bool RTPPortAllocator::bind(RTPTransport& trans, SocketAddr& addr, bool rtcp, unsigned int attempts)
+{
+    if (trans.m_rtpSock.valid() || trans.m_ports)
+	return false;
+    lock();
+    m_binds++;
+    RTPPortHost* h = findHost(addr,true);
+    RTPPortSpare s;
+    if (h && h->pop(s,Time::now())) {
+	unlock();
+	if (!rtcp) {
+	    closeHandle(s.rtcp);
+	    s.rtcp = Socket::invalidHandle();
+	}
+	addr.port(s.port);
+	trans.adoptSockets(s.rtp,s.rtcp,addr);
+	trans.m_ports = this;
+	ref();
+	lock();
+	m_reused++;
+	unlock();
+	return true;
+    }
+    for (; attempts; attempts--) {
+	int port = findPort();
+	if (!port)
+	    break;
+	unlock();
+	addr.port(port);
+	bool ok = trans.localAddr(addr,rtcp);
+	lock();
+	if (ok) {
+	    unlock();
+	    trans.m_ports = this;
+	    ref();
+	    return true;
+	}
+	// someone else holds the port, the next search starts elsewhere
+	XDebug(DebugAll,"RTPPortAllocator port %d is busy [%p]",port,this);
+	freePort(port);
+    }
+    m_failed++;
+    unlock();
+    return false;
+}
+
+// Take back the sockets of a transport, keep them as spares if possible
+void RTPPortAllocator::release(RTPTransport& trans)
+{
+    int port = trans.m_localAddr.port();
+    Lock lck(this);
+    RTPPortHost* h = trans.m_rtcpSock.valid() ? findHost(trans.m_localAddr,false) : 0;
+    if (h && trans.m_rtpSock.valid()) {
+	RTPPortSpare s;
+	s.rtp = trans.m_rtpSock.detach();
+	s.rtcp = trans.m_rtcpSock.detach();
+	s.port = port;
+	s.ready = Time::now() + PORT_IDLE * (u_int64_t)1000;
+	// drained by refill() once idle, data may still arrive meanwhile
+	s.drained = false;
+	if (h->push(s))
+	    return;
+	trans.m_rtpSock.attach(s.rtp);
+	trans.m_rtcpSock.attach(s.rtcp);
+    }
+    lck.drop();
+    trans.m_rtpSock.terminate();
+    trans.m_rtcpSock.terminate();
+    lck.acquire(this);
+    freePort(port);
+}
+
+void RTPPortAllocator::spares(unsigned int count)
+{
+    Lock lck(this);
+    m_spares = count;
+    for (ObjList* l = m_hosts.skipNull(); l; l = l->skipNext())
+	static_cast<RTPPortHost*>(l->get())->resize(count,this);
+}
+
+void RTPPortAllocator::prepare(const SocketAddr& addr)
+{
+    Lock lck(this);
+    findHost(addr,true);
+}
+
+unsigned int RTPPortAllocator::refill(unsigned int max)
+{
+    unsigned int done = 0;
+    Lock lck(this);
+    u_int64_t now = Time::now();
+    for (ObjList* l = m_hosts.skipNull(); l; l = l->skipNext())
+	static_cast<RTPPortHost*>(l->get())->drain(now);
+    for (ObjList* l = m_hosts.skipNull(); l && (done < max); l = l->skipNext()) {
+	RTPPortHost* h = static_cast<RTPPortHost*>(l->get());
+	// allow a few failures per address, ports may be held by others
+	for (unsigned int fails = 0; (h->count() < h->size()) && (done < max) && (fails < 4); ) {
+	    int port = findPort();
+	    if (!port)
+		return done;
+	    SocketAddr addr(h->addr());
+	    lck.drop();
+	    RTPPortSpare s;
+	    bool ok = bindPair(addr,port,s);
+	    lck.acquire(this);
+	    // spares may have been resized or the list changed while unlocked
+	    if (ok && (m_hosts.find(h)) && h->push(s)) {
+		done++;
+		continue;
+	    }
+	    if (ok) {
+		closeHandle(s.rtp);
+		closeHandle(s.rtcp);
+		freePort(port);
+		return done;
+	    }
+	    // someone else holds the port, give it back like bind() does
+	    freePort(port);
+	    fails++;
+	}
+    }
+    if (done)
+	DDebug(DebugAll,"RTPPortAllocator bound %u spare socket pairs [%p]",done,this);
+    return done;
+}
+
+void RTPPortAllocator::stats(String& str)
+{
+    Lock lck(this);
+    unsigned int spares = 0;
+    for (ObjList* l = m_hosts.skipNull(); l; l = l->skipNext())
+	spares += static_cast<RTPPortHost*>(l->get())->count();
+    str.append("ports=",",") << m_pairs;
+    str << ",portsused=" << m_used << ",spares=" << spares;
+    str << ",binds=" << m_binds << ",reused=" << m_reused << ",bindfailed=" << m_failed;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,216 @@
+/**
+ * quality.cpp
+ * Yet Another RTP Stack
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatertp.h>
+
+// Minimum number of received packets separating two bursts, RFC 3611 4.7.2
+#define QUALITY_GMIN 16
+
+using namespace TelEngine;
+
+// Equipment impairment and packet loss robustness, ITU-T G.113 Appendix I
+struct CodecImpairment {
+    const char* format;
+    int ie;
+    int bpl;                             // Scaled by 10
+};
+
+static const CodecImpairment s_codecs[] = {
+    { "mulaw", 0, 251 },
+    { "alaw", 0, 251 },
+    { "g729", 11, 190 },
+    { "g723", 15, 161 },
+    { 0, 0, 0 }
+};
+
+// Scale a count to a fraction of 256 saturated at 255 as used by RFC 3611
+static unsigned int fraction(u_int64_t count, u_int64_t total)
+{
+    if (!total)
+	return 0;
+    count = (count * 256) / total;
+    return (count > 255) ? 255 : (unsigned int)count;
+}
+
+
+RTPQuality::RTPQuality()
+    : m_ie(0), m_bpl(251)
+{
+    reset();
+}
+
+void RTPQuality::reset()
+{
+    m_received = m_lost = m_discarded = 0;
+    m_lastTs = m_frame = 0;
+    m_lastLost = false;
+    m_trans[0][0] = m_trans[0][1] = m_trans[1][0] = m_trans[1][1] = 0;
+    m_gapPkts = m_burstLost = 0;
+    m_c11 = m_c13 = m_c14 = m_c22 = m_c23 = m_c33 = 0;
+}
+
+// Burst/gap state machine of RFC 3611 Appendix A.2, classifies the previous
+//  loss run as isolated or burst when a gap of QUALITY_GMIN packets ends it
+void RTPQuality::lost(unsigned int count, bool discard)
+{
+    if (!count)
+	return;
+    if (discard)
+	m_discarded += count;
+    else
+	m_lost += count;
+    m_trans[m_lastLost ? 1 : 0][1]++;
+    m_trans[1][1] += count - 1;
+    m_lastLost = true;
+    if (m_gapPkts >= QUALITY_GMIN) {
+	if (m_burstLost == 1)
+	    m_c14++;
+	else if (m_burstLost)
+	    m_c13++;
+	m_burstLost = 1;
+	m_c11 += m_gapPkts;
+    }
+    else {
+	m_burstLost++;
+	if (m_gapPkts) {
+	    m_c23++;
+	    m_c22 += m_gapPkts - 1;
+	}
+	else
+	    m_c33++;
+    }
+    // any further losses follow each other inside the burst
+    m_burstLost += count - 1;
+    m_c33 += count - 1;
+    m_gapPkts = 0;
+}
+
+void RTPQuality::codec(const String& format)
+{
+    m_ie = 0;
+    m_bpl = 251;
+    for (const CodecImpairment* c = s_codecs; c->format; c++) {
+	if (format.startsWith(c->format)) {
+	    m_ie = c->ie;
+	    m_bpl = c->bpl;
+	    break;
+	}
+    }
+}
+
+unsigned int RTPQuality::minGap()
+{
+    return QUALITY_GMIN;
+}
+
+unsigned int RTPQuality::frameTime(unsigned int rate) const
+{
+    return rate ? (unsigned int)((u_int64_t)m_frame * 1000 / rate) : 0;
+}
+
+unsigned int RTPQuality::lossRate() const
+{
+    return fraction(m_lost,(u_int64_t)m_received + m_lost + m_discarded);
+}
+
+unsigned int RTPQuality::discardRate() const
+{
+    return fraction(m_discarded,(u_int64_t)m_received + m_lost + m_discarded);
+}
+
+void RTPQuality::bursts(unsigned int rate, unsigned int& burstDensity, unsigned int& gapDensity,
+    unsigned int& burstDuration, unsigned int& gapDuration) const
+{
+    // account the loss run and gap still in progress
+    u_int64_t c11 = (u_int64_t)m_c11 + m_gapPkts;
+    u_int64_t c13 = m_c13;
+    u_int64_t c14 = m_c14;
+    if (m_burstLost == 1)
+	c14++;
+    else if (m_burstLost)
+	c13++;
+    u_int64_t c22 = m_c22;
+    u_int64_t c23 = m_c23;
+    u_int64_t c33 = m_c33;
+    u_int64_t c31 = c13;
+    u_int64_t c32 = c23;
+    u_int64_t total = c11 + c14 + c13 + c22 + c23 + c31 + c32 + c33;
+    u_int64_t frame = frameTime(rate);
+    gapDensity = fraction(c14,c11 + c14);
+    if (!c13) {
+	// no burst, the whole stream is one gap
+	burstDensity = 0;
+	burstDuration = 0;
+	gapDuration = (unsigned int)(total * frame);
+	return;
+    }
+    double p32 = (double)c32 / (c31 + c32 + c33);
+    double p23 = (c22 + c23) ? (1.0 - (double)c22 / (c22 + c23)) : 1.0;
+    burstDensity = (unsigned int)(256 * p23 / (p23 + p32));
+    if (burstDensity > 255)
+	burstDensity = 255;
+    u_int64_t gap = (c11 + c14 + c13) * frame / c13;
+    gapDuration = (unsigned int)gap;
+    burstDuration = (unsigned int)(total * frame / c13 - gap);
+}
+
+// Simplified E-model of ITU-T G.107 with default values except the codec
+//  impairments, delay impairment approximated as in Cole and Rosenbluth
+int RTPQuality::rFactor(int delay) const
+{
+    double r = 93.2;
+    if (delay > 0) {
+	r -= 0.024 * delay;
+	if (delay > 177.3)
+	    r -= 0.11 * (delay - 177.3);
+    }
+    double ie = m_ie;
+    u_int32_t bad = m_lost + m_discarded;
+    if (bad) {
+	double ppl = 100.0 * bad / ((double)m_received + bad);
+	// burst ratio from the two state loss model, 1 for random loss
+	u_int64_t fromRecv = (u_int64_t)m_trans[0][0] + m_trans[0][1];
+	u_int64_t fromLost = (u_int64_t)m_trans[1][0] + m_trans[1][1];
+	double p = fromRecv ? (double)m_trans[0][1] / fromRecv : 0;
+	double q = fromLost ? (double)m_trans[1][0] / fromLost : 0;
+	double burstR = (p + q > 0) ? (1.0 / (p + q)) : 1.0;
+	ie += (95 - ie) * ppl / (ppl / burstR + m_bpl / 10.0);
+    }
+    r -= ie;
+    if (r <= 0)
+	return 0;
+    if (r >= 100)
+	return 100;
+    return (int)(r + 0.5);
+}
+
+unsigned int RTPQuality::mos(int rFactor)
+{
+    if (rFactor <= 0)
+	return 10;
+    if (rFactor >= 100)
+	return 45;
+    double r = rFactor;
+    double m = 1 + 0.035 * r + r * (r - 60) * (100 - r) * 7e-6;
+    unsigned int ret = (unsigned int)(m * 10 + 0.5);
+    return (ret < 10) ? 10 : ((ret > 45) ? 45 : ret);
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
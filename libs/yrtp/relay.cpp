@@ -0,0 +1,478 @@
+/**
+ * relay.cpp
+ * Yet Another RTP Stack
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatertp.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// Maximum number of datagrams sent in one batch
+#define RELAY_BATCH 16
+
+// Counters of relays are kept in pages that are never moved or freed
+//  so running relays can update them without holding any lock
+#define RELAY_PAGE 1024
+#define RELAY_PAGES 256
+
+// Watch state of a leg for missing media
+#define WATCH_NONE 0
+#define WATCH_ARMED 1
+#define WATCH_DONE 2
+
+using namespace TelEngine;
+
+static RTPRelayCounters* s_pages[RELAY_PAGES];
+static int* s_free = 0;
+static int s_freeCount = 0;
+static int s_slots = 0;
+static unsigned int s_relays = 0;
+static Mutex s_relayMutex(false,"RTPRelay");
+
+static inline RTPRelayCounters* slotCounters(int slot)
+{
+    return s_pages[slot / RELAY_PAGE] + 2 * (slot % RELAY_PAGE);
+}
+
+static void initCounters(RTPRelayCounters* c)
+{
+    for (int i = 0; i < 2; i++) {
+	::memset(c + i,0,sizeof(RTPRelayCounters));
+	c[i].payload = -1;
+    }
+}
+
+// Allocate the counters of a new relay, return slot number or -1 if full
+static int allocSlot()
+{
+    Lock lck(s_relayMutex);
+    s_relays++;
+    if (s_freeCount)
+	return s_free[--s_freeCount];
+    int page = s_slots / RELAY_PAGE;
+    if (page >= RELAY_PAGES)
+	return -1;
+    if (!s_pages[page]) {
+	// grow the free list so releasing a slot never needs to allocate
+	int* fl = (int*)::realloc(s_free,(page + 1) * RELAY_PAGE * sizeof(int));
+	if (!fl)
+	    return -1;
+	s_free = fl;
+	s_pages[page] = (RTPRelayCounters*)::calloc(2 * RELAY_PAGE,sizeof(RTPRelayCounters));
+	if (!s_pages[page])
+	    return -1;
+    }
+    return s_slots++;
+}
+
+static void freeSlot(int slot)
+{
+    Lock lck(s_relayMutex);
+    if (s_relays)
+	s_relays--;
+    if (slot < 0)
+	return;
+    // freed counters are zeroed so totals only include running relays
+    ::memset(slotCounters(slot),0,2 * sizeof(RTPRelayCounters));
+    s_free[s_freeCount++] = slot;
+}
+
+static inline u_int32_t getInt32(const unsigned char* buf)
+{
+    return ((u_int32_t)buf[0] << 24) | ((u_int32_t)buf[1] << 16) |
+	((u_int32_t)buf[2] << 8) | buf[3];
+}
+
+static inline void setInt32(unsigned char* buf, u_int32_t val)
+{
+    buf[0] = (unsigned char)(val >> 24);
+    buf[1] = (unsigned char)(val >> 16);
+    buf[2] = (unsigned char)(val >> 8);
+    buf[3] = (unsigned char)val;
+}
+
+
+RTPRelay::RTPRelay(DebugEnabler* dbg, const char* traceId)
+    : RTPProcessor(dbg,traceId),
+      m_legA(0), m_legB(0), m_slot(-1), m_rewrite(false), m_timeout(0)
+{
+    DDebug(this->dbg(),DebugAll,"RTPRelay::RTPRelay() [%p]",this);
+    for (int i = 0; i < 2; i++) {
+	m_armed[i] = 0;
+	m_watch[i] = WATCH_NONE;
+	m_srcValid[i] = false;
+	m_srcSsrc[i] = 0;
+	m_ssrc[i] = 0;
+	m_seqDelta[i] = 0;
+	m_seqLast[i] = 0;
+    }
+    m_legA = new RTPTransport(RTPTransport::RTP,dbg,traceId);
+    m_legB = new RTPTransport(RTPTransport::RTP,dbg,traceId);
+    m_slot = allocSlot();
+    if (m_slot >= 0)
+	m_stats[0] = slotCounters(m_slot);
+    else {
+	TraceDebug(m_traceId,this->dbg(),DebugMild,"Relay counters table is full [%p]",this);
+	m_stats[0] = new RTPRelayCounters[2];
+    }
+    m_stats[1] = m_stats[0] + 1;
+    initCounters(m_stats[0]);
+}
+
+RTPRelay::~RTPRelay()
+{
+    DDebug(dbg(),DebugAll,"RTPRelay::~RTPRelay() [%p]",this);
+    stop();
+    TelEngine::destruct(m_legA);
+    TelEngine::destruct(m_legB);
+    if (m_slot < 0)
+	delete[] m_stats[0];
+    freeSlot(m_slot);
+}
+
+void RTPRelay::destruct()
+{
+    stop();
+    RTPProcessor::destruct();
+}
+
+bool RTPRelay::start(int msec, Thread::Priority prio)
+{
+    if (group())
+	return true;
+    if (!RTPGroup::joinPool(this))
+	group(new RTPGroup(msec,prio));
+    RTPGroup* grp = group();
+    if (!grp)
+	return false;
+    m_legA->m_relay = this;
+    m_legB->m_relay = this;
+    m_legA->group(grp);
+    m_legB->group(grp);
+    return true;
+}
+
+void RTPRelay::stop()
+{
+    // leaving the group makes sure the relay is not running anymore
+    m_legA->group(0);
+    m_legB->group(0);
+    m_legA->m_relay = 0;
+    m_legB->m_relay = 0;
+    group(0);
+}
+
+void RTPRelay::rewrite(bool enable)
+{
+    Lock lck(group());
+    if (enable && !m_rewrite) {
+	for (int i = 0; i < 2; i++) {
+	    m_srcValid[i] = false;
+	    m_ssrc[i] = Random::random();
+	}
+    }
+    m_rewrite = enable;
+}
+
+void RTPRelay::startup(bool watchA, bool watchB)
+{
+    Lock lck(group());
+    u_int64_t now = Time::now();
+    if (watchA && (WATCH_NONE == m_watch[0])) {
+	m_armed[0] = now;
+	m_watch[0] = WATCH_ARMED;
+    }
+    if (watchB && (WATCH_NONE == m_watch[1])) {
+	m_armed[1] = now;
+	m_watch[1] = WATCH_ARMED;
+    }
+}
+
+void RTPRelay::timerTick(const Time& when)
+{
+    if (!m_timeout)
+	return;
+    for (int dir = 0; dir < 2; dir++) {
+	if (WATCH_ARMED != m_watch[dir])
+	    continue;
+	const RTPRelayCounters& c = *m_stats[dir];
+	u_int64_t last = c.last ? c.last : m_armed[dir];
+	if ((last + m_timeout) >= when.usec())
+	    continue;
+	// been there, done that, enough
+	m_watch[dir] = WATCH_DONE;
+	timeout(0 == dir,0 == c.first);
+    }
+}
+
+void RTPRelay::timeout(bool legA, bool initial)
+{
+    DDebug(dbg(),DebugNote,"%s timeout on relay leg %c [%p]",
+	(initial ? "Initial" : "Later"),(legA ? 'A' : 'B'),this);
+}
+
+// Forward a batch of datagrams received by one of the legs to the other
+// Called from the group thread with the group locked
+void RTPRelay::relay(RTPTransport* from, SocketDatagram* dgrams, int count, bool rtcp)
+{
+    int dir = (from == m_legA) ? 0 : 1;
+    RTPTransport* to = dir ? m_legA : m_legB;
+    RTPRelayCounters& c = *m_stats[dir];
+    Socket& sock = rtcp ? to->m_rtcpSock : to->m_rtpSock;
+    const SocketAddr& dest = rtcp ? to->m_remoteRTCP : to->m_remoteAddr;
+    bool& warn = rtcp ? to->m_warnSendErrorRtcp : to->m_warnSendErrorRtp;
+    bool isRtp = !rtcp && (RTPTransport::RTP == from->m_type);
+    bool got = false;
+    SocketDatagram out[RELAY_BATCH];
+    for (int base = 0; base < count; base += RELAY_BATCH) {
+	int end = base + RELAY_BATCH;
+	if (end > count)
+	    end = count;
+	int n = 0;
+	for (int i = base; i < end; i++) {
+	    SocketDatagram& d = dgrams[i];
+	    unsigned char* buf = (unsigned char*)d.buffer;
+	    if (rtcp) {
+		if (d.result < 8)
+		    continue;
+		from->m_rxAddrRTCP.assign(d.addr,d.addrLen);
+		if (from->m_rxAddrRTCP != from->m_remoteRTCP)
+		    continue;
+		c.rtcpPackets++;
+		if (m_rewrite)
+		    rewriteRtcp(buf,d.result,dir);
+	    }
+	    else {
+		from->m_rxAddrRTP.assign(d.addr,d.addrLen);
+		if (!from->rtpSource(buf,d.result))
+		    continue;
+		c.rtpPackets++;
+		c.rtpBytes += d.result;
+		// DTLS records of end to end keyed SRTP pass unchanged
+		if (isRtp && ((buf[0] & 0xc0) == 0x80)) {
+		    c.payload = 0x7f & buf[1];
+		    if (m_rewrite)
+			rewriteRtp(buf,dir);
+		}
+	    }
+	    got = true;
+	    // send straight from the receive buffer
+	    SocketDatagram& o = out[n++];
+	    o.buffer = buf;
+	    o.length = d.result;
+	    o.addr = dest.address();
+	    o.addrLen = dest.length();
+	    o.result = 0;
+	}
+	if (!n)
+	    continue;
+	if (!(sock.valid() && dest.valid())) {
+	    c.dropped += n;
+	    continue;
+	}
+	int sent = sock.sendBatch(out,n);
+	c.batches++;
+	if (sent >= n)
+	    continue;
+	c.dropped += n - ((sent > 0) ? sent : 0);
+	if (warn && (sent < 0) && !sock.canRetry()) {
+	    warn = false;
+	    String s;
+	    int e = sock.error();
+	    Thread::errorString(s,e);
+	    TraceDebug(m_traceId,dbg(),DebugNote,"%s relay send failed (remote=%s): %d %s [%p]",
+		(rtcp ? "RTCP" : "RTP"),dest.addr().c_str(),e,s.c_str(),this);
+	}
+    }
+    if (got) {
+	u_int64_t now = Time::now();
+	if (!c.first)
+	    c.first = now;
+	c.last = now;
+    }
+}
+
+// Rewrite the SSRC and sequence number of a RTP packet
+// When the source changes numbering continues after the last packet sent
+void RTPRelay::rewriteRtp(unsigned char* buf, int dir)
+{
+    u_int32_t ssrc = getInt32(buf + 8);
+    u_int16_t seq = ((u_int16_t)buf[2] << 8) | buf[3];
+    if (!m_srcValid[dir]) {
+	m_srcValid[dir] = true;
+	m_srcSsrc[dir] = ssrc;
+	m_seqDelta[dir] = 0;
+    }
+    else if (ssrc != m_srcSsrc[dir]) {
+	DDebug(dbg(),DebugInfo,"Relay leg %c source changed from 0x%X to 0x%X [%p]",
+	    (dir ? 'B' : 'A'),m_srcSsrc[dir],ssrc,this);
+	m_srcSsrc[dir] = ssrc;
+	m_seqDelta[dir] = m_seqLast[dir] + 1 - seq;
+    }
+    seq += m_seqDelta[dir];
+    m_seqLast[dir] = seq;
+    buf[2] = (unsigned char)(seq >> 8);
+    buf[3] = (unsigned char)seq;
+    setInt32(buf + 8,m_ssrc[dir]);
+}
+
+// Replace a SSRC of the sender of a RTCP packet going out on the other leg
+// The first one is always replaced, the others only if they are the source's
+void RTPRelay::ownSsrc(unsigned char* buf, int dir, bool first)
+{
+    if (first || (m_srcValid[dir] && (getInt32(buf) == m_srcSsrc[dir])))
+	setInt32(buf,m_ssrc[dir]);
+}
+
+// Map back a reported SSRC to the one the source of the other leg uses
+// Return true if the SSRC was the rewritten one
+bool RTPRelay::peerSsrc(unsigned char* buf, int dir)
+{
+    int rev = 1 - dir;
+    if (!(m_srcValid[rev] && (getInt32(buf) == m_ssrc[rev])))
+	return false;
+    setInt32(buf,m_srcSsrc[rev]);
+    return true;
+}
+
+// Map back a sequence number reported about the stream of the other leg
+void RTPRelay::peerSeq(unsigned char* buf, int dir)
+{
+    u_int16_t seq = (((u_int16_t)buf[0] << 8) | buf[1]) - m_seqDelta[1 - dir];
+    buf[0] = (unsigned char)(seq >> 8);
+    buf[1] = (unsigned char)seq;
+}
+
+// Rewrite the report blocks of a RTCP XR packet
+void RTPRelay::rewriteXr(unsigned char* buf, int len, int dir)
+{
+    int ofs = 8;
+    while (ofs + 4 <= len) {
+	int blen = 4 * ((((int)buf[ofs + 2] << 8) | buf[ofs + 3]) + 1);
+	if (ofs + blen > len)
+	    break;
+	unsigned char* b = buf + ofs;
+	switch (b[0]) {
+	    case 1: // Loss RLE
+	    case 2: // Duplicate RLE
+	    case 3: // Packet Receipt Times
+	    case 6: // Statistics Summary
+		if ((blen >= 12) && peerSsrc(b + 4,dir)) {
+		    peerSeq(b + 8,dir);
+		    peerSeq(b + 10,dir);
+		}
+		break;
+	    case 5: // DLRR, sub-blocks of SSRC, LRR and DLRR
+		for (int i = 4; i + 12 <= blen; i += 12)
+		    peerSsrc(b + i,dir);
+		break;
+	    case 7: // VoIP Metrics
+		if (blen >= 8)
+		    peerSsrc(b + 4,dir);
+		break;
+	}
+	ofs += blen;
+    }
+}
+
+// Rewrite the SSRCs of each packet in a compound RTCP packet to match the
+//  rewritten RTP: those of the sender are replaced by the one presented to
+//  the other side, the reported ones are mapped back to the source's own
+void RTPRelay::rewriteRtcp(unsigned char* buf, int len, int dir)
+{
+    while (len >= 8) {
+	if ((buf[0] & 0xc0) != 0x80)
+	    break;
+	int plen = 4 * ((((int)buf[2] << 8) | buf[3]) + 1);
+	if (plen > len)
+	    break;
+	int count = buf[0] & 0x1f;
+	switch (buf[1]) {
+	    case 200: // SR
+	    case 201: // RR
+		{
+		    ownSsrc(buf + 4,dir);
+		    // report blocks follow the sender info of a SR
+		    int ofs = (200 == buf[1]) ? 28 : 8;
+		    for (int i = 0; (i < count) && (ofs + 24 <= plen); i++, ofs += 24) {
+			if (peerSsrc(buf + ofs,dir))
+			    peerSeq(buf + ofs + 10,dir);
+		    }
+		}
+		break;
+	    case 202: // SDES
+		{
+		    int ofs = 4;
+		    for (int i = 0; (i < count) && (ofs + 4 <= plen); i++) {
+			ownSsrc(buf + ofs,dir,!i);
+			// skip the items up to the terminating null and padding
+			ofs += 4;
+			while ((ofs + 2 <= plen) && buf[ofs])
+			    ofs += 2 + buf[ofs + 1];
+			ofs = (ofs + 4) & ~3;
+		    }
+		}
+		break;
+	    case 203: // BYE
+		for (int i = 0; (i < count) && (8 + 4 * i <= plen); i++)
+		    ownSsrc(buf + 4 + 4 * i,dir,!i);
+		break;
+	    case 205: // RTPFB
+	    case 206: // PSFB
+		ownSsrc(buf + 4,dir);
+		if (plen >= 12)
+		    peerSsrc(buf + 8,dir);
+		break;
+	    case 207: // XR
+		ownSsrc(buf + 4,dir);
+		rewriteXr(buf,plen,dir);
+		break;
+	    default:
+		ownSsrc(buf + 4,dir);
+	}
+	buf += plen;
+	len -= plen;
+    }
+}
+
+unsigned int RTPRelay::relays()
+{
+    return s_relays;
+}
+
+void RTPRelay::relayStatus(String& str)
+{
+    u_int64_t packets = 0;
+    u_int64_t dropped = 0;
+    u_int64_t batches = 0;
+    Lock lck(s_relayMutex);
+    for (int i = 0; i < s_slots; i++) {
+	const RTPRelayCounters* c = slotCounters(i);
+	for (int j = 0; j < 2; j++) {
+	    packets += c[j].rtpPackets + c[j].rtcpPackets;
+	    dropped += c[j].dropped;
+	    batches += c[j].batches;
+	}
+    }
+    str.append("relays=",",") << s_relays;
+    str << ",relaypackets=" << packets << ",relaydropped=" << dropped;
+    str << ",relaybatches=" << batches;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -23,14 +23,359 @@
 #include <string.h>
 #include <stdlib.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(NO_SRTP_FAST)
+#define SRTP_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#define SRTP_AES __attribute__((target("aes,sse2")))
+#define SRTP_SHA __attribute__((target("sha,ssse3,sse4.1")))
+#endif
+
 using namespace TelEngine;
 
 static const DataBlock s_16bit(0,2);
 
+// Process a number of consecutive 64 byte blocks into a SHA1 chaining state
+typedef void (*SHA1Blocks)(u_int32_t* state, const unsigned char* data, unsigned int blocks);
+
+#define ROL32(x,n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static inline u_int32_t getBE32(const unsigned char* p)
+{
+    return ((u_int32_t)p[0] << 24) | ((u_int32_t)p[1] << 16) | ((u_int32_t)p[2] << 8) | p[3];
+}
+
+static inline void putBE32(unsigned char* p, u_int32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+// Portable SHA1 compression function
+static void sha1Generic(u_int32_t* state, const unsigned char* data, unsigned int blocks)
+{
+    u_int32_t w[16];
+    for (; blocks; blocks--, data += 64) {
+	u_int32_t a = state[0];
+	u_int32_t b = state[1];
+	u_int32_t c = state[2];
+	u_int32_t d = state[3];
+	u_int32_t e = state[4];
+	for (int i = 0; i < 80; i++) {
+	    u_int32_t t;
+	    if (i < 16)
+		t = w[i] = getBE32(data + 4 * i);
+	    else {
+		t = w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15];
+		t = w[i & 15] = ROL32(t,1);
+	    }
+	    if (i < 20)
+		t += ((b & c) | (~b & d)) + 0x5a827999;
+	    else if (i < 40)
+		t += (b ^ c ^ d) + 0x6ed9eba1;
+	    else if (i < 60)
+		t += ((b & c) | (b & d) | (c & d)) + 0x8f1bbcdc;
+	    else
+		t += (b ^ c ^ d) + 0xca62c1d6;
+	    t += ROL32(a,5) + e;
+	    e = d;
+	    d = c;
+	    c = ROL32(b,30);
+	    b = a;
+	    a = t;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+    }
+}
+
+#ifdef SRTP_X86
+
+// Four SHA1 rounds using the SHA extensions, keeps a rolling 16 word message schedule
+#define SHA_ROUNDS(i,f,eIn,eOut) \
+    if (i >= 4) \
+	m[i & 3] = _mm_sha1msg2_epu32(m[i & 3],m[(i - 1) & 3]); \
+    if (i) \
+	eIn = _mm_sha1nexte_epu32(eIn,m[i & 3]); \
+    else \
+	eIn = _mm_add_epi32(eIn,m[0]); \
+    eOut = abcd; \
+    abcd = _mm_sha1rnds4_epu32(abcd,eIn,f); \
+    if (i >= 1 && i <= 16) \
+	m[(i - 1) & 3] = _mm_sha1msg1_epu32(m[(i - 1) & 3],m[i & 3]); \
+    if (i >= 2 && i <= 17) \
+	m[(i - 2) & 3] = _mm_xor_si128(m[(i - 2) & 3],m[i & 3])
+
+// SHA1 compression function using the SHA-NI instructions
+SRTP_SHA static void sha1Native(u_int32_t* state, const unsigned char* data, unsigned int blocks)
+{
+    const __m128i swap = _mm_set_epi64x(0x0001020304050607ULL,0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state),0x1b);
+    __m128i e0 = _mm_set_epi32(state[4],0,0,0);
+    __m128i e1 = _mm_setzero_si128();
+    __m128i m[4];
+    for (; blocks; blocks--, data += 64) {
+	__m128i abcdSave = abcd;
+	__m128i eSave = e0;
+	for (int i = 0; i < 4; i++)
+	    m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)),swap);
+	SHA_ROUNDS(0,0,e0,e1);
+	SHA_ROUNDS(1,0,e1,e0);
+	SHA_ROUNDS(2,0,e0,e1);
+	SHA_ROUNDS(3,0,e1,e0);
+	SHA_ROUNDS(4,0,e0,e1);
+	SHA_ROUNDS(5,1,e1,e0);
+	SHA_ROUNDS(6,1,e0,e1);
+	SHA_ROUNDS(7,1,e1,e0);
+	SHA_ROUNDS(8,1,e0,e1);
+	SHA_ROUNDS(9,1,e1,e0);
+	SHA_ROUNDS(10,2,e0,e1);
+	SHA_ROUNDS(11,2,e1,e0);
+	SHA_ROUNDS(12,2,e0,e1);
+	SHA_ROUNDS(13,2,e1,e0);
+	SHA_ROUNDS(14,2,e0,e1);
+	SHA_ROUNDS(15,3,e1,e0);
+	SHA_ROUNDS(16,3,e0,e1);
+	SHA_ROUNDS(17,3,e1,e0);
+	SHA_ROUNDS(18,3,e0,e1);
+	SHA_ROUNDS(19,3,e1,e0);
+	e0 = _mm_sha1nexte_epu32(e0,eSave);
+	abcd = _mm_add_epi32(abcd,abcdSave);
+    }
+    _mm_storeu_si128((__m128i*)state,_mm_shuffle_epi32(abcd,0x1b));
+    state[4] = _mm_extract_epi32(e0,3);
+}
+
+#undef SHA_ROUNDS
+
+SRTP_AES static inline __m128i aesExpand(__m128i key, __m128i assist)
+{
+    assist = _mm_shuffle_epi32(assist,0xff);
+    key = _mm_xor_si128(key,_mm_slli_si128(key,4));
+    key = _mm_xor_si128(key,_mm_slli_si128(key,4));
+    key = _mm_xor_si128(key,_mm_slli_si128(key,4));
+    return _mm_xor_si128(key,assist);
+}
+
+#define AES_EXPAND(n,rcon) \
+    k[n] = aesExpand(k[n - 1],_mm_aeskeygenassist_si128(k[n - 1],rcon))
+
+// Expand an AES-128 key into the 11 round keys
+SRTP_AES static void aesKeys(unsigned char* keys, const unsigned char* key)
+{
+    __m128i k[11];
+    k[0] = _mm_loadu_si128((const __m128i*)key);
+    AES_EXPAND(1,0x01);
+    AES_EXPAND(2,0x02);
+    AES_EXPAND(3,0x04);
+    AES_EXPAND(4,0x08);
+    AES_EXPAND(5,0x10);
+    AES_EXPAND(6,0x20);
+    AES_EXPAND(7,0x40);
+    AES_EXPAND(8,0x80);
+    AES_EXPAND(9,0x1b);
+    AES_EXPAND(10,0x36);
+    for (int i = 0; i < 11; i++)
+	_mm_storeu_si128((__m128i*)(keys + 16 * i),k[i]);
+}
+
+#undef AES_EXPAND
+
+// Build counter block number n, RFC 3711 keeps it in the last 16 bits of the IV
+SRTP_AES static inline __m128i aesCounter(__m128i iv, unsigned int n)
+{
+    return _mm_insert_epi16(iv,(int)(((n & 0xff) << 8) | ((n >> 8) & 0xff)),7);
+}
+
+// AES-128 in counter mode, generates 4 keystream blocks at once to fill the pipeline
+SRTP_AES static void aesCtr(const unsigned char* keys, const unsigned char* ivData,
+    unsigned char* data, unsigned int len)
+{
+    __m128i k[11];
+    for (int i = 0; i < 11; i++)
+	k[i] = _mm_loadu_si128((const __m128i*)(keys + 16 * i));
+    __m128i iv = _mm_loadu_si128((const __m128i*)ivData);
+    unsigned int n = 0;
+    for (; len >= 64; len -= 64, data += 64, n += 4) {
+	__m128i b0 = _mm_xor_si128(aesCounter(iv,n),k[0]);
+	__m128i b1 = _mm_xor_si128(aesCounter(iv,n + 1),k[0]);
+	__m128i b2 = _mm_xor_si128(aesCounter(iv,n + 2),k[0]);
+	__m128i b3 = _mm_xor_si128(aesCounter(iv,n + 3),k[0]);
+	for (int r = 1; r < 10; r++) {
+	    b0 = _mm_aesenc_si128(b0,k[r]);
+	    b1 = _mm_aesenc_si128(b1,k[r]);
+	    b2 = _mm_aesenc_si128(b2,k[r]);
+	    b3 = _mm_aesenc_si128(b3,k[r]);
+	}
+	__m128i* p = (__m128i*)data;
+	_mm_storeu_si128(p,_mm_xor_si128(_mm_loadu_si128(p),_mm_aesenclast_si128(b0,k[10])));
+	_mm_storeu_si128(p + 1,_mm_xor_si128(_mm_loadu_si128(p + 1),_mm_aesenclast_si128(b1,k[10])));
+	_mm_storeu_si128(p + 2,_mm_xor_si128(_mm_loadu_si128(p + 2),_mm_aesenclast_si128(b2,k[10])));
+	_mm_storeu_si128(p + 3,_mm_xor_si128(_mm_loadu_si128(p + 3),_mm_aesenclast_si128(b3,k[10])));
+    }
+    for (; len; n++) {
+	__m128i b = _mm_xor_si128(aesCounter(iv,n),k[0]);
+	for (int r = 1; r < 10; r++)
+	    b = _mm_aesenc_si128(b,k[r]);
+	b = _mm_aesenclast_si128(b,k[10]);
+	if (len >= 16) {
+	    __m128i* p = (__m128i*)data;
+	    _mm_storeu_si128(p,_mm_xor_si128(_mm_loadu_si128(p),b));
+	    len -= 16;
+	    data += 16;
+	    continue;
+	}
+	unsigned char ks[16];
+	_mm_storeu_si128((__m128i*)ks,b);
+	for (unsigned int i = 0; i < len; i++)
+	    data[i] ^= ks[i];
+	break;
+    }
+}
+
+#endif // SRTP_X86
+
+// CPU features detected once at load time
+#ifdef SRTP_X86
+static bool s_cpuAes = false;
+#endif
+static SHA1Blocks s_sha1Blocks = sha1Generic;
+static const char* s_fastName = "generic";
+static bool s_fastPath = true;
+
+static bool detectCpu()
+{
+#ifdef SRTP_X86
+    unsigned int a = 0, b = 0, c = 0, d = 0;
+    if (!__get_cpuid(1,&a,&b,&c,&d))
+	return false;
+    // AES-NI in ECX bit 25, SHA code also needs SSE4.1 (bit 19) and SSSE3 (bit 9)
+    s_cpuAes = (0 != (c & (1 << 25)));
+    bool sse = (0 != (c & (1 << 19))) && (0 != (c & (1 << 9)));
+    if (sse && __get_cpuid_max(0,0) >= 7) {
+	__cpuid_count(7,0,a,b,c,d);
+	if (b & (1 << 29))
+	    s_sha1Blocks = sha1Native;
+    }
+    bool sha = (s_sha1Blocks != sha1Generic);
+    if (s_cpuAes)
+	s_fastName = sha ? "aes-ni,sha-ni" : "aes-ni";
+    else if (sha)
+	s_fastName = "sha-ni";
+#endif
+    return true;
+}
+
+static bool s_cpuChecked = detectCpu();
+
+namespace TelEngine {
+
+// Precomputed per session SRTP state for the native code path
+class RTPSecureFast
+{
+public:
+    RTPSecureFast(const DataBlock& cipherKey, const DataBlock& cipherSalt, const DataBlock& authKey);
+    inline bool cipher() const
+	{ return m_cipher; }
+    void crypt(unsigned char* data, int len, u_int32_t ssrc, u_int64_t seq) const;
+    void hmac(const unsigned char* data, int len, u_int32_t roc, unsigned char* digest) const;
+private:
+    unsigned char m_keys[176];
+    unsigned char m_salt[16];
+    u_int32_t m_inner[5];
+    u_int32_t m_outer[5];
+    bool m_cipher;
+};
+
+}; // namespace TelEngine
+
+RTPSecureFast::RTPSecureFast(const DataBlock& cipherKey, const DataBlock& cipherSalt, const DataBlock& authKey)
+    : m_cipher(false)
+{
+    ::memset(m_keys,0,sizeof(m_keys));
+    ::memset(m_salt,0,sizeof(m_salt));
+#ifdef SRTP_X86
+    if (s_cpuAes && (cipherKey.length() == 16) && (cipherSalt.length() == 16)) {
+	aesKeys(m_keys,(const unsigned char*)cipherKey.data());
+	::memcpy(m_salt,cipherSalt.data(),16);
+	m_cipher = true;
+    }
+#endif
+    // HMAC inner and outer states after hashing the padded key, computed once
+    static const u_int32_t init[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    const unsigned char* key = (const unsigned char*)authKey.data();
+    unsigned char ipad[64];
+    unsigned char opad[64];
+    for (unsigned int i = 0; i < 64; i++) {
+	unsigned char c = (i < authKey.length()) ? key[i] : 0;
+	ipad[i] = c ^ 0x36;
+	opad[i] = c ^ 0x5c;
+    }
+    ::memcpy(m_inner,init,sizeof(m_inner));
+    ::memcpy(m_outer,init,sizeof(m_outer));
+    s_sha1Blocks(m_inner,ipad,1);
+    s_sha1Blocks(m_outer,opad,1);
+}
+
+void RTPSecureFast::crypt(unsigned char* data, int len, u_int32_t ssrc, u_int64_t seq) const
+{
+#ifdef SRTP_X86
+    unsigned char iv[16];
+    ::memcpy(iv,m_salt,16);
+    // SSRC << 64, index << 16
+    for (int i = 7; i >= 4; i--) {
+	iv[i] ^= (ssrc & 0xff);
+	ssrc >>= 8;
+    }
+    for (int i = 13; i >= 8; i--) {
+	iv[i] ^= (seq & 0xff);
+	seq >>= 8;
+    }
+    aesCtr(m_keys,iv,data,len);
+#endif
+}
+
+void RTPSecureFast::hmac(const unsigned char* data, int len, u_int32_t roc, unsigned char* digest) const
+{
+    u_int32_t st[5];
+    unsigned char buf[128];
+    // inner hash over packet and ROC, all full blocks straight from the packet
+    ::memcpy(st,m_inner,sizeof(st));
+    unsigned int full = len / 64;
+    s_sha1Blocks(st,data,full);
+    unsigned int rem = len - 64 * full;
+    ::memcpy(buf,data + 64 * full,rem);
+    putBE32(buf + rem,roc);
+    rem += 4;
+    buf[rem++] = 0x80;
+    unsigned int blocks = (rem <= 56) ? 1 : 2;
+    ::memset(buf + rem,0,64 * blocks - rem);
+    u_int64_t bits = ((u_int64_t)len + 68) << 3;
+    putBE32(buf + 64 * blocks - 8,(u_int32_t)(bits >> 32));
+    putBE32(buf + 64 * blocks - 4,(u_int32_t)bits);
+    s_sha1Blocks(st,buf,blocks);
+    // outer hash over the inner digest fits a single block
+    for (int i = 0; i < 5; i++)
+	putBE32(buf + 4 * i,st[i]);
+    buf[20] = 0x80;
+    ::memset(buf + 21,0,41);
+    buf[62] = ((64 + 20) * 8) >> 8;
+    buf[63] = ((64 + 20) * 8) & 0xff;
+    ::memcpy(st,m_outer,sizeof(st));
+    s_sha1Blocks(st,buf,1);
+    for (int i = 0; i < 5; i++)
+	putBE32(digest + 4 * i,st[i]);
+}
+
 
 RTPSecure::RTPSecure(DebugEnabler* dbg, const char* traceId)
     : RTPDebug(dbg,traceId),
-      m_owner(0), m_rtpCipher(0),
+      m_owner(0), m_rtpCipher(0), m_fast(0),
       m_rtpAuthLen(0), m_rtpEncrypted(false)
 {
     DDebug(this->dbg(),DebugAll,"RTPSecure::RTPSecure() [%p]",this);
@@ -38,7 +383,7 @@ RTPSecure::RTPSecure(DebugEnabler* dbg, const char* traceId)
 
 RTPSecure::RTPSecure(const String& suite, DebugEnabler* dbg, const char* traceId)
     : RTPDebug(dbg,traceId),
-      m_owner(0), m_rtpCipher(0),
+      m_owner(0), m_rtpCipher(0), m_fast(0),
       m_rtpAuthLen(4), m_rtpEncrypted(true)
 {
     DDebug(this->dbg(),DebugAll,"RTPSecure::RTPSecure('%s') [%p]",suite.c_str(),this);
@@ -54,7 +399,7 @@ RTPSecure::RTPSecure(const String& suite, DebugEnabler* dbg, const char* traceId
 
 RTPSecure::RTPSecure(const RTPSecure& other)
     : GenObject(), RTPDebug(other.dbg(),other.m_traceId),
-      m_owner(0), m_rtpCipher(0),
+      m_owner(0), m_rtpCipher(0), m_fast(0),
       m_rtpAuthLen(other.m_rtpAuthLen), m_rtpEncrypted(other.m_rtpEncrypted)
 {
     DDebug(dbg(),DebugAll,"RTPSecure::~RTPSecure(%p) [%p]",&other,this);
@@ -64,6 +409,7 @@ RTPSecure::~RTPSecure()
 {
     DDebug(dbg(),DebugAll,"RTPSecure::~RTPSecure() [%p]",this);
     TelEngine::destruct(m_rtpCipher);
+    delete m_fast;
 }
 
 void RTPSecure::owner(RTPBaseIO* newOwner)
@@ -111,10 +457,13 @@ void RTPSecure::init()
 	// preinitialize the two partial digests
 	m_authIpad.update(ipad,sizeof(ipad));
 	m_authOpad.update(opad,sizeof(opad));
+	if (s_fastPath)
+	    m_fast = new RTPSecureFast(m_cipherKey,m_cipherSalt,authKey);
 	// finally, prepare the cipher for RTP processing
 	cipher->setKey(m_cipherKey);
 	m_rtpCipher = cipher;
-	DDebug(dbg(),DebugInfo,"RTPSecure::init() got cipher=%p [%p]",cipher,this);
+	DDebug(dbg(),DebugInfo,"RTPSecure::init() got cipher=%p fast=%s [%p]",cipher,
+	    (m_fast ? (m_fast->cipher() ? s_fastName : "hmac") : "no"),this);
     }
 }
 
@@ -214,6 +563,16 @@ bool RTPSecure::create(String& suite, String& keyParams, bool buildMaster)
     return true;
 }
 
+void RTPSecure::fastPath(bool enable)
+{
+    s_fastPath = enable;
+}
+
+const char* RTPSecure::fastPath()
+{
+    return s_fastPath ? s_fastName : "disabled";
+}
+
 bool RTPSecure::deriveKey(Cipher& cipher, DataBlock& key, unsigned int len, unsigned char label, u_int64_t index)
 {
     if (!(len && m_masterSalt.length()))
@@ -247,21 +606,29 @@ bool RTPSecure::rtpDecipher(unsigned char* data, int len, const void* secData, u
 	return true;
     if (!(len && m_rtpCipher))
 	return false;
-    DataBlock iv(m_cipherSalt);
+    if (m_fast && m_fast->cipher()) {
+	m_fast->crypt(data,len,ssrc,seq);
+	return true;
+    }
+    unsigned int ivLen = m_cipherSalt.length();
+    if (ivLen > 16)
+	return false;
+    unsigned char iv[16];
+    ::memcpy(iv,m_cipherSalt.data(),ivLen);
     int i;
     // SSRC << 64
-    unsigned char* p = (iv.length() - 8) + (unsigned char*)iv.data();
+    unsigned char* p = iv + ivLen - 8;
     for (i = 0; i < 4; i++) {
 	*--p ^= (ssrc & 0xff);
 	ssrc >>= 8;
     }
     // index << 16
-    p = (iv.length() - 2) + (unsigned char*)iv.data();
+    p = iv + ivLen - 2;
     for (i = 0; i < 6; i++) {
 	*--p ^= (seq & 0xff);
 	seq >>= 8;
     }
-    m_rtpCipher->initVector(iv);
+    m_rtpCipher->initVector(iv,ivLen);
     m_rtpCipher->decrypt(data,len);
     return true;
 }
@@ -274,26 +641,20 @@ bool RTPSecure::rtpCheckIntegrity(const unsigned char* data, int len, const void
 	return false;
 
     // RFC 3711 4.2
-    u_int32_t roc = htonl((u_int32_t)(seq >> 16));
-    SHA1 h1(m_authIpad);
-    h1.update(data,len);
-    h1.update(&roc,sizeof(roc));
-    h1.finalize();
-    SHA1 hmac(m_authOpad);
-    hmac.update(h1.rawDigest(),h1.rawLength());
-    hmac.finalize();
+    unsigned char digest[20];
+    hmac(data,len,(u_int32_t)(seq >> 16),digest);
 #ifdef DEBUG
-    if (::memcmp(authData,hmac.rawDigest(),m_rtpAuthLen)) {
+    if (::memcmp(authData,digest,m_rtpAuthLen)) {
 	String s1,s2;
 	s1.hexify((void*)authData,m_rtpAuthLen);
-	s2.hexify((void*)hmac.rawDigest(),m_rtpAuthLen);
+	s2.hexify(digest,m_rtpAuthLen);
 	Debug(dbg(),DebugMild,"SRTP HMAC recv: %s calc: %s seq: " FMT64U " [%p]",
 	    s1.c_str(),s2.c_str(),seq,this);
 	return false;
     }
     return true;
 #else
-    return 0 == ::memcmp(authData,hmac.rawDigest(),m_rtpAuthLen);
+    return 0 == ::memcmp(authData,digest,m_rtpAuthLen);
 #endif
 }
 
@@ -311,15 +672,26 @@ void RTPSecure::rtpAddIntegrity(const unsigned char* data, int len, unsigned cha
 	return;
 
     // RFC 3711 4.2
-    u_int32_t roc = htonl(m_owner->rollover());
+    unsigned char digest[20];
+    hmac(data,len,m_owner->rollover(),digest);
+    ::memcpy(authData,digest,m_rtpAuthLen);
+}
+
+void RTPSecure::hmac(const unsigned char* data, int len, u_int32_t roc, unsigned char* digest)
+{
+    if (m_fast) {
+	m_fast->hmac(data,len,roc,digest);
+	return;
+    }
+    roc = htonl(roc);
     SHA1 h1(m_authIpad);
     h1.update(data,len);
     h1.update(&roc,sizeof(roc));
     h1.finalize();
-    SHA1 hmac(m_authOpad);
-    hmac.update(h1.rawDigest(),h1.rawLength());
-    hmac.finalize();
-    ::memcpy(authData,hmac.rawDigest(),m_rtpAuthLen);
+    SHA1 h2(m_authOpad);
+    h2.update(h1.rawDigest(),h1.rawLength());
+    h2.finalize();
+    ::memcpy(digest,h2.rawDigest(),20);
 }
 
 /* vi: set ts=8 sw=4 sts=4 noet: */
@@ -33,6 +33,13 @@ using namespace TelEngine;
 // How many packets in a row will resync sequence
 #define SEQ_RESYNC_COUNT 5
 
+// Number of IFPs kept for UDPTL error recovery, must be a power of 2
+#define UDPTL_RING 16
+// Longest UDPTL IFP that can be sent or recovered
+#define UDPTL_IFP 255
+// Longest UDPTL packet
+#define UDPTL_MAX_LEN 1492
+
 RTPDebug::RTPDebug(RTPSession* session)
     : m_dbg(0)
 {
@@ -139,6 +146,25 @@ void RTPReceiver::setDejitter(RTPDejitter* dejitter)
     m_dejitter = dejitter;
 }
 
+void RTPReceiver::rtpPacket(const DataBlock& packet)
+{
+    const DataBlock* old = m_packet;
+    m_packet = &packet;
+    rtpData(packet.data(),packet.length());
+    m_packet = old;
+}
+
+bool RTPReceiver::packetSlice(DataBlock& dest, const void* data, int len) const
+{
+    if (!(m_packet && m_packet->buffer()) || len < 0)
+	return false;
+    const unsigned char* start = (const unsigned char*)m_packet->data();
+    const unsigned char* ptr = (const unsigned char*)data;
+    if (ptr < start || ptr + len > start + m_packet->length())
+	return false;
+    return dest.slice(*m_packet,ptr - start,len);
+}
+
 void RTPReceiver::rtpData(const void* data, int len)
 {
     // trivial check for basic fields validity
@@ -196,6 +222,7 @@ void RTPReceiver::rtpData(const void* data, int len)
 	m_seq = seq-1;
 	m_seqCount = 0;
 	m_warn = true;
+	m_arrivalBase = 0;
 	if (m_debugData)
 	    TraceDebug(m_traceId,dbg(),m_debugDataLevel,"RTP recv INIT SEQ=%u TS=%u TS_LAST=%u [%p]",
 		seq,ts,m_tsLast,this);
@@ -219,6 +246,7 @@ void RTPReceiver::rtpData(const void* data, int len)
 	m_seq = seq;
 	m_ts = ts - m_tsLast;
 	m_seqCount = 0;
+	m_arrivalBase = 0;
 	if (m_debugData)
 	    TraceDebug(m_traceId,dbg(),m_debugDataLevel,
 		"RTP recv SEQ=%u TS=%u TS_LAST=%u new SSRC accepted, dropping [%p]",
@@ -328,22 +356,47 @@ void RTPReceiver::rtpData(const void* data, int len)
     // keep track of the last valid sequence number and timestamp we have seen
     m_seq = seq;
     m_rollover = rollover;
+    updateJitter(ts);
 
     if (m_dejitter) {
-	if (!m_dejitter->rtpRecv(marker,typ,m_tsLast,pc,len))
-	    m_ioLostPkt++;
+	// the dejitter buffer accounts the packets it fails to deliver
+	m_dejitter->rtpRecv(seq,marker,typ,m_tsLast,pc,len);
 	return;
     }
-    if (ds > 1)
+    if (ds > 1) {
 	m_ioLostPkt += (ds - 1);
-    if (ds >= 1)
+	m_quality.lost(ds - 1);
+    }
+    if (ds >= 1) {
+	m_quality.received(m_tsLast);
 	rtpRecv(marker,typ,m_tsLast,pc,len);
+    }
+    else
+	m_quality.discarded();
 }
 
 void RTPReceiver::rtcpData(const void* data, int len)
 {
 }
 
+// Update the interarrival jitter estimate as described in RFC 3550 A.8
+void RTPReceiver::updateJitter(u_int32_t timestamp)
+{
+    u_int64_t now = Time::now();
+    if (!m_arrivalBase) {
+	m_arrivalBase = now;
+	m_transit = 0 - timestamp;
+	return;
+    }
+    u_int32_t arrival = (u_int32_t)((now - m_arrivalBase) * m_clockRate / 1000000);
+    u_int32_t transit = arrival - timestamp;
+    int32_t d = (int32_t)(transit - m_transit);
+    m_transit = transit;
+    if (d < 0)
+	d = -d;
+    m_jitter += d - ((m_jitter + 8) >> 4);
+}
+
 bool RTPReceiver::rtpRecv(bool marker, int payload, unsigned int timestamp, const void* data, int len)
 {
     if ((payload != dataPayload()) && (payload != eventPayload()) && (payload != silencePayload()))
@@ -481,6 +534,60 @@ void RTPReceiver::stats(NamedList& stat) const
     stat.setParam("synclost",String(m_syncLost));
     stat.setParam("wrongssrc",String(m_wrongSSRC));
     stat.setParam("seqslost",String(m_seqLost));
+    stat.setParam("jitter",String(jitterUsec() / 1000));
+    if (m_dejitter) {
+	stat.setParam("latepkts",String(m_dejitter->late()));
+	stat.setParam("playout",String(m_dejitter->delay() / 1000));
+    }
+    qualityStats(stat);
+}
+
+unsigned int RTPReceiver::endDelay() const
+{
+    unsigned int delay = m_quality.frameTime(m_clockRate);
+    if (m_dejitter)
+	delay += m_dejitter->delay() / 1000;
+    return delay;
+}
+
+void RTPReceiver::qualityStats(NamedList& stat) const
+{
+    if (!m_quality.packets())
+	return;
+    unsigned int bDensity, gDensity, bDuration, gDuration;
+    m_quality.bursts(m_clockRate,bDensity,gDensity,bDuration,gDuration);
+    int rFactor = m_quality.rFactor(endDelay());
+    unsigned int mos = RTPQuality::mos(rFactor);
+    unsigned int mosLq = RTPQuality::mos(m_quality.rFactor());
+    stat.setParam("discardpkts",String(m_quality.discardedPackets()));
+    // densities are reported in percent
+    stat.setParam("burstdensity",String(bDensity * 100 / 256));
+    stat.setParam("burstduration",String(bDuration));
+    stat.setParam("gapdensity",String(gDensity * 100 / 256));
+    stat.setParam("gapduration",String(gDuration));
+    stat.setParam("enddelay",String(endDelay()));
+    stat.setParam("rfactor",String(rFactor));
+    String tmp;
+    tmp << (mos / 10) << "." << (mos % 10);
+    stat.setParam("mos",tmp);
+    tmp.clear();
+    tmp << (mosLq / 10) << "." << (mosLq % 10);
+    stat.setParam("mos_lq",tmp);
+}
+
+void RTPReceiver::qualityStats(String& stats) const
+{
+    if (!m_quality.packets())
+	return;
+    unsigned int bDensity, gDensity, bDuration, gDuration;
+    m_quality.bursts(m_clockRate,bDensity,gDensity,bDuration,gDuration);
+    int rFactor = m_quality.rFactor(endDelay());
+    unsigned int mos = RTPQuality::mos(rFactor);
+    stats.append("PD=",",") << m_quality.discardedPackets();
+    stats << ",BD=" << (bDensity * 100 / 256) << ",BL=" << bDuration;
+    stats << ",GD=" << (gDensity * 100 / 256) << ",GL=" << gDuration;
+    stats << ",ED=" << endDelay() << ",RF=" << rFactor;
+    stats << ",MOS=" << (mos / 10) << "." << (mos % 10);
 }
 
 
@@ -498,7 +605,7 @@ bool RTPSender::rtpSend(bool marker, int payload, unsigned int timestamp, const
 {
     if (m_debugData) {
 	const char* oper = "send";
-	if (!(m_session && m_session->UDPSession::transport()))
+	if (!(m_session && m_session->UDPSession::transport()) || m_session->dtlsPending())
 	    oper = "not sending";
 	TraceDebug(m_traceId,dbg(),m_debugDataLevel,
 	    "RTP %s seq=%u payload=%d ts=%u len=%u  [%p]",
@@ -507,6 +614,9 @@ bool RTPSender::rtpSend(bool marker, int payload, unsigned int timestamp, const
 
     if (!(m_session && m_session->UDPSession::transport()))
 	return false;
+    // no clear media while DTLS is negotiating the SRTP keys
+    if (m_session->dtlsPending())
+	return false;
 
     if (!data)
 	len = 0;
@@ -734,6 +844,9 @@ bool UDPSession::initGroup(int msec, Thread::Priority prio, const String& affini
     // try to pick the group from the transport if it has one
     if (m_transport)
 	group(m_transport->group());
+    // use the shared pool if one was set up
+    if (!m_group)
+	RTPGroup::joinPool(this);
     if (!m_group)
 	group(new RTPGroup(msec,prio,affinity));
     if (!m_group)
@@ -771,7 +884,8 @@ RTPSession::RTPSession(DebugEnabler* dbg, const char* traceId)
     : UDPSession(dbg,traceId), Mutex(true,"RTPSession"),
       m_direction(FullStop),
       m_send(0), m_recv(0), m_secure(0),
-      m_reportTime(0), m_reportInterval(0),
+      m_dtls(0), m_dtlsKeyed(false), m_dtlsFailed(false),
+      m_reportTime(0), m_reportInterval(0), m_reportXR(false),
       m_warnSeq(1)
 {
     DDebug(this->dbg(),DebugInfo,"RTPSession::RTPSession() [%p]",this);
@@ -784,6 +898,7 @@ RTPSession::~RTPSession()
     group(0);
     transport(0);
     TelEngine::destruct(m_secure);
+    dtlsClear();
 }
 
 void RTPSession::timerTick(const Time& when)
@@ -792,6 +907,8 @@ void RTPSession::timerTick(const Time& when)
 	static_cast<RTPBaseIO*>(m_send)->timerTick(when);
     if (m_recv)
 	static_cast<RTPBaseIO*>(m_recv)->timerTick(when);
+    if (m_dtls)
+	dtlsTick();
 
     if (m_timeoutInterval) {
 	// only check timeout if we have a receiver
@@ -815,6 +932,8 @@ void RTPSession::timerTick(const Time& when)
 
 void RTPSession::rtpData(const void* data, int len)
 {
+    if (m_dtls && dtlsData(data,len))
+	return;
     if ((m_direction & RecvOnly) == 0)
 	return;
     if (m_recv) {
@@ -823,6 +942,18 @@ void RTPSession::rtpData(const void* data, int len)
     }
 }
 
+void RTPSession::rtpPacket(const DataBlock& packet)
+{
+    if (m_dtls && dtlsData(packet.data(),packet.length()))
+	return;
+    if ((m_direction & RecvOnly) == 0)
+	return;
+    if (m_recv) {
+	m_timeoutTime = 0;
+	m_recv->rtpPacket(packet);
+    }
+}
+
 void RTPSession::rtcpData(const void* data, int len)
 {
     if ((m_direction & RecvOnly) == 0)
@@ -885,6 +1016,8 @@ void RTPSession::transport(RTPTransport* trans)
     if (!trans)
 	sendRtcpBye();
     UDPSession::transport(trans);
+    if (m_transport)
+	m_transport->acceptDtls(0 != m_dtls);
     if (!m_transport)
 	m_direction = FullStop;
 }
@@ -994,11 +1127,15 @@ void RTPSession::getStats(String& stats) const
 	stats.append("PR=",",") << m_recv->ioPackets();
 	stats << ",OR=" << m_recv->ioOctets();
 	stats << ",PL=" << m_recv->ioPacketsLost();
+	stats << ",JI=" << (m_recv->jitterUsec() / 1000);
+	if (m_recv->dejitter())
+	    stats << ",PLT=" << m_recv->dejitter()->late();
     }
 }
 
-void RTPSession::setReports(int interval)
+void RTPSession::setReports(int interval, bool extended)
 {
+    m_reportXR = extended;
     if (interval > 0 && m_transport && m_transport->rtcpSock()->valid()) {
 	if (interval < 500)
 	    interval = 500;
@@ -1028,11 +1165,61 @@ static void store32(unsigned char* buf, unsigned int& len, u_int32_t val)
     buf[len++] = (unsigned char)(val & 0xff);
 }
 
+static void store16(unsigned char* buf, unsigned int& len, unsigned int val)
+{
+    if (val > 0xffff)
+	val = 0xffff;
+    buf[len++] = (unsigned char)(val >> 8);
+    buf[len++] = (unsigned char)(val & 0xff);
+}
+
+// Append a RTCP XR packet holding a VoIP metrics block (RFC 3611 4.7)
+static void storeXR(unsigned char* buf, unsigned int& len, u_int32_t ssrc, const RTPReceiver* recv)
+{
+    const RTPQuality& q = recv->quality();
+    buf[len++] = 0x80;
+    buf[len++] = 0xcf; // XR
+    store16(buf,len,10);
+    store32(buf,len,ssrc);
+    buf[len++] = 7; // VoIP Metrics
+    buf[len++] = 0;
+    store16(buf,len,8);
+    store32(buf,len,recv->ssrc());
+    unsigned int bDensity, gDensity, bDuration, gDuration;
+    q.bursts(recv->clockRate(),bDensity,gDensity,bDuration,gDuration);
+    buf[len++] = (unsigned char)q.lossRate();
+    buf[len++] = (unsigned char)q.discardRate();
+    buf[len++] = (unsigned char)bDensity;
+    buf[len++] = (unsigned char)gDensity;
+    store16(buf,len,bDuration);
+    store16(buf,len,gDuration);
+    // round trip delay is not measured
+    store16(buf,len,0);
+    store16(buf,len,recv->endDelay());
+    // signal, noise and residual echo levels are unavailable
+    buf[len++] = 127;
+    buf[len++] = 127;
+    buf[len++] = 127;
+    buf[len++] = (unsigned char)RTPQuality::minGap();
+    int rFactor = q.rFactor(recv->endDelay());
+    buf[len++] = (unsigned char)rFactor;
+    buf[len++] = 127;
+    buf[len++] = (unsigned char)RTPQuality::mos(q.rFactor());
+    buf[len++] = (unsigned char)RTPQuality::mos(rFactor);
+    RTPDejitter* dej = recv->dejitter();
+    // receiver configuration: adaptive jitter buffer if we have one
+    buf[len++] = dej ? 0x30 : 0x00;
+    buf[len++] = 0;
+    store16(buf,len,dej ? dej->delay() / 1000 : 0);
+    store16(buf,len,dej ? dej->maxDelay() / 1000 : 0);
+    store16(buf,len,dej ? dej->maxDelay() / 1000 : 0);
+}
+
 void RTPSession::sendRtcpReport(const Time& when)
 {
     if (!((m_send || m_recv) && m_transport && m_transport->rtcpSock()->valid()))
 	return;
-    unsigned char buf[52];
+    unsigned char buf[96];
     buf[0] = 0x80; // RC=0
     buf[1] = 0xc9; // RR
     buf[2] = 0;
@@ -1057,8 +1244,8 @@ void RTPSession::sendRtcpReport(const Time& when)
 	u_int32_t lostf = 0xff & (lost * 255 / (lost + m_recv->ioPackets()));
 	store32(buf,len,(lost & 0xffffff) | (lostf << 24));
 	store32(buf,len,(uint32_t)m_recv->fullSeq());
-	// TODO: Compute and store Jitter, LSR and DLSR
-	store32(buf,len,0);
+	store32(buf,len,m_recv->jitter());
+	// TODO: Compute and store LSR and DLSR
 	store32(buf,len,0);
 	store32(buf,len,0);
     }
@@ -1067,8 +1254,11 @@ void RTPSession::sendRtcpReport(const Time& when)
 	return;
     DDebug(dbg(),DebugInfo,"RTPSession sending RTCP Report [%p]",this);
     unsigned int lptr = 4;
-    store32(buf,lptr,(m_send ? m_send->ssrcInit() : 0));
+    u_int32_t ssrc = m_send ? m_send->ssrcInit() : 0;
+    store32(buf,lptr,ssrc);
     buf[3] = (len - 1) / 4; // same as ((len + 3) / 4) - 1
+    if (m_reportXR && m_recv && m_recv->quality().packets())
+	storeXR(buf,len,ssrc,m_recv);
     static_cast<RTPProcessor*>(m_transport)->rtcpData(buf,len);
 }
 
@@ -1100,22 +1290,80 @@ void RTPSession::incWrongSrc()
 }
 
 
+namespace TelEngine {
+
+// An IFP kept for building or using UDPTL error recovery data
+struct UDPTLEntry
+{
+    int len;
+    u_int16_t seq;
+    unsigned char data[UDPTL_IFP];
+};
+
+// Rings of the IFPs recently sent and received by an UDPTL session
+class UDPTLBuffer
+{
+public:
+    inline UDPTLBuffer()
+	{ reset(tx); reset(rx); }
+    static inline void reset(UDPTLEntry* ring)
+	{
+	    for (int i = 0; i < UDPTL_RING; i++)
+		ring[i].len = -1;
+	}
+    static inline const UDPTLEntry* find(const UDPTLEntry* ring, u_int16_t seq)
+	{
+	    const UDPTLEntry& e = ring[seq & (UDPTL_RING - 1)];
+	    return ((e.len >= 0) && (e.seq == seq)) ? &e : 0;
+	}
+    static inline void store(UDPTLEntry* ring, u_int16_t seq, const void* data, int len)
+	{
+	    UDPTLEntry& e = ring[seq & (UDPTL_RING - 1)];
+	    e.seq = seq;
+	    e.len = len;
+	    ::memcpy(e.data,data,len);
+	}
+    UDPTLEntry tx[UDPTL_RING];
+    UDPTLEntry rx[UDPTL_RING];
+};
+
+};
+
 UDPTLSession::UDPTLSession(u_int16_t maxLen, u_int8_t maxSec, DebugEnabler* dbg, const char* traceId)
     : UDPSession(dbg,traceId), Mutex(true,"UDPTLSession"),
       m_rxSeq(0xffff), m_txSeq(0xffff),
-      m_maxLen(maxLen), m_maxSec(maxSec),
-      m_warn(true)
+      m_maxLen(maxLen), m_maxSec(maxSec), m_fecSpan(0), m_fecEntries(0),
+      m_warn(true), m_recovered(0), m_lost(0), m_buffer(new UDPTLBuffer)
 {
     DDebug(this->dbg(),DebugInfo,"UDPTLSession::UDPTLSession(%u,%u) [%p]",maxLen,maxSec,this);
     if (m_maxLen < 96)
 	m_maxLen = 96;
-    else if (m_maxLen > 1492)
-	m_maxLen = 1492;
+    else if (m_maxLen > UDPTL_MAX_LEN)
+	m_maxLen = UDPTL_MAX_LEN;
 }
 
 UDPTLSession::~UDPTLSession()
 {
-    DDebug(dbg(),DebugInfo,"UDPTLSession::~UDPTLSession() [%p]",this);
+    DDebug(dbg(),DebugInfo,"UDPTLSession::~UDPTLSession() recovered=%u lost=%u [%p]",
+	m_recovered,m_lost,this);
+    delete m_buffer;
+}
+
+bool UDPTLSession::setFec(unsigned int span, unsigned int entries)
+{
+    Lock lck(this);
+    if (!span) {
+	m_fecSpan = m_fecEntries = 0;
+	return true;
+    }
+    if (!entries)
+	entries = 1;
+    // all IFPs covered by a packet must still be in the ring
+    if (span * entries >= UDPTL_RING)
+	return false;
+    m_fecSpan = span;
+    m_fecEntries = entries;
+    return true;
 }
 
 void UDPTLSession::timerTick(const Time& when)
@@ -1169,6 +1417,8 @@ void UDPTLSession::rtpData(const void* data, int len)
 	}
 	ds = 1;
     }
+    // keep even late IFPs, they may help recovering others from parity data
+    UDPTLBuffer::store(m_buffer->rx,seq,pd+3,pLen);
     if (ds < 0) {
 	// received old packet
 	if (m_warn) {
@@ -1180,9 +1430,22 @@ void UDPTLSession::rtpData(const void* data, int len)
     m_warn = true;
     if (ds > 1) {
 	// some packets were lost, try to recover
-	if (0 == pd[pLen+3])
+	const unsigned char* ec = pd + pLen + 3;
+	int ecLen = len - pLen - 3;
+	if (0 == ec[0])
 	    // recover from secondary IFPs
-	    recoverSec(pd+pLen+5,len-pLen-5,seq-1,pd[pLen+4]);
+	    recoverSec(ec+2,ecLen-2,seq-1,ec[1]);
+	else if (0x80 == ec[0])
+	    // recover from parity FEC
+	    recoverFec(ec+1,ecLen-1,seq);
+	ds = seq - m_rxSeq;
+	if (ds > 1) {
+	    m_lost += ds - 1;
+	    if (ds == 2)
+		TraceDebug(m_traceId,dbg(),DebugMild,"UDPTL lost IFP with SEQ %u [%p]",m_rxSeq+1,this);
+	    else
+		TraceDebug(m_traceId,dbg(),DebugWarn,"UDPTL lost IFPs with SEQ %u-%u [%p]",m_rxSeq+1,seq-1,this);
+	}
     }
     m_rxSeq = seq;
     udptlRecv(pd+3,pLen,seq,false);
@@ -1199,6 +1462,66 @@ void UDPTLSession::recoverSec(const unsigned char* data, int len, u_int16_t seq,
 	return;
     // recursively recover from remaining secondaries
     recoverSec(data+sLen+1,len-sLen-1,seq-1,nSec-1);
+    recovered(data+1,sLen,seq);
+}
+
+// Recover lost IFPs from the parity FEC data of a packet with given sequence
+// Entry m of the FEC data is the XOR of IFPs seq + m - k * entries, k = 1..span
+void UDPTLSession::recoverFec(const unsigned char* data, int len, u_int16_t seq)
+{
+    // the span is an unconstrained integer preceded by its length
+    if ((len < 2) || (data[0] < 1) || (data[0] > 2) || (len < data[0] + 2))
+	return;
+    unsigned int span = data[1];
+    if (data[0] == 2)
+	span = (span << 8) | data[2];
+    int pos = data[0] + 1;
+    unsigned int entries = data[pos++];
+    if (!(span && entries) || (span * entries >= UDPTL_RING))
+	return;
+    const unsigned char* fec[UDPTL_RING];
+    int fecLen[UDPTL_RING];
+    for (unsigned int m = 0; m < entries; m++) {
+	if (pos >= len)
+	    return;
+	fecLen[m] = data[pos++];
+	if (pos + fecLen[m] > len)
+	    return;
+	fec[m] = data + pos;
+	pos += fecLen[m];
+    }
+    u_int16_t first = seq - span * entries;
+    if ((int16_t)(first - m_rxSeq) <= 0)
+	first = m_rxSeq + 1;
+    unsigned char buf[UDPTL_IFP];
+    // recover in order, every lost IFP whose group was otherwise received
+    for (u_int16_t s = first; s != seq; s++) {
+	unsigned int d = (u_int16_t)(seq - s);
+	unsigned int m = (entries - (d % entries)) % entries;
+	int fl = fecLen[m];
+	::memcpy(buf,fec[m],fl);
+	bool ok = true;
+	for (unsigned int k = 1; k <= span; k++) {
+	    u_int16_t o = seq + m - k * entries;
+	    if (o == s)
+		continue;
+	    const UDPTLEntry* e = UDPTLBuffer::find(m_buffer->rx,o);
+	    if (!e) {
+		ok = false;
+		break;
+	    }
+	    int l = (e->len < fl) ? e->len : fl;
+	    for (int i = 0; i < l; i++)
+		buf[i] ^= e->data[i];
+	}
+	if (ok)
+	    recovered(buf,fl,s);
+    }
+}
+
+// Deliver an IFP recovered after data loss and keep it for further recoveries
+void UDPTLSession::recovered(const unsigned char* data, int len, u_int16_t seq)
+{
     int16_t ds = seq - m_rxSeq;
     switch (ds) {
 	case 1:
@@ -1210,9 +1533,45 @@ void UDPTLSession::recoverSec(const unsigned char* data, int len, u_int16_t seq,
 	    TraceDebug(m_traceId,dbg(),DebugWarn,"UDPTL lost IFPs with SEQ %u-%u [%p]",m_rxSeq+1,seq-1,this);
 	    break;
     }
+    if (ds > 1)
+	m_lost += ds - 1;
     TraceDebug(m_traceId,dbg(),DebugInfo,"UDPTL recovered IFP with SEQ %u [%p]",seq,this);
+    UDPTLBuffer::store(m_buffer->rx,seq,data,len);
+    m_recovered++;
     m_rxSeq = seq;
-    udptlRecv(data+1,sLen,seq,true);
+    udptlRecv(data,len,seq,true);
+}
+
+// Append parity FEC data after the primary IFP
+// Return the new packet length, zero if the FEC data does not fit
+int UDPTLSession::addFec(unsigned char* pd, int pl, u_int16_t seq)
+{
+    pd[pl++] = 0x80;
+    pd[pl++] = 1;
+    pd[pl++] = m_fecSpan;
+    pd[pl++] = m_fecEntries;
+    for (unsigned int m = 0; m < m_fecEntries; m++) {
+	unsigned char* fec = pd + pl + 1;
+	int fl = 0;
+	for (unsigned int k = 1; k <= m_fecSpan; k++) {
+	    const UDPTLEntry* e = UDPTLBuffer::find(m_buffer->tx,seq + m - k * m_fecEntries);
+	    if (!e)
+		continue;
+	    if ((pl + 1 + e->len) > m_maxLen)
+		return 0;
+	    // shorter IFPs are padded with zeros
+	    int i = 0;
+	    for (; (i < e->len) && (i < fl); i++)
+		fec[i] ^= e->data[i];
+	    for (; i < e->len; i++)
+		fec[i] = e->data[i];
+	    if (e->len > fl)
+		fl = e->len;
+	}
+	pd[pl] = fl;
+	pl += fl + 1;
+    }
+    return (pl <= m_maxLen) ? pl : 0;
 }
 
 bool UDPTLSession::udptlSend(const void* data, int len, u_int16_t seq)
@@ -1220,49 +1579,43 @@ bool UDPTLSession::udptlSend(const void* data, int len, u_int16_t seq)
     if (!(UDPSession::transport() && data && len))
 	return false;
     Lock lck(this);
-    int pl = len + 5;
-    if ((len > 255) || (pl > m_maxLen)) {
+    if ((len > UDPTL_IFP) || ((len + 5) > m_maxLen)) {
 	TraceDebug(m_traceId,dbg(),DebugWarn,"UDPTL could not send IFP with len=%d [%p]",len,this);
-	m_txQueue.clear();
+	UDPTLBuffer::reset(m_buffer->tx);
 	return false;
     }
     // substraction with overflow
     int16_t ds = seq - m_txSeq;
-    if (ds != 0) {
-	if (ds != 1) {
-	    TraceDebug(m_traceId,dbg(),DebugInfo,"UDPTL sending SEQ %u while current is %u [%p]",seq,m_txSeq,this);
-	    m_txQueue.clear();
-	}
-	if (m_maxSec)
-	    m_txQueue.insert(new DataBlock(const_cast<void*>(data),len));
+    if ((ds != 0) && (ds != 1)) {
+	TraceDebug(m_traceId,dbg(),DebugInfo,"UDPTL sending SEQ %u while current is %u [%p]",seq,m_txSeq,this);
+	UDPTLBuffer::reset(m_buffer->tx);
     }
-    DataBlock buf(0,m_maxLen);
-    unsigned char* pd = buf.data(0,6);
-    if (!pd)
-	return false;
+    UDPTLBuffer::store(m_buffer->tx,seq,data,len);
+    unsigned char pd[UDPTL_MAX_LEN + 8];
     pd[0] = (seq >> 8) & 0xff;
     pd[1] = seq & 0xff;
     pd[2] = len & 0xff;
     ::memcpy(pd+3,data,len);
-    pd[len+3] = 0; // secondary IFPs
-    int nSec = 0;
-    for (ObjList* l = m_txQueue.skipNext(); l; l = l->skipNext()) {
-	// truncate the TX queue when reaching maximum packet length or IFP count
-	if (nSec >= m_maxSec) {
-	    l->clear();
-	    break;
-	}
-	DataBlock* d = static_cast<DataBlock*>(l->get());
-	if ((pl+d->length()+1) > m_maxLen) {
-	    l->clear();
-	    break;
+    int pl = len + 3;
+    int fl = m_fecSpan ? addFec(pd,pl,seq) : 0;
+    if (fl)
+	pl = fl;
+    else {
+	// secondary IFPs, newest first, as many as fit in the packet
+	pd[pl] = 0;
+	int nSec = 0;
+	int pos = pl + 2;
+	for (; nSec < m_maxSec; nSec++) {
+	    const UDPTLEntry* e = UDPTLBuffer::find(m_buffer->tx,seq - 1 - nSec);
+	    if (!e || ((pos + e->len + 1) > m_maxLen))
+		break;
+	    pd[pos] = e->len & 0xff;
+	    ::memcpy(pd+pos+1,e->data,e->len);
+	    pos += e->len + 1;
 	}
-	pd[pl] = d->length() & 0xff;
-	::memcpy(pd+pl+1,d->data(),d->length());
-	pl += d->length()+1;
-	nSec++;
+	pd[pl+1] = nSec;
+	pl = pos;
     }
-    pd[len+4] = nSec;
     m_txSeq = seq;
     static_cast<RTPProcessor*>(UDPSession::transport())->rtpData(pd,pl);
     return true;
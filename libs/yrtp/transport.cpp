@@ -20,13 +20,136 @@
 
 #include <yatertp.h>
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifdef HAVE_EPOLL
+#include <unistd.h>
+#include <sys/epoll.h>
+#endif
 
 #define BUF_SIZE 1500
+// Number of packets read from a socket in one system call
+#define RECV_BATCH 16
+// Space reserved in front of each received packet
+#define BUF_HEADROOM 64
+// Number of receive buffers kept while packets still reference them
+#define RECV_PARKED 16
+// Maximum number of socket events retrieved in one group loop
+#define POLL_EVENTS 64
+// Maximum time a readiness driven group waits, needed to check for cancellation
+#define POLL_MAX_WAIT 100
 
 using namespace TelEngine;
 
 static unsigned long s_sleep = 5;
 
+// Shared pool of RTP groups
+static ObjList s_pool;
+static String s_poolSpec;
+static Mutex s_poolMutex(false,"RTPPool");
+
+#ifdef HAVE_EPOLL
+static bool s_readiness = false;
+#endif
+
+namespace TelEngine {
+
+// Packet and address buffers for batched reading of RTP and RTCP sockets
+// Packets are read in shared buffers so they can be passed along without copying
+// One batch is used by all the transports of a RTP group, from the group thread
+class RTPRecvBatch
+{
+public:
+    inline RTPRecvBatch()
+	: m_allocated(0)
+	{
+	    for (int i = 0; i < RECV_BATCH; i++) {
+		m_buffers[i] = 0;
+		dgrams[i].addr = (struct sockaddr*)&m_addrs[i];
+	    }
+	    for (int i = 0; i < RECV_PARKED; i++)
+		m_parked[i] = 0;
+	}
+    inline ~RTPRecvBatch()
+	{
+	    for (int i = 0; i < RECV_BATCH; i++)
+		TelEngine::destruct(m_buffers[i]);
+	    for (int i = 0; i < RECV_PARKED; i++)
+		TelEngine::destruct(m_parked[i]);
+	}
+    // Restore buffers, addresses and lengths changed by a previous read
+    // Socket filters claiming datagrams reorder the entries so all are set again
+    // Replace buffers still referenced by packets kept from a previous read
+    inline bool reset()
+	{
+	    for (int i = 0; i < RECV_BATCH; i++) {
+		if (!m_buffers[i] || m_buffers[i]->refcount() > 1) {
+		    park(m_buffers[i]);
+		    m_buffers[i] = spare();
+		    if (!m_buffers[i])
+			return false;
+		}
+		dgrams[i].buffer = m_buffers[i]->data() + BUF_HEADROOM;
+		dgrams[i].addr = (struct sockaddr*)&m_addrs[i];
+		dgrams[i].length = BUF_SIZE;
+		dgrams[i].addrLen = sizeof(m_addrs[i]);
+		dgrams[i].result = 0;
+	    }
+	    return true;
+	}
+    DataBuffer* owner(int index) const;
+    inline u_int64_t allocated() const
+	{ return m_allocated; }
+    SocketDatagram dgrams[RECV_BATCH];
+private:
+    void park(DataBuffer* buf);
+    DataBuffer* spare();
+    DataBuffer* m_buffers[RECV_BATCH];
+    DataBuffer* m_parked[RECV_PARKED];
+    struct sockaddr_storage m_addrs[RECV_BATCH];
+    u_int64_t m_allocated;
+};
+
+// A processor timer kept in the deadline heap of a group
+struct RTPDeadline
+{
+    u_int64_t when;
+    RTPProcessor* proc;
+};
+
+// Readiness wait and timer heap of a RTP group
+// All methods except wait() must be called with the group locked
+class RTPGroupPoller
+{
+public:
+    RTPGroupPoller();
+    ~RTPGroupPoller();
+    inline bool valid() const
+	{ return m_epoll >= 0; }
+    bool watch(Socket& sock, RTPTransport* trans, bool rtcp);
+    void unwatch(Socket& sock);
+    int wait(int msec);
+    RTPTransport* event(int index, bool& rtcp);
+    void schedule(RTPProcessor* proc, u_int64_t when);
+    void remove(RTPProcessor* proc);
+    RTPProcessor* expired(u_int64_t now, u_int64_t interval);
+    int timeout(u_int64_t now, unsigned int maxWait) const;
+    ObjList m_dead;
+private:
+    void heapUp(unsigned int pos);
+    void heapDown(unsigned int pos);
+    int m_epoll;
+    RTPDeadline* m_heap;
+    unsigned int m_heapLen;
+    unsigned int m_heapSize;
+#ifdef HAVE_EPOLL
+    struct epoll_event m_events[POLL_EVENTS];
+#endif
+};
+
+}; // namespace TelEngine
+
 // Set IPv6 sin6_scope_id for remote addresses from local address
 // recvFrom() will set the sin6_scope_id of the remote socket address
 // This will avoid socket address comparison mismatch (same address, different scope id)
@@ -43,9 +166,221 @@ static inline void setScopeId(const SocketAddr& local, SocketAddr& sa1,
 }
 
 
+RTPGroupPoller::RTPGroupPoller()
+    : m_epoll(-1), m_heap(0), m_heapLen(0), m_heapSize(0)
+{
+#ifdef HAVE_EPOLL
+    m_epoll = ::epoll_create(64);
+    if (m_epoll < 0)
+	Debug(DebugWarn,"RTPGroup failed to create epoll: %d %s",errno,::strerror(errno));
+#endif
+}
+
+RTPGroupPoller::~RTPGroupPoller()
+{
+#ifdef HAVE_EPOLL
+    if (m_epoll >= 0)
+	::close(m_epoll);
+#endif
+    ::free(m_heap);
+}
+
+// Watch a socket for input, the transport pointer is tagged for RTCP socket
+bool RTPGroupPoller::watch(Socket& sock, RTPTransport* trans, bool rtcp)
+{
+#ifdef HAVE_EPOLL
+    if (m_epoll < 0 || !sock.valid())
+	return false;
+    struct epoll_event ev;
+    ::memset(&ev,0,sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = (u_int64_t)(uintptr_t)trans | (rtcp ? 1 : 0);
+    if (::epoll_ctl(m_epoll,EPOLL_CTL_ADD,sock.handle(),&ev) == 0 || errno == EEXIST)
+	return true;
+    Debug(DebugMild,"RTPGroup failed to watch socket %d: %d %s",
+	sock.handle(),errno,::strerror(errno));
+#endif
+    return false;
+}
+
+void RTPGroupPoller::unwatch(Socket& sock)
+{
+#ifdef HAVE_EPOLL
+    if (m_epoll >= 0 && sock.valid()) {
+	struct epoll_event ev;
+	::epoll_ctl(m_epoll,EPOLL_CTL_DEL,sock.handle(),&ev);
+    }
+#endif
+}
+
+// Wait for socket events, return the number of events retrieved
+int RTPGroupPoller::wait(int msec)
+{
+#ifdef HAVE_EPOLL
+    int n = ::epoll_wait(m_epoll,m_events,POLL_EVENTS,msec);
+    if (n >= 0)
+	return n;
+    if (errno != EINTR) {
+	Debug(DebugWarn,"RTPGroup wait error: %d %s",errno,::strerror(errno));
+	Thread::idle();
+    }
+#endif
+    return 0;
+}
+
+// Retrieve the transport of a socket event, NULL if it left the group meanwhile
+RTPTransport* RTPGroupPoller::event(int index, bool& rtcp)
+{
+#ifdef HAVE_EPOLL
+    u_int64_t val = m_events[index].data.u64;
+    rtcp = (val & 1) != 0;
+    RTPTransport* trans = (RTPTransport*)(uintptr_t)(val & ~(u_int64_t)1);
+    if (!m_dead.find(static_cast<GenObject*>(trans)))
+	return trans;
+#endif
+    return 0;
+}
+
+void RTPGroupPoller::schedule(RTPProcessor* proc, u_int64_t when)
+{
+    if (m_heapLen >= m_heapSize) {
+	unsigned int size = m_heapSize ? (2 * m_heapSize) : 16;
+	RTPDeadline* heap = (RTPDeadline*)::realloc(m_heap,size * sizeof(RTPDeadline));
+	if (!heap) {
+	    Debug(DebugFail,"RTPGroup failed to grow timer heap to %u",size);
+	    return;
+	}
+	m_heap = heap;
+	m_heapSize = size;
+    }
+    m_heap[m_heapLen].when = when;
+    m_heap[m_heapLen].proc = proc;
+    heapUp(m_heapLen++);
+}
+
+void RTPGroupPoller::remove(RTPProcessor* proc)
+{
+    for (unsigned int i = 0; i < m_heapLen; i++) {
+	if (m_heap[i].proc != proc)
+	    continue;
+	if (i != --m_heapLen) {
+	    m_heap[i] = m_heap[m_heapLen];
+	    heapDown(i);
+	    heapUp(i);
+	}
+	return;
+    }
+}
+
+// Pop the earliest expired processor and schedule its next run
+RTPProcessor* RTPGroupPoller::expired(u_int64_t now, u_int64_t interval)
+{
+    if (!m_heapLen || m_heap[0].when > now)
+	return 0;
+    RTPProcessor* proc = m_heap[0].proc;
+    m_heap[0].when += interval;
+    // don't try to catch up if we are seriously late
+    if (m_heap[0].when <= now)
+	m_heap[0].when = now + interval;
+    heapDown(0);
+    return proc;
+}
+
+// Milliseconds to wait until the earliest timer expires
+int RTPGroupPoller::timeout(u_int64_t now, unsigned int maxWait) const
+{
+    if (!m_heapLen)
+	return maxWait;
+    u_int64_t when = m_heap[0].when;
+    if (when <= now)
+	return 0;
+    if (when - now >= 1000 * (u_int64_t)maxWait)
+	return maxWait;
+    return (int)((when - now + 999) / 1000);
+}
+
+void RTPGroupPoller::heapUp(unsigned int pos)
+{
+    RTPDeadline d = m_heap[pos];
+    while (pos) {
+	unsigned int parent = (pos - 1) / 2;
+	if (m_heap[parent].when <= d.when)
+	    break;
+	m_heap[pos] = m_heap[parent];
+	pos = parent;
+    }
+    m_heap[pos] = d;
+}
+
+void RTPGroupPoller::heapDown(unsigned int pos)
+{
+    RTPDeadline d = m_heap[pos];
+    while (true) {
+	unsigned int child = 2 * pos + 1;
+	if (child >= m_heapLen)
+	    break;
+	if ((child + 1 < m_heapLen) && (m_heap[child + 1].when < m_heap[child].when))
+	    child++;
+	if (d.when <= m_heap[child].when)
+	    break;
+	m_heap[pos] = m_heap[child];
+	pos = child;
+    }
+    m_heap[pos] = d;
+}
+
+
+// Keep a buffer still referenced by a packet until it is released
+// If there is no room left the last reference will free it
+void RTPRecvBatch::park(DataBuffer* buf)
+{
+    if (!buf)
+	return;
+    for (int i = 0; i < RECV_PARKED; i++) {
+	if (!m_parked[i]) {
+	    m_parked[i] = buf;
+	    return;
+	}
+    }
+    TelEngine::destruct(buf);
+}
+
+// Find the buffer a received datagram was read in, it may have been moved by filters
+DataBuffer* RTPRecvBatch::owner(int index) const
+{
+    const void* buf = dgrams[index].buffer;
+    for (int i = 0; i < RECV_BATCH; i++) {
+	if (m_buffers[i] && ((const void*)(m_buffers[i]->data() + BUF_HEADROOM) == buf))
+	    return m_buffers[i];
+    }
+    return 0;
+}
+
+// Get a parked buffer no longer referenced elsewhere or allocate a new one
+DataBuffer* RTPRecvBatch::spare()
+{
+    for (int i = 0; i < RECV_PARKED; i++) {
+	DataBuffer* buf = m_parked[i];
+	if (buf && (buf->refcount() == 1)) {
+	    m_parked[i] = 0;
+	    return buf;
+	}
+    }
+    DataBuffer* buf = new DataBuffer(BUF_HEADROOM + BUF_SIZE);
+    if (!buf->data()) {
+	TelEngine::destruct(buf);
+	return 0;
+    }
+    m_allocated++;
+    return buf;
+}
+
+
 RTPGroup::RTPGroup(int msec, Priority prio, const String& affinity)
     : Mutex(true,"RTPGroup"),
-      Thread("RTP Group",prio), m_listChanged(false)
+      Thread("RTP Group",prio), m_listChanged(false), m_poller(0), m_rxBatch(0),
+      m_pooled(false), m_count(0), m_cpus(affinity),
+      m_loops(0), m_busyTime(0), m_busyMax(0), m_overruns(0), m_events(0)
 {
     DDebug(DebugInfo,"RTPGroup::RTPGroup() [%p]",this);
     if (msec < 1)
@@ -59,16 +394,30 @@ RTPGroup::RTPGroup(int msec, Priority prio, const String& affinity)
 	    Debug(DebugWarn,"Failed to set affinity to '%s', error=%s(%d) [%p]",
 		    affinity.c_str(),::strerror(err),err,this);
     }
+#ifdef HAVE_EPOLL
+    if (s_readiness) {
+	m_poller = new RTPGroupPoller;
+	if (!m_poller->valid()) {
+	    delete m_poller;
+	    m_poller = 0;
+	}
+    }
+#endif
 }
 
 RTPGroup::~RTPGroup()
 {
     DDebug(DebugInfo,"RTPGroup::~RTPGroup() [%p]",this);
+    delete m_poller;
+    delete m_rxBatch;
 }
 
 void RTPGroup::cleanup()
 {
     DDebug(DebugInfo,"RTPGroup::cleanup() [%p]",this);
+    s_poolMutex.lock();
+    s_pool.remove(this,false);
+    s_poolMutex.unlock();
     lock();
     m_listChanged = true;
     ObjList* l = &m_processors;
@@ -82,12 +431,43 @@ void RTPGroup::cleanup()
 	l = l->next();
     }
     m_processors.clear();
+    m_count = 0;
     unlock();
 }
 
 void RTPGroup::run()
 {
-    DDebug(DebugInfo,"RTPGroup::run() [%p]",this);
+    DDebug(DebugInfo,"RTPGroup::run() readiness=%s [%p]",String::boolText(readiness()),this);
+    if (m_poller)
+	runReady();
+    else
+	runPolling();
+    DDebug(DebugInfo,"RTPGroup::run() ran out of processors [%p]",this);
+}
+
+// Update loop statistics, must be called with the group locked
+void RTPGroup::loopDone(const Time& start, unsigned long msec)
+{
+    u_int64_t busy = Time::now() - start;
+    m_loops++;
+    m_busyTime += busy;
+    if (busy > m_busyMax)
+	m_busyMax = busy;
+    if (busy > msec * 1000)
+	m_overruns++;
+}
+
+// Receive buffers shared by the transports of the group, must be called with the group locked
+RTPRecvBatch& RTPGroup::rxBatch()
+{
+    if (!m_rxBatch)
+	m_rxBatch = new RTPRecvBatch;
+    return *m_rxBatch;
+}
+
+// Call all processors periodically, they will poll their sockets
+void RTPGroup::runPolling()
+{
     bool ok = true;
     while (ok) {
 	unsigned long msec = m_sleep;
@@ -97,7 +477,8 @@ void RTPGroup::run()
 	Time t;
 	ObjList* l = &m_processors;
 	m_listChanged = false;
-	for (ok = false;l;l = l->next()) {
+	// pooled groups keep running even without processors
+	for (ok = m_pooled;l;l = l->next()) {
 	    RTPProcessor* p = static_cast<RTPProcessor*>(l->get());
 	    if (p) {
 		ok = true;
@@ -109,10 +490,48 @@ void RTPGroup::run()
 		    break;
 	    }
 	}
+	loopDone(t,msec);
 	unlock();
 	Thread::msleep(msec,true);
     }
-    DDebug(DebugInfo,"RTPGroup::run() ran out of processors [%p]",this);
+}
+
+// Handle sockets as they become readable and processor timers as they expire
+void RTPGroup::runReady()
+{
+    bool ok = true;
+    while (ok) {
+	unsigned long msec = m_sleep;
+	if (msec < s_sleep)
+	    msec = s_sleep;
+	lock();
+	// safe to forget processors that left, no retrieved event points to them
+	m_poller->m_dead.clear();
+	int tout = m_poller->timeout(Time::now(),POLL_MAX_WAIT);
+	unlock();
+	int n = m_poller->wait(tout);
+	Thread::check();
+	lock();
+	Time t;
+	for (int i = 0; i < n; i++) {
+	    bool rtcp = false;
+	    RTPTransport* trans = m_poller->event(i,rtcp);
+	    if (!trans)
+		continue;
+	    m_events++;
+	    if (rtcp)
+		trans->readRtcp(rxBatch());
+	    else
+		trans->readRtp(rxBatch());
+	}
+	RTPProcessor* p;
+	while ((p = m_poller->expired(t,msec * 1000)))
+	    p->timerTick(t);
+	// pooled groups keep running even without processors
+	ok = m_pooled || m_count;
+	loopDone(t,msec);
+	unlock();
+    }
 }
 
 void RTPGroup::join(RTPProcessor* proc)
@@ -121,6 +540,12 @@ void RTPGroup::join(RTPProcessor* proc)
     lock();
     m_listChanged = true;
     m_processors.append(proc)->setDelete(false);
+    m_count++;
+    if (m_poller) {
+	m_poller->m_dead.remove(proc,false);
+	m_poller->schedule(proc,Time::now() + m_sleep * 1000);
+    }
+    proc->groupChanged(this,true);
     startup();
     unlock();
 }
@@ -130,10 +555,148 @@ void RTPGroup::part(RTPProcessor* proc)
     DDebug(DebugAll,"RTPGroup::part(%p) [%p]",proc,this);
     lock();
     m_listChanged = true;
-    m_processors.remove(proc,false);
+    if (m_processors.remove(proc,false)) {
+	if (m_count)
+	    m_count--;
+	if (m_poller) {
+	    m_poller->remove(proc);
+	    m_poller->m_dead.append(proc)->setDelete(false);
+	}
+	proc->groupChanged(this,false);
+    }
     unlock();
 }
 
+bool RTPGroup::watchSocket(Socket& sock, RTPTransport* trans, bool rtcp)
+{
+    Lock lck(this);
+    return m_poller && m_poller->watch(sock,trans,rtcp);
+}
+
+void RTPGroup::unwatchSocket(Socket& sock)
+{
+    Lock lck(this);
+    if (m_poller)
+	m_poller->unwatch(sock);
+}
+
+bool RTPGroup::setReadiness(bool enable)
+{
+#ifdef HAVE_EPOLL
+    s_readiness = enable;
+    return true;
+#else
+    return !enable;
+#endif
+}
+
+void RTPGroup::loopStats(String& stats) const
+{
+    u_int64_t loops = m_loops;
+    u_int64_t avg = loops ? (m_busyTime / loops) : 0;
+    stats << m_count << "|" << loops << "|" << avg << "|" << m_busyMax
+	<< "|" << m_overruns << "|" << m_events << "|" << m_cpus
+	<< "|" << (m_rxBatch ? m_rxBatch->allocated() : 0);
+}
+
+unsigned int RTPGroup::setupPool(int count, int msec, Priority prio, const String& affinity)
+{
+    // build the list of CPUs the groups are pinned to
+    ObjList cpus;
+    DataBlock mask;
+    if (affinity) {
+	if (!Thread::parseCPUMask(affinity,mask))
+	    Debug(DebugWarn,"Invalid RTP pool affinity '%s'",affinity.c_str());
+    }
+    else if (count < 0)
+	Thread::getCurrentAffinity(mask);
+    for (unsigned int i = 0; i < mask.length() * 8; i++) {
+	if (mask.at(i >> 3) & (1 << (i & 7)))
+	    cpus.append(new String(i));
+    }
+    if (count < 0)
+	count = cpus.count() ? cpus.count() : 1;
+    String spec;
+    spec << count << "|" << msec << "|" << prio;
+#ifdef HAVE_EPOLL
+    spec << "|" << s_readiness;
+#endif
+    if (count)
+	spec << "|" << affinity;
+    Lock lck(s_poolMutex);
+    if (spec == s_poolSpec)
+	return s_pool.count();
+    s_poolSpec = spec;
+    // retired groups stop when their last processor leaves
+    for (ObjList* l = s_pool.skipNull(); l; l = l->skipNext())
+	static_cast<RTPGroup*>(l->get())->m_pooled = false;
+    s_pool.clear();
+    ObjList* cpu = cpus.skipNull();
+    for (int i = 0; i < count; i++) {
+	String aff;
+	if (cpu) {
+	    aff = cpu->get()->toString();
+	    cpu = cpu->skipNext();
+	    if (!cpu)
+		cpu = cpus.skipNull();
+	}
+	RTPGroup* g = new RTPGroup(msec,prio,aff);
+	g->m_pooled = true;
+	if (!g->startup()) {
+	    Debug(DebugWarn,"Failed to start pooled RTP group %d",i);
+	    delete g;
+	    continue;
+	}
+	s_pool.append(g)->setDelete(false);
+    }
+    if (count)
+	Debug(DebugInfo,"Started %u pooled RTP groups",s_pool.count());
+    return s_pool.count();
+}
+
+unsigned int RTPGroup::poolSize()
+{
+    Lock lck(s_poolMutex);
+    return s_pool.count();
+}
+
+RTPGroup* RTPGroup::joinPool(RTPProcessor* proc)
+{
+    if (!proc)
+	return 0;
+    Lock lck(s_poolMutex);
+    // pick the group with least processors, then the one with shortest loops
+    RTPGroup* best = 0;
+    u_int64_t bestAvg = 0;
+    for (ObjList* l = s_pool.skipNull(); l; l = l->skipNext()) {
+	RTPGroup* g = static_cast<RTPGroup*>(l->get());
+	u_int64_t loops = g->m_loops;
+	u_int64_t avg = loops ? (g->m_busyTime / loops) : 0;
+	if (!best || (g->m_count < best->m_count) ||
+		((g->m_count == best->m_count) && (avg < bestAvg))) {
+	    best = g;
+	    bestAvg = avg;
+	}
+    }
+    if (best)
+	proc->group(best);
+    return best;
+}
+
+void RTPGroup::poolStatus(String& str)
+{
+    Lock lck(s_poolMutex);
+    str.append("pool=",",") << s_pool.count();
+    if (!s_pool.skipNull())
+	return;
+    str << ",poolformat=Processors|Loops|AvgLoop|MaxLoop|Overruns|Events|CPU|RxBuffers";
+    unsigned int i = 0;
+    for (ObjList* l = s_pool.skipNull(); l; l = l->skipNext(), i++) {
+	str << ",pool." << i << "=";
+	static_cast<RTPGroup*>(l->get())->loopStats(str);
+    }
+}
+
 void RTPGroup::setMinSleep(int msec)
 {
     if (msec < 1)
@@ -173,10 +736,19 @@ void RTPProcessor::rtpData(const void* data, int len)
 {
 }
 
+void RTPProcessor::rtpPacket(const DataBlock& packet)
+{
+    rtpData(packet.data(),packet.length());
+}
+
 void RTPProcessor::rtcpData(const void* data, int len)
 {
 }
 
+void RTPProcessor::groupChanged(RTPGroup* grp, bool joined)
+{
+}
+
 void RTPProcessor::getStats(String& stats) const
 {
 }
@@ -184,8 +756,10 @@ void RTPProcessor::getStats(String& stats) const
 
 RTPTransport::RTPTransport(RTPTransport::Type type, DebugEnabler* dbg, const char* traceId)
     : RTPProcessor(dbg,traceId),
-      m_type(type), m_processor(0), m_monitor(0), m_autoRemote(false),
-      m_warnSendErrorRtp(true), m_warnSendErrorRtcp(true)
+      m_type(type), m_processor(0), m_monitor(0), m_relay(0),
+      m_ports(0), m_autoRemote(false), m_dtls(false),
+      m_warnSendErrorRtp(true), m_warnSendErrorRtcp(true),
+      m_rtpWatched(false), m_rtcpWatched(false)
 {
     DDebug(this->dbg(),DebugAll,"RTPTransport::RTPTransport(%d) [%p]",type,this);
 }
@@ -199,6 +773,11 @@ RTPTransport::~RTPTransport()
     group(0);
     setProcessor();
     setMonitor();
+    if (m_ports) {
+	// the sockets may be kept bound for another transport
+	m_ports->release(*this);
+	TelEngine::destruct(m_ports);
+    }
 }
 
 void RTPTransport::destruct()
@@ -212,65 +791,165 @@ void RTPTransport::destruct()
 void RTPTransport::timerTick(const Time& when)
 {
     XDebug(dbg(),DebugAll,"RTPTransport::timerTick() group=%p [%p]",group(),this);
+    RTPGroup* grp = group();
+    if (!grp)
+	return;
+    // sockets watched by a readiness driven group are read when data arrives
     if (m_rtpSock.valid()) {
-	char buf[BUF_SIZE];
-	int len;
-	while ((len = m_rtpSock.recvFrom(buf,sizeof(buf),m_rxAddrRTP)) > 0) {
-	    XDebug(dbg(),DebugAll,"RTP/UDPTL from '%s:%d' length %d [%p]",
-		m_rxAddrRTP.host().c_str(),m_rxAddrRTP.port(),len,this);
-	    switch (m_type) {
-		case RTP:
-		    if (len < 12)
-			continue;
-		    if (((unsigned char)buf[0] & 0xc0) != 0x80)
-			continue;
-		    break;
-		case UDPTL:
-		    if (len < 6)
-			continue;
-		    break;
-		default:
-		    break;
-	    }
-	    if (!m_remoteAddr.valid())
-		continue;
-	    // looks like it's RTP or UDPTL, at least by length and version
-	    bool preferred = false;
-	    if ((m_autoRemote || (preferred = (m_rxAddrRTP == m_remotePref))) && (m_rxAddrRTP != m_remoteAddr)) {
-		TraceDebug(m_traceId,dbg(),DebugInfo,"Auto changing RTP address from %s:%d to%s %s:%d",
-		    m_remoteAddr.host().c_str(),m_remoteAddr.port(),
-		    (preferred ? " preferred" : ""),
-		    m_rxAddrRTP.host().c_str(),m_rxAddrRTP.port());
-		// if we received from the preferred address don't auto change any more
-		if (preferred)
-		    m_remotePref.clear();
-		remoteAddr(m_rxAddrRTP);
-	    }
-	    m_autoRemote = false;
-	    if (m_rxAddrRTP == m_remoteAddr) {
-		if (m_processor)
-		    m_processor->rtpData(buf,len);
-		if (m_monitor)
-		    m_monitor->rtpData(buf,len);
-	    }
-	    else if (m_processor)
-		m_processor->incWrongSrc();
-	}
+	if (!m_rtpWatched)
+	    readRtp(grp->rxBatch());
 	m_rtpSock.timerTick(when);
     }
     if (m_rtcpSock.valid()) {
-	char buf[BUF_SIZE];
-	int len;
-	while (((len = m_rtcpSock.recvFrom(buf,sizeof(buf),m_rxAddrRTCP)) >= 8) && (m_rxAddrRTCP == m_remoteRTCP)) {
+	if (!m_rtcpWatched)
+	    readRtcp(grp->rxBatch());
+	m_rtcpSock.timerTick(when);
+    }
+}
+
+void RTPTransport::groupChanged(RTPGroup* grp, bool joined)
+{
+    if (!(grp && grp->readiness()))
+	return;
+    if (joined) {
+	m_rtpWatched = m_rtpSock.valid() && grp->watchSocket(m_rtpSock,this,false);
+	m_rtcpWatched = m_rtcpSock.valid() && grp->watchSocket(m_rtcpSock,this,true);
+	return;
+    }
+    if (m_rtpWatched)
+	grp->unwatchSocket(m_rtpSock);
+    if (m_rtcpWatched)
+	grp->unwatchSocket(m_rtcpSock);
+    m_rtpWatched = m_rtcpWatched = false;
+}
+
+// Watch sockets created after joining a readiness driven group
+void RTPTransport::watchSockets()
+{
+    RTPGroup* grp = group();
+    if (grp && grp->readiness())
+	groupChanged(grp,true);
+}
+
+// Take over sockets bound in advance by a port allocator
+// The allocator already discarded any data received while they were idle
+bool RTPTransport::adoptSockets(SOCKET rtp, SOCKET rtcp, const SocketAddr& addr)
+{
+    if (m_rtpSock.valid())
+	return false;
+    m_warnSendErrorRtp = true;
+    m_warnSendErrorRtcp = true;
+    m_rtpSock.attach(rtp);
+    m_rtcpSock.attach(rtcp);
+    m_localAddr = addr;
+    if (m_rtcpSock.valid())
+	setScopeId(m_localAddr,m_remoteAddr,m_remoteRTCP,&m_remotePref);
+    else
+	setScopeId(m_localAddr,m_remoteAddr,m_remotePref);
+    watchSockets();
+    return true;
+}
+
+// Read all packets waiting on the RTP socket
+void RTPTransport::readRtp(RTPRecvBatch& batch)
+{
+    int n;
+    while (batch.reset() && (n = m_rtpSock.recvBatch(batch.dgrams,RECV_BATCH)) > 0) {
+	if (m_relay)
+	    m_relay->relay(this,batch.dgrams,n,false);
+	else for (int i = 0; i < n; i++) {
+	    const SocketDatagram& d = batch.dgrams[i];
+	    m_rxAddrRTP.assign(d.addr,d.addrLen);
+	    DataBuffer* buf = batch.owner(i);
+	    if (!buf)
+		continue;
+	    DataBlock packet(buf,BUF_HEADROOM,d.result);
+	    rtpReceived(packet);
+	}
+	// Short batch means the socket buffer was emptied
+	if (n < RECV_BATCH)
+	    break;
+    }
+}
+
+// Read all packets waiting on the RTCP socket
+void RTPTransport::readRtcp(RTPRecvBatch& batch)
+{
+    int n;
+    while (batch.reset() && (n = m_rtcpSock.recvBatch(batch.dgrams,RECV_BATCH)) > 0) {
+	if (m_relay)
+	    m_relay->relay(this,batch.dgrams,n,true);
+	else for (int i = 0; i < n; i++) {
+	    const SocketDatagram& d = batch.dgrams[i];
+	    if (d.result < 8)
+		continue;
+	    m_rxAddrRTCP.assign(d.addr,d.addrLen);
+	    if (m_rxAddrRTCP != m_remoteRTCP)
+		continue;
 	    XDebug(dbg(),DebugAll,"RTCP from '%s:%d' length %d [%p]",
-		m_rxAddrRTCP.host().c_str(),m_rxAddrRTCP.port(),len,this);
+		m_rxAddrRTCP.host().c_str(),m_rxAddrRTCP.port(),d.result,this);
 	    if (m_processor)
-		m_processor->rtcpData(buf,len);
+		m_processor->rtcpData(d.buffer,d.result);
 	    if (m_monitor)
-		m_monitor->rtcpData(buf,len);
+		m_monitor->rtcpData(d.buffer,d.result);
 	}
-	m_rtcpSock.timerTick(when);
+	if (n < RECV_BATCH)
+	    break;
+    }
+}
+
+// Process one packet received on the RTP socket from m_rxAddrRTP
+void RTPTransport::rtpReceived(const DataBlock& packet)
+{
+    if (!rtpSource((const unsigned char*)packet.data(),packet.length()))
+	return;
+    if (m_processor)
+	m_processor->rtpPacket(packet);
+    if (m_monitor)
+	m_monitor->rtpPacket(packet);
+}
+
+// Check a packet received on the RTP socket from m_rxAddrRTP
+// Adjust the remote address if allowed to, return true if packet must be processed
+bool RTPTransport::rtpSource(const unsigned char* buf, int len)
+{
+    XDebug(dbg(),DebugAll,"RTP/UDPTL from '%s:%d' length %d [%p]",
+	m_rxAddrRTP.host().c_str(),m_rxAddrRTP.port(),len,this);
+    switch (m_type) {
+	case RTP:
+	    if (len < 12)
+		return false;
+	    // accept DTLS records too if negotiated, they share the port as in RFC 5764
+	    if (((buf[0] & 0xc0) != 0x80) && !(m_dtls && (buf[0] >= 20) && (buf[0] <= 63)))
+		return false;
+	    break;
+	case UDPTL:
+	    if (len < 6)
+		return false;
+	    break;
+	default:
+	    break;
     }
+    if (!m_remoteAddr.valid())
+	return false;
+    // looks like it's RTP or UDPTL, at least by length and version
+    bool preferred = false;
+    if ((m_autoRemote || (preferred = (m_rxAddrRTP == m_remotePref))) && (m_rxAddrRTP != m_remoteAddr)) {
+	TraceDebug(m_traceId,dbg(),DebugInfo,"Auto changing RTP address from %s:%d to%s %s:%d",
+	    m_remoteAddr.host().c_str(),m_remoteAddr.port(),
+	    (preferred ? " preferred" : ""),
+	    m_rxAddrRTP.host().c_str(),m_rxAddrRTP.port());
+	// if we received from the preferred address don't auto change any more
+	if (preferred)
+	    m_remotePref.clear();
+	remoteAddr(m_rxAddrRTP);
+    }
+    m_autoRemote = false;
+    if (m_rxAddrRTP == m_remoteAddr)
+	return true;
+    if (m_processor)
+	m_processor->incWrongSrc();
+    return false;
 }
 
 // Send data to remote party
@@ -367,6 +1046,7 @@ bool RTPTransport::localAddr(SocketAddr& addr, bool rtcp)
 	    m_rtpSock.getSockName(addr);
 	    m_localAddr = addr;
 	    setScopeId(m_localAddr,m_remoteAddr,m_remotePref);
+	    watchSockets();
 	    return true;
 	}
 	if (!p) {
@@ -380,6 +1060,7 @@ bool RTPTransport::localAddr(SocketAddr& addr, bool rtcp)
 		    m_rtpSock.setBlocking(false);
 		    m_localAddr = addr;
 		    setScopeId(m_localAddr,m_remoteAddr,m_remoteRTCP,&m_remotePref);
+		    watchSockets();
 		    return true;
 		}
 		DDebug(dbg(),DebugMild,"RTP Socket failed with code %d",m_rtpSock.error());
@@ -394,6 +1075,7 @@ bool RTPTransport::localAddr(SocketAddr& addr, bool rtcp)
 	    addr.port(p);
 	    m_localAddr = addr;
 	    setScopeId(m_localAddr,m_remoteAddr,m_remoteRTCP,&m_remotePref);
+	    watchSockets();
 	    return true;
 	}
 #ifdef DEBUG
@@ -50,6 +50,16 @@ class RTPSession;
 class RTPSender;
 class RTPReceiver;
 class RTPSecure;
+class RTPRecvBatch;
+class RTPPortAllocator;
+class RTPPortHost;
+class UDPTLBuffer;
+class RTPGroupPoller;
+class RTPRelay;
+class RTPDejitterSlot;
+class RTPSecureFast;
+class RTPDtls;
+class RTPDtlsLink;
 
 /**
  * Object holding RTP debug
@@ -115,6 +125,7 @@ class YRTP_API RTPProcessor : public GenObject, public RTPDebug
     friend class RTPTransport;
     friend class RTPSender;
     friend class RTPReceiver;
+    friend class RTPRelay;
 
 public:
     /**
@@ -143,6 +154,14 @@ public:
      */
     virtual void rtpData(const void* data, int len);
 
+    /**
+     * This method is called to process a received RTP packet held in a
+     *  shared buffer. Parts of the packet can be kept without copying.
+     * Default behaviour is to call rtpData() with the raw packet data
+     * @param packet Data block holding the raw RTP packet
+     */
+    virtual void rtpPacket(const DataBlock& packet);
+
     /**
      * This method is called to send or process a RTCP packet
      * @param data Pointer to raw RTCP data
@@ -182,6 +201,14 @@ protected:
      */
     virtual void timerTick(const Time& when) = 0;
 
+    /**
+     * Method called when the processor joins or leaves a group.
+     * Processors owning sockets can have the group wait for their readiness
+     * @param grp Group that the processor joined or left
+     * @param joined True if the processor joined the group, false if it left
+     */
+    virtual void groupChanged(RTPGroup* grp, bool joined);
+
     unsigned int m_wrongSrc;
 
 private:
@@ -191,11 +218,17 @@ private:
 /**
  * Several possibly related RTP processors share the same RTP group which
  *  holds the thread that keeps them running.
+ * A fixed pool of groups can be set up so new sessions are spread among
+ *  them instead of each starting its own thread.
+ * Where supported a group can wait for socket readiness and run processor
+ *  timers from a deadline heap instead of polling everything every loop.
  * @short A group of RTP processors handled by the same thread
  */
 class YRTP_API RTPGroup : public GenObject, public Mutex, public Thread
 {
     friend class RTPProcessor;
+    friend class RTPGroupPoller;
+    friend class RTPTransport;
 
 public:
     /**
@@ -239,10 +272,113 @@ public:
      */
     void part(RTPProcessor* proc);
 
+    /**
+     * Get the number of RTP processors running in this group
+     * @return Number of processors in the group
+     */
+    inline unsigned int processors() const
+	{ return m_count; }
+
+    /**
+     * Check if this group waits for socket readiness instead of polling
+     * @return True if the group is readiness driven
+     */
+    inline bool readiness() const
+	{ return m_poller != 0; }
+
+    /**
+     * Have the group thread wake up when a transport socket becomes readable
+     * @param sock Socket to watch, must be valid
+     * @param trans Transport owning the socket
+     * @param rtcp True if the socket is the RTCP one of the transport
+     * @return True if the socket is watched, false if polling must be used
+     */
+    bool watchSocket(Socket& sock, RTPTransport* trans, bool rtcp);
+
+    /**
+     * Stop watching a transport socket, must be called before closing it
+     * @param sock Socket previously watched
+     */
+    void unwatchSocket(Socket& sock);
+
+    /**
+     * Check if this group belongs to the shared pool
+     * @return True if the group is part of the shared pool
+     */
+    inline bool pooled() const
+	{ return m_pooled; }
+
+    /**
+     * Retrieve the loop statistics of this group
+     * @param stats String to append Processors|Loops|AvgLoop|MaxLoop|Overruns|Events|CPU|RxBuffers
+     *  to, loop times are in microseconds, RxBuffers counts receive buffers allocated
+     */
+    void loopStats(String& stats) const;
+
+    /**
+     * Select how groups created from now on wait for data
+     * @param enable True to wait for socket readiness, false to poll in loop
+     * @return True if the requested mode will be used
+     */
+    static bool setReadiness(bool enable);
+
+    /**
+     * Set up the pool of shared RTP groups. Groups of a previous pool are
+     *  retired and stop when their last processor leaves.
+     * @param count Number of groups in the pool, zero to disable the pool,
+     *  negative to create one group per available CPU
+     * @param msec Minimum time to sleep in loop in milliseconds
+     * @param prio Thread priority to run the groups
+     * @param affinity Comma-separated list of CPUs and/or CPU ranges,
+     *  each group is pinned to one of them in turn
+     * @return Number of groups in the pool
+     */
+    static unsigned int setupPool(int count, int msec = 0, Priority prio = Normal,
+	const String& affinity = String::empty());
+
+    /**
+     * Retire all the groups of the shared pool
+     */
+    static inline void stopPool()
+	{ setupPool(0); }
+
+    /**
+     * Get the number of groups in the shared pool
+     * @return Number of pooled groups, zero if pooling is disabled
+     */
+    static unsigned int poolSize();
+
+    /**
+     * Attach a RTP processor to the least loaded group of the shared pool
+     * @param proc Pointer to the RTP processor to attach
+     * @return Pointer to the group the processor joined, NULL if pooling is disabled
+     */
+    static RTPGroup* joinPool(RTPProcessor* proc);
+
+    /**
+     * Retrieve the status of the shared pool
+     * @param str String to append pool size and per group loop statistics to
+     */
+    static void poolStatus(String& str);
+
 private:
+    void runPolling();
+    void runReady();
+    void loopDone(const Time& start, unsigned long msec);
+    RTPRecvBatch& rxBatch();
     ObjList m_processors;
     bool m_listChanged;
     unsigned long m_sleep;
+    RTPGroupPoller* m_poller;
+    RTPRecvBatch* m_rxBatch;
+    volatile bool m_pooled;
+    unsigned int m_count;
+    String m_cpus;
+    u_int64_t m_loops;
+    u_int64_t m_busyTime;
+    u_int64_t m_busyMax;
+    unsigned int m_overruns;
+    u_int64_t m_events;
 };
 
 /**
@@ -251,6 +387,9 @@ private:
  */
 class YRTP_API RTPTransport : public RTPProcessor
 {
+    friend class RTPGroup;
+    friend class RTPRelay;
+    friend class RTPPortAllocator;
 public:
     /**
      * Activation status of the transport
@@ -365,6 +504,14 @@ public:
      */
     bool drillHole();
 
+    /**
+     * Accept DTLS records sharing the RTP port as in RFC 5764.
+     * Otherwise only packets that look like RTP are accepted
+     * @param enable True if DTLS is negotiated on this transport
+     */
+    inline void acceptDtls(bool enable)
+	{ m_dtls = enable; }
+
 protected:
     /**
      * Method called periodically to read data out of sockets
@@ -386,12 +533,28 @@ protected:
      */
     virtual void rtcpData(const void* data, int len);
 
+protected:
+    /**
+     * Register or unregister the sockets with a readiness driven group
+     * @param grp Group that the transport joined or left
+     * @param joined True if the transport joined the group, false if it left
+     */
+    virtual void groupChanged(RTPGroup* grp, bool joined);
+
 private:
     bool sendData(Socket& sock, const SocketAddr& to, const void* data, int len,
 	const char* what, bool& flag);
+    void watchSockets();
+    bool adoptSockets(SOCKET rtp, SOCKET rtcp, const SocketAddr& addr);
+    void readRtp(RTPRecvBatch& batch);
+    void readRtcp(RTPRecvBatch& batch);
+    void rtpReceived(const DataBlock& packet);
+    bool rtpSource(const unsigned char* buf, int len);
     Type m_type;
     RTPProcessor* m_processor;
     RTPProcessor* m_monitor;
+    RTPRelay* m_relay;
+    RTPPortAllocator* m_ports;
     Socket m_rtpSock;
     Socket m_rtcpSock;
     SocketAddr m_localAddr;
@@ -401,14 +564,301 @@ private:
     SocketAddr m_rxAddrRTP;
     SocketAddr m_rxAddrRTCP;
     bool m_autoRemote;
+    bool m_dtls;
     bool m_warnSendErrorRtp;
     bool m_warnSendErrorRtcp;
+    bool m_rtpWatched;
+    bool m_rtcpWatched;
+};
+
+/**
+ * Allocator of local ports for RTP transports from a fixed range.
+ * Port pairs in use are kept in a bitmap so a free pair is found without
+ *  repeatedly trying to bind random ports.
+ * Optionally a number of socket pairs are kept bound for each local address
+ *  so transports can be set up without creating and binding sockets. Sockets
+ *  of released transports are reused after they stay idle for a while, the
+ *  data received meanwhile is discarded by refill().
+ * @short Local RTP port allocator with pools of bound sockets
+ */
+class YRTP_API RTPPortAllocator : public RefObject, public Mutex
+{
+    friend class RTPTransport;
+    friend class RTPPortHost;
+public:
+    /**
+     * Constructor
+     * @param minPort Lowest port of the range, rounded up to an even number
+     * @param maxPort Port after the last one of the range
+     * @param spares Number of bound socket pairs to keep for each local address
+     */
+    RTPPortAllocator(int minPort, int maxPort, unsigned int spares = 0);
+
+    /**
+     * Destructor, closes all spare sockets
+     */
+    virtual ~RTPPortAllocator();
+
+    /**
+     * Bind the sockets of a transport to a free port pair
+     * @param trans Transport whose sockets are not yet bound
+     * @param addr Local address to bind, its port is set on return
+     * @param rtcp True to also bind the RTCP socket on the next odd port
+     * @param attempts Number of free ports to try if binding fails
+     * @return True if the transport sockets were bound
+     */
+    bool bind(RTPTransport& trans, SocketAddr& addr, bool rtcp = true, unsigned int attempts = 10);
+
+    /**
+     * Set the number of bound socket pairs kept for each local address
+     * @param count Number of spare socket pairs, zero to close all
+     */
+    void spares(unsigned int count);
+
+    /**
+     * Open spare socket pairs for a local address in advance
+     * @param addr Local address to keep socket pairs bound on
+     */
+    void prepare(const SocketAddr& addr);
+
+    /**
+     * Discard the data received by released socket pairs that finished their
+     *  idle time, they are not reused before that. Then bind new spare socket
+     *  pairs for the local addresses that used some
+     * @param max Maximum number of socket pairs to bind in this call
+     * @return Number of socket pairs bound
+     */
+    unsigned int refill(unsigned int max = 64);
+
+    /**
+     * Get the first port of the range
+     * @return Lowest port handed out by the allocator
+     */
+    inline int minPort() const
+	{ return m_minPort; }
+
+    /**
+     * Get the port after the end of the range
+     * @return Port after the highest one handed out by the allocator
+     */
+    inline int maxPort() const
+	{ return m_minPort + 2 * m_pairs; }
+
+    /**
+     * Retrieve the allocator statistics
+     * @param str String to append the statistics to
+     */
+    void stats(String& str);
+
+private:
+    int findPort();
+    void freePort(int port);
+    RTPPortHost* findHost(const SocketAddr& addr, bool create);
+    void release(RTPTransport& trans);
+    int m_minPort;
+    unsigned int m_pairs;
+    u_int32_t* m_map;
+    unsigned int m_used;
+    unsigned int m_spares;
+    ObjList m_hosts;
+    u_int64_t m_binds;
+    u_int64_t m_reused;
+    u_int64_t m_failed;
+};
+
+/**
+ * Counters of one direction of a relayed stream. They are kept in flat arrays
+ *  shared by all relays and are only updated by the thread running the relay
+ */
+struct RTPRelayCounters
+{
+    /**
+     * Number of RTP packets received and forwarded
+     */
+    u_int64_t rtpPackets;
+
+    /**
+     * Number of RTP bytes received and forwarded
+     */
+    u_int64_t rtpBytes;
+
+    /**
+     * Number of RTCP packets received and forwarded
+     */
+    u_int64_t rtcpPackets;
+
+    /**
+     * Number of packets that could not be forwarded
+     */
+    u_int64_t dropped;
+
+    /**
+     * Number of batches sent to the other side
+     */
+    u_int64_t batches;
+
+    /**
+     * Time of the first packet received, zero if none yet
+     */
+    u_int64_t first;
+
+    /**
+     * Time of the last packet received
+     */
+    u_int64_t last;
+
+    /**
+     * Payload type of the last RTP packet, -1 if none yet
+     */
+    int payload;
+};
+
+/**
+ * A relay forwards RTP and RTCP datagrams between two transports without
+ *  decoding them. Packets are read in batches and sent to the other side
+ *  straight from the receive buffers. Optionally the SSRC and sequence number
+ *  are rewritten so the far end sees one continuous stream when the source
+ *  changes. Both transports and the relay itself run in the same RTP group,
+ *  one of the shared pool if it was set up.
+ * @short Batched forwarder of datagrams between two RTP transports
+ */
+class YRTP_API RTPRelay : public RTPProcessor
+{
+    friend class RTPTransport;
+public:
+    /**
+     * Constructor, creates the two unconnected transports
+     * @param dbg Relay DebugEnabler
+     * @param traceId Relay trace ID
+     */
+    RTPRelay(DebugEnabler* dbg = 0, const char* traceId = 0);
+
+    /**
+     * Destructor, stops relaying and destroys the transports
+     */
+    virtual ~RTPRelay();
+
+    /**
+     * Destroys the object, disposes the memory. Do not call delete directly.
+     */
+    virtual void destruct();
+
+    /**
+     * Get the first transport of the relay
+     * @return Reference to the transport of leg A
+     */
+    inline RTPTransport& legA() const
+	{ return *m_legA; }
+
+    /**
+     * Get the second transport of the relay
+     * @return Reference to the transport of leg B
+     */
+    inline RTPTransport& legB() const
+	{ return *m_legB; }
+
+    /**
+     * Start relaying, join a pooled group or create a new one
+     * @param msec Minimum time to sleep in group loop in milliseconds
+     * @param prio Thread priority of a newly created group
+     * @return True if the relay is running in a group
+     */
+    bool start(int msec = 0, Thread::Priority prio = Thread::Normal);
+
+    /**
+     * Stop relaying, the relay and transports leave their group
+     */
+    void stop();
+
+    /**
+     * Enable or disable rewriting of SSRC and sequence numbers.
+     * RTCP is rewritten to match: sender, SDES and BYE identifiers are
+     *  replaced, report blocks are mapped back to the original source.
+     * SRTP and SRTCP authenticate the rewritten fields so this must not be
+     *  enabled when relaying end to end protected media
+     * @param enable True to present a single stream to each side
+     */
+    void rewrite(bool enable);
+
+    /**
+     * Set the interval after which missing media on a leg is reported
+     * @param msec Timeout in milliseconds, zero to disable
+     */
+    inline void setTimeout(int msec)
+	{ m_timeout = (msec > 0) ? 1000 * (u_int64_t)msec : 0; }
+
+    /**
+     * Start watching legs for missing media, the timeout starts counting now
+     *  if no packet was received yet. Each leg times out at most once
+     * @param watchA True to watch media received on leg A
+     * @param watchB True to watch media received on leg B
+     */
+    void startup(bool watchA = true, bool watchB = true);
+
+    /**
+     * Retrieve the counters of media received on one of the legs
+     * @param legA True for media received on leg A and sent on leg B
+     * @return Reference to the counters of that direction
+     */
+    inline const RTPRelayCounters& counters(bool legA) const
+	{ return *m_stats[legA ? 0 : 1]; }
+
+    /**
+     * Get the number of relays currently allocated
+     * @return Count of relay objects
+     */
+    static unsigned int relays();
+
+    /**
+     * Append comma separated totals of all relays to a status string
+     * @param str String to append the relay status to
+     */
+    static void relayStatus(String& str);
+
+protected:
+    /**
+     * Method called periodically to check for missing media
+     * @param when Time to use as base in all computing
+     */
+    virtual void timerTick(const Time& when);
+
+    /**
+     * Method called when no media was received on a watched leg
+     * @param legA True if the timeout occured on leg A
+     * @param initial True if no packet was received at all on that leg
+     */
+    virtual void timeout(bool legA, bool initial);
+
+private:
+    void relay(RTPTransport* from, SocketDatagram* dgrams, int count, bool rtcp);
+    void rewriteRtp(unsigned char* buf, int dir);
+    void rewriteRtcp(unsigned char* buf, int len, int dir);
+    void rewriteXr(unsigned char* buf, int len, int dir);
+    void ownSsrc(unsigned char* buf, int dir, bool first = true);
+    bool peerSsrc(unsigned char* buf, int dir);
+    void peerSeq(unsigned char* buf, int dir);
+    RTPTransport* m_legA;
+    RTPTransport* m_legB;
+    RTPRelayCounters* m_stats[2];
+    int m_slot;
+    bool m_rewrite;
+    u_int64_t m_timeout;
+    u_int64_t m_armed[2];
+    int m_watch[2];
+    bool m_srcValid[2];
+    u_int32_t m_srcSsrc[2];
+    u_int32_t m_ssrc[2];
+    u_int16_t m_seqDelta[2];
+    u_int16_t m_seqLast[2];
 };
 
 /**
  * A dejitter buffer that can be inserted in the receive data path to
- *  absorb variations in packet arrival time. Incoming packets are stored
- *  and forwarded at fixed intervals.
+ *  absorb variations in packet arrival time. Incoming packets are copied
+ *  in a ring of preallocated slots indexed by sequence number and forwarded
+ *  at their playout time.
+ * The playout delay follows the interarrival jitter measured by the receiver,
+ *  growing at once and shrinking slowly between the minimum and maximum delay.
  * @short Dejitter buffer for incoming data packets
  */
 class YRTP_API RTPDejitter : public RTPProcessor
@@ -442,11 +892,59 @@ public:
     virtual bool rtpRecv(bool marker, int payload, unsigned int timestamp,
 	const void* data, int len);
 
+    /**
+     * Process and store one RTP data packet with a known sequence number
+     * @param seq Sequence number of the packet
+     * @param marker True if the marker bit is set in data packet
+     * @param payload Payload number
+     * @param timestamp Sampling instant of the packet data
+     * @param data Pointer to data block to process
+     * @param len Length of the data block in bytes
+     * @return True if the data packet was queued
+     */
+    bool rtpRecv(u_int16_t seq, bool marker, int payload, unsigned int timestamp,
+	const void* data, int len);
+
     /**
      * Clear the delayed packets queue and all variables
      */
     void clear();
 
+    /**
+     * Get the current playout delay
+     * @return Delay applied to packets in microseconds
+     */
+    inline unsigned int delay() const
+	{ return m_delay; }
+
+    /**
+     * Get the minimum playout delay
+     * @return Smallest delay applied to packets in microseconds
+     */
+    inline unsigned int minDelay() const
+	{ return m_minDelay; }
+
+    /**
+     * Get the maximum playout delay
+     * @return Largest delay applied to packets in microseconds
+     */
+    inline unsigned int maxDelay() const
+	{ return m_maxDelay; }
+
+    /**
+     * Get the number of packets that arrived or were handled after their playout time
+     * @return Count of late packets, including those dropped from buffer
+     */
+    inline u_int32_t late() const
+	{ return m_late; }
+
+    /**
+     * Get the number of packets that were never received in time to be delivered
+     * @return Count of packets skipped at playout
+     */
+    inline u_int32_t lost() const
+	{ return m_lost; }
+
 protected:
     /**
      * Method called periodically to keep the data flowing
@@ -455,15 +953,27 @@ protected:
     virtual void timerTick(const Time& when);
 
 private:
-    ObjList m_packets;
+    void reset();
+    void lose(unsigned int count);
+    void grow(unsigned int len);
+    RTPDejitterSlot* m_slots;
+    unsigned char* m_storage;
+    unsigned int m_slotSize;
+    unsigned int m_mask;
+    unsigned int m_count;
     RTPReceiver* m_receiver;
     unsigned int m_minDelay;
     unsigned int m_maxDelay;
-    unsigned int m_headStamp;
-    unsigned int m_tailStamp;
+    unsigned int m_delay;
+    bool m_started;
+    u_int16_t m_headSeq;
+    u_int16_t m_nextSeq;
+    bool m_refValid;
+    unsigned int m_refStamp;
+    int64_t m_refTime;
     u_int64_t m_headTime;
-    u_int64_t m_sampRate;
-    unsigned char m_fastRate;
+    u_int32_t m_late;
+    u_int32_t m_lost;
 };
 
 /**
@@ -673,6 +1183,154 @@ private:
     int m_silenceType;
 };
 
+/**
+ * Voice quality estimator of one received stream.
+ * Packets played, lost and discarded feed the burst/gap model of RFC 3611
+ *  incrementally, the VoIP metrics and an ITU-T G.107 E-model rating are
+ *  only computed when requested.
+ * @short Quality metrics of a received RTP stream
+ */
+class YRTP_API RTPQuality
+{
+public:
+    /**
+     * Constructor
+     */
+    RTPQuality();
+
+    /**
+     * Clear all counters and the burst/gap state
+     */
+    void reset();
+
+    /**
+     * Account a packet that was played out
+     * @param timestamp RTP timestamp of the packet, used to find the packet duration
+     */
+    inline void received(u_int32_t timestamp)
+	{
+	    m_trans[m_lastLost ? 1 : 0][0]++;
+	    if (m_gapPkts++) {
+		// smallest step between consecutive packets skips over silence
+		u_int32_t dTs = timestamp - m_lastTs;
+		if (dTs && (dTs < 0x10000) && ((dTs < m_frame) || !m_frame))
+		    m_frame = dTs;
+	    }
+	    m_lastLost = false;
+	    m_lastTs = timestamp;
+	    m_received++;
+	}
+
+    /**
+     * Account packets that were never received or never played
+     * @param count Number of consecutive packets missing
+     * @param discard True if the packets were received but dropped without being played
+     */
+    void lost(unsigned int count = 1, bool discard = false);
+
+    /**
+     * Account a packet already counted as lost that arrived too late to be played
+     */
+    inline void discarded()
+	{ if (m_lost) { m_lost--; m_discarded++; } }
+
+    /**
+     * Select the equipment impairment factors of the E-model from a format name
+     * @param format Name of the data format, unknown formats rate like G.711
+     */
+    void codec(const String& format);
+
+    /**
+     * Get the number of packets played out
+     * @return Count of packets received in time
+     */
+    inline u_int32_t packets() const
+	{ return m_received; }
+
+    /**
+     * Get the number of packets that were lost
+     * @return Count of packets that never arrived
+     */
+    inline u_int32_t lostPackets() const
+	{ return m_lost; }
+
+    /**
+     * Get the number of packets discarded as arriving too late
+     * @return Count of packets discarded
+     */
+    inline u_int32_t discardedPackets() const
+	{ return m_discarded; }
+
+    /**
+     * Get the duration of the data carried by a packet
+     * @param rate Clock rate of the RTP timestamps
+     * @return Packet duration in milliseconds, zero if not known yet
+     */
+    unsigned int frameTime(unsigned int rate) const;
+
+    /**
+     * Get the fraction of expected packets that were lost
+     * @return Loss rate scaled by 256 as in RFC 3611
+     */
+    unsigned int lossRate() const;
+
+    /**
+     * Get the fraction of expected packets that were discarded
+     * @return Discard rate scaled by 256 as in RFC 3611
+     */
+    unsigned int discardRate() const;
+
+    /**
+     * Compute the burst and gap metrics of RFC 3611 4.7.2
+     * @param rate Clock rate of the RTP timestamps
+     * @param burstDensity Fraction of packets lost or discarded in bursts, scaled by 256
+     * @param gapDensity Fraction of packets lost or discarded in gaps, scaled by 256
+     * @param burstDuration Mean duration of bursts in milliseconds
+     * @param gapDuration Mean duration of gaps in milliseconds
+     */
+    void bursts(unsigned int rate, unsigned int& burstDensity, unsigned int& gapDensity,
+	unsigned int& burstDuration, unsigned int& gapDuration) const;
+
+    /**
+     * Compute the transmission rating factor using the simplified E-model
+     * @param delay One way delay in milliseconds, negative to leave out delay impairment
+     * @return R factor in range 0 to 100
+     */
+    int rFactor(int delay = -1) const;
+
+    /**
+     * Convert a transmission rating factor to an estimated Mean Opinion Score
+     * @param rFactor R factor as returned by @ref rFactor()
+     * @return MOS scaled by 10 in range 10 to 45
+     */
+    static unsigned int mos(int rFactor);
+
+    /**
+     * Get the minimum number of received packets that separates loss bursts
+     * @return Gmin of the burst/gap model
+     */
+    static unsigned int minGap();
+
+private:
+    u_int32_t m_received;
+    u_int32_t m_lost;
+    u_int32_t m_discarded;
+    u_int32_t m_lastTs;                  // Timestamp of last played packet
+    u_int32_t m_frame;                   // Packet duration in timestamp units
+    bool m_lastLost;                     // Previous packet was lost
+    u_int32_t m_trans[2][2];             // Received/lost state transitions
+    u_int32_t m_gapPkts;                 // Packets received since last loss
+    u_int32_t m_burstLost;               // Losses in current burst
+    u_int32_t m_c11;                     // RFC 3611 A.2 transition counters
+    u_int32_t m_c13;
+    u_int32_t m_c14;
+    u_int32_t m_c22;
+    u_int32_t m_c23;
+    u_int32_t m_c33;
+    int m_ie;                            // Equipment impairment factor
+    int m_bpl;                           // Packet loss robustness factor, scaled by 10
+};
+
 /**
  * Class that handles incoming RTP and RTCP packets
  * @short RTP/RTCP packet receiver
@@ -687,9 +1345,10 @@ public:
      */
     inline RTPReceiver(RTPSession* session = 0)
 	: RTPBaseIO(session),
-	  m_ioLostPkt(0), m_dejitter(0),
+	  m_ioLostPkt(0), m_dejitter(0), m_packet(0),
 	  m_seqSync(0), m_seqCount(0), m_warn(true), m_warnSeq(1),
-	  m_seqLost(0), m_wrongSSRC(0), m_syncLost(0)
+	  m_seqLost(0), m_wrongSSRC(0), m_syncLost(0),
+	  m_clockRate(8000), m_jitter(0), m_transit(0), m_arrivalBase(0)
 	{ }
 
     /**
@@ -704,6 +1363,73 @@ public:
     inline u_int32_t ioPacketsLost() const
 	{ return m_ioLostPkt; }
 
+    /**
+     * Retrieve the RTP clock rate used to compute the interarrival jitter
+     * @return Clock rate of the RTP timestamps in Hz
+     */
+    inline unsigned int clockRate() const
+	{ return m_clockRate; }
+
+    /**
+     * Set the RTP clock rate used to compute the interarrival jitter
+     * @param rate Clock rate of the RTP timestamps in Hz
+     */
+    inline void clockRate(unsigned int rate)
+	{ if (rate) m_clockRate = rate; }
+
+    /**
+     * Retrieve the interarrival jitter as defined in RFC 3550
+     * @return Estimated jitter in timestamp units
+     */
+    inline u_int32_t jitter() const
+	{ return m_jitter >> 4; }
+
+    /**
+     * Retrieve the interarrival jitter in time units
+     * @return Estimated jitter in microseconds
+     */
+    inline unsigned int jitterUsec() const
+	{ return (unsigned int)((u_int64_t)(m_jitter >> 4) * 1000000 / m_clockRate); }
+
+    /**
+     * Retrieve the dejitter buffer of this receiver
+     * @return Pointer to the dejitter buffer, NULL if not set
+     */
+    inline RTPDejitter* dejitter() const
+	{ return m_dejitter; }
+
+    /**
+     * Retrieve the quality metrics of the received stream
+     * @return Reference to the quality estimator
+     */
+    inline const RTPQuality& quality() const
+	{ return m_quality; }
+
+    /**
+     * Retrieve the quality metrics of the received stream for changes
+     * @return Reference to the quality estimator
+     */
+    inline RTPQuality& quality()
+	{ return m_quality; }
+
+    /**
+     * Get the delay added by this end to received media
+     * @return Playout buffer delay plus one packet duration in milliseconds
+     */
+    unsigned int endDelay() const;
+
+    /**
+     * Put the quality metrics of the received stream in a list
+     * @param stat NamedList to populate with the metrics
+     */
+    void qualityStats(NamedList& stat) const;
+
+    /**
+     * Append the quality metrics of the received stream to a string
+     * @param stats String to append KEY=value pairs to
+     */
+    void qualityStats(String& stats) const;
+
 
     /**
      * Set a new dejitter buffer in this receiver
@@ -719,6 +1445,16 @@ public:
     inline void setDejitter(unsigned int mindelay, unsigned int maxdelay)
 	{ setDejitter(new RTPDejitter(this,mindelay,maxdelay,dbg(),m_traceId)); }
 
+    /**
+     * Make a data block share part of the RTP packet currently being delivered.
+     * This is possible only while processing a packet received in a shared buffer
+     * @param dest Data block to fill, it is left untouched on failure
+     * @param data Pointer to the data inside the current packet
+     * @param len Length of the data in bytes
+     * @return True if the data block now shares the packet buffer
+     */
+    bool packetSlice(DataBlock& dest, const void* data, int len) const;
+
     /**
      * Process one RTP payload packet.
      * Default behaviour is to call rtpRecvData() or rtpRecvEvent().
@@ -814,12 +1550,16 @@ protected:
 
 private:
     void rtpData(const void* data, int len);
+    void rtpPacket(const DataBlock& packet);
     void rtcpData(const void* data, int len);
     bool decodeEvent(bool marker, unsigned int timestamp, const void* data, int len);
     bool decodeSilence(bool marker, unsigned int timestamp, const void* data, int len);
     void finishEvent(unsigned int timestamp);
     bool pushEvent(int event, int duration, int volume, unsigned int timestamp);
+    void updateJitter(u_int32_t timestamp);
     RTPDejitter* m_dejitter;
+    RTPQuality m_quality;
+    const DataBlock* m_packet;           // Packet being delivered, if held in a shared buffer
     u_int16_t m_seqSync;
     u_int16_t m_seqCount;
     bool m_warn;
@@ -827,6 +1567,10 @@ private:
     unsigned int m_seqLost;
     unsigned int m_wrongSSRC;
     unsigned int m_syncLost;
+    unsigned int m_clockRate;
+    u_int32_t m_jitter;                  // Jitter scaled by 16 in timestamp units
+    u_int32_t m_transit;                 // Relative transit time of last packet
+    u_int64_t m_arrivalBase;             // Time arrivals are measured from, zero to restart
 };
 
 /**
@@ -1098,6 +1842,12 @@ public:
      */
     virtual void rtpData(const void* data, int len);
 
+    /**
+     * This method is called to process a RTP packet held in a shared buffer.
+     * @param packet Data block holding the raw RTP packet
+     */
+    virtual void rtpPacket(const DataBlock& packet);
+
     /**
      * This method is called to process a RTCP packet.
      * @param data Pointer to raw RTCP data
@@ -1175,6 +1925,44 @@ public:
      */
     virtual bool checkCipher(const String& name);
 
+    /**
+     * Create a DTLS endpoint when DTLS-SRTP keying is requested
+     * @return Pointer to newly allocated RTPDtls or NULL if not supported
+     */
+    virtual RTPDtls* createDtls();
+
+    /**
+     * Start negotiating the SRTP keys over DTLS on the RTP transport (RFC 5764).
+     * Media is neither sent nor accepted until the keys are installed
+     * @param client True to act as DTLS client (a=setup:active)
+     * @param fingerprint Expected fingerprint of the peer certificate as
+     *  "hash-func XX:XX:...", DTLS is refused if it is empty
+     * @return True if the DTLS endpoint was created
+     */
+    bool dtlsSetup(bool client, const String& fingerprint = String::empty());
+
+    /**
+     * Get the fingerprint of the local DTLS certificate, it can be retrieved
+     *  before starting DTLS so it can be placed in an offer
+     * @param buf String to fill with the fingerprint as "hash-func XX:XX:..."
+     * @return True if DTLS is supported and the fingerprint was retrieved
+     */
+    bool dtlsFingerprint(String& buf);
+
+    /**
+     * Check if DTLS keying was requested but the SRTP keys are not installed yet
+     * @return True if media must be held until negotiation completes
+     */
+    inline bool dtlsPending() const
+	{ return m_dtls && !m_dtlsKeyed; }
+
+    /**
+     * Check if SRTP keys are negotiated over DTLS in this session
+     * @return True if DTLS keying was started
+     */
+    inline bool dtlsActive() const
+	{ return 0 != m_dtls; }
+
     /**
      * Send one RTP payload packet
      * @param marker Set to true if the marker bit must be set
@@ -1363,8 +2151,9 @@ public:
     /**
      * Set the RTCP report interval
      * @param interval Average interval between reports in msec, zero to disable
+     * @param extended True to add a RTCP XR VoIP metrics block to reports
      */
-    void setReports(int interval);
+    void setReports(int interval, bool extended = false);
 
     /**
      * Put the collected statistical data
@@ -1415,17 +2204,28 @@ protected:
     void sendRtcpBye();
 
 private:
+    bool dtlsData(const void* data, int len);
+    void dtlsTick();
+    void dtlsClear();
+    bool dtlsKeys();
     Direction m_direction;
     RTPSender* m_send;
     RTPReceiver* m_recv;
     RTPSecure* m_secure;
+    RTPDtlsLink* m_dtls;
+    bool m_dtlsKeyed;
+    bool m_dtlsFailed;
     u_int64_t m_reportTime;
     u_int64_t m_reportInterval;
+    bool m_reportXR;
     int m_warnSeq;                       // Warn on invalid sequence (1: DebugWarn, -1: DebugInfo)
 };
 
 /**
- * A bidirectional UDPTL session usable for T.38
+ * A bidirectional UDPTL session usable for T.38.
+ * Lost IFPs are recovered from redundant secondary IFPs or from parity FEC
+ *  data. Recent IFPs of both directions are kept in fixed size rings so no
+ *  memory is allocated per packet.
  * @short UDPTL session
  */
 class YRTP_API UDPTLSession : public UDPSession, public Mutex
@@ -1458,6 +2258,42 @@ public:
     inline u_int8_t maxSec() const
 	{ return m_maxSec; }
 
+    /**
+     * Send parity FEC data instead of redundant secondary IFPs
+     * @param span Number of IFPs combined in each FEC entry, zero to send secondary IFPs
+     * @param entries Number of FEC entries in each packet, each IFP is covered by one
+     * @return True if the requested FEC parameters are used
+     */
+    bool setFec(unsigned int span, unsigned int entries = 1);
+
+    /**
+     * Get the number of IFPs combined in each sent FEC entry
+     * @return FEC span, zero if secondary IFPs are sent
+     */
+    inline u_int8_t fecSpan() const
+	{ return m_fecSpan; }
+
+    /**
+     * Get the number of FEC entries in each sent packet
+     * @return Number of FEC entries
+     */
+    inline u_int8_t fecEntries() const
+	{ return m_fecEntries; }
+
+    /**
+     * Get the number of IFPs recovered after data loss
+     * @return Number of recovered IFPs
+     */
+    inline u_int32_t recoveredIfps() const
+	{ return m_recovered; }
+
+    /**
+     * Get the number of IFPs that were lost and could not be recovered
+     * @return Number of IFPs lost
+     */
+    inline u_int32_t lostIfps() const
+	{ return m_lost; }
+
     /**
      * This method is called to send or process an UDPTL packet
      * @param data Pointer to raw UDPTL data
@@ -1509,12 +2345,98 @@ protected:
 
 private:
     void recoverSec(const unsigned char* data, int len, u_int16_t seq, int nSec);
+    void recoverFec(const unsigned char* data, int len, u_int16_t seq);
+    void recovered(const unsigned char* data, int len, u_int16_t seq);
+    int addFec(unsigned char* pd, int pl, u_int16_t seq);
     u_int16_t m_rxSeq;
     u_int16_t m_txSeq;
     u_int16_t m_maxLen;
     u_int8_t m_maxSec;
+    u_int8_t m_fecSpan;
+    u_int8_t m_fecEntries;
     bool m_warn;
-    ObjList m_txQueue;
+    u_int32_t m_recovered;
+    u_int32_t m_lost;
+    UDPTLBuffer* m_buffer;
+};
+
+/**
+ * Interface to a DTLS endpoint negotiating SRTP keys as in RFC 5764.
+ * Implementations are provided by a cryptographic module through the
+ *  engine.dtls message. All methods are called from a single thread that is
+ *  not the media thread, the endpoint exchanges datagrams only through the
+ *  received() and output() methods.
+ * @short DTLS-SRTP key negotiation endpoint
+ */
+class RTPDtls : public RefObject
+{
+public:
+    /**
+     * State of the DTLS association
+     */
+    enum State {
+	Idle = 0,
+	Handshake,
+	Connected,
+	Failed
+    };
+
+    /**
+     * Prepare the endpoint for a handshake
+     * @param client True to act as DTLS client, false to wait for the peer
+     * @param fingerprint Expected fingerprint of the peer certificate,
+     *  the handshake fails if it is empty
+     * @return True if the endpoint is ready
+     */
+    virtual bool init(bool client, const String& fingerprint) = 0;
+
+    /**
+     * Get the fingerprint of the local certificate
+     * @return Fingerprint as "hash-func XX:XX:..."
+     */
+    virtual const String& fingerprint() const = 0;
+
+    /**
+     * Start the handshake, a client sends its first flight
+     * @return New state of the association
+     */
+    virtual State start() = 0;
+
+    /**
+     * Process one DTLS datagram received from the peer
+     * @param data Pointer to the datagram
+     * @param len Length of the datagram
+     * @return New state of the association
+     */
+    virtual State received(const void* data, int len) = 0;
+
+    /**
+     * Handle an expired retransmission timer
+     * @return New state of the association
+     */
+    virtual State timer() = 0;
+
+    /**
+     * Get the interval until the retransmission timer expires
+     * @return Interval in milliseconds, negative if no timer is running
+     */
+    virtual int timeout() = 0;
+
+    /**
+     * Retrieve the next datagram that must be sent to the peer
+     * @param packet Block to fill with the datagram
+     * @return True if a datagram was retrieved
+     */
+    virtual bool output(DataBlock& packet) = 0;
+
+    /**
+     * Retrieve the negotiated SRTP keys once connected
+     * @param suite Name of the SRTP crypto suite as used in SDES
+     * @param material Keying material laid out as in RFC 5764 4.2: client key,
+     *  server key, client salt, server salt
+     * @return True if keys are available
+     */
+    virtual bool keys(String& suite, DataBlock& material) = 0;
 };
 
 /**
@@ -1598,6 +2520,18 @@ public:
      */
     virtual bool create(String& suite, String& keyParams, bool buildMaster = true);
 
+    /**
+     * Enable or disable the native SRTP code path for instances keyed later
+     * @param enable True to use the CPU specific AES-CTR and HMAC-SHA1 code
+     */
+    static void fastPath(bool enable);
+
+    /**
+     * Get the native SRTP implementation that new instances will use
+     * @return Name of the implementation, "disabled" if turned off
+     */
+    static const char* fastPath();
+
 protected:
     /**
      * Initialize security related variables in the RTP session
@@ -1653,8 +2587,10 @@ protected:
     bool deriveKey(Cipher& cipher, DataBlock& key, unsigned int len, unsigned char label, u_int64_t index = 0);
 
 private:
+    void hmac(const unsigned char* data, int len, u_int32_t roc, unsigned char* digest);
     RTPBaseIO* m_owner;
     Cipher* m_rtpCipher;
+    RTPSecureFast* m_fast;
     DataBlock m_masterKey;
     DataBlock m_masterSalt;
     DataBlock m_cipherKey;
@@ -85,12 +85,14 @@ class AmrTrans : public DataTranslator
 public:
     AmrTrans(const char* sFormat, const char* dFormat, void* amrState, bool octetAlign, bool encoding);
     virtual ~AmrTrans();
-    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags);
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ return transcode(data,tStamp,flags); }
     inline bool valid() const
 	{ return 0 != m_amrState; }
     static inline const char* alignName(bool align)
 	{ return align ? "octet aligned" : "bandwidth efficient"; }
 protected:
+    virtual unsigned long process(const DataBlock& data, unsigned long tStamp, unsigned long flags);
     void filterBias(short* buf, unsigned int len);
     bool dataError(const char* text = 0);
     virtual bool pushData(unsigned long& tStamp, unsigned long& flags) = 0;
@@ -285,7 +287,7 @@ AmrTrans::~AmrTrans()
 }
 
 // Actual transcoding of data
-unsigned long AmrTrans::Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+unsigned long AmrTrans::process(const DataBlock& data, unsigned long tStamp, unsigned long flags)
 {
     if (!(m_amrState && getTransSource()))
 	return 0;
@@ -23,6 +23,15 @@
 
 #include <yatephone.h>
 
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(NO_DATA_SIMD)
+#define CONF_X86
+#include <immintrin.h>
+#define CONF_SSE2 __attribute__((target("sse2")))
+#define CONF_AVX2 __attribute__((target("avx2")))
+#endif
+
 using namespace TelEngine;
 namespace { // anonymous
 
@@ -33,6 +42,9 @@ namespace { // anonymous
 #define MAX_SPEAKERS 8
 #define DEF_SPEAKERS 3
 
+// maximum number of loudest talkers we can limit the mix to
+#define MAX_TALKERS 32
+
 // Speaking detector energy square hysteresis
 #define SPEAK_HIST_MIN 16384
 #define SPEAK_HIST_MAX 32768
@@ -62,6 +74,7 @@ namespace { // anonymous
 #error SHIFT_RAISE must be higher than SHIFT_LEVEL
 #endif
 
+struct MixKernels;
 class ConfConsumer;
 class ConfSource;
 class ConfChan;
@@ -106,6 +119,8 @@ public:
 	{ return m_minBuffer; }
     inline unsigned int maxBuffer() const
 	{ return m_maxBuffer; }
+    inline const MixKernels* mixer() const
+	{ return m_mix; }
     void mix(ConfConsumer* cons = 0);
     void addChannel(ConfChan* chan, bool player = false);
     void delChannel(ConfChan* chan);
@@ -125,6 +140,8 @@ private:
     // Set the expire time
     void setExpire();
     String m_name;
+    DataBlock m_mixSum;
+    DataBlock m_mixOwn;
     ObjList m_chans;
     ObjList m_owners;
     String m_notify;
@@ -141,6 +158,8 @@ private:
     ConfChan* m_speakers[MAX_SPEAKERS];
     int m_trackSpeakers;
     int m_trackInterval;
+    int m_maxTalkers;
+    const MixKernels* m_mix;
     u_int64_t m_nextNotify;
     u_int64_t m_nextSpeakers;
     unsigned int m_minBuffer;
@@ -188,7 +207,7 @@ class ConfConsumer : public DataConsumer
     YCLASS(ConfConsumer,DataConsumer);
 public:
     ConfConsumer(ConfRoom* room, bool smart = false)
-	: m_room(room), m_src(0), m_muted(false), m_smart(smart), m_speak(false),
+	: m_room(room), m_src(0), m_muted(false), m_smart(smart), m_speak(false), m_mixed(false),
 	  m_energy2(ENERGY_MIN), m_noise2(ENERGY_MIN), m_envelope2(ENERGY_MIN)
 	{ DDebug(DebugAll,"ConfConsumer::ConfConsumer(%p,%s) [%p]",room,String::boolText(smart),this); m_format = room->getFormat(); }
     ~ConfConsumer()
@@ -215,13 +234,15 @@ public:
     inline bool shouldMix() const
 	{ return hasSignal() && (m_buffer.length() > 1); }
 private:
-    void consumed(const int* mixed, unsigned int samples);
-    void dataForward(const int* mixed, unsigned int samples);
+    void mixInto(int* mixed, unsigned int samples);
+    void consumed(const int* mixed, const DataBlock& mix, int16_t* own, unsigned int samples);
+    void dataForward(const int* mixed, const DataBlock& mix, int16_t* own, unsigned int samples);
     RefPointer<ConfRoom> m_room;
     ConfSource* m_src;
     bool m_muted;
     bool m_smart;
     bool m_speak;
+    bool m_mixed;
     unsigned int m_energy2;
     unsigned int m_noise2;
     unsigned int m_envelope2;
@@ -303,6 +324,162 @@ static unsigned int binLog(unsigned int x)
     return v;
 }
 
+// Mixing kernels, the sum of all talkers is kept in 32 bit integers
+typedef void (*MixAdd)(int* mixed, const int16_t* samples, unsigned int n);
+typedef void (*MixOut)(int16_t* out, const int* mixed, unsigned int n);
+typedef void (*MixMinus)(int16_t* out, const int* mixed, const int16_t* samples, unsigned int n);
+
+// Saturate symmetrically the result of additions and substraction
+static inline int16_t mixSaturate(int val)
+{
+    return (val < -32767) ? -32767 : ((val > 32767) ? 32767 : val);
+}
+
+static void mixAddGeneric(int* mixed, const int16_t* samples, unsigned int n)
+{
+    while (n--)
+	*mixed++ += *samples++;
+}
+
+static void mixOutGeneric(int16_t* out, const int* mixed, unsigned int n)
+{
+    while (n--)
+	*out++ = mixSaturate(*mixed++);
+}
+
+static void mixMinusGeneric(int16_t* out, const int* mixed, const int16_t* samples, unsigned int n)
+{
+    while (n--)
+	*out++ = mixSaturate(*mixed++ - *samples++);
+}
+
+#ifdef CONF_X86
+// Pack 32 bit sums in 16 bit samples, the pack saturates to -32768 so clamp again
+CONF_SSE2 static inline __m128i mixPackSse2(__m128i lo, __m128i hi)
+{
+    return _mm_max_epi16(_mm_packs_epi32(lo,hi),_mm_set1_epi16(-32767));
+}
+
+CONF_SSE2 static void mixAddSse2(int* mixed, const int16_t* samples, unsigned int n)
+{
+    for (; n >= 8; n -= 8, samples += 8, mixed += 8) {
+	__m128i v = _mm_loadu_si128((const __m128i*)samples);
+	// sign extend by moving each sample in the high half then shifting back
+	__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v,v),16);
+	__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v,v),16);
+	_mm_storeu_si128((__m128i*)mixed,_mm_add_epi32(_mm_loadu_si128((const __m128i*)mixed),lo));
+	_mm_storeu_si128((__m128i*)(mixed + 4),_mm_add_epi32(_mm_loadu_si128((const __m128i*)(mixed + 4)),hi));
+    }
+    mixAddGeneric(mixed,samples,n);
+}
+
+CONF_SSE2 static void mixOutSse2(int16_t* out, const int* mixed, unsigned int n)
+{
+    for (; n >= 8; n -= 8, mixed += 8, out += 8) {
+	__m128i lo = _mm_loadu_si128((const __m128i*)mixed);
+	__m128i hi = _mm_loadu_si128((const __m128i*)(mixed + 4));
+	_mm_storeu_si128((__m128i*)out,mixPackSse2(lo,hi));
+    }
+    mixOutGeneric(out,mixed,n);
+}
+
+CONF_SSE2 static void mixMinusSse2(int16_t* out, const int* mixed, const int16_t* samples, unsigned int n)
+{
+    for (; n >= 8; n -= 8, mixed += 8, samples += 8, out += 8) {
+	__m128i v = _mm_loadu_si128((const __m128i*)samples);
+	__m128i lo = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)mixed),
+	    _mm_srai_epi32(_mm_unpacklo_epi16(v,v),16));
+	__m128i hi = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(mixed + 4)),
+	    _mm_srai_epi32(_mm_unpackhi_epi16(v,v),16));
+	_mm_storeu_si128((__m128i*)out,mixPackSse2(lo,hi));
+    }
+    mixMinusGeneric(out,mixed,samples,n);
+}
+
+// The AVX2 pack works on 128 bit lanes so the result must be reordered
+CONF_AVX2 static inline __m256i mixPackAvx2(__m256i lo, __m256i hi)
+{
+    __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo,hi),0xd8);
+    return _mm256_max_epi16(v,_mm256_set1_epi16(-32767));
+}
+
+CONF_AVX2 static void mixAddAvx2(int* mixed, const int16_t* samples, unsigned int n)
+{
+    for (; n >= 16; n -= 16, samples += 16, mixed += 16) {
+	__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)samples));
+	__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(samples + 8)));
+	_mm256_storeu_si256((__m256i*)mixed,_mm256_add_epi32(_mm256_loadu_si256((const __m256i*)mixed),lo));
+	_mm256_storeu_si256((__m256i*)(mixed + 8),_mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(mixed + 8)),hi));
+    }
+    mixAddGeneric(mixed,samples,n);
+}
+
+CONF_AVX2 static void mixOutAvx2(int16_t* out, const int* mixed, unsigned int n)
+{
+    for (; n >= 16; n -= 16, mixed += 16, out += 16) {
+	__m256i lo = _mm256_loadu_si256((const __m256i*)mixed);
+	__m256i hi = _mm256_loadu_si256((const __m256i*)(mixed + 8));
+	_mm256_storeu_si256((__m256i*)out,mixPackAvx2(lo,hi));
+    }
+    mixOutGeneric(out,mixed,n);
+}
+
+CONF_AVX2 static void mixMinusAvx2(int16_t* out, const int* mixed, const int16_t* samples, unsigned int n)
+{
+    for (; n >= 16; n -= 16, mixed += 16, samples += 16, out += 16) {
+	__m256i lo = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)mixed),
+	    _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)samples)));
+	__m256i hi = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(mixed + 8)),
+	    _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(samples + 8))));
+	_mm256_storeu_si256((__m256i*)out,mixPackAvx2(lo,hi));
+    }
+    mixMinusGeneric(out,mixed,samples,n);
+}
+#endif
+
+// Set of mixing kernels working together
+struct MixKernels {
+    const char* name;
+    MixAdd add;
+    MixOut out;
+    MixMinus minus;
+};
+
+static const MixKernels s_mixGeneric = { "generic", mixAddGeneric, mixOutGeneric, mixMinusGeneric };
+#ifdef CONF_X86
+static const MixKernels s_mixSse2 = { "sse2", mixAddSse2, mixOutSse2, mixMinusSse2 };
+static const MixKernels s_mixAvx2 = { "avx2", mixAddAvx2, mixOutAvx2, mixMinusAvx2 };
+#endif
+
+// Find the mixing kernels by name, return the best ones the CPU supports if not set
+static const MixKernels* findMix(const String& name = String::empty())
+{
+    if (name == s_mixGeneric.name)
+	return &s_mixGeneric;
+#ifdef CONF_X86
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2");
+    bool sse2 = __builtin_cpu_supports("sse2");
+    if ((name == s_mixAvx2.name) && avx2)
+	return &s_mixAvx2;
+    if ((name == s_mixSse2.name) && sse2)
+	return &s_mixSse2;
+    if (name && (name != s_mixAvx2.name) && (name != s_mixSse2.name))
+	Debug(DebugMild,"Unknown conference mixer '%s'",name.c_str());
+    if (avx2)
+	return &s_mixAvx2;
+    if (sse2)
+	return &s_mixSse2;
+#else
+    if (name)
+	Debug(DebugMild,"Conference mixer '%s' is not available",name.c_str());
+#endif
+    return &s_mixGeneric;
+}
+
+// Mixing kernels picked at startup from the CPU features
+static const MixKernels* s_mix = findMix();
+
 
 // Get a pointer to a conference by name, optionally creates it with given parameters
 // If a pointer is returned it must be dereferenced by the caller
@@ -349,6 +526,9 @@ ConfRoom::ConfRoom(const String& name, const NamedList& params)
 	m_trackInterval = 0;
     else if (m_trackInterval < MIN_INTERVAL)
 	m_trackInterval = MIN_INTERVAL;
+    m_maxTalkers = params.getIntValue("maxtalkers",0,0,MAX_TALKERS);
+    const String& mixer = params["mixer"];
+    m_mix = mixer ? findMix(mixer) : s_mix;
     setLonelyTimeout(params["lonely"]);
     if (m_rate != 8000)
 	m_format << "/" << m_rate;
@@ -357,6 +537,9 @@ ConfRoom::ConfRoom(const String& name, const NamedList& params)
     m_dataChunk = 2 * tenMs;
     m_minBuffer = 3 * tenMs;
     m_maxBuffer = 6 * tenMs;
+    // mixing buffers are allocated once, we never mix more than maximum buffer
+    m_mixSum.assign(0,m_maxBuffer / sizeof(int16_t) * sizeof(int));
+    m_mixOwn.assign(0,m_maxBuffer);
     for (int i = 0; i < MAX_SPEAKERS; i++)
 	m_speakers[i] = 0;
     s_rooms.append(this);
@@ -552,6 +735,8 @@ void ConfRoom::msgStatus(Message& msg)
     msg.retValue() << ",expire=" << (int)exp;
     msg.retValue() << ",rate=" << m_rate;
     msg.retValue() << ",users=" << m_users;
+    if (m_maxTalkers)
+	msg.retValue() << ",maxtalkers=" << m_maxTalkers;
     msg.retValue() << ",chans=" << m_chans.count();
     msg.retValue() << ",owners=" << m_owners.count();
     if (m_notify)
@@ -694,16 +879,26 @@ void ConfRoom::mix(ConfConsumer* cons)
 	speakChan[spk] = 0;
     }
     len = len * m_dataChunk / sizeof(int16_t);
-    DataBlock mixbuf(0,len*sizeof(int));
-    int* buf = (int*)mixbuf.data();
+    if (m_mixSum.length() < len*sizeof(int)) {
+	m_mixSum.assign(0,len*sizeof(int));
+	m_mixOwn.assign(0,len*sizeof(int16_t));
+    }
+    else
+	::memset(m_mixSum.data(),0,len*sizeof(int));
+    int* buf = (int*)m_mixSum.data();
+    // loudest talkers sorted by decreasing envelope if we limit their number
+    ConfConsumer* talkers[MAX_TALKERS];
+    unsigned int talkVol[MAX_TALKERS];
+    int nTalk = 0;
     for (l = m_chans.skipNull(); l; l = l->skipNext()) {
 	ConfChan* ch = static_cast<ConfChan*>(l->get());
 	ConfConsumer* co = static_cast<ConfConsumer*>(ch->getConsumer());
 	if (co) {
+	    co->m_mixed = false;
 	    // avoid mixing in noise
 	    if (co->shouldMix()) {
-		unsigned int n = co->m_buffer.length() / 2;
 #ifdef XDEBUG
+		unsigned int n = co->m_buffer.length() / 2;
 		if (ch->debugAt(DebugAll)) {
 		    int noise = co->noise();
 		    int energy = co->energy() - noise;
@@ -717,11 +912,19 @@ void ConfRoom::mix(ConfConsumer* cons)
 			String('=',energy).safe(),String('-',tip).safe());
 		}
 #endif
-		if (n > len)
-		    n = len;
-		const int16_t* p = (const int16_t*)co->m_buffer.data();
-		for (unsigned int i=0; i < n; i++)
-		    buf[i] += *p++;
+		// channels without level detection can't be ranked, always mix them
+		unsigned int vol = co->envelope2();
+		if (!(m_maxTalkers && co->smart()))
+		    co->mixInto(buf,len);
+		else if ((nTalk < m_maxTalkers) || (vol > talkVol[nTalk-1])) {
+		    int i = (nTalk < m_maxTalkers) ? nTalk++ : (nTalk - 1);
+		    for (; (i > 0) && (vol > talkVol[i-1]); i--) {
+			talkers[i] = talkers[i-1];
+			talkVol[i] = talkVol[i-1];
+		    }
+		    talkers[i] = co;
+		    talkVol[i] = vol;
+		}
 	    }
 	    if (m_trackSpeakers && m_notify && !ch->isUtility() && co->speaking()) {
 		int vol = co->envelope();
@@ -738,21 +941,19 @@ void ConfRoom::mix(ConfConsumer* cons)
 	    }
 	}
     }
+    for (int i = 0; i < nTalk; i++)
+	talkers[i]->mixInto(buf,len);
+    // all channels not heard in the mix will share the same output data
+    DataBlock data(0,len*sizeof(int16_t));
+    m_mix->out((int16_t*)data.data(),buf,len);
     // we finished mixing - notify consumers about it
+    int16_t* own = (int16_t*)m_mixOwn.data();
     for (l = m_chans.skipNull(); l; l = l->skipNext()) {
 	ConfChan* ch = static_cast<ConfChan*>(l->get());
 	ConfConsumer* co = static_cast<ConfConsumer*>(ch->getConsumer());
 	if (co)
-	    co->consumed(buf,len);
+	    co->consumed(buf,data,own,len);
     }
-    DataBlock data(0,len*sizeof(int16_t));
-    int16_t* p = (int16_t*)data.data();
-    for (unsigned int i=0; i < len; i++) {
-	int val = buf[i];
-	// saturate symmetrically the result of addition
-	*p++ = (val < -32767) ? -32767 : ((val > 32767) ? 32767 : val);
-    }
-    mixbuf.clear();
     Message* m = 0;
     while (m_trackSpeakers && m_notify) {
 	u_int64_t now = Time::now();
@@ -954,13 +1155,23 @@ unsigned long ConfConsumer::Consume(const DataBlock& data, unsigned long tStamp,
     return invalidStamp();
 }
 
+// Add our buffered data to the mix, this method is called with the room locked
+void ConfConsumer::mixInto(int* mixed, unsigned int samples)
+{
+    unsigned int n = m_buffer.length() / 2;
+    if (n > samples)
+	n = samples;
+    m_room->mixer()->add(mixed,(const int16_t*)m_buffer.data(),n);
+    m_mixed = true;
+}
+
 // Take out of the buffer the samples mixed in or skipped
 //  this method is called with the room locked
-void ConfConsumer::consumed(const int* mixed, unsigned int samples)
+void ConfConsumer::consumed(const int* mixed, const DataBlock& mix, int16_t* own, unsigned int samples)
 {
     if (!samples)
 	return;
-    dataForward(mixed,samples);
+    dataForward(mixed,mix,own,samples);
     unsigned int n = m_buffer.length() / 2;
     if (samples > n) {
 	// buffer underflowed
@@ -980,7 +1191,8 @@ void ConfConsumer::consumed(const int* mixed, unsigned int samples)
 }
 
 // Substract our own data from the mix and send it on the no-echo source
-void ConfConsumer::dataForward(const int* mixed, unsigned int samples)
+// The own buffer is room scratch memory, we hold the room locked while using it
+void ConfConsumer::dataForward(const int* mixed, const DataBlock& mix, int16_t* own, unsigned int samples)
 {
     if (!(m_src && mixed))
 	return;
@@ -991,19 +1203,20 @@ void ConfConsumer::dataForward(const int* mixed, unsigned int samples)
     if (!src)
 	return;
 
-    int16_t* d = (int16_t*)m_buffer.data();
-    unsigned int n = m_buffer.length() / 2;
-    DataBlock data(0,samples*sizeof(int16_t));
-    int16_t* p = (int16_t*)data.data();
-    for (unsigned int i=0; i < samples; i++) {
-	int val = *mixed++;
-	// substract our own data if we contributed - only as much as we have
-	if ((i < n) && shouldMix())
-	    val -= d[i];
-	// saturate symmetrically the result of additions and substraction
-	*p++ = (val < -32767) ? -32767 : ((val > 32767) ? 32767 : val);
+    if (!m_mixed) {
+	// we are not heard so we get what everybody else does
+	src->Forward(mix);
+	return;
     }
+    // substract our own data - only as much as we have
+    unsigned int n = m_buffer.length() / 2;
+    if (n > samples)
+	n = samples;
+    m_room->mixer()->minus(own,mixed,(const int16_t*)m_buffer.data(),n);
+    m_room->mixer()->out(own + n,mixed + n,samples - n);
+    DataBlock data(own,samples*sizeof(int16_t),false);
     src->Forward(data);
+    data.clear(false);
 }
 
 unsigned int ConfConsumer::energy() const
@@ -1369,6 +1582,10 @@ bool ConferenceDriver::received(Message &msg, int id)
 	    In the initial state a value of 0 indicates lonely=true
 	"notify" - ID used for "chan.notify" room notifications, an empty
 	    string (default) will disable notifications
+	"maxtalkers" - mix only this many of the loudest talkers, up to 32,
+	    the default of 0 mixes all channels that have a signal
+	"mixer" - mixing code to use: generic, sse2 or avx2, the default is
+	    the fastest one supported by the CPU
 	"record" - route that will make an outgoing record-only call
     Input parameters - per conference leg:
 	"utility" - true creates a channel that is used for housekeeping
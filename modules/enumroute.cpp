@@ -51,6 +51,7 @@ static int s_retries;
 static int s_maxcall;
 
 static bool s_success;
+static bool s_cached;
 static bool s_redirect;
 static bool s_autoFork;
 static bool s_sipUsed;
@@ -134,7 +135,8 @@ bool EnumHandler::resolve(Message& msg,bool canRedirect,const ObjList* domains)
 	const String* s = static_cast<const String*>(l->get());
 	if (!s || s->null())
 	    continue;
-	int result = Resolver::naptrQuery(tmp + *s,res);
+	int result = s_cached ? Resolver::resolve(Resolver::Naptr,tmp + *s,res) :
+	    Resolver::naptrQuery(tmp + *s,res);
 	if ((result == 0) && res.skipNull())
 	    break;
     }
@@ -317,6 +319,7 @@ void EnumModule::initialize()
     s_maxcall = tmp;
 
     s_success = cfg.getBoolValue("general","success",true);
+    s_cached = cfg.getBoolValue("general","cached",true);
     s_redirect = cfg.getBoolValue("general","redirect");
     s_autoFork = cfg.getBoolValue("general","autofork");
     s_sipUsed  = cfg.getBoolValue("protocols","sip",true);
@@ -74,8 +74,10 @@ public:
     ~G722Codec();
     virtual bool valid() const
 	{ return m_enc || m_dec; }
-    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp,
-	unsigned long flags);
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ return transcode(data,tStamp,flags); }
+protected:
+    virtual unsigned long process(const DataBlock& data, unsigned long tStamp, unsigned long flags);
 private:
     bool m_encoding;                     // Encoder/decoder flag
     G722EncInst* m_enc;                  // Encoder instance
@@ -167,7 +169,7 @@ G722Codec::~G722Codec()
     __plugin.decCount();
 }
 
-unsigned long G722Codec::Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+unsigned long G722Codec::process(const DataBlock& data, unsigned long tStamp, unsigned long flags)
 {
     RefPointer<DataSource> src = getTransSource();
     if (!(src && valid()))
@@ -177,7 +179,11 @@ unsigned long G722Codec::Consume(const DataBlock& data, unsigned long tStamp, un
     ref();
     if (m_encoding && (tStamp != invalidStamp()) && !m_data.null())
 	tStamp -= (m_data.length() / 2);
-    m_data += data;
+    // hold the incoming buffer instead of copying it if nothing is pending
+    if (m_data.null())
+	m_data.share(data);
+    else
+	m_data += data;
     int frames,consumed;
     // G.722 declared rate and timestamps are for 8000 samples/s so it needs tweaking
     if (m_encoding) {
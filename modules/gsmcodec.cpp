@@ -54,7 +54,10 @@ class GsmCodec : public DataTranslator
 public:
     GsmCodec(const char* sFormat, const char* dFormat, bool encoding);
     ~GsmCodec();
-    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags);
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ return transcode(data,tStamp,flags); }
+protected:
+    virtual unsigned long process(const DataBlock& data, unsigned long tStamp, unsigned long flags);
 private:
     bool m_encoding;
     gsm m_gsm;
@@ -82,7 +85,7 @@ GsmCodec::~GsmCodec()
     }
 }
 
-unsigned long GsmCodec::Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+unsigned long GsmCodec::process(const DataBlock& data, unsigned long tStamp, unsigned long flags)
 {
     if (!(m_gsm && getTransSource()))
 	return 0;
@@ -91,7 +94,11 @@ unsigned long GsmCodec::Consume(const DataBlock& data, unsigned long tStamp, uns
     ref();
     if (m_encoding && (tStamp != invalidStamp()) && !m_data.null())
 	tStamp -= (m_data.length() / 2);
-    m_data += data;
+    // hold the incoming buffer instead of copying it if nothing is pending
+    if (m_data.null())
+	m_data.share(data);
+    else
+	m_data += data;
     int frames,consumed;
     if (m_encoding) {
 	frames = m_data.length() / sizeof(gsm_block);
@@ -133,7 +133,11 @@ unsigned long iLBCCodec::Consume(const DataBlock& data, unsigned long tStamp, un
     }
     if (m_encoding && (tStamp != invalidStamp()) && !m_data.null())
 	tStamp -= (m_data.length() / 2);
-    m_data += data;
+    // hold the incoming buffer instead of copying it if nothing is pending
+    if (m_data.null())
+	m_data.share(data);
+    else
+	m_data += data;
     int frames,consumed;
     if (m_encoding) {
 	frames = m_data.length() / (2 * block);
@@ -68,8 +68,10 @@ public:
     ~iLBCwrCodec();
     virtual bool valid() const
 	{ return m_enc || m_dec; }
-    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp,
-	unsigned long flags);
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ return transcode(data,tStamp,flags); }
+protected:
+    virtual unsigned long process(const DataBlock& data, unsigned long tStamp, unsigned long flags);
 private:
     bool m_encoding;                     // Encoder/decoder flag
     iLBC_encinst_t* m_enc;               // Encoder instance
@@ -169,7 +171,7 @@ iLBCwrCodec::~iLBCwrCodec()
     __plugin.decCount();
 }
 
-unsigned long iLBCwrCodec::Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+unsigned long iLBCwrCodec::process(const DataBlock& data, unsigned long tStamp, unsigned long flags)
 {
     if (!getTransSource())
 	return 0;
@@ -98,9 +98,11 @@ public:
     ~iSACCodec();
     inline bool valid() const
 	{ return m_isac != 0; }
-    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp,
-	unsigned long flags);
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ return transcode(data,tStamp,flags); }
     void timerTick();
+protected:
+    virtual unsigned long process(const DataBlock& data, unsigned long tStamp, unsigned long flags);
 private:
     // Retrieve the ISAC error
     inline WebRtc_Word16 isacGetError() const
@@ -217,10 +219,10 @@ iSACCodec::~iSACCodec()
     __plugin.decCount();
 }
 
-unsigned long iSACCodec::Consume(const DataBlock& data, unsigned long tStamp,
+unsigned long iSACCodec::process(const DataBlock& data, unsigned long tStamp,
     unsigned long flags)
 {
-    XDebug(&__plugin,DebugAll,"%scoder::Consume(%u,%lu,%lu) buffer=%u [%p]",
+    XDebug(&__plugin,DebugAll,"%scoder::process(%u,%lu,%lu) buffer=%u [%p]",
 	m_encoding ? "En" : "De",data.length(),tStamp,flags,m_buffer.length(),this);
     m_inBytes += data.length();
     m_inPackets++;
@@ -41,6 +41,15 @@
 #include <openssl/des.h>
 #endif
 
+#if !defined(OPENSSL_NO_SRTP) && !defined(OPENSSL_NO_DTLS) && (OPENSSL_VERSION_NUMBER >= 0x10100000L)
+#define HAVE_DTLS_SRTP
+#include <yatertp.h>
+#include <openssl/x509.h>
+#include <openssl/evp.h>
+// Path MTU assumed for handshake datagrams
+#define DTLS_MTU 1200
+#endif
+
 #ifdef USE_TLS_METHOD
 #define CTX_METHOD ::TLS_method()
 #else
@@ -126,6 +135,36 @@ private:
     SSL* m_ssl;
 };
 
+#ifdef HAVE_DTLS_SRTP
+// DTLS endpoint negotiating SRTP keys, datagrams pass through memory
+class DtlsEndpoint : public RTPDtls
+{
+public:
+    DtlsEndpoint();
+    virtual ~DtlsEndpoint();
+    virtual bool init(bool client, const String& fingerprint);
+    virtual const String& fingerprint() const;
+    virtual State start();
+    virtual State received(const void* data, int len);
+    virtual State timer();
+    virtual int timeout();
+    virtual bool output(DataBlock& packet);
+    virtual bool keys(String& suite, DataBlock& material);
+    // Called from the BIO to move datagrams
+    int bioRead(char* buffer, int length);
+    void bioWrite(const char* data, int length);
+private:
+    State result(int retcode);
+    bool checkPeer();
+    SSL* m_ssl;
+    ObjList m_out;
+    const void* m_inData;
+    int m_inLen;
+    String m_remote;
+    State m_state;
+};
+#endif
+
 #ifndef OPENSSL_NO_AES
 // AES Counter Mode
 class AesCtrCipher : public Cipher
@@ -246,6 +285,21 @@ public:
     virtual bool received(Message& msg);
 };
 
+#ifdef HAVE_DTLS_SRTP
+class DtlsHandler : public MessageHandler
+{
+public:
+    inline DtlsHandler()
+	: MessageHandler("engine.dtls",100,__plugin.name())
+	{ }
+    virtual bool received(Message& msg);
+};
+
+static SSL_CTX* s_dtlsContext = 0;
+static BIO_METHOD* s_dtlsBio = 0;
+static String s_dtlsFingerprint;
+#endif
+
 
 // Attempt to add randomness from system time when called
 static void addRand(u_int64_t usec)
@@ -867,6 +921,313 @@ bool DesCtrCipher::decrypt(void* outData, unsigned int len, const void* inpData)
 }
 #endif
 
+#ifdef HAVE_DTLS_SRTP
+// Compute a certificate fingerprint as used in SDP (RFC 8122)
+static bool certFingerprint(String& buf, X509* cert, const String& hash)
+{
+    const EVP_MD* md = 0;
+    if (hash == YSTRING("sha-256"))
+	md = ::EVP_sha256();
+    else if (hash == YSTRING("sha-1"))
+	md = ::EVP_sha1();
+    else if (hash == YSTRING("sha-384"))
+	md = ::EVP_sha384();
+    else if (hash == YSTRING("sha-512"))
+	md = ::EVP_sha512();
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    if (!(md && cert && ::X509_digest(cert,md,digest,&len)))
+	return false;
+    String hex;
+    hex.hexify(digest,len,':',true);
+    buf = hash;
+    buf << " " << hex;
+    return true;
+}
+
+// Any certificate is accepted by OpenSSL, the fingerprint is checked later
+static int dtlsVerify(int ok, X509_STORE_CTX* ctx)
+{
+    return 1;
+}
+
+static int dtlsBioWrite(BIO* bio, const char* data, int length)
+{
+    static_cast<DtlsEndpoint*>(::BIO_get_data(bio))->bioWrite(data,length);
+    return length;
+}
+
+static int dtlsBioRead(BIO* bio, char* buffer, int length)
+{
+    BIO_clear_retry_flags(bio); // macro - no ::
+    int len = static_cast<DtlsEndpoint*>(::BIO_get_data(bio))->bioRead(buffer,length);
+    if (len <= 0)
+	BIO_set_retry_read(bio);
+    return len;
+}
+
+static long dtlsBioCtrl(BIO* bio, int cmd, long num, void* ptr)
+{
+    switch (cmd) {
+	case BIO_CTRL_FLUSH:
+	    return 1;
+	case BIO_CTRL_DGRAM_QUERY_MTU:
+	    return DTLS_MTU;
+	default:
+	    return 0;
+    }
+}
+
+static int dtlsBioCreate(BIO* bio)
+{
+    ::BIO_set_init(bio,1);
+    return 1;
+}
+
+// Create the DTLS context and its self signed certificate
+// Must be called with the plugin locked
+static bool dtlsInit()
+{
+    if (s_dtlsContext)
+	return true;
+    EVP_PKEY* key = 0;
+    EVP_PKEY_CTX* kctx = ::EVP_PKEY_CTX_new_id(EVP_PKEY_EC,0);
+    if (kctx && (::EVP_PKEY_keygen_init(kctx) > 0)
+	&& (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx,NID_X9_62_prime256v1) > 0)) // macro - no ::
+	::EVP_PKEY_keygen(kctx,&key);
+    ::EVP_PKEY_CTX_free(kctx);
+    if (!key) {
+	Debug(&__plugin,DebugWarn,"Failed to generate the DTLS key");
+	return false;
+    }
+    X509* cert = ::X509_new();
+    ::X509_set_version(cert,2);
+    ::ASN1_INTEGER_set(::X509_get_serialNumber(cert),Random::random() & 0x7fffffff);
+    ::X509_gmtime_adj(X509_getm_notBefore(cert),-86400);
+    ::X509_gmtime_adj(X509_getm_notAfter(cert),86400L * 365);
+    ::X509_set_pubkey(cert,key);
+    X509_NAME* name = ::X509_get_subject_name(cert);
+    ::X509_NAME_add_entry_by_txt(name,"CN",MBSTRING_ASC,(const unsigned char*)"yate",-1,-1,0);
+    ::X509_set_issuer_name(cert,name);
+    SSL_CTX* ctx = 0;
+    if (::X509_sign(cert,key,::EVP_sha256()) && certFingerprint(s_dtlsFingerprint,cert,"sha-256")) {
+	ctx = ::SSL_CTX_new(::DTLS_method());
+	if (ctx && !(::SSL_CTX_use_certificate(ctx,cert) && ::SSL_CTX_use_PrivateKey(ctx,key)
+	    && (0 == ::SSL_CTX_set_tlsext_use_srtp(ctx,"SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32")))) {
+	    ::SSL_CTX_free(ctx);
+	    ctx = 0;
+	}
+    }
+    ::X509_free(cert);
+    ::EVP_PKEY_free(key);
+    if (!ctx) {
+	Debug(&__plugin,DebugWarn,"Failed to create the DTLS context");
+	return false;
+    }
+    ::SSL_CTX_set_verify(ctx,SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,dtlsVerify);
+    SSL_CTX_set_read_ahead(ctx,1); // macro - no ::
+    BIO_METHOD* bio = ::BIO_meth_new(::BIO_get_new_index() | BIO_TYPE_SOURCE_SINK,"yate dtls");
+    ::BIO_meth_set_write(bio,dtlsBioWrite);
+    ::BIO_meth_set_read(bio,dtlsBioRead);
+    ::BIO_meth_set_ctrl(bio,dtlsBioCtrl);
+    ::BIO_meth_set_create(bio,dtlsBioCreate);
+    s_dtlsBio = bio;
+    s_dtlsContext = ctx;
+    Debug(&__plugin,DebugInfo,"DTLS certificate fingerprint '%s'",s_dtlsFingerprint.c_str());
+    return true;
+}
+
+
+DtlsEndpoint::DtlsEndpoint()
+    : m_ssl(0), m_inData(0), m_inLen(0), m_state(Idle)
+{
+}
+
+DtlsEndpoint::~DtlsEndpoint()
+{
+    if (m_ssl)
+	::SSL_free(m_ssl);
+}
+
+bool DtlsEndpoint::init(bool client, const String& fingerprint)
+{
+    if (m_ssl)
+	return false;
+    m_ssl = ::SSL_new(s_dtlsContext);
+    if (!m_ssl)
+	return false;
+    BIO* bio = ::BIO_new(s_dtlsBio);
+    if (!bio)
+	return false;
+    ::BIO_set_data(bio,this);
+    ::SSL_set_bio(m_ssl,bio,bio);
+    SSL_set_options(m_ssl,SSL_OP_NO_QUERY_MTU); // macro - no ::
+    SSL_set_mtu(m_ssl,DTLS_MTU); // macro - no ::
+    if (client)
+	::SSL_set_connect_state(m_ssl);
+    else
+	::SSL_set_accept_state(m_ssl);
+    m_remote = fingerprint;
+    m_state = Handshake;
+    return true;
+}
+
+const String& DtlsEndpoint::fingerprint() const
+{
+    return s_dtlsFingerprint;
+}
+
+RTPDtls::State DtlsEndpoint::start()
+{
+    if (m_state != Handshake)
+	return m_state;
+    return result(::SSL_do_handshake(m_ssl));
+}
+
+RTPDtls::State DtlsEndpoint::received(const void* data, int len)
+{
+    if (!m_ssl || m_state == Failed)
+	return m_state;
+    m_inData = data;
+    m_inLen = len;
+    if (m_state == Handshake)
+	result(::SSL_do_handshake(m_ssl));
+    else {
+	// no application data is expected, this answers retransmissions and alerts
+	char buf[256];
+	int ret = ::SSL_read(m_ssl,buf,sizeof(buf));
+	if ((ret <= 0) && (::SSL_get_error(m_ssl,ret) == SSL_ERROR_ZERO_RETURN))
+	    Debug(&__plugin,DebugInfo,"DTLS peer closed the association [%p]",this);
+    }
+    m_inData = 0;
+    m_inLen = 0;
+    return m_state;
+}
+
+RTPDtls::State DtlsEndpoint::timer()
+{
+    if (m_ssl && (m_state == Handshake) && (DTLSv1_handle_timeout(m_ssl) < 0)) { // macro - no ::
+	Debug(&__plugin,DebugMild,"DTLS handshake timed out [%p]",this);
+	m_state = Failed;
+    }
+    return m_state;
+}
+
+int DtlsEndpoint::timeout()
+{
+    struct timeval tv;
+    if (!(m_ssl && (m_state == Handshake) && DTLSv1_get_timeout(m_ssl,&tv))) // macro - no ::
+	return -1;
+    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+bool DtlsEndpoint::output(DataBlock& packet)
+{
+    DataBlock* d = static_cast<DataBlock*>(m_out.remove(false));
+    if (!d)
+	return false;
+    packet = *d;
+    TelEngine::destruct(d);
+    return true;
+}
+
+bool DtlsEndpoint::keys(String& suite, DataBlock& material)
+{
+    if (m_state != Connected)
+	return false;
+    SRTP_PROTECTION_PROFILE* prof = ::SSL_get_selected_srtp_profile(m_ssl);
+    if (!prof)
+	return false;
+    switch (prof->id) {
+	case SRTP_AES128_CM_SHA1_80:
+	    suite = "AES_CM_128_HMAC_SHA1_80";
+	    break;
+	case SRTP_AES128_CM_SHA1_32:
+	    suite = "AES_CM_128_HMAC_SHA1_32";
+	    break;
+	default:
+	    return false;
+    }
+    // RFC 5764 4.2, two 128 bit keys and two 112 bit salts
+    static const char label[] = "EXTRACTOR-dtls_srtp";
+    material.assign(0,60);
+    return 1 == ::SSL_export_keying_material(m_ssl,(unsigned char*)material.data(),material.length(),
+	label,sizeof(label) - 1,0,0,0);
+}
+
+int DtlsEndpoint::bioRead(char* buffer, int length)
+{
+    if (!m_inData)
+	return -1;
+    int len = (m_inLen < length) ? m_inLen : length;
+    ::memcpy(buffer,m_inData,len);
+    m_inData = 0;
+    return len;
+}
+
+void DtlsEndpoint::bioWrite(const char* data, int length)
+{
+    m_out.append(new DataBlock(const_cast<char*>(data),length));
+}
+
+// Translate the result of a handshake step
+RTPDtls::State DtlsEndpoint::result(int retcode)
+{
+    if (retcode == 1) {
+	if (!checkPeer())
+	    return (m_state = Failed);
+	return (m_state = Connected);
+    }
+    int err = ::SSL_get_error(m_ssl,retcode);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+	return m_state;
+    unsigned long e = ::ERR_get_error();
+    char buf[256];
+    ::ERR_error_string_n(e,buf,sizeof(buf));
+    Debug(&__plugin,DebugMild,"DTLS handshake failed: %d %s [%p]",err,buf,this);
+    ::ERR_clear_error();
+    return (m_state = Failed);
+}
+
+// Check the peer certificate against the fingerprint from signaling
+bool DtlsEndpoint::checkPeer()
+{
+    // without a fingerprint anybody in the media path could complete the handshake
+    if (m_remote.null()) {
+	Debug(&__plugin,DebugWarn,"DTLS peer has no fingerprint to be checked against [%p]",this);
+	return false;
+    }
+    int sp = m_remote.find(' ');
+    if (sp <= 0)
+	return false;
+    String hash = m_remote.substr(0,sp);
+    hash.toLower();
+    X509* cert = ::SSL_get_peer_certificate(m_ssl);
+    String fp;
+    bool ok = certFingerprint(fp,cert,hash) && (fp &= m_remote);
+    if (cert)
+	::X509_free(cert);
+    if (!ok)
+	Debug(&__plugin,DebugWarn,"DTLS peer fingerprint '%s' does not match '%s' [%p]",
+	    fp.c_str(),m_remote.c_str(),this);
+    return ok;
+}
+
+// Handler for the engine.dtls message - DTLS-SRTP endpoint factory
+bool DtlsHandler::received(Message& msg)
+{
+    addRand(msg.msgTime());
+    Lock lck(__plugin);
+    if (!dtlsInit())
+	return false;
+    lck.drop();
+    RTPDtls** ppDtls = static_cast<RTPDtls**>(msg.userObject(YATOM("RTPDtls*")));
+    if (ppDtls)
+	*ppDtls = new DtlsEndpoint;
+    return true;
+}
+#endif
+
 // Handler for the engine.cipher message - Cipher Factory
 bool CipherHandler::received(Message& msg)
 {
@@ -910,6 +1271,12 @@ OpenSSL::~OpenSSL()
 {
     Output("Unloading module OpenSSL");
     ::SSL_CTX_free(s_context);
+#ifdef HAVE_DTLS_SRTP
+    if (s_dtlsContext)
+	::SSL_CTX_free(s_dtlsContext);
+    if (s_dtlsBio)
+	::BIO_meth_free(s_dtlsBio);
+#endif
 }
 
 void OpenSSL::initialize()
@@ -930,6 +1297,9 @@ void OpenSSL::initialize()
 	Engine::install(m_handler);
 #if !defined(OPENSSL_NO_AES) || !defined(OPENSSL_NO_DES)
 	Engine::install(new CipherHandler);
+#endif
+#ifdef HAVE_DTLS_SRTP
+	Engine::install(new DtlsHandler);
 #endif
     }
 
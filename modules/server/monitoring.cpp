@@ -537,13 +537,18 @@ public:
 	SeqLost     = 8,
 	WrongSRC    = 9,
 	WrongSSRC   = 10,
+	DiscardPkts = 11,
+	Streams     = 12,
+	PoorStreams = 13,
+	AvgRFactor  = 14,
+	AvgMOS      = 15,
     };
     RTPEntry(String rtpDirection);
     ~RTPEntry();
     inline const String& toString() const
 	{ return m_rtpDir; }
-    // update the entry from the received information
-    void update(const NamedList& nl);
+    // update the entry from the received information, rate streams below poor
+    void update(const NamedList& nl, int poor);
     // reset internal data
     void reset();
     // set the index for this entry
@@ -561,7 +566,12 @@ private:
     // the RTP direction
     String m_rtpDir;
     // counters
-    unsigned int m_counters[WrongSSRC - Direction];
+    unsigned int m_counters[DiscardPkts - Direction];
+    // streams reporting quality, poor ones and sums of their ratings
+    unsigned int m_streams;
+    unsigned int m_poor;
+    u_int64_t m_rSum;
+    u_int64_t m_mosSum;
     unsigned int m_index;
     // flag if monitored direction is current (i.e. false means this direction was removed from monitoring)
     bool m_isCurrent;
@@ -598,6 +608,8 @@ private:
     u_int64_t m_resetTime;
     // RTP monitored?
     bool m_monitor;
+    // R-factor under which a stream has poor quality
+    int m_poorRFactor;
 };
 
 // A route entry which is monitored for quality of service values
@@ -1367,6 +1379,7 @@ TokenDict RTPEntry::s_rtpInfo[] = {
     {"seqslost",    RTPEntry::SeqLost},
     {"wrongsrc",    RTPEntry::WrongSRC},
     {"wrongssrc",   RTPEntry::WrongSSRC},
+    {"discardpkts", RTPEntry::DiscardPkts},
     {0,0}
 };
 
@@ -1381,6 +1394,11 @@ static TokenDict s_rtpQuery[] = {
     {"sequenceNumberLost",  RTPEntry::SeqLost},
     {"wrongSRC",	    RTPEntry::WrongSRC},
     {"wrongSSRC",	    RTPEntry::WrongSSRC},
+    {"packetsDiscarded",    RTPEntry::DiscardPkts},
+    {"qualityStreams",      RTPEntry::Streams},
+    {"poorQualityStreams",  RTPEntry::PoorStreams},
+    {"averageRFactor",      RTPEntry::AvgRFactor},
+    {"averageMOS",	    RTPEntry::AvgMOS},
     {0,0}
 };
 
@@ -2757,7 +2775,7 @@ RTPEntry::~RTPEntry()
 }
 
 // update the RTP info from the given list
-void RTPEntry::update(const NamedList& nl)
+void RTPEntry::update(const NamedList& nl, int poor)
 {
     DDebug(&__plugin,DebugAll,"RTPEntry::update() name='%s' [%p]",m_rtpDir.c_str(),this);
     for (unsigned int i = 0; i < nl.count(); i++) {
@@ -2769,14 +2787,25 @@ void RTPEntry::update(const NamedList& nl)
 	    continue;
 	m_counters[type - NoAudio] += (*n).toInteger();
     }
+    // only streams that received media report a quality estimate
+    int rFactor = nl.getIntValue(YSTRING("rfactor"),-1);
+    if (rFactor < 0)
+	return;
+    m_streams++;
+    m_rSum += rFactor;
+    m_mosSum += (unsigned int)(nl.getDoubleValue(YSTRING("mos")) * 10 + 0.5);
+    if (rFactor < poor)
+	m_poor++;
 }
 
 // reset counters
 void RTPEntry::reset()
 {
     DDebug(&__plugin,DebugAll,"RTPEntry::reset() '%s' [%p]",m_rtpDir.c_str(),this);
-    for (int i = 0; i < WrongSSRC - Direction; i++)
+    for (int i = 0; i < DiscardPkts - Direction; i++)
 	m_counters[i] = 0;
+    m_streams = m_poor = 0;
+    m_rSum = m_mosSum = 0;
 }
 
 // the the answer to a query about this RTP direction
@@ -2798,8 +2827,22 @@ String RTPEntry::getInfo(unsigned int query)
 	case SeqLost:
 	case WrongSRC:
 	case WrongSSRC:
+	case DiscardPkts:
 	    retStr << m_counters[query - NoAudio];
 	    break;
+	case Streams:
+	    retStr << m_streams;
+	    break;
+	case PoorStreams:
+	    retStr << m_poor;
+	    break;
+	case AvgRFactor:
+	    retStr << (unsigned int)(m_streams ? (m_rSum / m_streams) : 0);
+	    break;
+	case AvgMOS:
+	    // in tenths, like RTCP XR
+	    retStr << (unsigned int)(m_streams ? (m_mosSum / m_streams) : 0);
+	    break;
 	default:
 	    break;
     }
@@ -2811,7 +2854,7 @@ String RTPEntry::getInfo(unsigned int query)
  */
 RTPTable::RTPTable(const NamedList* cfg)
     : m_rtpMtx(false,"Monitor::rtpInfo"),
-      m_resetInterval(3600), m_monitor(false)
+      m_resetInterval(3600), m_monitor(false), m_poorRFactor(70)
 {
     Debug(&__plugin,DebugAll,"RTPTable created [%p]",this);
     // build RTPEntry objects for monitoring RTP directions if monitoring is enabled
@@ -2824,6 +2867,7 @@ void RTPTable::reconfigure(const NamedList* cfg)
 	return;
     m_monitor = cfg->getBoolValue("monitor",false);
     m_resetInterval = cfg->getIntValue("reset_interval",3600);
+    m_poorRFactor = cfg->getIntValue("poor_rfactor",70,0,100);
 
     m_rtpMtx.lock();
     if (!m_monitor)
@@ -2883,7 +2927,7 @@ void RTPTable::update(Message& msg)
     m_rtpMtx.lock();
     RTPEntry* entry = static_cast<RTPEntry*>(m_rtpEntries[rtpDir]);
     if (entry)
-	entry->update(msg);
+	entry->update(msg,m_poorRFactor);
     m_rtpMtx.unlock();
 }
 
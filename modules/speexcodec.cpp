@@ -56,7 +56,10 @@ class SpeexCodec : public DataTranslator
 public:
     SpeexCodec(const char* sFormat, const char* dFormat, bool encoding, int type);
     ~SpeexCodec();
-    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags);
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ return transcode(data,tStamp,flags); }
+protected:
+    virtual unsigned long process(const DataBlock& data, unsigned long tStamp, unsigned long flags);
 private:
     bool m_encoding;
     DataBlock m_data;
@@ -169,7 +172,7 @@ SpeexCodec::~SpeexCodec()
     s_cmutex.unlock();
 }
 
-unsigned long SpeexCodec::Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+unsigned long SpeexCodec::process(const DataBlock& data, unsigned long tStamp, unsigned long flags)
 {
     if (!(m_state && m_bits && getTransSource()))
 	return 0;
@@ -0,0 +1,203 @@
+/**
+ * clocktest.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Shared media clock test: schedule accuracy, release and stopping
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+// Clock threads used if the engine has none configured
+#define TEST_THREADS 2
+// Sources with each period, some periods are longer than the wheel
+#define TEST_SOURCES 5
+// Time the schedule is checked in milliseconds
+#define TEST_TIME 1000
+// Resolution of the clock, a source may be called this much before its time
+#define TEST_SLOT 1000
+
+// Source checking it is called on schedule, it can stop itself or take long to tick
+class ClockSource : public ThreadedSource
+{
+public:
+    inline ClockSource(unsigned int period, unsigned int limit = 0)
+	: m_period(period), m_limit(limit), m_busy(0), m_selfStop(0),
+	  m_last(0), m_ticks(0), m_early(0), m_skew(0), m_inTick(false)
+	{ }
+    virtual unsigned int tick(u_int64_t when);
+    inline bool start()
+	{ return ThreadedSource::start("ClockTest",Thread::Normal,true); }
+    unsigned int m_period;
+    unsigned int m_limit;
+    unsigned int m_busy;
+    unsigned int m_selfStop;
+    u_int64_t m_last;
+    volatile unsigned int m_ticks;
+    unsigned int m_early;
+    unsigned int m_skew;
+    volatile bool m_inTick;
+};
+
+class ClockTest : public Plugin
+{
+public:
+    ClockTest();
+    virtual void initialize();
+private:
+    bool check(bool ok, const char* what);
+    bool testSchedule();
+    bool testRelease();
+    bool testStop();
+    bool testSelfStop();
+    bool m_first;
+};
+
+INIT_PLUGIN(ClockTest);
+
+
+unsigned int ClockSource::tick(u_int64_t when)
+{
+    m_inTick = true;
+    // each call must be scheduled exactly one period after the previous
+    if (m_last && (when != m_last + m_period))
+	m_skew++;
+    if (Time::now() + TEST_SLOT < when)
+	m_early++;
+    m_last = when;
+    unsigned int n = ++m_ticks;
+    if (m_busy)
+	Thread::usleep(m_busy);
+    if (n == m_selfStop)
+	stop();
+    m_inTick = false;
+    return (m_limit && (n >= m_limit)) ? 0 : m_period;
+}
+
+
+ClockTest::ClockTest()
+    : Plugin("clocktest"),
+      m_first(true)
+{
+    Output("Hello, I am module ClockTest");
+}
+
+void ClockTest::initialize()
+{
+    Output("Initializing module ClockTest");
+    if (!m_first)
+	return;
+    m_first = false;
+    unsigned int threads = ThreadedSource::clockThreads();
+    if (!threads)
+	ThreadedSource::setClockThreads(TEST_THREADS);
+    bool ok = testSchedule();
+    ok = testRelease() && ok;
+    ok = testStop() && ok;
+    ok = testSelfStop() && ok;
+    if (!threads)
+	ThreadedSource::setClockThreads(0);
+    Output("Media clock test %s",ok ? "passed" : "FAILED");
+}
+
+bool ClockTest::check(bool ok, const char* what)
+{
+    if (!ok)
+	Debug(this,DebugWarn,"Clock check failed: %s",what);
+    return ok;
+}
+
+// Sources are called exactly on their schedule, also when it spans the wheel
+bool ClockTest::testSchedule()
+{
+    static const unsigned int periods[] = { 10000, 20000, 30000, 100000 };
+    static const unsigned int count = sizeof(periods) / sizeof(periods[0]);
+    ClockSource* src[count * TEST_SOURCES];
+    bool ok = true;
+    unsigned int i;
+    for (i = 0; i < count * TEST_SOURCES; i++) {
+	src[i] = new ClockSource(periods[i % count]);
+	ok = check(src[i]->start(),"start clocked") && ok;
+    }
+    Thread::msleep(TEST_TIME);
+    for (i = 0; i < count * TEST_SOURCES; i++)
+	src[i]->stop();
+    for (i = 0; i < count * TEST_SOURCES; i++) {
+	ClockSource* s = src[i];
+	// the first tick is right away, allow for the time spent starting and stopping
+	int expect = 1 + TEST_TIME * 1000 / s->m_period;
+	int diff = (int)s->m_ticks - expect;
+	if (diff < -2 || diff > 2 || s->m_early || s->m_skew) {
+	    Debug(this,DebugWarn,"Source every %u usec ticked %u times, expected %d, %u early, %u skewed",
+		s->m_period,s->m_ticks,expect,s->m_early,s->m_skew);
+	    ok = false;
+	}
+	TelEngine::destruct(src[i]);
+    }
+    return check(ok,"schedule");
+}
+
+// A source returning zero is released and no longer called
+bool ClockTest::testRelease()
+{
+    ClockSource* s = new ClockSource(10000,5);
+    bool ok = check(s->start(),"start limited");
+    Thread::msleep(200);
+    ok = check(s->m_ticks == 5,"limited source ticks") && ok;
+    ok = check(!s->running(),"limited source released") && ok;
+    s->stop();
+    TelEngine::destruct(s);
+    return ok;
+}
+
+// Stopping waits for the tick in progress and the source is not called again
+bool ClockTest::testStop()
+{
+    ClockSource* s = new ClockSource(10000);
+    s->m_busy = 30000;
+    bool ok = check(s->start(),"start busy");
+    for (int i = 0; i < 100 && !s->m_inTick; i++)
+	Thread::msleep(1);
+    ok = check(s->m_inTick,"busy source ticking") && ok;
+    s->stop();
+    ok = check(!s->m_inTick,"stop waited for tick") && ok;
+    unsigned int n = s->m_ticks;
+    Thread::msleep(50);
+    ok = check(s->m_ticks == n,"no tick after stop") && ok;
+    ok = check(!s->running(),"busy source stopped") && ok;
+    TelEngine::destruct(s);
+    return ok;
+}
+
+// A source can stop itself from its own tick
+bool ClockTest::testSelfStop()
+{
+    ClockSource* s = new ClockSource(10000);
+    s->m_selfStop = 3;
+    bool ok = check(s->start(),"start self stopping");
+    Thread::msleep(100);
+    ok = check(s->m_ticks == 3,"self stopped source ticks") && ok;
+    ok = check(!s->running(),"self stopped source released") && ok;
+    TelEngine::destruct(s);
+    return ok;
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
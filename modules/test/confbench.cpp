@@ -0,0 +1,406 @@
+/**
+ * confbench.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Conference mixer correctness and speed test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+
+#include <math.h>
+#include <string.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+// Samples sent by each member in a round, 20ms at 8kHz
+#define BENCH_BLOCK 160
+// Rounds timed for each room
+#define BENCH_ROUNDS 250
+// Rounds sent before timing so the level detectors settle
+#define BENCH_WARMUP 100
+// Loudest talkers mixed when limiting the mix
+#define BENCH_TALKERS 4
+// Samples of speech generated in advance for each member, one second
+#define BENCH_SPEECH 8000
+// Rounds sent when checking the mix and members mixed, they are loud enough to saturate
+#define CHECK_ROUNDS 50
+#define CHECK_MEMBERS 4
+// Rounds sent when checking the talker limit, the first ones are not checked
+#define TALK_ROUNDS 100
+#define TALK_SETTLE 25
+
+// Consumer counting the mixed data sent back to a member, it can also keep it
+class BenchConsumer : public DataConsumer
+{
+public:
+    inline BenchConsumer(bool record)
+	: DataConsumer("slin"), m_bytes(0), m_record(record)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags);
+    inline unsigned int bytes() const
+	{ return m_bytes; }
+    inline const DataBlock& data() const
+	{ return m_data; }
+private:
+    unsigned int m_bytes;
+    bool m_record;
+    DataBlock m_data;
+};
+
+// A conference member talking with its own pitch and loudness
+// The signal is a tone with a syllable like envelope so the noise detector sees pauses
+class BenchMember : public CallEndpoint
+{
+public:
+    BenchMember(unsigned int index);
+    BenchMember(const char* name, const DataBlock& speech, bool record = false);
+    ~BenchMember();
+    bool join(const String& room, const NamedList& params);
+    void talk(unsigned int round);
+    inline unsigned int received() const
+	{ return m_cons->bytes(); }
+    inline const DataBlock& mixed() const
+	{ return m_cons->data(); }
+private:
+    void init(bool record);
+    DataSource* m_src;
+    BenchConsumer* m_cons;
+    DataBlock m_speech;
+};
+
+class StartHandler : public MessageHandler
+{
+public:
+    inline StartHandler()
+	: MessageHandler("engine.start",150)
+	{ }
+    virtual bool received(Message& msg);
+};
+
+class ConfBench : public Plugin
+{
+public:
+    ConfBench();
+    virtual void initialize();
+    void run();
+private:
+    bool checkMix(const char* mixer);
+    bool checkTalkers();
+    bool checkOutput(const BenchMember& member, const int* expected, unsigned int first,
+	unsigned int samples, const char* what);
+    void timeRoom(unsigned int members, int talkers);
+    bool m_first;
+};
+
+INIT_PLUGIN(ConfBench);
+
+static unsigned int s_seed = 1;
+
+// Repeatable pseudo random samples covering the whole 16 bit range
+static int16_t randomSample()
+{
+    s_seed = s_seed * 1103515245 + 12345;
+    return (int16_t)(s_seed >> 16);
+}
+
+// Saturate like the mixer does, symmetrically
+static int saturate(int val)
+{
+    return (val < -32767) ? -32767 : ((val > 32767) ? 32767 : val);
+}
+
+// Steady tone, the level detectors see it as speech for a few seconds
+static void makeTone(DataBlock& data, unsigned int samples, double level, double freq)
+{
+    data.assign(0,samples * sizeof(int16_t));
+    int16_t* d = (int16_t*)data.data();
+    for (unsigned int i = 0; i < samples; i++)
+	d[i] = (int16_t)(level * sin(2 * M_PI * freq * i / 8000));
+}
+
+
+unsigned long BenchConsumer::Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+{
+    m_bytes += data.length();
+    if (m_record)
+	m_data += data;
+    return invalidStamp();
+}
+
+
+BenchMember::BenchMember(unsigned int index)
+    : CallEndpoint(String("confbench/") + String(index)),
+      m_speech(0,BENCH_SPEECH * sizeof(int16_t))
+{
+    double freq = 2 * M_PI * (200 + (index * 37) % 800) / 8000;
+    double level = 1000 + (index * 997) % 8000;
+    int16_t* d = (int16_t*)m_speech.data();
+    for (unsigned int i = 0; i < BENCH_SPEECH; i++) {
+	double env = 0.55 + 0.45 * sin(2 * M_PI * 3 * i / 8000);
+	d[i] = (int16_t)(level * env * sin(freq * i));
+    }
+    init(false);
+}
+
+BenchMember::BenchMember(const char* name, const DataBlock& speech, bool record)
+    : CallEndpoint(String("confbench/") + name),
+      m_speech(speech)
+{
+    init(record);
+}
+
+void BenchMember::init(bool record)
+{
+    m_src = new DataSource("slin");
+    m_cons = new BenchConsumer(record);
+    setSource(m_src);
+    setConsumer(m_cons);
+}
+
+BenchMember::~BenchMember()
+{
+    TelEngine::destruct(m_src);
+    TelEngine::destruct(m_cons);
+}
+
+bool BenchMember::join(const String& room, const NamedList& params)
+{
+    Message msg("call.execute");
+    msg.copyParams(params);
+    msg.addParam("callto",room);
+    msg.userData(this);
+    return Engine::dispatch(msg);
+}
+
+void BenchMember::talk(unsigned int round)
+{
+    unsigned int offs = (round * BENCH_BLOCK) % (m_speech.length() / sizeof(int16_t));
+    DataBlock data((int16_t*)m_speech.data() + offs,BENCH_BLOCK * sizeof(int16_t),false);
+    m_src->Forward(data,round * BENCH_BLOCK);
+    data.clear(false);
+}
+
+bool StartHandler::received(Message& msg)
+{
+    __plugin.run();
+    return false;
+}
+
+
+ConfBench::ConfBench()
+    : Plugin("confbench"),
+      m_first(true)
+{
+    Output("Hello, I am module ConfBench");
+}
+
+void ConfBench::initialize()
+{
+    Output("Initializing module ConfBench");
+    if (m_first) {
+	m_first = false;
+	// the conference module is not guaranteed to be initialized before us
+	Engine::install(new StartHandler);
+    }
+}
+
+void ConfBench::run()
+{
+    bool ok = checkMix("generic");
+    ok = checkMix("sse2") && ok;
+    ok = checkMix("avx2") && ok;
+    ok = checkTalkers() && ok;
+    Output("Conference mixer output %s",ok ? "matches the scalar reference" : "FAILED");
+    static const unsigned int sizes[] = { 10, 100, 500 };
+    for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+	timeRoom(sizes[i],0);
+	timeRoom(sizes[i],BENCH_TALKERS);
+    }
+}
+
+// Check the mix is bit exact, including saturation, with the given kernels
+// Every member hears the sum of the others, a listener that does not talk hears all
+bool ConfBench::checkMix(const char* mixer)
+{
+    String room("conf/confbench-mix-");
+    room << mixer;
+    NamedList params("");
+    params.addParam("maxusers",String(CHECK_MEMBERS + 1));
+    params.addParam("smart",String::boolText(false));
+    params.addParam("mixer",mixer);
+    unsigned int samples = CHECK_ROUNDS * BENCH_BLOCK;
+    int* sum = new int[samples];
+    int* expected = new int[samples];
+    ::memset(sum,0,samples * sizeof(int));
+    BenchMember* m[CHECK_MEMBERS + 1];
+    DataBlock speech[CHECK_MEMBERS];
+    bool ok = true;
+    unsigned int i;
+    for (i = 0; i < CHECK_MEMBERS; i++) {
+	// each member is quieter than the previous so not all sums saturate
+	speech[i].assign(0,samples * sizeof(int16_t));
+	int16_t* d = (int16_t*)speech[i].data();
+	for (unsigned int t = 0; t < samples; t++) {
+	    d[t] = randomSample() >> (2 * i);
+	    sum[t] += d[t];
+	}
+	m[i] = new BenchMember(String("mix") + String(i),speech[i],true);
+	ok = m[i]->join(room,params) && ok;
+    }
+    DataBlock silence;
+    m[CHECK_MEMBERS] = new BenchMember("listen",silence,true);
+    params.setParam("voice",String::boolText(false));
+    ok = m[CHECK_MEMBERS]->join(room,params) && ok;
+    if (!ok)
+	Debug(this,DebugWarn,"Not all members joined '%s'",room.c_str());
+    for (unsigned int r = 0; r < CHECK_ROUNDS; r++)
+	for (i = 0; i < CHECK_MEMBERS; i++)
+	    m[i]->talk(r);
+    for (i = 0; i <= CHECK_MEMBERS; i++) {
+	const int16_t* own = (i < CHECK_MEMBERS) ? (const int16_t*)speech[i].data() : 0;
+	for (unsigned int t = 0; t < samples; t++)
+	    expected[t] = saturate(sum[t] - (own ? own[t] : 0));
+	ok = checkOutput(*m[i],expected,0,samples,mixer) && ok;
+    }
+    for (i = 0; i <= CHECK_MEMBERS; i++) {
+	m[i]->disconnect();
+	m[i]->clearEndpoint();
+	TelEngine::destruct(m[i]);
+    }
+    delete[] expected;
+    delete[] sum;
+    return ok;
+}
+
+// Check only the loudest talkers are mixed when they are limited
+bool ConfBench::checkTalkers()
+{
+    static const double levels[] = { 6000, 10000, 2000, 8000, 4000 };
+    static const unsigned int count = sizeof(levels) / sizeof(levels[0]);
+    String room("conf/confbench-talkers");
+    NamedList params("");
+    params.addParam("maxusers",String(count + 1));
+    params.addParam("maxtalkers","2");
+    unsigned int samples = TALK_ROUNDS * BENCH_BLOCK;
+    int* expected = new int[samples];
+    ::memset(expected,0,samples * sizeof(int));
+    BenchMember* m[count + 1];
+    bool ok = true;
+    unsigned int i;
+    for (i = 0; i < count; i++) {
+	DataBlock speech;
+	makeTone(speech,samples,levels[i],300 + 100 * i);
+	// the two loudest are mixed
+	if (levels[i] >= 8000) {
+	    const int16_t* d = (const int16_t*)speech.data();
+	    for (unsigned int t = 0; t < samples; t++)
+		expected[t] += d[t];
+	}
+	m[i] = new BenchMember(String("talk") + String(i),speech,true);
+	ok = m[i]->join(room,params) && ok;
+    }
+    // a silent member is heard by nobody so it must hear the whole mix
+    DataBlock silence(0,samples * sizeof(int16_t));
+    m[count] = new BenchMember("silent",silence,true);
+    ok = m[count]->join(room,params) && ok;
+    if (!ok)
+	Debug(this,DebugWarn,"Not all members joined '%s'",room.c_str());
+    for (unsigned int r = 0; r < TALK_ROUNDS; r++)
+	for (i = 0; i <= count; i++)
+	    m[i]->talk(r);
+    // level detectors need some time to rank the talkers
+    unsigned int first = TALK_SETTLE * BENCH_BLOCK;
+    // quieter talkers are not mixed so they hear the same as the silent member
+    ok = checkOutput(*m[count],expected,first,samples,"silent member") && ok;
+    ok = checkOutput(*m[2],expected,first,samples,"quietest talker") && ok;
+    ok = checkOutput(*m[4],expected,first,samples,"third talker") && ok;
+    for (i = 0; i <= count; i++) {
+	m[i]->disconnect();
+	m[i]->clearEndpoint();
+	TelEngine::destruct(m[i]);
+    }
+    delete[] expected;
+    return ok;
+}
+
+// Compare what a member received with the expected mix, the last samples may be still buffered
+bool ConfBench::checkOutput(const BenchMember& member, const int* expected, unsigned int first,
+    unsigned int samples, const char* what)
+{
+    unsigned int n = member.mixed().length() / sizeof(int16_t);
+    if (n > samples)
+	n = samples;
+    if (n + 3 * BENCH_BLOCK < samples) {
+	Debug(this,DebugWarn,"Mix check %s: %s received only %u of %u samples",
+	    what,member.id().c_str(),n,samples);
+	return false;
+    }
+    const int16_t* d = (const int16_t*)member.mixed().data();
+    for (unsigned int t = first; t < n; t++) {
+	if (d[t] == expected[t])
+	    continue;
+	Debug(this,DebugWarn,"Mix check %s: %s sample %u is %d, expected %d",
+	    what,member.id().c_str(),t,d[t],expected[t]);
+	return false;
+    }
+    return true;
+}
+
+// Put all members in a room, all of them talking, and time the mixing rounds
+void ConfBench::timeRoom(unsigned int members, int talkers)
+{
+    String room("conf/confbench-");
+    room << members << "-" << talkers;
+    BenchMember** m = new BenchMember*[members];
+    NamedList params("");
+    params.addParam("maxusers",String(members));
+    params.addParam("maxtalkers",String(talkers));
+    unsigned int joined = 0;
+    for (unsigned int i = 0; i < members; i++) {
+	m[i] = new BenchMember(i);
+	if (m[i]->join(room,params))
+	    joined++;
+    }
+    if (joined != members)
+	Debug(this,DebugWarn,"Only %u of %u members joined '%s'",joined,members,room.c_str());
+    unsigned int r = 0;
+    for (; r < BENCH_WARMUP; r++)
+	for (unsigned int i = 0; i < members; i++)
+	    m[i]->talk(r);
+    u_int64_t start = Time::now();
+    for (; r < BENCH_WARMUP + BENCH_ROUNDS; r++)
+	for (unsigned int i = 0; i < members; i++)
+	    m[i]->talk(r);
+    u_int64_t spent = Time::now() - start;
+    unsigned int bytes = 0;
+    for (unsigned int i = 0; i < members; i++)
+	bytes += m[i]->received();
+    Output("Room of %3u members mixing %-7s %8.1f us/round %6.2f%% CPU, %u bytes out",
+	members,(talkers ? (String(talkers) + " talkers").c_str() : "all"),
+	(double)spent / BENCH_ROUNDS,100.0 * spent / (BENCH_ROUNDS * 20000.0),bytes);
+    for (unsigned int i = 0; i < members; i++) {
+	m[i]->disconnect();
+	m[i]->clearEndpoint();
+	TelEngine::destruct(m[i]);
+    }
+    delete[] m;
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,470 @@
+/**
+ * dnsstub.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Asynchronous resolver test against a local stub DNS server
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+
+#include <string.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+// Domain answered by the stub, queries for other names are refused
+#define STUB_DOMAIN ".stub.test"
+// Delay of answers to names starting with "slow" (msec)
+#define STUB_SLOW 300
+// Clients querying the same slow name at once
+#define STUB_COALESCE 10
+// Names queried to check the source port randomization
+#define STUB_PORTS 20
+
+// Stub DNS server listening on UDP and TCP on a local port
+// Names it knows:
+//  a.*     one A record
+//  nx.*    NXDOMAIN with a SOA giving the negative TTL
+//  big.*   truncated over UDP, 3 A records over TCP
+//  slow.*  one A record, answered late
+//  spoof.* one A record preceded by forged answers
+//  r<N>.*  one A record, the query source port is recorded
+class StubServer : public Thread
+{
+public:
+    StubServer();
+    ~StubServer();
+    bool init();
+    virtual void run();
+    inline int port() const
+	{ return m_addr.port(); }
+    unsigned int queries(const char* name, bool tcp = false);
+    unsigned int ports();
+private:
+    int answer(const unsigned char* buf, int len, unsigned char* out, bool tcp,
+	const SocketAddr& from, bool& forge);
+    void processTcp();
+    void count(const String& name, bool tcp);
+    Mutex m_mutex;
+    Socket m_udp;
+    Socket m_tcp;
+    Socket m_spoof;
+    SocketAddr m_addr;
+    NamedList m_queries;
+    ObjList m_ports;
+};
+
+// Client counting the answers of asynchronous queries
+class StubClient : public ResolverClient
+{
+public:
+    inline StubClient()
+	: m_mutex(false,"StubClient"), m_answers(0), m_records(0)
+	{ }
+    virtual void resolved(Resolver::Type type, const String& dname, int code,
+	ObjList& result, void* userData);
+    inline unsigned int answers()
+	{ Lock lck(m_mutex); return m_answers; }
+    inline unsigned int records()
+	{ Lock lck(m_mutex); return m_records; }
+private:
+    Mutex m_mutex;
+    unsigned int m_answers;
+    unsigned int m_records;
+};
+
+// Runs the tests without blocking the engine
+class StubTests : public Thread
+{
+public:
+    inline StubTests()
+	: Thread("DNS Stub Tests")
+	{ }
+    virtual void run();
+};
+
+class StartHandler : public MessageHandler
+{
+public:
+    inline StartHandler()
+	: MessageHandler("engine.start",150)
+	{ }
+    virtual bool received(Message& msg);
+};
+
+class DnsStub : public Plugin
+{
+public:
+    DnsStub();
+    virtual void initialize();
+    void run();
+private:
+    bool check(const char* test, bool ok, const char* details = 0);
+    bool m_first;
+    unsigned int m_tests;
+    unsigned int m_passed;
+};
+
+INIT_PLUGIN(DnsStub);
+
+
+static void putU16(unsigned char* p, unsigned int val)
+{
+    p[0] = (unsigned char)(val >> 8);
+    p[1] = (unsigned char)val;
+}
+
+static void putU32(unsigned char* p, unsigned int val)
+{
+    putU16(p,val >> 16);
+    putU16(p + 2,val);
+}
+
+// Append an A record pointing to the question name
+static int putA(unsigned char* p, const char* ip, unsigned int ttl)
+{
+    p[0] = 0xc0;
+    p[1] = 12;
+    putU16(p + 2,1);
+    putU16(p + 4,1);
+    putU32(p + 6,ttl);
+    putU16(p + 10,4);
+    SocketAddr addr(SocketAddr::IPv4);
+    addr.host(ip);
+    ::memcpy(p + 12,&((struct sockaddr_in*)addr.address())->sin_addr,4);
+    return 16;
+}
+
+// Resolve a name and return its first A record, empty on failure
+static int resolveA(const char* name, String& ip, unsigned int* count = 0)
+{
+    ObjList res;
+    int code = Resolver::resolve(Resolver::A4,name,res);
+    ip.clear();
+    TxtRecord* rec = static_cast<TxtRecord*>(res.get());
+    if (rec)
+	ip = rec->text();
+    if (count)
+	*count = res.count();
+    return code;
+}
+
+
+StubServer::StubServer()
+    : Thread("DNS Stub"),
+      m_mutex(false,"StubServer"),
+      m_udp(SocketAddr::IPv4,SOCK_DGRAM,IPPROTO_UDP),
+      m_tcp(SocketAddr::IPv4,SOCK_STREAM,IPPROTO_TCP),
+      m_spoof(SocketAddr::IPv4,SOCK_DGRAM,IPPROTO_UDP),
+      m_addr(SocketAddr::IPv4), m_queries("")
+{
+}
+
+StubServer::~StubServer()
+{
+}
+
+// Bind the UDP socket to a free port and the TCP one on the same port
+bool StubServer::init()
+{
+    m_addr.host("127.0.0.1");
+    m_addr.port(0);
+    if (!(m_udp.bind(m_addr) && m_udp.getSockName(m_addr)))
+	return false;
+    SocketAddr any(SocketAddr::IPv4);
+    any.host("127.0.0.1");
+    return m_spoof.bind(any) && m_tcp.setReuse() && m_tcp.bind(m_addr) && m_tcp.listen(5)
+	&& m_tcp.setBlocking(false);
+}
+
+void StubServer::run()
+{
+    unsigned char buf[1500];
+    unsigned char out[1500];
+    while (!Thread::check(false)) {
+	processTcp();
+	bool ok = false;
+	if (!(m_udp.select(&ok,0,0,10000) && ok))
+	    continue;
+	SocketAddr from;
+	int len = m_udp.recvFrom(buf,sizeof(buf),from);
+	if (len < 12)
+	    continue;
+	bool forge = false;
+	int r = answer(buf,len,out,false,from,forge);
+	if (r <= 0)
+	    continue;
+	if (forge) {
+	    // Right id and content from another port, then wrong id from the server port
+	    unsigned char fake[1500];
+	    ::memcpy(fake,out,r);
+	    putA(fake + r - 16,"203.0.113.66",300);
+	    m_spoof.sendTo(fake,r,from);
+	    putU16(fake,((fake[0] << 8) | fake[1]) ^ 0x5a5a);
+	    m_udp.sendTo(fake,r,from);
+	}
+	m_udp.sendTo(out,r,from);
+    }
+}
+
+// Serve one TCP connection if any is waiting
+void StubServer::processTcp()
+{
+    Socket* sock = m_tcp.accept();
+    if (!sock)
+	return;
+    sock->setBlocking(true);
+    unsigned char buf[1500];
+    unsigned char out[1502];
+    int got = 0;
+    while (got < 2 || got < 2 + ((buf[0] << 8) | buf[1])) {
+	int r = sock->recv(buf + got,sizeof(buf) - got);
+	if (r <= 0)
+	    break;
+	got += r;
+    }
+    if (got > 14) {
+	SocketAddr from;
+	bool forge = false;
+	int r = answer(buf + 2,got - 2,out + 2,true,from,forge);
+	if (r > 0) {
+	    putU16(out,r);
+	    sock->send(out,r + 2);
+	}
+    }
+    delete sock;
+}
+
+// Build the answer to a query, return its length
+int StubServer::answer(const unsigned char* buf, int len, unsigned char* out, bool tcp,
+    const SocketAddr& from, bool& forge)
+{
+    String name;
+    int pos = 12;
+    while (pos < len && buf[pos]) {
+	if (name)
+	    name << ".";
+	name.append((const char*)buf + pos + 1,buf[pos]);
+	pos += buf[pos] + 1;
+    }
+    pos += 5;
+    if (pos > len)
+	return 0;
+    name.toLower();
+    count(name,tcp);
+    ::memcpy(out,buf,pos);
+    // Response, recursion desired and available, only the question
+    out[2] = 0x81;
+    out[3] = 0x80;
+    putU16(out + 6,0);
+    putU16(out + 8,0);
+    putU16(out + 10,0);
+    if (!name.endsWith(STUB_DOMAIN)) {
+	// Refused
+	out[3] |= 5;
+	return pos;
+    }
+    if (name.startsWith("nx.")) {
+	out[3] |= 3;
+	putU16(out + 8,1);
+	out[pos] = 0xc0;
+	out[pos + 1] = 12;
+	putU16(out + pos + 2,6);
+	putU16(out + pos + 4,1);
+	putU32(out + pos + 6,300);
+	putU16(out + pos + 10,22);
+	out[pos + 12] = 0;
+	out[pos + 13] = 0;
+	putU32(out + pos + 14,1);
+	putU32(out + pos + 18,3600);
+	putU32(out + pos + 22,600);
+	putU32(out + pos + 26,86400);
+	putU32(out + pos + 30,30);
+	return pos + 34;
+    }
+    if (name.startsWith("big.")) {
+	if (!tcp) {
+	    out[2] |= 0x02;
+	    return pos;
+	}
+	putU16(out + 6,3);
+	pos += putA(out + pos,"192.0.2.10",300);
+	pos += putA(out + pos,"192.0.2.11",300);
+	return pos + putA(out + pos,"192.0.2.12",300);
+    }
+    if (name.startsWith("slow."))
+	Thread::msleep(STUB_SLOW);
+    else if (name.startsWith("spoof."))
+	forge = true;
+    else if (name.startsWith("r")) {
+	Lock lck(m_mutex);
+	if (!m_ports.find(String(from.port())))
+	    m_ports.append(new String(from.port()));
+    }
+    putU16(out + 6,1);
+    return pos + putA(out + pos,forge ? "192.0.2.7" : "192.0.2.1",300);
+}
+
+void StubServer::count(const String& name, bool tcp)
+{
+    String key = name;
+    if (tcp)
+	key << "/tcp";
+    Lock lck(m_mutex);
+    m_queries.setParam(key,String(m_queries.getIntValue(key) + 1));
+}
+
+// Number of queries received for a name
+unsigned int StubServer::queries(const char* name, bool tcp)
+{
+    String key = name;
+    if (tcp)
+	key << "/tcp";
+    Lock lck(m_mutex);
+    return m_queries.getIntValue(key);
+}
+
+// Number of distinct source ports seen on r<N> queries
+unsigned int StubServer::ports()
+{
+    Lock lck(m_mutex);
+    return m_ports.count();
+}
+
+
+void StubClient::resolved(Resolver::Type type, const String& dname, int code,
+    ObjList& result, void* userData)
+{
+    Lock lck(m_mutex);
+    m_answers++;
+    m_records += result.count();
+}
+
+
+void StubTests::run()
+{
+    __plugin.run();
+}
+
+bool StartHandler::received(Message& msg)
+{
+    (new StubTests)->startup();
+    return false;
+}
+
+
+DnsStub::DnsStub()
+    : Plugin("dnsstub"),
+      m_first(true), m_tests(0), m_passed(0)
+{
+    Output("Hello, I am module DnsStub");
+}
+
+void DnsStub::initialize()
+{
+    Output("Initializing module DnsStub");
+    if (m_first) {
+	m_first = false;
+	// the engine configures the resolver before starting
+	Engine::install(new StartHandler);
+    }
+}
+
+bool DnsStub::check(const char* test, bool ok, const char* details)
+{
+    m_tests++;
+    if (ok)
+	m_passed++;
+    else
+	Debug(this,DebugWarn,"Resolver test '%s' failed: %s",test,TelEngine::c_safe(details));
+    return ok;
+}
+
+void DnsStub::run()
+{
+    StubServer* stub = new StubServer;
+    if (!(stub->init() && stub->startup())) {
+	Debug(this,DebugWarn,"Could not start the stub DNS server");
+	delete stub;
+	return;
+    }
+    NamedList params("");
+    params.addParam("servers","127.0.0.1:" + String(stub->port()));
+    params.addParam("timeout","1000");
+    params.addParam("retries","1");
+    Resolver::setup(params);
+    Resolver::flushCache();
+    NamedList before("");
+    Resolver::getStats(before);
+
+    String ip;
+    int code = resolveA("a" STUB_DOMAIN,ip);
+    check("Positive answer",!code && ip == "192.0.2.1",ip);
+    code = resolveA("a" STUB_DOMAIN,ip);
+    check("Positive cache",!code && ip == "192.0.2.1" && stub->queries("a" STUB_DOMAIN) == 1,
+	String(stub->queries("a" STUB_DOMAIN)) + " queries");
+
+    code = resolveA("nx" STUB_DOMAIN,ip);
+    check("Negative answer",code != 0,String(code));
+    code = resolveA("nx" STUB_DOMAIN,ip);
+    check("Negative cache",code != 0 && stub->queries("nx" STUB_DOMAIN) == 1,
+	String(stub->queries("nx" STUB_DOMAIN)) + " queries");
+
+    StubClient client;
+    for (unsigned int i = 0; i < STUB_COALESCE; i++)
+	Resolver::asyncQuery(Resolver::A4,"slow" STUB_DOMAIN,&client);
+    for (unsigned int n = 0; n < 200 && client.answers() < STUB_COALESCE; n++)
+	Thread::msleep(10);
+    String tmp;
+    tmp << client.answers() << " answers, " << stub->queries("slow" STUB_DOMAIN) << " queries";
+    check("Coalescing",client.answers() == STUB_COALESCE && client.records() == STUB_COALESCE
+	&& stub->queries("slow" STUB_DOMAIN) == 1,tmp);
+    Resolver::cancelQuery(&client);
+
+    unsigned int count = 0;
+    code = resolveA("big" STUB_DOMAIN,ip,&count);
+    tmp.clear();
+    tmp << count << " records, " << stub->queries("big" STUB_DOMAIN) << " UDP and "
+	<< stub->queries("big" STUB_DOMAIN,true) << " TCP queries";
+    check("Truncated answer over TCP",!code && count == 3 && stub->queries("big" STUB_DOMAIN) == 1
+	&& stub->queries("big" STUB_DOMAIN,true) == 1,tmp);
+    code = resolveA("big" STUB_DOMAIN,ip,&count);
+    check("Truncated answer cache",!code && count == 3 && stub->queries("big" STUB_DOMAIN) == 1,
+	String(stub->queries("big" STUB_DOMAIN)) + " UDP queries");
+
+    code = resolveA("spoof" STUB_DOMAIN,ip);
+    NamedList after("");
+    Resolver::getStats(after);
+    unsigned int forged = after.getIntValue(YSTRING("forged")) - before.getIntValue(YSTRING("forged"));
+    tmp.clear();
+    tmp << "got '" << ip << "', " << forged << " forged";
+    check("Forged answers ignored",!code && ip == "192.0.2.7" && forged == 2,tmp);
+
+    for (unsigned int i = 0; i < STUB_PORTS; i++)
+	resolveA("r" + String(i) + STUB_DOMAIN,ip);
+    // Random ports may repeat by chance, rarely
+    check("Random source ports",stub->ports() >= STUB_PORTS - 2,String(stub->ports()) + " ports");
+
+    Output("Resolver stub tests: %u of %u passed",m_passed,m_tests);
+    if (m_passed != m_tests)
+	Output("Resolver stub tests FAILED");
+    stub->cancel();
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
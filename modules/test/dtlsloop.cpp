@@ -0,0 +1,255 @@
+/**
+ * dtlsloop.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * DTLS-SRTP keying test between two loopback RTP sessions
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+#include <yatertp.h>
+
+#include <string.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+// Packets sent by each side and interval between them
+#define LOOP_PACKETS 100
+#define LOOP_MSEC 20
+#define LOOP_LEN 160
+
+class CipherHolder : public RefObject
+{
+public:
+    inline CipherHolder()
+	: m_cipher(0)
+	{ }
+    virtual ~CipherHolder()
+	{ TelEngine::destruct(m_cipher); }
+    virtual void* getObject(const String& name) const
+	{ return (name == YATOM("Cipher*")) ? (void*)&m_cipher : RefObject::getObject(name); }
+    inline Cipher* cipher()
+	{ Cipher* tmp = m_cipher; m_cipher = 0; return tmp; }
+private:
+    Cipher* m_cipher;
+};
+
+class DtlsHolder : public RefObject
+{
+public:
+    inline DtlsHolder()
+	: m_dtls(0)
+	{ }
+    virtual ~DtlsHolder()
+	{ TelEngine::destruct(m_dtls); }
+    virtual void* getObject(const String& name) const
+	{ return (name == YATOM("RTPDtls*")) ? (void*)&m_dtls : RefObject::getObject(name); }
+    inline RTPDtls* dtls()
+	{ RTPDtls* tmp = m_dtls; m_dtls = 0; return tmp; }
+private:
+    RTPDtls* m_dtls;
+};
+
+// Session counting the packets that decrypt to the expected payload
+class LoopSession : public RTPSession
+{
+public:
+    inline LoopSession(const char* name)
+	: m_name(name), m_received(0), m_valid(0)
+	{ }
+    virtual Cipher* createCipher(const String& name, Cipher::Direction dir);
+    virtual bool checkCipher(const String& name);
+    virtual RTPDtls* createDtls();
+    virtual bool rtpRecvData(bool marker, unsigned int timestamp, const void* data, int len);
+    bool init(const SocketAddr& local);
+    inline const char* name() const
+	{ return m_name; }
+    inline int received() const
+	{ return m_received; }
+    inline int valid() const
+	{ return m_valid; }
+private:
+    const char* m_name;
+    int m_received;
+    int m_valid;
+};
+
+class StartHandler : public MessageHandler
+{
+public:
+    inline StartHandler()
+	: MessageHandler("engine.start",150)
+	{ }
+    virtual bool received(Message& msg);
+};
+
+class DtlsLoop : public Plugin
+{
+public:
+    DtlsLoop();
+    virtual void initialize();
+    void run();
+private:
+    bool m_first;
+};
+
+INIT_PLUGIN(DtlsLoop);
+
+
+Cipher* LoopSession::createCipher(const String& name, Cipher::Direction dir)
+{
+    Message msg("engine.cipher");
+    msg.addParam("cipher",name);
+    msg.addParam("direction",lookup(dir,Cipher::directions(),"unknown"));
+    CipherHolder* cHold = new CipherHolder;
+    msg.userData(cHold);
+    cHold->deref();
+    return Engine::dispatch(msg) ? cHold->cipher() : 0;
+}
+
+bool LoopSession::checkCipher(const String& name)
+{
+    Message msg("engine.cipher");
+    msg.addParam("cipher",name);
+    return Engine::dispatch(msg);
+}
+
+RTPDtls* LoopSession::createDtls()
+{
+    Message msg("engine.dtls");
+    DtlsHolder* dHold = new DtlsHolder;
+    msg.userData(dHold);
+    dHold->deref();
+    return Engine::dispatch(msg) ? dHold->dtls() : 0;
+}
+
+bool LoopSession::rtpRecvData(bool marker, unsigned int timestamp, const void* data, int len)
+{
+    m_received++;
+    // each packet is filled with a single byte, a bad key would scramble it
+    const unsigned char* p = (const unsigned char*)data;
+    int i = 1;
+    while (i < len && p[i] == p[0])
+	i++;
+    if (len == LOOP_LEN && i == len)
+	m_valid++;
+    return true;
+}
+
+bool LoopSession::init(const SocketAddr& local)
+{
+    SocketAddr addr(local);
+    return initTransport() && initGroup() && localAddr(addr,false)
+	&& direction(SendRecv) && dataPayload(0);
+}
+
+
+bool StartHandler::received(Message& msg)
+{
+    __plugin.run();
+    return false;
+}
+
+
+DtlsLoop::DtlsLoop()
+    : Plugin("dtlsloop"),
+      m_first(true)
+{
+    Output("Hello, I am module DtlsLoop");
+}
+
+void DtlsLoop::initialize()
+{
+    Output("Initializing module DtlsLoop");
+    if (m_first) {
+	m_first = false;
+	// the DTLS provider is not guaranteed to be initialized before us
+	Engine::install(new StartHandler);
+    }
+}
+
+void DtlsLoop::run()
+{
+    SocketAddr local(SocketAddr::IPv4);
+    local.host("127.0.0.1");
+    LoopSession* a = new LoopSession("client");
+    LoopSession* b = new LoopSession("server");
+    String fpA, fpB;
+    if (!(a->init(local) && b->init(local))) {
+	Debug(this,DebugWarn,"Could not set up the loopback RTP sessions");
+	TelEngine::destruct(a);
+	TelEngine::destruct(b);
+	return;
+    }
+    SocketAddr addrA(a->UDPSession::transport()->localAddr());
+    SocketAddr addrB(b->UDPSession::transport()->localAddr());
+    a->remoteAddr(addrB);
+    b->remoteAddr(addrA);
+    // any certificate would do without a fingerprint, this must be refused
+    if (a->dtlsSetup(true,String::empty())) {
+	Debug(this,DebugFail,"DTLS was started without a peer fingerprint");
+	TelEngine::destruct(a);
+	TelEngine::destruct(b);
+	return;
+    }
+    if (!(a->dtlsFingerprint(fpA) && b->dtlsFingerprint(fpB)
+	&& b->dtlsSetup(false,fpA) && a->dtlsSetup(true,fpB))) {
+	Debug(this,DebugWarn,"DTLS is not available, is the openssl module loaded?");
+	TelEngine::destruct(a);
+	TelEngine::destruct(b);
+	return;
+    }
+    Output("DTLS loop %s <-> %s fingerprint '%s'",
+	addrA.addr().c_str(),addrB.addr().c_str(),fpA.c_str());
+    u_int64_t start = Time::now();
+    u_int64_t keyed = 0;
+    int held = 0;
+    unsigned char buf[LOOP_LEN];
+    for (unsigned int i = 1; i <= LOOP_PACKETS; ) {
+	::memset(buf,i & 0xff,sizeof(buf));
+	bool sa = a->rtpSendData(false,i * LOOP_LEN,buf,sizeof(buf));
+	bool sb = b->rtpSendData(false,i * LOOP_LEN,buf,sizeof(buf));
+	if (sa && sb) {
+	    if (!keyed)
+		keyed = Time::now();
+	    i++;
+	}
+	else if (++held > 5000 / LOOP_MSEC)
+	    break;
+	Thread::msleep(LOOP_MSEC);
+    }
+    Thread::msleep(200);
+    if (keyed) {
+	bool secure = a->receiver() && a->receiver()->security() && a->security()
+	    && b->receiver() && b->receiver()->security() && b->security();
+	Output("DTLS-SRTP keys installed after %u ms, srtp=%s",
+	    (unsigned int)((keyed - start) / 1000),String::boolText(secure));
+	LoopSession* s[2] = { a, b };
+	for (int i = 0; i < 2; i++)
+	    Debug(this,(s[i]->valid() == LOOP_PACKETS) ? DebugInfo : DebugWarn,
+		"Session %s received %d packets, %d valid of %d sent",
+		s[i]->name(),s[i]->received(),s[i]->valid(),LOOP_PACKETS);
+    }
+    else
+	Debug(this,DebugWarn,"DTLS-SRTP keys were not installed in 5 seconds");
+    TelEngine::destruct(a);
+    TelEngine::destruct(b);
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,267 @@
+/**
+ * g711bench.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * G.711 and channel conversion correctness and speed test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+
+#include <string.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+// Samples in each timed block, 20ms at 8kHz
+#define BENCH_BLOCK 160
+// Blocks converted for each timing
+#define BENCH_ROUNDS 50000
+
+// Consumer keeping the last block it received
+class BenchConsumer : public DataConsumer
+{
+public:
+    inline BenchConsumer(const char* format)
+	: DataConsumer(format)
+	{ }
+    virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags)
+	{ m_data = data; return invalidStamp(); }
+    inline const DataBlock& data() const
+	{ return m_data; }
+private:
+    DataBlock m_data;
+};
+
+class G711Bench : public Plugin
+{
+public:
+    G711Bench();
+    virtual void initialize();
+private:
+    bool checkDecode(const char* format);
+    bool checkEncode(const char* format);
+    bool checkStereo(const char* sFormat, const char* dFormat);
+    void timeConvert(const char* sFormat, const char* dFormat, unsigned int sampleLen);
+    void timeStereo(const char* sFormat, const char* dFormat);
+    bool m_first;
+};
+
+INIT_PLUGIN(G711Bench);
+
+
+// Sample value for the n-th sample of a test signal covering all the range
+static inline short testSample(unsigned int n)
+{
+    return (short)(n * 40503);
+}
+
+// What the stereo translator must produce for a single frame
+static inline short stereoAverage(short l, short r)
+{
+    int v = ((int)l + r) / 2;
+    return (v < -32767) ? -32767 : v;
+}
+
+
+G711Bench::G711Bench()
+    : Plugin("g711bench"),
+      m_first(true)
+{
+    Output("Hello, I am module G711Bench");
+}
+
+void G711Bench::initialize()
+{
+    Output("Initializing module G711Bench");
+    if (!m_first)
+	return;
+    m_first = false;
+    bool ok = checkDecode("alaw") & checkDecode("mulaw") &
+	checkEncode("alaw") & checkEncode("mulaw") &
+	checkStereo("slin","2*slin") & checkStereo("2*slin","slin");
+    Output("G.711 and stereo conversions %s",ok ? "match the reference" : "FAILED");
+    timeConvert("alaw","slin",1);
+    timeConvert("mulaw","slin",1);
+    timeConvert("slin","alaw",2);
+    timeConvert("slin","mulaw",2);
+    timeConvert("alaw","mulaw",1);
+    timeStereo("slin","2*slin");
+    timeStereo("2*slin","slin");
+}
+
+// Compare decoding long blocks against decoding one byte at a time
+bool G711Bench::checkDecode(const char* format)
+{
+    short ref[256];
+    unsigned char code[1];
+    DataBlock in(code,1,false);
+    DataBlock out;
+    for (unsigned int i = 0; i < 256; i++) {
+	code[0] = i;
+	if (!out.convert(in,format,"slin"))
+	    return false;
+	ref[i] = *(const short*)out.data();
+    }
+    in.clear(false);
+    // many lengths and start offsets to hit every vector width and tail
+    unsigned char buf[1024 + 64];
+    for (unsigned int i = 0; i < sizeof(buf); i++)
+	buf[i] = (unsigned char)(i * 7 + (i >> 8));
+    unsigned int errors = 0;
+    for (unsigned int off = 0; off < 32; off++) {
+	for (unsigned int len = 1; len <= 1024; len += (len < 64) ? 1 : 61) {
+	    in.assign(buf + off,len,false);
+	    out.convert(in,format,"slin");
+	    in.clear(false);
+	    const short* o = (const short*)out.data();
+	    for (unsigned int i = 0; i < len; i++)
+		if (o[i] != ref[buf[off + i]])
+		    errors++;
+	}
+    }
+    if (errors)
+	Debug(this,DebugWarn,"Decoding %s has %u errors",format,errors);
+    return !errors;
+}
+
+// Compare encoding all the 16 bit values in one block against one at a time
+bool G711Bench::checkEncode(const char* format)
+{
+    DataBlock ref(0,65536);
+    DataBlock all(0,2 * 65536);
+    short* a = (short*)all.data();
+    unsigned char* r = (unsigned char*)ref.data();
+    short sample[1];
+    DataBlock in(sample,2,false);
+    DataBlock out;
+    for (unsigned int i = 0; i < 65536; i++) {
+	a[i] = sample[0] = (short)i;
+	if (!out.convert(in,"slin",format))
+	    return false;
+	r[i] = *(const unsigned char*)out.data();
+    }
+    in.clear(false);
+    unsigned int errors = 0;
+    for (unsigned int off = 0; off < 32; off++) {
+	in.assign(a + off,2 * (65536 - 64) + 2 * off,false);
+	out.convert(in,"slin",format);
+	in.clear(false);
+	const unsigned char* o = (const unsigned char*)out.data();
+	for (unsigned int i = 0; i < out.length(); i++)
+	    if (o[i] != r[(i + off) & 0xffff])
+		errors++;
+    }
+    if (errors)
+	Debug(this,DebugWarn,"Encoding %s has %u errors",format,errors);
+    return !errors;
+}
+
+// Push all the sample values through a stereo translator, check the result
+bool G711Bench::checkStereo(const char* sFormat, const char* dFormat)
+{
+    DataTranslator* trans = DataTranslator::create(sFormat,dFormat);
+    if (!trans) {
+	Debug(this,DebugWarn,"No translator from %s to %s",sFormat,dFormat);
+	return false;
+    }
+    BenchConsumer* cons = new BenchConsumer(dFormat);
+    DataSource* src = new DataSource(sFormat);
+    trans->getTransSource()->attach(cons);
+    src->attach(trans);
+    bool toMono = ('2' == *sFormat);
+    unsigned int errors = 0;
+    unsigned int ts = 0;
+    for (unsigned int len = 1; len <= 257; len += 4) {
+	for (unsigned int base = 0; base < 65536; base += len * 2) {
+	    DataBlock in(0,len * (toMono ? 4 : 2));
+	    short* s = (short*)in.data();
+	    unsigned int n = in.length() / 2;
+	    for (unsigned int i = 0; i < n; i++)
+		s[i] = testSample(base + i);
+	    ts += len;
+	    src->Forward(in,ts);
+	    const DataBlock& out = cons->data();
+	    const short* o = (const short*)out.data();
+	    if (out.length() != len * (toMono ? 2 : 4)) {
+		errors++;
+		continue;
+	    }
+	    for (unsigned int i = 0; i < len; i++) {
+		if (toMono) {
+		    if (o[i] != stereoAverage(s[2 * i],s[2 * i + 1]))
+			errors++;
+		}
+		else if (o[2 * i] != s[i] || o[2 * i + 1] != s[i])
+		    errors++;
+	    }
+	}
+    }
+    src->detach(trans);
+    trans->getTransSource()->detach(cons);
+    TelEngine::destruct(src);
+    TelEngine::destruct(cons);
+    TelEngine::destruct(trans);
+    if (errors)
+	Debug(this,DebugWarn,"Converting %s to %s has %u errors",sFormat,dFormat,errors);
+    return !errors;
+}
+
+void G711Bench::timeConvert(const char* sFormat, const char* dFormat, unsigned int sampleLen)
+{
+    DataBlock in(0,BENCH_BLOCK * sampleLen);
+    unsigned char* s = (unsigned char*)in.data();
+    for (unsigned int i = 0; i < in.length(); i++)
+	s[i] = (unsigned char)testSample(i);
+    DataBlock out;
+    u_int64_t start = Time::now();
+    for (unsigned int i = 0; i < BENCH_ROUNDS; i++)
+	out.convert(in,sFormat,dFormat);
+    u_int64_t spent = Time::now() - start;
+    Output("Convert %-6s to %-6s %6.2f ns/sample",sFormat,dFormat,
+	1000.0 * spent / ((double)BENCH_ROUNDS * BENCH_BLOCK));
+}
+
+void G711Bench::timeStereo(const char* sFormat, const char* dFormat)
+{
+    DataTranslator* trans = DataTranslator::create(sFormat,dFormat);
+    if (!trans)
+	return;
+    BenchConsumer* cons = new BenchConsumer(dFormat);
+    DataSource* src = new DataSource(sFormat);
+    trans->getTransSource()->attach(cons);
+    src->attach(trans);
+    DataBlock in(0,BENCH_BLOCK * (('2' == *sFormat) ? 4 : 2));
+    short* s = (short*)in.data();
+    for (unsigned int i = 0; i < in.length() / 2; i++)
+	s[i] = testSample(i);
+    unsigned long ts = 0;
+    u_int64_t start = Time::now();
+    for (unsigned int i = 0; i < BENCH_ROUNDS; i++)
+	src->Forward(in,ts += BENCH_BLOCK);
+    u_int64_t spent = Time::now() - start;
+    Output("Translate %-6s to %-6s %6.2f ns/frame",sFormat,dFormat,
+	1000.0 * spent / ((double)BENCH_ROUNDS * BENCH_BLOCK));
+    src->detach(trans);
+    trans->getTransSource()->detach(cons);
+    TelEngine::destruct(src);
+    TelEngine::destruct(cons);
+    TelEngine::destruct(trans);
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
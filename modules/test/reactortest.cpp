@@ -0,0 +1,217 @@
+/**
+ * reactortest.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Socket reactor test: sockets, timers, removal and stopping
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+// Datagrams sent while the socket is watched and after it was removed
+#define TEST_DGRAMS 100
+// Interval of the repeating timer in microseconds
+#define TEST_INTERVAL 10000
+
+// Client counting datagrams and timer expirations, it can destroy a reactor
+class TestClient : public ReactorClient
+{
+public:
+    inline TestClient()
+	: m_oneShotId(0), m_repeatId(0), m_kill(0), m_killed(false)
+	{ }
+    virtual void socketEvent(Socket& sock, unsigned int events);
+    virtual void timerEvent(unsigned int id, const Time& when);
+    inline void killOnTimer(SocketReactor* reactor)
+	{ m_kill = reactor; }
+    AtomicInt m_dgrams;
+    AtomicInt m_oneShot;
+    AtomicInt m_repeat;
+    unsigned int m_oneShotId;
+    unsigned int m_repeatId;
+    SocketReactor* m_kill;
+    volatile bool m_killed;
+};
+
+class ReactorTest : public Plugin
+{
+public:
+    ReactorTest();
+    virtual void initialize();
+private:
+    bool check(bool ok, const char* what);
+    bool testSockets(SocketReactor& reactor);
+    bool testTimers(SocketReactor& reactor);
+    bool testStop();
+    bool testDestroy(unsigned int threads);
+    bool m_first;
+};
+
+INIT_PLUGIN(ReactorTest);
+
+
+void TestClient::socketEvent(Socket& sock, unsigned int events)
+{
+    // edge triggered, read until the socket is empty
+    char buf[64];
+    while (sock.recvFrom(buf,sizeof(buf)) > 0)
+	m_dgrams.inc();
+}
+
+void TestClient::timerEvent(unsigned int id, const Time& when)
+{
+    if (m_kill) {
+	delete m_kill;
+	m_kill = 0;
+	m_killed = true;
+	return;
+    }
+    if (id == m_oneShotId)
+	m_oneShot.inc();
+    else if (id == m_repeatId)
+	m_repeat.inc();
+}
+
+
+ReactorTest::ReactorTest()
+    : Plugin("reactortest"),
+      m_first(true)
+{
+    Output("Hello, I am module ReactorTest");
+}
+
+void ReactorTest::initialize()
+{
+    Output("Initializing module ReactorTest");
+    if (!m_first)
+	return;
+    m_first = false;
+    if (!SocketReactor::supported()) {
+	Output("Socket reactor is not supported on this platform");
+	return;
+    }
+    SocketReactor* reactor = new SocketReactor("ReactorTest",2);
+    bool ok = check(reactor->start(),"start");
+    ok = testSockets(*reactor) && ok;
+    ok = testTimers(*reactor) && ok;
+    delete reactor;
+    ok = testStop() && ok;
+    ok = testDestroy(1) && ok;
+    ok = testDestroy(2) && ok;
+    Output("Socket reactor test %s",ok ? "passed" : "FAILED");
+}
+
+bool ReactorTest::check(bool ok, const char* what)
+{
+    if (!ok)
+	Debug(this,DebugWarn,"Reactor check failed: %s",what);
+    return ok;
+}
+
+// Datagrams are notified while watched and not after the socket was removed
+bool ReactorTest::testSockets(SocketReactor& reactor)
+{
+    SocketAddr addr(SocketAddr::IPv4);
+    addr.host("127.0.0.1");
+    Socket* rx = new Socket;
+    Socket tx;
+    if (!(rx->create(AF_INET,SOCK_DGRAM) && rx->bind(addr) && rx->getSockName(addr)
+	&& rx->setBlocking(false) && tx.create(AF_INET,SOCK_DGRAM))) {
+	delete rx;
+	return check(false,"socket setup");
+    }
+    TestClient client;
+    SocketRef* ref = new SocketRef(rx);
+    bool ok = check(reactor.addSocket(ref,&client),"add socket");
+    for (int i = 0; i < TEST_DGRAMS; i++)
+	tx.sendTo(&i,sizeof(i),addr);
+    Thread::msleep(100);
+    ok = check(client.m_dgrams.valueAtomic() == TEST_DGRAMS,"datagrams notified") && ok;
+    ok = check(reactor.removeSocket(ref),"remove socket") && ok;
+    ok = check(!reactor.removeSocket(ref),"socket removed once") && ok;
+    for (int i = 0; i < TEST_DGRAMS; i++)
+	tx.sendTo(&i,sizeof(i),addr);
+    Thread::msleep(100);
+    ok = check(client.m_dgrams.valueAtomic() == TEST_DGRAMS,"no datagrams after removal") && ok;
+    TelEngine::destruct(ref);
+    delete rx;
+    return ok;
+}
+
+// One shot timers fire once, repeating ones until removed
+bool ReactorTest::testTimers(SocketReactor& reactor)
+{
+    TestClient client;
+    client.m_oneShotId = reactor.addTimer(&client,TEST_INTERVAL);
+    client.m_repeatId = reactor.addTimer(&client,TEST_INTERVAL,true);
+    bool ok = check(client.m_oneShotId && client.m_repeatId,"add timers");
+    Thread::msleep(200);
+    int n = client.m_repeat.valueAtomic();
+    ok = check(client.m_oneShot.valueAtomic() == 1,"one shot timer fired once") && ok;
+    ok = check(n >= 5,"repeating timer fired") && ok;
+    ok = check(!reactor.removeTimer(client.m_oneShotId),"one shot timer gone") && ok;
+    ok = check(reactor.removeTimer(client.m_repeatId),"remove timer") && ok;
+    n = client.m_repeat.valueAtomic();
+    Thread::msleep(50);
+    ok = check(client.m_repeat.valueAtomic() == n,"no expiration after removal") && ok;
+    // removing the client cancels all its timers
+    client.m_repeatId = reactor.addTimer(&client,TEST_INTERVAL,true);
+    reactor.removeClient(&client);
+    n = client.m_repeat.valueAtomic();
+    Thread::msleep(50);
+    ok = check(client.m_repeat.valueAtomic() == n,"no expiration after client removal") && ok;
+    return ok;
+}
+
+// Stopping waits for the loops, timers added before don't fire after
+bool ReactorTest::testStop()
+{
+    SocketReactor reactor("ReactorTest",2);
+    TestClient client;
+    bool ok = check(reactor.start(),"restart");
+    client.m_repeatId = reactor.addTimer(&client,TEST_INTERVAL,true);
+    Thread::msleep(50);
+    reactor.stop();
+    ok = check(!reactor.running(),"stopped") && ok;
+    int n = client.m_repeat.valueAtomic();
+    Thread::msleep(50);
+    ok = check(client.m_repeat.valueAtomic() == n,"no expiration after stop") && ok;
+    reactor.removeClient(&client);
+    return ok;
+}
+
+// Destroying a reactor from its own notification
+bool ReactorTest::testDestroy(unsigned int threads)
+{
+    SocketReactor* reactor = new SocketReactor("ReactorTest",threads);
+    TestClient client;
+    client.killOnTimer(reactor);
+    bool ok = check(reactor->start(),"start to destroy");
+    ok = check(0 != reactor->addTimer(&client,TEST_INTERVAL),"add destroying timer") && ok;
+    for (int i = 0; i < 100 && !client.m_killed; i++)
+	Thread::msleep(10);
+    ok = check(client.m_killed,"destroyed from notification") && ok;
+    // let the orphaned loop thread exit before the client goes away
+    Thread::msleep(50);
+    return ok;
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
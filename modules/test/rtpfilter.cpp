@@ -0,0 +1,188 @@
+/**
+ * rtpfilter.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Batched RTP reading with a socket filter claiming some of the datagrams
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+#include <yatertp.h>
+
+#include <string.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+// Bursts sent, RTP packets in each burst and their payload length
+#define FILTER_BURSTS 25
+#define FILTER_BURST 8
+#define FILTER_LEN 160
+// Length and filler of the datagrams claimed by the filter, like STUN they start with 0
+#define FILTER_JUNK_LEN 100
+#define FILTER_JUNK 0xee
+
+// Claims the datagrams that can't be RTP, like the STUN filter does
+class JunkFilter : public SocketFilter
+{
+public:
+    inline JunkFilter()
+	: m_claimed(0)
+	{ }
+    virtual bool received(const void* buffer, int length, int flags,
+	const struct sockaddr* addr, socklen_t adrlen);
+    inline int claimed() const
+	{ return m_claimed; }
+private:
+    int m_claimed;
+};
+
+// Session checking each payload is intact and received only once
+class FilterSession : public RTPSession
+{
+public:
+    inline FilterSession()
+	: m_received(0), m_valid(0)
+	{ ::memset(m_seen,0,sizeof(m_seen)); }
+    virtual bool rtpRecvData(bool marker, unsigned int timestamp, const void* data, int len);
+    bool init(const SocketAddr& local);
+    inline int received() const
+	{ return m_received; }
+    inline int valid() const
+	{ return m_valid; }
+private:
+    int m_received;
+    int m_valid;
+    bool m_seen[256];
+};
+
+class RtpFilter : public Plugin
+{
+public:
+    RtpFilter();
+    virtual void initialize();
+    void run();
+private:
+    bool m_first;
+};
+
+INIT_PLUGIN(RtpFilter);
+
+
+bool JunkFilter::received(const void* buffer, int length, int flags,
+    const struct sockaddr* addr, socklen_t adrlen)
+{
+    if (length < 1 || ((const unsigned char*)buffer)[0])
+	return false;
+    m_claimed++;
+    return true;
+}
+
+
+bool FilterSession::rtpRecvData(bool marker, unsigned int timestamp, const void* data, int len)
+{
+    m_received++;
+    // each packet is filled with its own number, a payload or length
+    //  taken from another datagram would not match or repeat one already seen
+    if (len != FILTER_LEN)
+	return true;
+    const unsigned char* p = (const unsigned char*)data;
+    int i = 1;
+    while (i < len && p[i] == p[0])
+	i++;
+    if (i == len && !m_seen[p[0]]) {
+	m_seen[p[0]] = true;
+	m_valid++;
+    }
+    return true;
+}
+
+bool FilterSession::init(const SocketAddr& local)
+{
+    SocketAddr addr(local);
+    return initTransport() && initGroup() && localAddr(addr,false)
+	&& direction(SendRecv) && dataPayload(0);
+}
+
+
+RtpFilter::RtpFilter()
+    : Plugin("rtpfilter"),
+      m_first(true)
+{
+    Output("Hello, I am module RtpFilter");
+}
+
+void RtpFilter::initialize()
+{
+    Output("Initializing module RtpFilter");
+    if (!m_first)
+	return;
+    m_first = false;
+    run();
+}
+
+void RtpFilter::run()
+{
+    SocketAddr local(SocketAddr::IPv4);
+    local.host("127.0.0.1");
+    FilterSession* a = new FilterSession;
+    FilterSession* b = new FilterSession;
+    Socket junk;
+    if (!(a->init(local) && b->init(local) && junk.create(AF_INET,SOCK_DGRAM))) {
+	Debug(this,DebugWarn,"Could not set up the loopback RTP sessions");
+	TelEngine::destruct(a);
+	TelEngine::destruct(b);
+	return;
+    }
+    SocketAddr addrA(a->UDPSession::transport()->localAddr());
+    SocketAddr addrB(b->UDPSession::transport()->localAddr());
+    a->remoteAddr(addrB);
+    b->remoteAddr(addrA);
+    JunkFilter* filter = new JunkFilter;
+    if (!b->UDPSession::transport()->rtpSock()->installFilter(filter)) {
+	Debug(this,DebugWarn,"Could not install the socket filter");
+	delete filter;
+	TelEngine::destruct(a);
+	TelEngine::destruct(b);
+	return;
+    }
+    unsigned char buf[FILTER_LEN];
+    unsigned char jbuf[FILTER_JUNK_LEN];
+    ::memset(jbuf,FILTER_JUNK,sizeof(jbuf));
+    jbuf[0] = 0;
+    unsigned int ts = 0;
+    // interleave claimed datagrams and RTP so they are read in the same batches
+    for (int i = 0; i < FILTER_BURSTS; i++) {
+	for (int j = 0; j < FILTER_BURST; j++) {
+	    junk.sendTo(jbuf,sizeof(jbuf),addrB);
+	    ts += FILTER_LEN;
+	    ::memset(buf,(unsigned char)(ts / FILTER_LEN),sizeof(buf));
+	    a->rtpSendData(false,ts,buf,sizeof(buf));
+	}
+	Thread::msleep(20);
+    }
+    Thread::msleep(200);
+    int sent = FILTER_BURSTS * FILTER_BURST;
+    bool ok = (b->received() == sent) && (b->valid() == sent) && (filter->claimed() == sent);
+    Output("RTP filter test received %d packets, %d valid of %d sent, %d of %d claimed: %s",
+	b->received(),b->valid(),sent,filter->claimed(),sent,ok ? "passed" : "FAILED");
+    TelEngine::destruct(a);
+    TelEngine::destruct(b);
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
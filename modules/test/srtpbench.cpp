@@ -0,0 +1,290 @@
+/**
+ * srtpbench.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * SRTP protection correctness and speed test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+#include <yatertp.h>
+
+#include <string.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+#define BENCH_SUITE "AES_CM_128_HMAC_SHA1_80"
+#define BENCH_AUTH 10
+#define BENCH_HDR 12
+#define BENCH_MAX 1500
+
+class CipherHolder : public RefObject
+{
+public:
+    inline CipherHolder()
+	: m_cipher(0)
+	{ }
+    virtual ~CipherHolder()
+	{ TelEngine::destruct(m_cipher); }
+    virtual void* getObject(const String& name) const
+	{ return (name == YATOM("Cipher*")) ? (void*)&m_cipher : RefObject::getObject(name); }
+    inline Cipher* cipher()
+	{ Cipher* tmp = m_cipher; m_cipher = 0; return tmp; }
+private:
+    Cipher* m_cipher;
+};
+
+// Session that only knows how to build ciphers through the engine
+class BenchSession : public RTPSession
+{
+public:
+    virtual Cipher* createCipher(const String& name, Cipher::Direction dir);
+    virtual bool checkCipher(const String& name);
+};
+
+// Gives access to the per packet protection methods
+class BenchSecure : public RTPSecure
+{
+public:
+    inline BenchSecure()
+	: RTPSecure(BENCH_SUITE)
+	{ }
+    void protect(unsigned char* pkt, int len);
+    bool unprotect(unsigned char* pkt, int len);
+};
+
+// One sending leg keyed with either the reference or the native code
+class BenchLeg
+{
+public:
+    BenchLeg(RTPSession* session, bool fast, String& key);
+    ~BenchLeg();
+    inline bool valid() const
+	{ return m_secure && m_secure->rtpCipher(); }
+    inline BenchSecure* secure() const
+	{ return m_secure; }
+private:
+    RTPSender* m_sender;
+    BenchSecure* m_secure;
+};
+
+class StartHandler : public MessageHandler
+{
+public:
+    inline StartHandler()
+	: MessageHandler("engine.start",150)
+	{ }
+    virtual bool received(Message& msg);
+};
+
+class SrtpBench : public Plugin
+{
+public:
+    SrtpBench();
+    virtual void initialize();
+    void run();
+private:
+    bool check(BenchLeg& ref, BenchLeg& fast);
+    void speed(BenchLeg& ref, BenchLeg& fast, int payload, unsigned int count);
+    u_int64_t timeProtect(BenchLeg& leg, int len, unsigned int count);
+    u_int64_t timeUnprotect(BenchLeg& leg, int len, unsigned int count);
+    bool m_first;
+};
+
+INIT_PLUGIN(SrtpBench);
+
+static void fillRandom(unsigned char* buf, int len)
+{
+    for (int i = 0; i < len; i++)
+	buf[i] = (unsigned char)Random::random();
+}
+
+
+Cipher* BenchSession::createCipher(const String& name, Cipher::Direction dir)
+{
+    Message msg("engine.cipher");
+    msg.addParam("cipher",name);
+    msg.addParam("direction",lookup(dir,Cipher::directions(),"unknown"));
+    CipherHolder* cHold = new CipherHolder;
+    msg.userData(cHold);
+    cHold->deref();
+    return Engine::dispatch(msg) ? cHold->cipher() : 0;
+}
+
+bool BenchSession::checkCipher(const String& name)
+{
+    Message msg("engine.cipher");
+    msg.addParam("cipher",name);
+    return Engine::dispatch(msg);
+}
+
+
+void BenchSecure::protect(unsigned char* pkt, int len)
+{
+    len -= BENCH_AUTH;
+    rtpEncipher(pkt + BENCH_HDR,len - BENCH_HDR);
+    rtpAddIntegrity(pkt,len,pkt + len);
+}
+
+bool BenchSecure::unprotect(unsigned char* pkt, int len)
+{
+    len -= BENCH_AUTH;
+    if (!rtpCheckIntegrity(pkt,len,pkt + len,owner()->ssrc(),owner()->fullSeq()))
+	return false;
+    return rtpDecipher(pkt + BENCH_HDR,len - BENCH_HDR,0,owner()->ssrc(),owner()->fullSeq());
+}
+
+
+BenchLeg::BenchLeg(RTPSession* session, bool fast, String& key)
+    : m_sender(0), m_secure(new BenchSecure)
+{
+    String suite(BENCH_SUITE);
+    if (key.null())
+	m_secure->create(suite,key);
+    else
+	m_secure->setup(suite,key);
+    RTPSecure::fastPath(fast);
+    // not sending anything so keep a fixed sequence number
+    m_sender = new RTPSender(session,false);
+    m_sender->security(m_secure);
+}
+
+BenchLeg::~BenchLeg()
+{
+    // the sender owns the security object
+    delete m_sender;
+}
+
+
+bool StartHandler::received(Message& msg)
+{
+    __plugin.run();
+    return false;
+}
+
+
+SrtpBench::SrtpBench()
+    : Plugin("srtpbench"),
+      m_first(true)
+{
+    Output("Hello, I am module SrtpBench");
+}
+
+void SrtpBench::initialize()
+{
+    Output("Initializing module SrtpBench");
+    if (m_first) {
+	m_first = false;
+	// the cipher provider is not guaranteed to be initialized before us
+	Engine::install(new StartHandler);
+    }
+}
+
+void SrtpBench::run()
+{
+    bool enabled = (0 != ::strcmp(RTPSecure::fastPath(),"disabled"));
+    BenchSession* session = new BenchSession;
+    String key;
+    BenchLeg ref(session,false,key);
+    BenchLeg fast(session,true,key);
+    const char* impl = RTPSecure::fastPath();
+    RTPSecure::fastPath(enabled);
+    if (ref.valid() && fast.valid()) {
+	Output("SRTP native implementation: %s",impl);
+	if (check(ref,fast)) {
+	    speed(ref,fast,160,200000);
+	    speed(ref,fast,1200,50000);
+	}
+    }
+    else
+	Debug(this,DebugWarn,"Cipher 'aes_ctr' is not available, is the openssl module loaded?");
+    TelEngine::destruct(session);
+}
+
+// Compare the native code against the reference for all packet sizes
+bool SrtpBench::check(BenchLeg& ref, BenchLeg& fast)
+{
+    unsigned char orig[BENCH_MAX];
+    unsigned char a[BENCH_MAX];
+    unsigned char b[BENCH_MAX];
+    for (int len = BENCH_HDR + BENCH_AUTH + 1; len <= BENCH_MAX; len++) {
+	fillRandom(orig,len);
+	::memcpy(a,orig,len);
+	::memcpy(b,orig,len);
+	ref.secure()->protect(a,len);
+	fast.secure()->protect(b,len);
+	if (::memcmp(a,b,len)) {
+	    Debug(this,DebugWarn,"Protected packet of %d bytes differs from reference",len);
+	    return false;
+	}
+	if (!(ref.secure()->unprotect(b,len) && fast.secure()->unprotect(a,len))) {
+	    Debug(this,DebugWarn,"Packet of %d bytes failed authentication",len);
+	    return false;
+	}
+	if (::memcmp(a,orig,len - BENCH_AUTH) || ::memcmp(b,orig,len - BENCH_AUTH)) {
+	    Debug(this,DebugWarn,"Packet of %d bytes did not decrypt to the original",len);
+	    return false;
+	}
+    }
+    Debug(this,DebugInfo,"Native SRTP matches the reference for %d to %d byte packets",
+	BENCH_HDR + BENCH_AUTH + 1,BENCH_MAX);
+    return true;
+}
+
+void SrtpBench::speed(BenchLeg& ref, BenchLeg& fast, int payload, unsigned int count)
+{
+    int len = BENCH_HDR + payload + BENCH_AUTH;
+    u_int64_t refSend = timeProtect(ref,len,count);
+    u_int64_t fastSend = timeProtect(fast,len,count);
+    u_int64_t refRecv = timeUnprotect(ref,len,count);
+    u_int64_t fastRecv = timeUnprotect(fast,len,count);
+    Output("SRTP %d byte payload, %u packets: protect %u / %u ns, unprotect %u / %u ns, speedup %.2f / %.2f",
+	payload,count,
+	(unsigned int)(refSend * 1000 / count),(unsigned int)(fastSend * 1000 / count),
+	(unsigned int)(refRecv * 1000 / count),(unsigned int)(fastRecv * 1000 / count),
+	fastSend ? (double)refSend / fastSend : 0.0,
+	fastRecv ? (double)refRecv / fastRecv : 0.0);
+}
+
+u_int64_t SrtpBench::timeProtect(BenchLeg& leg, int len, unsigned int count)
+{
+    unsigned char buf[BENCH_MAX];
+    fillRandom(buf,len);
+    u_int64_t t = Time::now();
+    for (unsigned int i = 0; i < count; i++)
+	leg.secure()->protect(buf,len);
+    return Time::now() - t;
+}
+
+u_int64_t SrtpBench::timeUnprotect(BenchLeg& leg, int len, unsigned int count)
+{
+    unsigned char orig[BENCH_MAX];
+    unsigned char buf[BENCH_MAX];
+    fillRandom(orig,len);
+    leg.secure()->protect(orig,len);
+    u_int64_t t = Time::now();
+    for (unsigned int i = 0; i < count; i++) {
+	::memcpy(buf,orig,len);
+	if (!leg.secure()->unprotect(buf,len))
+	    break;
+    }
+    return Time::now() - t;
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,344 @@
+/**
+ * tonebench.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Tone detector validation corpus and speed test
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+
+#include <math.h>
+#include <string.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+// Samples in each forwarded block, 20ms at 8kHz
+#define BENCH_BLOCK 160
+// Streams fed in parallel by the speed test
+#define BENCH_STREAMS 200
+// Blocks timed for each stream
+#define BENCH_ROUNDS 250
+
+// One signal of the corpus and the detections it must produce
+typedef struct {
+    // detector to attach, the consumer name used in chan.attach
+    const char* detector;
+    // DTMF digits to send, if NULL a tone of freq1 (+ freq2) is sent instead
+    const char* digits;
+    int freq1;
+    int freq2;
+    // peak amplitude of the (low group) tone
+    int level;
+    // amplitude of the second (high group) tone in percents
+    int twist;
+    // duration of each digit or tone and the pause after it
+    int onMsec;
+    int offMsec;
+    // peak amplitude of white noise added over the whole signal
+    int noise;
+    // channel holding the signal: 0 mono, 'L' or 'R' stereo
+    char channel;
+    // expected detections: DTMF digits, F for fax and O for continuity
+    const char* expect;
+    const char* name;
+} CorpusCase;
+
+static const CorpusCase s_corpus[] = {
+    { "tone/*", "1234567890*#ABCD", 0, 0, 8000, 100, 60, 60, 0, 0, "1234567890*#ABCD", "DTMF all digits" },
+    { "tone/*", "159D", 0, 0, 1500, 100, 60, 60, 0, 0, "159D", "DTMF quiet" },
+    { "tone/*", "159D", 0, 0, 600, 100, 60, 60, 0, 0, "", "DTMF below power threshold" },
+    { "tone/*", "2580", 0, 0, 8000, 100, 50, 50, 0, 0, "2580", "DTMF fast dialing" },
+    { "tone/*", "2580", 0, 0, 8000, 100, 20, 50, 0, 0, "", "DTMF too short" },
+    { "tone/*", "1122", 0, 0, 8000, 100, 60, 60, 0, 0, "1122", "DTMF repeated digits" },
+    { "tone/*", "3690", 0, 0, 8000, 100, 60, 60, 800, 0, "3690", "DTMF with noise" },
+    { "tone/*", "3690", 0, 0, 8000, 70, 60, 60, 0, 0, "3690", "DTMF weak high group" },
+    { "tone/*", "3690", 0, 0, 6000, 130, 60, 60, 0, 0, "3690", "DTMF strong high group" },
+    { "tone/*", "3690", 0, 0, 8000, 20, 60, 60, 0, 0, "", "DTMF excessive twist" },
+    { "tone/dtmf", "*#", 0, 0, 8000, 100, 60, 60, 0, 0, "*#", "DTMF only detector" },
+    { "tone/*", 0, 697, 0, 8000, 0, 500, 100, 0, 0, "", "Single DTMF component" },
+    { "tone/*", 0, 500, 1000, 8000, 100, 500, 100, 0, 0, "", "Dual tone not DTMF" },
+    { "tone/*", 0, 1100, 0, 8000, 0, 500, 3000, 0, 0, "F", "Fax CNG" },
+    { "tone/*", 0, 1100, 0, 1000, 0, 500, 3000, 0, 0, "", "Fax CNG below power threshold" },
+    { "tone/*", 0, 1100, 0, 8000, 0, 500, 100, 2000, 0, "F", "Fax CNG with noise" },
+    { "tone/*", 0, 2100, 0, 8000, 0, 2000, 100, 0, 0, "", "Fax CED not detected by default" },
+    { "tone/rfax", 0, 2100, 0, 8000, 0, 2000, 100, 0, 0, "F", "Fax CED" },
+    { "tone/cotv", 0, 2010, 0, 8000, 0, 1000, 100, 0, 0, "O", "Continuity verified" },
+    { "tone/cots", 0, 1780, 0, 8000, 0, 1000, 100, 0, 0, "O", "Continuity send" },
+    { "tone/cotv", 0, 1780, 0, 8000, 0, 1000, 100, 0, 0, "", "Continuity send tone on verify" },
+    { "tone/*", 0, 0, 0, 0, 0, 1000, 0, 0, 0, "", "Silence" },
+    { "tone/*", 0, 0, 0, 0, 0, 2000, 0, 8000, 0, "", "White noise" },
+    { "tone/left/dtmf", "147", 0, 0, 8000, 100, 60, 60, 0, 'L', "147", "Stereo left DTMF" },
+    { "tone/right/dtmf", "147", 0, 0, 8000, 100, 60, 60, 0, 'L', "", "Stereo right channel silent" },
+    { "tone/right/*", 0, 1100, 0, 8000, 0, 500, 100, 0, 'R', "F", "Stereo right fax" },
+    { "tone/mixed/dtmf", "147", 0, 0, 8000, 100, 60, 60, 0, 'R', "147", "Stereo mixed DTMF" },
+};
+
+// DTMF low and high group frequencies for each digit
+static const char s_digits[] = "123A456B789C*0#D";
+static const int s_dtmfL[] = { 697, 770, 852, 941 };
+static const int s_dtmfH[] = { 1209, 1336, 1477, 1633 };
+
+// Detections collected for each corpus case, indexed by the case number
+static String s_detected[sizeof(s_corpus) / sizeof(s_corpus[0])];
+static Mutex s_mutex(false,"ToneBench");
+
+// Collects the detections the tone detector sends as chan.masquerade
+class MasqueradeHandler : public MessageHandler
+{
+public:
+    inline MasqueradeHandler()
+	: MessageHandler("chan.masquerade",10)
+	{ }
+    virtual bool received(Message& msg);
+};
+
+class StartHandler : public MessageHandler
+{
+public:
+    inline StartHandler()
+	: MessageHandler("engine.start",150)
+	{ }
+    virtual bool received(Message& msg);
+};
+
+// Detections are enqueued so we must not block the engine while waiting
+class BenchThread : public Thread
+{
+public:
+    inline BenchThread()
+	: Thread("Tone Bench")
+	{ }
+    virtual void run();
+};
+
+class ToneBench : public Plugin
+{
+public:
+    ToneBench();
+    virtual void initialize();
+    void run();
+private:
+    bool checkCorpus();
+    void timeDetect(const char* detector);
+    bool m_first;
+};
+
+INIT_PLUGIN(ToneBench);
+
+
+// Small deterministic generator for the noise
+static int noiseSample(unsigned int& seed, int level)
+{
+    seed = seed * 1103515245 + 12345;
+    return level ? (int)((seed >> 16) % (2 * level + 1)) - level : 0;
+}
+
+// Build the signal of a corpus case
+static void buildSignal(const CorpusCase& c, DataBlock& data)
+{
+    unsigned int count = c.digits ? ::strlen(c.digits) : 1;
+    unsigned int onSamp = c.onMsec * 8;
+    unsigned int samples = count * (onSamp + c.offMsec * 8);
+    bool stereo = (0 != c.channel);
+    data.assign(0,samples * (stereo ? 4 : 2));
+    int16_t* d = (int16_t*)data.data();
+    unsigned int seed = 1;
+    unsigned int n = 0;
+    for (unsigned int k = 0; k < count; k++) {
+	int f1 = c.freq1;
+	int f2 = c.freq2;
+	if (c.digits) {
+	    const char* p = ::strchr(s_digits,c.digits[k]);
+	    int idx = p ? p - s_digits : 0;
+	    f1 = s_dtmfL[idx / 4];
+	    f2 = s_dtmfH[idx % 4];
+	}
+	for (unsigned int i = 0; i < onSamp + c.offMsec * 8; i++, n++) {
+	    double v = 0;
+	    if (i < onSamp) {
+		v = c.level * sin(2 * M_PI * f1 * n / 8000);
+		if (f2)
+		    v += c.level * c.twist / 100.0 * sin(2 * M_PI * f2 * n / 8000);
+	    }
+	    int s = (int)v + noiseSample(seed,c.noise);
+	    s = (s > 32767) ? 32767 : ((s < -32767) ? -32767 : s);
+	    if (!stereo)
+		d[n] = s;
+	    else {
+		d[2 * n] = ('L' == c.channel) ? s : 0;
+		d[2 * n + 1] = ('R' == c.channel) ? s : 0;
+	    }
+	}
+    }
+}
+
+// Attach a detector to a new source like chan.attach would do for a channel
+static DataSource* attachDetector(const char* detector, const char* format, const String& id)
+{
+    DataSource* src = new DataSource(format);
+    Message m("chan.attach");
+    m.addParam("consumer",detector);
+    m.addParam("id",id);
+    m.userData(src);
+    if (Engine::dispatch(m) || m.userData() != src)
+	return src;
+    Debug(&__plugin,DebugWarn,"Could not attach '%s' as '%s'",detector,id.c_str());
+    TelEngine::destruct(src);
+    return 0;
+}
+
+// Forward a signal in blocks of 20ms
+static void forwardSignal(DataSource* src, const DataBlock& data, unsigned int frame)
+{
+    unsigned int len = BENCH_BLOCK * frame;
+    for (unsigned int offs = 0; offs < data.length(); offs += len) {
+	unsigned int n = data.length() - offs;
+	if (n > len)
+	    n = len;
+	DataBlock block((char*)data.data() + offs,n,false);
+	src->Forward(block,offs / frame);
+	block.clear(false);
+    }
+}
+
+
+bool MasqueradeHandler::received(Message& msg)
+{
+    String id = msg["id"];
+    if (!id.startSkip("tonebench/",false))
+	return false;
+    int idx = id.toInteger(-1);
+    if (idx < 0 || idx >= (int)(sizeof(s_corpus) / sizeof(s_corpus[0])))
+	return true;
+    Lock mylock(s_mutex);
+    const String& what = msg["message"];
+    if (what == YSTRING("chan.dtmf"))
+	s_detected[idx] << msg["text"];
+    else if (what == YSTRING("call.fax"))
+	s_detected[idx] << "F";
+    return true;
+}
+
+bool StartHandler::received(Message& msg)
+{
+    (new BenchThread)->startup();
+    return false;
+}
+
+void BenchThread::run()
+{
+    __plugin.run();
+}
+
+
+ToneBench::ToneBench()
+    : Plugin("tonebench"),
+      m_first(true)
+{
+    Output("Hello, I am module ToneBench");
+}
+
+void ToneBench::initialize()
+{
+    Output("Initializing module ToneBench");
+    if (m_first) {
+	m_first = false;
+	Engine::install(new MasqueradeHandler);
+	// the tone detector is not guaranteed to be initialized before us
+	Engine::install(new StartHandler);
+    }
+}
+
+void ToneBench::run()
+{
+    bool ok = checkCorpus();
+    Output("Tone detector corpus %s",ok ? "matches the expected detections" : "FAILED");
+    timeDetect("tone/dtmf");
+    timeDetect("tone/*");
+    timeDetect("tone/fax,cotv,dtmf");
+}
+
+// Run all the corpus signals through detectors, then compare the detections
+bool ToneBench::checkCorpus()
+{
+    unsigned int cases = sizeof(s_corpus) / sizeof(s_corpus[0]);
+    for (unsigned int i = 0; i < cases; i++) {
+	const CorpusCase& c = s_corpus[i];
+	DataSource* src = attachDetector(c.detector,(c.channel ? "2*slin" : "slin"),
+	    "tonebench/" + String(i));
+	if (!src)
+	    continue;
+	DataBlock data;
+	buildSignal(c,data);
+	forwardSignal(src,data,c.channel ? 4 : 2);
+	src->clear();
+	TelEngine::destruct(src);
+    }
+    // detections are enqueued, give the engine time to deliver them
+    Thread::msleep(500);
+    unsigned int failed = 0;
+    Lock mylock(s_mutex);
+    for (unsigned int i = 0; i < cases; i++) {
+	const CorpusCase& c = s_corpus[i];
+	if (s_detected[i] == c.expect)
+	    continue;
+	failed++;
+	Debug(this,DebugWarn,"Corpus '%s' with '%s' detected '%s', expected '%s'",
+	    c.name,c.detector,s_detected[i].c_str(),c.expect);
+    }
+    Output("Tone detector corpus: %u of %u signals detected as expected",cases - failed,cases);
+    return !failed;
+}
+
+// Feed many streams of speech like signal with no tones to detect
+void ToneBench::timeDetect(const char* detector)
+{
+    static const CorpusCase speech =
+	{ 0, 0, 440, 1250, 6000, 60, 180, 40, 500, 0, "", "Speech like" };
+    DataSource* src[BENCH_STREAMS];
+    unsigned int n = 0;
+    for (; n < BENCH_STREAMS; n++) {
+	src[n] = attachDetector(detector,"slin","tonebench/bench");
+	if (!src[n])
+	    break;
+    }
+    DataBlock data;
+    buildSignal(speech,data);
+    unsigned int blocks = data.length() / (2 * BENCH_BLOCK);
+    u_int64_t start = Time::now();
+    for (unsigned int r = 0; r < BENCH_ROUNDS; r++) {
+	DataBlock block((int16_t*)data.data() + (r % blocks) * BENCH_BLOCK,
+	    2 * BENCH_BLOCK,false);
+	for (unsigned int i = 0; i < n; i++)
+	    src[i]->Forward(block,r * BENCH_BLOCK);
+	block.clear(false);
+    }
+    u_int64_t spent = Time::now() - start;
+    if (n)
+	Output("Detect %-20s %6.2f ns/sample, %5.1f us per second of audio on each stream",
+	    detector,1000.0 * spent / ((double)BENCH_ROUNDS * BENCH_BLOCK * n),
+	    50.0 * spent / ((double)BENCH_ROUNDS * n));
+    while (n--) {
+	src[n]->clear();
+	TelEngine::destruct(src[n]);
+    }
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
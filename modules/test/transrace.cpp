@@ -0,0 +1,173 @@
+/**
+ * transrace.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * Translator lookups racing against factories being installed and removed
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatephone.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+// Reader threads and install/remove rounds of the test factory
+#define RACE_READERS 4
+#define RACE_ROUNDS 2000
+
+// Factory converting to a private format, it also looks up translators
+//  from inside create() like factories building their own chains do
+class RaceFactory : public TranslatorFactory
+{
+public:
+    inline RaceFactory()
+	: TranslatorFactory("transrace"), m_alive(true)
+	{ }
+    virtual DataTranslator* create(const DataFormat& sFormat, const DataFormat& dFormat);
+    virtual const TranslatorCaps* getCapabilities() const;
+    inline void retire()
+	{ m_alive = false; }
+private:
+    volatile bool m_alive;
+};
+
+// Only used to reach the protected factory install and removal
+class RaceTranslator : public DataTranslator
+{
+public:
+    static inline void add(TranslatorFactory* factory)
+	{ install(factory); }
+    static inline void remove(TranslatorFactory* factory)
+	{ uninstall(factory); }
+};
+
+class RaceReader : public Thread
+{
+public:
+    inline RaceReader()
+	: Thread("TransRace")
+	{ }
+    virtual void run();
+};
+
+class TransRace : public Plugin
+{
+public:
+    TransRace();
+    virtual void initialize();
+private:
+    bool m_first;
+};
+
+INIT_PLUGIN(TransRace);
+
+static TranslatorCaps s_caps[] = {
+    { 0, 0, 1 },
+    { 0, 0, 0 }
+};
+
+static AtomicUInt s_lookups;
+static AtomicUInt s_creates;
+static AtomicUInt s_late;
+static AtomicInt s_running;
+static volatile bool s_stop = false;
+
+
+DataTranslator* RaceFactory::create(const DataFormat& sFormat, const DataFormat& dFormat)
+{
+    s_creates.inc();
+    if (!m_alive)
+	s_late.inc();
+    // nested lookup while the outer one keeps the table in use
+    DataTranslator::cost("slin","alaw");
+    Thread::yield();
+    if (!m_alive)
+	s_late.inc();
+    return 0;
+}
+
+const TranslatorCaps* RaceFactory::getCapabilities() const
+{
+    return s_caps;
+}
+
+
+void RaceReader::run()
+{
+    s_running.inc();
+    while (!s_stop) {
+	// directly and through a chain built on the factory
+	TelEngine::destruct(DataTranslator::create("slin","transrace"));
+	TelEngine::destruct(DataTranslator::create("mulaw","transrace"));
+	DataTranslator::cost("alaw","transrace");
+	s_lookups.add(3);
+    }
+    s_running.dec();
+}
+
+
+TransRace::TransRace()
+    : Plugin("transrace"),
+      m_first(true)
+{
+    Output("Hello, I am module TransRace");
+}
+
+void TransRace::initialize()
+{
+    Output("Initializing module TransRace");
+    if (!m_first)
+	return;
+    m_first = false;
+    s_caps[0].src = FormatRepository::getFormat("slin");
+    s_caps[0].dest = FormatRepository::addFormat("transrace",0,20000);
+    if (!(s_caps[0].src && s_caps[0].dest))
+	return;
+    // factories install themselves before they are fully constructed
+    //  so build them all before any lookup can see them
+    // removed factories are kept until the end to detect any late use
+    ObjList factories;
+    unsigned int i;
+    for (i = 0; i < RACE_ROUNDS; i++) {
+	RaceFactory* f = new RaceFactory;
+	RaceTranslator::remove(f);
+	factories.append(f);
+    }
+    for (i = 0; i < RACE_READERS; i++)
+	(new RaceReader)->startup();
+    while (s_running.valueAtomic() < RACE_READERS)
+	Thread::idle();
+    u_int64_t start = Time::now();
+    for (ObjList* l = factories.skipNull(); l; l = l->skipNext()) {
+	RaceFactory* f = static_cast<RaceFactory*>(l->get());
+	RaceTranslator::add(f);
+	Thread::yield();
+	RaceTranslator::remove(f);
+	f->retire();
+    }
+    u_int64_t spent = Time::now() - start;
+    s_stop = true;
+    while (s_running.valueAtomic())
+	Thread::idle();
+    unsigned int late = s_late.valueAtomic();
+    Output("Translator race %u rounds in %u ms, %u lookups, %u creates, %u after removal: %s",
+	RACE_ROUNDS,(unsigned int)(spent / 1000),s_lookups.valueAtomic(),s_creates.valueAtomic(),
+	late,late ? "FAILED" : "passed");
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
@@ -0,0 +1,199 @@
+/**
+ * udptlloss.cpp
+ * This file is part of the YATE Project http://YATE.null.ro
+ *
+ * UDPTL error recovery test over a simulated lossy link
+ *
+ * Yet Another Telephony Engine - a fully featured software PBX and IVR
+ * Copyright (C) 2004-2023 Null Team
+ *
+ * This software is distributed under multiple licenses;
+ * see the COPYING file in the main directory for licensing
+ * information for this specific distribution.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <yatengine.h>
+#include <yatertp.h>
+
+#include <string.h>
+
+using namespace TelEngine;
+namespace { // anonymous
+
+// IFPs sent for each test case
+#define LOSS_PACKETS 20000
+
+class LossSession;
+
+// Transport that hands packets directly to the peer session unless dropped
+class LossTransport : public RTPTransport
+{
+public:
+    inline LossTransport()
+	: RTPTransport(RTPTransport::UDPTL),
+	  m_peer(0), m_rand(12345), m_loss(0), m_burst(0), m_inBurst(false), m_dropped(0)
+	{ }
+    // Set random loss per mille, bursts continue with given per mille chance
+    inline void setLoss(unsigned int loss, unsigned int burst)
+	{ m_loss = loss; m_burst = burst; }
+    inline void peer(LossSession* session)
+	{ m_peer = session; }
+    inline unsigned int dropped() const
+	{ return m_dropped; }
+    virtual void rtpData(const void* data, int len);
+private:
+    LossSession* m_peer;
+    Random m_rand;
+    unsigned int m_loss;
+    unsigned int m_burst;
+    bool m_inBurst;
+    unsigned int m_dropped;
+};
+
+// Session checking the content of each received IFP
+class LossSession : public UDPTLSession
+{
+public:
+    inline LossSession(u_int8_t maxSec)
+	: UDPTLSession(400,maxSec),
+	  m_received(0), m_valid(0)
+	{ }
+    inline LossTransport* lossTransport() const
+	{ return static_cast<LossTransport*>(UDPSession::transport()); }
+    inline unsigned int received() const
+	{ return m_received; }
+    inline unsigned int valid() const
+	{ return m_valid; }
+    static int fill(unsigned char* buf, u_int16_t seq);
+protected:
+    virtual RTPTransport* createTransport()
+	{ return new LossTransport; }
+    virtual void udptlRecv(const void* data, int len, u_int16_t seq, bool recovered);
+private:
+    unsigned int m_received;
+    unsigned int m_valid;
+};
+
+class UdptlLoss : public Plugin
+{
+public:
+    UdptlLoss();
+    virtual void initialize();
+private:
+    void run(const char* name, u_int8_t maxSec, unsigned int span, unsigned int entries,
+	unsigned int loss, unsigned int burst);
+    bool m_first;
+};
+
+INIT_PLUGIN(UdptlLoss);
+
+
+void LossTransport::rtpData(const void* data, int len)
+{
+    if (m_inBurst)
+	m_inBurst = (m_rand.next() % 1000) < m_burst;
+    else
+	m_inBurst = (m_rand.next() % 1000) < m_loss;
+    if (m_inBurst) {
+	m_dropped++;
+	return;
+    }
+    if (m_peer)
+	m_peer->rtpData(data,len);
+}
+
+
+// Build an IFP of variable length whose content depends on its sequence
+int LossSession::fill(unsigned char* buf, u_int16_t seq)
+{
+    int len = 20 + (seq * 37) % 60;
+    for (int i = 0; i < len; i++)
+	buf[i] = (unsigned char)(seq * 7 + i + 1);
+    return len;
+}
+
+void LossSession::udptlRecv(const void* data, int len, u_int16_t seq, bool recovered)
+{
+    m_received++;
+    unsigned char buf[256];
+    int l = fill(buf,seq);
+    if (len < l || ::memcmp(data,buf,l))
+	return;
+    // IFPs recovered from parity data are padded with zeros
+    const unsigned char* p = (const unsigned char*)data;
+    while (l < len && !p[l])
+	l++;
+    if (l == len)
+	m_valid++;
+}
+
+
+UdptlLoss::UdptlLoss()
+    : Plugin("udptlloss"),
+      m_first(true)
+{
+    Output("Hello, I am module UdptlLoss");
+}
+
+void UdptlLoss::initialize()
+{
+    Output("Initializing module UdptlLoss");
+    if (!m_first)
+	return;
+    m_first = false;
+    static const unsigned int losses[] = { 10, 50, 100, 200, 0 };
+    for (const unsigned int* l = losses; *l; l++) {
+	run("none",0,0,0,*l,0);
+	run("redundancy 2",2,0,0,*l,0);
+	run("redundancy 4",4,0,0,*l,0);
+	run("fec 3x3",0,3,3,*l,0);
+	run("fec 5x3",0,5,3,*l,0);
+    }
+    // bursts of 3 packets on average, about the same overall loss
+    for (const unsigned int* l = losses; *l; l++) {
+	run("redundancy 4",4,0,0,*l / 3,667);
+	run("fec 3x3",0,3,3,*l / 3,667);
+    }
+}
+
+void UdptlLoss::run(const char* name, u_int8_t maxSec, unsigned int span, unsigned int entries,
+    unsigned int loss, unsigned int burst)
+{
+    LossSession* tx = new LossSession(maxSec);
+    LossSession* rx = new LossSession(maxSec);
+    if (!(tx->initTransport() && rx->initTransport() && tx->setFec(span,entries))) {
+	Debug(this,DebugWarn,"Could not set up the %s test",name);
+	TelEngine::destruct(tx);
+	TelEngine::destruct(rx);
+	return;
+    }
+    tx->lossTransport()->peer(rx);
+    tx->lossTransport()->setLoss(loss,burst);
+    unsigned char buf[256];
+    u_int64_t start = Time::now();
+    for (unsigned int i = 0; i < LOSS_PACKETS; i++) {
+	u_int16_t seq = i;
+	tx->udptlSend(buf,LossSession::fill(buf,seq),seq);
+    }
+    u_int64_t spent = Time::now() - start;
+    unsigned int dropped = tx->lossTransport()->dropped();
+    Output("UDPTL %-12s loss %4.1f%%%s: dropped %u, recovered %u (%.1f%%), "
+	"delivered %.2f%%, valid %u, %u ns/packet",
+	name,100.0 * dropped / LOSS_PACKETS,(burst ? " bursty" : ""),dropped,rx->recoveredIfps(),
+	(dropped ? 100.0 * rx->recoveredIfps() / dropped : 100.0),
+	100.0 * rx->received() / LOSS_PACKETS,rx->valid(),
+	(unsigned int)(spent * 1000 / LOSS_PACKETS));
+    TelEngine::destruct(tx);
+    TelEngine::destruct(rx);
+}
+
+}; // anonymous namespace
+
+/* vi: set ts=8 sw=4 sts=4 noet: */
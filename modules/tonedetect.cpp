@@ -22,6 +22,14 @@
 #include <yatephone.h>
 
 #include <math.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(NO_DATA_SIMD)
+#define TONE_X86
+#include <immintrin.h>
+#define TONE_SSE2 __attribute__((target("sse2")))
+#define TONE_AVX2 __attribute__((target("avx2")))
+#endif
 
 using namespace TelEngine;
 
@@ -47,6 +55,16 @@ namespace { // anonymous
 // minimum DTMF detect time
 #define DETECT_DTMF_MSEC 32
 
+// filters in a bank, two groups of 8 that are updated together
+#define BANK_SIZE 16
+// first 4 DTMF low group filters then 4 high group ones
+#define BANK_DTMF_L 0
+#define BANK_DTMF_H 4
+// the other group holds the fax and continuity filters, the rest are unused
+#define BANK_OTHER 8
+#define BANK_FAX 8
+#define BANK_COT 9
+
 // 2-pole filter parameters
 typedef struct
 {
@@ -55,32 +73,32 @@ typedef struct
     double y1;
 } Params2Pole;
 
-// Half 2-pole filter - the other part is common to all filters
-class Tone2PoleFilter
+// State of a bank of half 2-pole filters - the other part is common to all
+// Each coefficient is stored in its own array so filters update together
+typedef struct
+{
+    float mult[BANK_SIZE];
+    float y0[BANK_SIZE];
+    float y1[BANK_SIZE];
+    float ya[BANK_SIZE];
+    float yb[BANK_SIZE];
+    float val[BANK_SIZE];
+} FilterBank;
+
+// Bank of all the filters used by a detector, fed with the same signal
+class ToneFilterBank
 {
 public:
-    inline Tone2PoleFilter()
-	: m_mult(0.0), m_y0(0.0), m_y1(0.0)
-	{ }
-    inline Tone2PoleFilter(double gain, double y0, double y1)
-	: m_mult(1.0/gain), m_y0(y0), m_y1(y1)
-	{ init(); }
-    inline Tone2PoleFilter(const Params2Pole& params)
-	: m_mult(1.0/params.gain), m_y0(params.y0), m_y1(params.y1)
-	{ init(); }
-    inline void assign(const Params2Pole& params)
-	{ m_mult = 1.0/params.gain; m_y0 = params.y0; m_y1 = params.y1; init(); }
-    inline void init()
-	{ m_val = m_y[1] = m_y[2] = 0.0; }
-    inline double value() const
-	{ return m_val; }
-    void update(double xd);
+    ToneFilterBank();
+    void assign(unsigned int index, const Params2Pole& params);
+    void init();
+    inline void init(unsigned int index)
+	{ m_bank.val[index] = m_bank.ya[index] = m_bank.yb[index] = 0.0; }
+    inline double value(unsigned int index) const
+	{ return m_bank.val[index]; }
+    void update(const float* xd, unsigned int samples, bool dtmf, bool other);
 private:
-    double m_mult;
-    double m_y0;
-    double m_y1;
-    double m_val;
-    double m_y[3];
+    FilterBank m_bank;
 };
 
 class ToneConsumer : public DataConsumer
@@ -122,10 +140,7 @@ private:
     int m_dtmfCount;
     double m_xv[3];
     double m_pwr;
-    Tone2PoleFilter m_fax;
-    Tone2PoleFilter m_cont;
-    Tone2PoleFilter m_dtmfL[4];
-    Tone2PoleFilter m_dtmfH[4];
+    ToneFilterBank m_bank;
 };
 
 class ToneDetectorModule : public Module
@@ -215,26 +230,195 @@ static void updatePwr(double& avg, double val)
 }
 
 
-void Tone2PoleFilter::update(double xd)
+// Filter kernels run a group of 8 or all 16 filters over some samples
+// All of them compute in single precision in the same order so they give the same results
+typedef void (*BankUpdate)(FilterBank& bank, unsigned int first, unsigned int count,
+    const float* xd, unsigned int samples);
+
+static void bankUpdateGeneric(FilterBank& bank, unsigned int first, unsigned int count,
+    const float* xd, unsigned int samples)
+{
+    const float keep = MOVING_AVG_KEEP;
+    const float rate = 1 - MOVING_AVG_KEEP;
+    // work on a local copy, the samples might alias the bank
+    float mult[BANK_SIZE], y0[BANK_SIZE], y1[BANK_SIZE], ya[BANK_SIZE], yb[BANK_SIZE], val[BANK_SIZE];
+    unsigned int n = 0;
+    for (unsigned int j = first; j < first + count; j++) {
+	// unused filters have no gain, nothing to compute
+	if (bank.mult[j] == 0)
+	    continue;
+	mult[n] = bank.mult[j];
+	y0[n] = bank.y0[j];
+	y1[n] = bank.y1[j];
+	ya[n] = bank.ya[j];
+	yb[n] = bank.yb[j];
+	val[n] = bank.val[j];
+	n++;
+    }
+    for (unsigned int i = 0; i < samples; i++) {
+	float x = xd[i];
+	for (unsigned int j = 0; j < n; j++) {
+	    float y = ((x * mult[j]) + (y0[j] * ya[j])) + (y1[j] * yb[j]);
+	    ya[j] = yb[j];
+	    yb[j] = y;
+	    val[j] = (keep * val[j]) + ((rate * y) * y);
+	}
+    }
+    n = 0;
+    for (unsigned int j = first; j < first + count; j++) {
+	if (bank.mult[j] == 0)
+	    continue;
+	bank.ya[j] = ya[n];
+	bank.yb[j] = yb[n];
+	bank.val[j] = val[n];
+	n++;
+    }
+}
+
+#ifdef TONE_X86
+// Run V vectors of filters keeping their state in registers, each filter is an
+//  independent recursion so the vectors hide each other's latency
+template <unsigned int V> TONE_SSE2 static inline void bankRunSse2(FilterBank& bank,
+    unsigned int first, const float* xd, unsigned int samples)
+{
+    __m128 mult[V], y0[V], y1[V], ya[V], yb[V], val[V];
+    for (unsigned int v = 0; v < V; v++) {
+	unsigned int j = first + 4 * v;
+	mult[v] = _mm_loadu_ps(bank.mult + j);
+	y0[v] = _mm_loadu_ps(bank.y0 + j);
+	y1[v] = _mm_loadu_ps(bank.y1 + j);
+	ya[v] = _mm_loadu_ps(bank.ya + j);
+	yb[v] = _mm_loadu_ps(bank.yb + j);
+	val[v] = _mm_loadu_ps(bank.val + j);
+    }
+    const __m128 keep = _mm_set1_ps(MOVING_AVG_KEEP);
+    const __m128 rate = _mm_set1_ps(1 - MOVING_AVG_KEEP);
+    for (unsigned int i = 0; i < samples; i++) {
+	__m128 x = _mm_set1_ps(xd[i]);
+	for (unsigned int v = 0; v < V; v++) {
+	    __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x,mult[v]),_mm_mul_ps(y0[v],ya[v])),
+		_mm_mul_ps(y1[v],yb[v]));
+	    ya[v] = yb[v];
+	    yb[v] = y;
+	    val[v] = _mm_add_ps(_mm_mul_ps(keep,val[v]),_mm_mul_ps(_mm_mul_ps(rate,y),y));
+	}
+    }
+    for (unsigned int v = 0; v < V; v++) {
+	unsigned int j = first + 4 * v;
+	_mm_storeu_ps(bank.ya + j,ya[v]);
+	_mm_storeu_ps(bank.yb + j,yb[v]);
+	_mm_storeu_ps(bank.val + j,val[v]);
+    }
+}
+
+TONE_SSE2 static void bankUpdateSse2(FilterBank& bank, unsigned int first, unsigned int count,
+    const float* xd, unsigned int samples)
+{
+    if (count > 8)
+	bankRunSse2<4>(bank,first,xd,samples);
+    else
+	bankRunSse2<2>(bank,first,xd,samples);
+}
+
+template <unsigned int V> TONE_AVX2 static inline void bankRunAvx2(FilterBank& bank,
+    unsigned int first, const float* xd, unsigned int samples)
+{
+    __m256 mult[V], y0[V], y1[V], ya[V], yb[V], val[V];
+    for (unsigned int v = 0; v < V; v++) {
+	unsigned int j = first + 8 * v;
+	mult[v] = _mm256_loadu_ps(bank.mult + j);
+	y0[v] = _mm256_loadu_ps(bank.y0 + j);
+	y1[v] = _mm256_loadu_ps(bank.y1 + j);
+	ya[v] = _mm256_loadu_ps(bank.ya + j);
+	yb[v] = _mm256_loadu_ps(bank.yb + j);
+	val[v] = _mm256_loadu_ps(bank.val + j);
+    }
+    const __m256 keep = _mm256_set1_ps(MOVING_AVG_KEEP);
+    const __m256 rate = _mm256_set1_ps(1 - MOVING_AVG_KEEP);
+    for (unsigned int i = 0; i < samples; i++) {
+	__m256 x = _mm256_set1_ps(xd[i]);
+	for (unsigned int v = 0; v < V; v++) {
+	    __m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x,mult[v]),_mm256_mul_ps(y0[v],ya[v])),
+		_mm256_mul_ps(y1[v],yb[v]));
+	    ya[v] = yb[v];
+	    yb[v] = y;
+	    val[v] = _mm256_add_ps(_mm256_mul_ps(keep,val[v]),_mm256_mul_ps(_mm256_mul_ps(rate,y),y));
+	}
+    }
+    for (unsigned int v = 0; v < V; v++) {
+	unsigned int j = first + 8 * v;
+	_mm256_storeu_ps(bank.ya + j,ya[v]);
+	_mm256_storeu_ps(bank.yb + j,yb[v]);
+	_mm256_storeu_ps(bank.val + j,val[v]);
+    }
+}
+
+TONE_AVX2 static void bankUpdateAvx2(FilterBank& bank, unsigned int first, unsigned int count,
+    const float* xd, unsigned int samples)
+{
+    if (count > 8)
+	bankRunAvx2<2>(bank,first,xd,samples);
+    else
+	bankRunAvx2<1>(bank,first,xd,samples);
+}
+#endif
+
+static BankUpdate detectBankUpdate()
+{
+#ifdef TONE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+	return bankUpdateAvx2;
+    if (__builtin_cpu_supports("sse2"))
+	return bankUpdateSse2;
+#endif
+    return bankUpdateGeneric;
+}
+
+static BankUpdate s_bankUpdate = detectBankUpdate();
+
+
+ToneFilterBank::ToneFilterBank()
+{
+    // unused filters have no gain so their output stays zero
+    ::memset(&m_bank,0,sizeof(m_bank));
+}
+
+void ToneFilterBank::assign(unsigned int index, const Params2Pole& params)
+{
+    m_bank.mult[index] = 1.0/params.gain;
+    m_bank.y0[index] = params.y0;
+    m_bank.y1[index] = params.y1;
+    init(index);
+}
+
+void ToneFilterBank::init()
+{
+    for (unsigned int i = 0; i < BANK_SIZE; i++)
+	init(i);
+}
+
+// Update the DTMF and/or the other group of filters with some samples
+void ToneFilterBank::update(const float* xd, unsigned int samples, bool dtmf, bool other)
 {
-    m_y[0] = m_y[1]; m_y[1] = m_y[2];
-    m_y[2] = (xd * m_mult) +
-	(m_y0 * m_y[0]) +
-	(m_y1 * m_y[1]);
-    updatePwr(m_val,m_y[2]);
+    if (dtmf)
+	s_bankUpdate(m_bank,0,other ? BANK_SIZE : BANK_OTHER,xd,samples);
+    else if (other)
+	s_bankUpdate(m_bank,BANK_OTHER,BANK_SIZE - BANK_OTHER,xd,samples);
 }
 
 
 ToneConsumer::ToneConsumer(const String& id, const String& name)
     : m_id(id), m_name(name), m_mode(Mono),
-      m_detFax(true), m_detCont(false), m_detDtmf(true), m_detDnis(false),
-      m_fax(s_paramsCNG), m_cont(s_paramsCOTv)
+      m_detFax(true), m_detCont(false), m_detDtmf(true), m_detDnis(false)
 {
     Debug(&plugin,DebugAll,"ToneConsumer::ToneConsumer(%s,'%s') [%p]",
 	id.c_str(),name.c_str(),this);
+    m_bank.assign(BANK_FAX,s_paramsCNG);
+    m_bank.assign(BANK_COT,s_paramsCOTv);
     for (int i = 0; i < 4; i++) {
-	m_dtmfL[i].assign(s_paramsDtmfL[i]);
-	m_dtmfH[i].assign(s_paramsDtmfH[i]);
+	m_bank.assign(BANK_DTMF_L + i,s_paramsDtmfL[i]);
+	m_bank.assign(BANK_DTMF_H + i,s_paramsDtmfH[i]);
     }
     init();
     String tmp = name;
@@ -261,12 +445,12 @@ ToneConsumer::ToneConsumer(const String& id, const String& name)
 	    m_detDtmf = m_detDtmf || (*s == "dtmf");
 	    if (*s == "rfax") {
 		// detection of receiving Fax requested
-		m_fax.assign(s_paramsCED);
+		m_bank.assign(BANK_FAX,s_paramsCED);
 		m_detFax = true;
 	    }
 	    else if (*s == "cots") {
 		// detection of COT Send tone requested
-		m_cont.assign(s_paramsCOTs);
+		m_bank.assign(BANK_COT,s_paramsCOTs);
 		m_detCont = true;
 	    }
 	    else if (*s == "callsetup") {
@@ -294,12 +478,7 @@ void ToneConsumer::init()
 {
     m_xv[1] = m_xv[2] = 0.0;
     m_pwr = 0.0;
-    m_fax.init();
-    m_cont.init();
-    for (int i = 0; i < 4; i++) {
-	m_dtmfL[i].init();
-	m_dtmfH[i].init();
-    }
+    m_bank.init();
     m_dtmfTone = '\0';
     m_dtmfCount = 0;
 }
@@ -311,18 +490,18 @@ void ToneConsumer::checkDtmf()
     char c = m_dtmfTone;
     m_dtmfTone = '\0';
     int l = 0;
-    double maxL = m_dtmfL[0].value();
+    double maxL = m_bank.value(BANK_DTMF_L);
     for (i = 1; i < 4; i++) {
-	if (maxL < m_dtmfL[i].value()) {
-	    maxL = m_dtmfL[i].value();
+	if (maxL < m_bank.value(BANK_DTMF_L + i)) {
+	    maxL = m_bank.value(BANK_DTMF_L + i);
 	    l = i;
 	}
     }
     int h = 0;
-    double maxH = m_dtmfH[0].value();
+    double maxH = m_bank.value(BANK_DTMF_H);
     for (i = 1; i < 4; i++) {
-	if (maxH < m_dtmfH[i].value()) {
-	    maxH = m_dtmfH[i].value();
+	if (maxH < m_bank.value(BANK_DTMF_H + i)) {
+	    maxH = m_bank.value(BANK_DTMF_H + i);
 	    h = i;
 	}
     }
@@ -387,16 +566,17 @@ void ToneConsumer::checkDtmf()
 // Check if we detected a Fax CNG or CED tone
 void ToneConsumer::checkFax()
 {
-    if (m_fax.value() < m_pwr*THRESHOLD2_REL_FAX)
+    double val = m_bank.value(BANK_FAX);
+    if (val < m_pwr*THRESHOLD2_REL_FAX)
 	return;
-    if (m_fax.value() > m_pwr) {
+    if (val > m_pwr) {
 	DDebug(&plugin,DebugNote,"Overshoot on %s, signal=%0.2f, total=%0.2f",
-	    m_id.c_str(),m_fax.value(),m_pwr);
+	    m_id.c_str(),val,m_pwr);
 	init();
 	return;
     }
     DDebug(&plugin,DebugInfo,"Fax detected on %s, signal=%0.1f, total=%0.1f",
-	m_id.c_str(),m_fax.value(),m_pwr);
+	m_id.c_str(),val,m_pwr);
     // prepare for new detection
     init();
     m_detFax = false;
@@ -421,16 +601,17 @@ void ToneConsumer::checkFax()
 // Check if we detected a Continuity Test tone
 void ToneConsumer::checkCont()
 {
-    if (m_cont.value() < m_pwr*THRESHOLD2_REL_COT)
+    double val = m_bank.value(BANK_COT);
+    if (val < m_pwr*THRESHOLD2_REL_COT)
 	return;
-    if (m_cont.value() > m_pwr) {
+    if (val > m_pwr) {
 	DDebug(&plugin,DebugNote,"Overshoot on %s, signal=%0.2f, total=%0.2f",
-	    m_id.c_str(),m_cont.value(),m_pwr);
+	    m_id.c_str(),val,m_pwr);
 	init();
 	return;
     }
     DDebug(&plugin,DebugInfo,"Continuity detected on %s, signal=%0.1f, total=%0.1f",
-	m_id.c_str(),m_cont.value(),m_pwr);
+	m_id.c_str(),val,m_pwr);
     // prepare for new detection
     init();
     m_detCont = false;
@@ -453,44 +634,38 @@ unsigned long ToneConsumer::Consume(const DataBlock& data, unsigned long tStamp,
     const int16_t* s = (const int16_t*)data.data();
     if (!s)
 	return 0;
-    while (samp--) {
-	m_xv[0] = m_xv[1]; m_xv[1] = m_xv[2];
-	switch (m_mode) {
-	    case Left:
-		// use 1st sample, skip 2nd
-		m_xv[2] = *s++;
-		s++;
-		break;
-	    case Right:
-		// skip 1st sample, use 2nd
-		s++;
-		m_xv[2] = *s++;
-		break;
-	    case Mixed:
-		// add together samples
-		m_xv[2] = s[0]+(int)s[1];
-		s+=2;
-		break;
-	    default:
-		m_xv[2] = *s++;
-	}
-	double dx = m_xv[2] - m_xv[0];
-	updatePwr(m_pwr,m_xv[2]);
-
-	// update all active detectors
-	if (m_detFax)
-	    m_fax.update(dx);
-	if (m_detCont)
-	    m_cont.update(dx);
-	if (m_detDtmf || m_detDnis) {
-	    for (int j = 0; j < 4; j++) {
-		m_dtmfL[j].update(dx);
-		m_dtmfH[j].update(dx);
+    // filter input of the samples up to the next check
+    float xd[8];
+    while (samp) {
+	// only do checks every millisecond
+	unsigned int n = (samp - 1) % 8 + 1;
+	samp -= n;
+	for (unsigned int i = 0; i < n; i++) {
+	    m_xv[0] = m_xv[1]; m_xv[1] = m_xv[2];
+	    switch (m_mode) {
+		case Left:
+		    // use 1st sample, skip 2nd
+		    m_xv[2] = *s++;
+		    s++;
+		    break;
+		case Right:
+		    // skip 1st sample, use 2nd
+		    s++;
+		    m_xv[2] = *s++;
+		    break;
+		case Mixed:
+		    // add together samples
+		    m_xv[2] = s[0]+(int)s[1];
+		    s+=2;
+		    break;
+		default:
+		    m_xv[2] = *s++;
 	    }
+	    xd[i] = m_xv[2] - m_xv[0];
+	    updatePwr(m_pwr,m_xv[2]);
 	}
-	// only do checks every millisecond
-	if (samp % 8)
-	    continue;
+	// update all active detectors
+	m_bank.update(xd,n,m_detDtmf || m_detDnis,m_detFax || m_detCont);
 	// is it enough total power to accept a signal?
 	if (m_pwr >= THRESHOLD2_ABS) {
 	    if (m_detDtmf || m_detDnis)
@@ -506,7 +681,7 @@ unsigned long ToneConsumer::Consume(const DataBlock& data, unsigned long tStamp,
 	}
     }
     XDebug(&plugin,DebugAll,"Fax detector on %s: signal=%0.1f, total=%0.1f",
-	m_id.c_str(),m_fax.value(),m_pwr);
+	m_id.c_str(),m_bank.value(BANK_FAX),m_pwr);
     return invalidStamp();
 }
 
@@ -519,6 +694,9 @@ void ToneConsumer::setFaxDivert(const Message& msg)
     NamedString* divert = msg.getParam("fax_divert");
     if (!divert)
 	return;
+    // the fax filter may have been updated while the continuity one was in use
+    if (!m_detFax)
+	m_bank.init(BANK_FAX);
     m_detFax = true;
     // if divert is empty or false disable diverting
     if (divert->null() || !divert->toBoolean(true))
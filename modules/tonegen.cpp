@@ -122,7 +122,6 @@ class ToneSource : public ThreadedSource
 {
 public:
     virtual void destroyed();
-    virtual void run();
     inline const String& name()
 	{ return m_name; }
     bool startup();
@@ -135,6 +134,7 @@ protected:
     virtual bool noChan() const
 	{ return false; }
     virtual void cleanup();
+    virtual unsigned int tick(u_int64_t when);
     void advanceTone(const Tone*& tone);
     static const ToneDesc* getBlock(String& tone, const ToneDesc* table);
     static const ToneDesc* findToneDesc(String& tone, const String& prefix);
@@ -147,6 +147,11 @@ private:
     unsigned m_brate;
     unsigned m_total;
     u_int64_t m_time;
+    // playback position: current tone, its length, sample number and position in data
+    const Tone* m_play;
+    int m_nsam;
+    int m_samp;
+    int m_dpos;
 };
 
 class TempSource : public ToneSource
@@ -657,7 +662,8 @@ bool ToneData::decode(const String& desc, int& samples, const short*& data, bool
 
 ToneSource::ToneSource(const ToneDesc* tone)
     : m_tone(0), m_repeat(tone == 0), m_firstPass(true),
-      m_data(0,320), m_brate(16000), m_total(0), m_time(0)
+      m_data(0,320), m_brate(16000), m_total(0), m_time(0),
+      m_play(0), m_nsam(0), m_samp(0), m_dpos(1)
 {
     if (tone) {
 	m_tone = tone->tones();
@@ -679,7 +685,13 @@ void ToneSource::destroyed()
 bool ToneSource::startup()
 {
     DDebug(&__plugin,DebugAll,"ToneSource::startup(\"%s\") tone=%p",m_name.c_str(),m_tone);
-    return m_tone && start("Tone Source");
+    if (!m_tone)
+	return false;
+    m_play = m_tone;
+    m_nsam = m_play->nsamples;
+    if (m_nsam < 0)
+	m_nsam = -m_nsam;
+    return start("Tone Source",Thread::Normal,true);
 }
 
 void ToneSource::cleanup()
@@ -846,57 +858,45 @@ ToneSource* ToneSource::getTone(String& tone, const String& prefix)
     return t;
 }
 
-void ToneSource::run()
+unsigned int ToneSource::tick(u_int64_t when)
 {
-    Debug(&__plugin,DebugAll,"ToneSource::run() [%p]",this);
-    u_int64_t tpos = Time::now();
-    m_time = tpos;
-    int samp = 0; // sample number
-    int dpos = 1; // position in data
-    const Tone* tone = m_tone;
-    int nsam = tone->nsamples;
-    if (nsam < 0)
-	nsam = -nsam;
-    while (m_tone && looping(noChan())) {
-	Thread::check();
-	short *d = (short *) m_data.data();
-	for (unsigned int i = m_data.length()/2; i--; samp++,dpos++) {
-	    if (samp >= nsam) {
-		// go to the start of the next tone
-		samp = 0;
-		const Tone *otone = tone;
-		advanceTone(tone);
-		nsam = tone ? tone->nsamples : 32000;
-		if (nsam < 0) {
-		    nsam = -nsam;
-		    // reset repeat point here
-		    m_tone = tone;
-		}
-		if (tone != otone)
-		    dpos = 1;
-	    }
-	    if (tone && tone->data) {
-		if (dpos > tone->data[0])
-		    dpos = 1;
-		*d++ = tone->data[dpos];
+    if (!m_time) {
+	Debug(&__plugin,DebugAll,"ToneSource::tick() starting [%p]",this);
+	m_time = Time::now();
+    }
+    if (!(m_tone && looping(noChan()))) {
+	Debug(&__plugin,DebugAll,"ToneSource [%p] end, total=%u (%u b/s)",
+	    this,m_total,byteRate(m_time,m_total));
+	m_time = 0;
+	return 0;
+    }
+    short *d = (short *) m_data.data();
+    for (unsigned int i = m_data.length()/2; i--; m_samp++,m_dpos++) {
+	if (m_samp >= m_nsam) {
+	    // go to the start of the next tone
+	    m_samp = 0;
+	    const Tone *otone = m_play;
+	    advanceTone(m_play);
+	    m_nsam = m_play ? m_play->nsamples : 32000;
+	    if (m_nsam < 0) {
+		m_nsam = -m_nsam;
+		// reset repeat point here
+		m_tone = m_play;
 	    }
-	    else
-		*d++ = 0;
+	    if (m_play != otone)
+		m_dpos = 1;
 	}
-	int64_t dly = tpos - Time::now();
-	if (dly > 0) {
-	    XDebug(&__plugin,DebugAll,"ToneSource sleeping for " FMT64 " usec",dly);
-	    Thread::usleep((unsigned long)dly);
+	if (m_play && m_play->data) {
+	    if (m_dpos > m_play->data[0])
+		m_dpos = 1;
+	    *d++ = m_play->data[m_dpos];
 	}
-	if (!looping(noChan()))
-	    break;
-	Forward(m_data,m_total/2);
-	m_total += m_data.length();
-	tpos += (m_data.length()*(u_int64_t)1000000/m_brate);
+	else
+	    *d++ = 0;
     }
-    Debug(&__plugin,DebugAll,"ToneSource [%p] end, total=%u (%u b/s)",
-	this,m_total,byteRate(m_time,m_total));
-    m_time = 0;
+    Forward(m_data,m_total/2);
+    m_total += m_data.length();
+    return m_data.length()*(u_int64_t)1000000/m_brate;
 }
 
 
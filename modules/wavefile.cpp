@@ -26,16 +26,74 @@
 using namespace TelEngine;
 namespace { // anonymous
 
+// Payload of a prompt file shared by all the sources playing it
+class CachedPrompt : public RefObject
+{
+public:
+    inline CachedPrompt(const String& file, unsigned int mtime, const String& format,
+	unsigned rate, unsigned brate, const DataBlock& data)
+	: m_file(file), m_mtime(mtime), m_format(format),
+	  m_rate(rate), m_brate(brate), m_data(data)
+	{ }
+    virtual const String& toString() const
+	{ return m_file; }
+    inline unsigned int mtime() const
+	{ return m_mtime; }
+    inline const String& format() const
+	{ return m_format; }
+    inline unsigned rate() const
+	{ return m_rate; }
+    inline unsigned brate() const
+	{ return m_brate; }
+    inline const DataBlock& data() const
+	{ return m_data; }
+private:
+    String m_file;
+    unsigned int m_mtime;
+    String m_format;
+    unsigned m_rate;
+    unsigned m_brate;
+    DataBlock m_data;
+};
+
+// Memory bounded LRU cache of prompt files keyed by path and modification time
+class PromptCache : public Mutex
+{
+public:
+    PromptCache();
+    bool get(RefPointer<CachedPrompt>& prompt, const String& file, unsigned int mtime);
+    void add(RefPointer<CachedPrompt>& prompt);
+    void uncached();
+    void setLimits(unsigned int maxMemory, unsigned int maxFile);
+    void statusParams(String& str);
+    inline bool enabled() const
+	{ return 0 != m_maxMemory; }
+    inline unsigned int maxFile() const
+	{ return m_maxFile; }
+private:
+    void trim();
+    ObjList m_prompts;
+    unsigned int m_maxMemory;
+    unsigned int m_maxFile;
+    unsigned int m_memory;
+    unsigned int m_count;
+    unsigned int m_hits;
+    unsigned int m_misses;
+    unsigned int m_uncached;
+    unsigned int m_stale;
+};
+
 class WaveSource : public ThreadedSource
 {
 public:
     static WaveSource* create(const String& file, CallEndpoint* chan,
 	bool autoclose, bool autorepeat, const NamedString* param);
     ~WaveSource();
-    virtual void run();
     virtual void cleanup();
     virtual void attached(bool added);
     void setNotify(const String& id);
+protected:
+    virtual unsigned int tick(u_int64_t when);
 private:
     WaveSource(const char* file, CallEndpoint* chan, bool autoclose);
     void init(const String& file, bool autorepeat);
@@ -43,9 +101,13 @@ private:
     void detectWavFormat();
     void detectIlbcFormat();
     bool computeDataRate();
+    bool usePrompt(const String& file, unsigned int mtime, bool autorepeat);
+    bool loadPrompt(const String& file, unsigned int mtime);
     void notify(WaveSource* source, const char* reason = 0);
     CallEndpoint* m_chan;
     Stream* m_stream;
+    RefPointer<CachedPrompt> m_prompt;
+    unsigned int m_offset;
     DataBlock m_data;
     bool m_swap;
     unsigned m_rate;
@@ -53,6 +115,7 @@ private:
     int64_t m_repeatPos;
     unsigned m_total;
     u_int64_t m_time;
+    unsigned long m_ts;
     String m_id;
     bool m_autoclose;
     bool m_nodata;
@@ -136,6 +199,7 @@ int s_reading = 0;
 int s_writing = 0;
 bool s_dataPadding = true;
 bool s_pubReadable = false;
+PromptCache s_prompts;
 
 INIT_PLUGIN(WaveFileDriver);
 
@@ -186,6 +250,104 @@ static const char* ilbcFormat(Stream& stream)
 }
 
 
+PromptCache::PromptCache()
+    : Mutex(false,"WaveFile::prompts"),
+      m_maxMemory(0), m_maxFile(0), m_memory(0), m_count(0),
+      m_hits(0), m_misses(0), m_uncached(0), m_stale(0)
+{
+}
+
+// Find a cached prompt, drop it if the file was changed or removed (zero mtime)
+// Misses are counted when the prompt is loaded and added
+bool PromptCache::get(RefPointer<CachedPrompt>& prompt, const String& file, unsigned int mtime)
+{
+    Lock mylock(this);
+    CachedPrompt* p = static_cast<CachedPrompt*>(m_prompts[file]);
+    if (!p)
+	return false;
+    m_prompts.remove(p,false);
+    if (p->mtime() != mtime) {
+	DDebug(&__plugin,DebugInfo,"Dropping %s prompt '%s' from cache",
+	    (mtime ? "changed" : "missing"),file.c_str());
+	m_memory -= p->data().length();
+	m_count--;
+	m_stale++;
+	TelEngine::destruct(p);
+	return false;
+    }
+    // most recently used prompts are kept at the head of the list
+    m_prompts.insert(p);
+    m_hits++;
+    prompt = p;
+    return true;
+}
+
+// Insert a new prompt, replace it with the cached one if another source loaded it first
+void PromptCache::add(RefPointer<CachedPrompt>& prompt)
+{
+    if (!prompt)
+	return;
+    Lock mylock(this);
+    m_misses++;
+    CachedPrompt* p = static_cast<CachedPrompt*>(m_prompts[prompt->toString()]);
+    if (p) {
+	if (p->mtime() == prompt->mtime()) {
+	    prompt = p;
+	    return;
+	}
+	m_prompts.remove(p,false);
+	m_memory -= p->data().length();
+	m_count--;
+	m_stale++;
+	TelEngine::destruct(p);
+    }
+    if (!prompt->ref())
+	return;
+    m_prompts.insert(prompt);
+    m_memory += prompt->data().length();
+    m_count++;
+    trim();
+}
+
+// Count a playback of a file that could not be cached
+void PromptCache::uncached()
+{
+    Lock mylock(this);
+    m_uncached++;
+}
+
+void PromptCache::setLimits(unsigned int maxMemory, unsigned int maxFile)
+{
+    Lock mylock(this);
+    m_maxMemory = maxMemory;
+    m_maxFile = (maxFile < maxMemory) ? maxFile : maxMemory;
+    trim();
+}
+
+void PromptCache::statusParams(String& str)
+{
+    Lock mylock(this);
+    str << ",prompts=" << m_count << ",promptkb=" << ((m_memory + 1023) / 1024);
+    str << ",hits=" << m_hits << ",misses=" << m_misses << ",uncached=" << m_uncached;
+    str << ",stale=" << m_stale;
+}
+
+// Evict least recently used prompts until memory fits, call with lock held
+void PromptCache::trim()
+{
+    while (m_memory > m_maxMemory) {
+	ObjList* l = m_prompts.last();
+	CachedPrompt* p = l ? static_cast<CachedPrompt*>(l->get()) : 0;
+	if (!p)
+	    break;
+	DDebug(&__plugin,DebugAll,"Evicting prompt '%s' from cache",p->toString().c_str());
+	m_memory -= p->data().length();
+	m_count--;
+	m_prompts.remove(p);
+    }
+}
+
+
 WaveSource* WaveSource::create(const String& file, CallEndpoint* chan, bool autoclose, bool autorepeat, const NamedString* param)
 {
     WaveSource* tmp = new WaveSource(file,chan,autoclose);
@@ -212,6 +374,7 @@ WaveSource* WaveSource::create(const String& file, CallEndpoint* chan, bool auto
 
 void WaveSource::init(const String& file, bool autorepeat)
 {
+    unsigned int mtime = 0;
     if (!m_stream) {
 	if (file == "-") {
 	    m_nodata = true;
@@ -220,6 +383,13 @@ void WaveSource::init(const String& file, bool autorepeat)
 	    start("Wave Source");
 	    return;
 	}
+	if (s_prompts.enabled()) {
+	    // a file that can't be found must not stay in the cache either
+	    if (!File::getFileTime(file,mtime))
+		mtime = 0;
+	    if (usePrompt(file,mtime,autorepeat))
+		return;
+	}
 	m_stream = new File;
 	if (!static_cast<File*>(m_stream)->openPath(file,false,true,false,false,true)) {
 	    Debug(DebugWarn,"Opening '%s': error %d: %s",
@@ -263,9 +433,18 @@ void WaveSource::init(const String& file, bool autorepeat)
     else if (!file.endsWith(".slin"))
 	Debug(DebugMild,"Unknown format for playback file '%s', assuming signed linear",file.c_str());
     if (computeDataRate()) {
-	if (autorepeat)
-	    m_repeatPos = m_stream->seek(Stream::SeekCurrent);
-	start("Wave Source");
+	// files changed in the last seconds may still be written to, don't cache them
+	if (mtime && (mtime + 2 < Time::secNow()) && loadPrompt(file,mtime)) {
+	    if (autorepeat)
+		m_repeatPos = 0;
+	}
+	else {
+	    if (s_prompts.enabled())
+		s_prompts.uncached();
+	    if (autorepeat)
+		m_repeatPos = m_stream->seek(Stream::SeekCurrent);
+	}
+	start("Wave Source",Thread::Normal,true);
     }
     else {
 	Debug(DebugWarn,"Unable to compute data rate for file '%s'",file.c_str());
@@ -274,8 +453,8 @@ void WaveSource::init(const String& file, bool autorepeat)
 }
 
 WaveSource::WaveSource(const char* file, CallEndpoint* chan, bool autoclose)
-    : m_chan(chan), m_stream(0), m_swap(false), m_rate(8000), m_brate(0), m_repeatPos(-1),
-      m_total(0), m_time(0), m_autoclose(autoclose),
+    : m_chan(chan), m_stream(0), m_offset(0), m_swap(false), m_rate(8000), m_brate(0), m_repeatPos(-1),
+      m_total(0), m_time(0), m_ts(0), m_autoclose(autoclose),
       m_nodata(false)
 {
     Debug(&__plugin,DebugAll,"WaveSource::WaveSource(\"%s\",%p) [%p]",file,chan,this);
@@ -358,6 +537,70 @@ void WaveSource::detectIlbcFormat()
     m_stream->seek(0);
 }
 
+// Start playing a prompt already held in the cache
+bool WaveSource::usePrompt(const String& file, unsigned int mtime, bool autorepeat)
+{
+    if (!s_prompts.get(m_prompt,file,mtime))
+	return false;
+    DDebug(&__plugin,DebugAll,"WaveSource playing cached prompt '%s' [%p]",file.c_str(),this);
+    m_format = m_prompt->format();
+    m_rate = m_prompt->rate();
+    m_brate = m_prompt->brate();
+    if (autorepeat)
+	m_repeatPos = 0;
+    start("Wave Source",Thread::Normal,true);
+    return true;
+}
+
+// Read the file payload in a shared buffer, add it to the cache and close the file
+bool WaveSource::loadPrompt(const String& file, unsigned int mtime)
+{
+    int64_t pos = m_stream->seek(Stream::SeekCurrent);
+    int64_t len = m_stream->length() - pos;
+    if (pos < 0 || len <= 0 || len > (int64_t)s_prompts.maxFile())
+	return false;
+    unsigned int size = (unsigned int)len;
+    // extend the last byte to fill the last block as it would be done when reading
+    unsigned int blen = (m_brate*20)/1000;
+    if (blen && (size % blen) && s_dataPadding && ((m_format == "mulaw") || (m_format == "alaw")))
+	size += blen - (size % blen);
+    DataBuffer* buf = new DataBuffer(size);
+    DataBlock data(buf,0,size);
+    TelEngine::destruct(buf);
+    if (data.length() != size)
+	return false;
+    unsigned char* d = (unsigned char*)data.data();
+    unsigned int got = 0;
+    while (got < (unsigned int)len) {
+	int r = m_stream->readData(d + got,(unsigned int)len - got);
+	if (r <= 0)
+	    break;
+	got += r;
+    }
+    if (got != (unsigned int)len) {
+	m_stream->seek(pos);
+	return false;
+    }
+    while (got < size) {
+	d[got] = d[got - 1];
+	got++;
+    }
+    if (m_swap) {
+	uint16_t* p = (uint16_t*)d;
+	for (unsigned int i = 0; i < size / 2; i++, p++)
+	    *p = ntohs(*p);
+	m_swap = false;
+    }
+    m_prompt = new CachedPrompt(file,mtime,m_format,m_rate,m_brate,data);
+    m_prompt->deref();
+    s_prompts.add(m_prompt);
+    DDebug(&__plugin,DebugInfo,"WaveSource loaded prompt '%s' len=%u [%p]",
+	file.c_str(),size,this);
+    delete m_stream;
+    m_stream = 0;
+    return true;
+}
+
 bool WaveSource::computeDataRate()
 {
     if (m_brate)
@@ -370,61 +613,63 @@ bool WaveSource::computeDataRate()
     return (m_brate != 0);
 }
 
-void WaveSource::run()
+unsigned int WaveSource::tick(u_int64_t when)
 {
-    unsigned long ts = 0;
-    int r = 0;
     // internally reference if used for override or replace purpose
     bool noChan = (0 == m_chan);
-    // wait until at least one consumer is attached
-    unsigned int fast = 4;
-    while (!r) {
+    if (!m_data.length()) {
+	// wait until at least one consumer is attached
 	lock();
-	r = m_consumers.count();
+	bool found = (0 != m_consumers.count());
 	unlock();
-	if (r)
-	    ;
-	else if (fast) {
-	    --fast;
-	    Thread::yield();
-	}
-	else
-	    Thread::idle();
 	if (!looping(noChan)) {
 	    notify(0,"replaced");
-	    return;
+	    return 0;
 	}
+	if (!found)
+	    return Thread::idleUsec();
+	DDebug(&__plugin,DebugAll,"Consumer found, starting to play data with rate %d [%p]",m_brate,this);
+	m_data.assign(0,(m_brate*20)/1000);
     }
     unsigned int blen = (m_brate*20)/1000;
-    DDebug(&__plugin,DebugAll,"Consumer found, starting to play data with rate %d [%p]",m_brate,this);
-    m_data.assign(0,blen);
-    u_int64_t tpos = 0;
-    m_time = tpos;
-    while ((r > 0) && looping(noChan)) {
-	r = m_stream ? m_stream->readData(m_data.data(),m_data.length()) : m_data.length();
+    int r = 0;
+    while (looping(noChan)) {
+	if (m_prompt) {
+	    // play a slice of the shared payload, no data is copied
+	    r = m_prompt->data().length() - m_offset;
+	    if (r > (int)blen)
+		r = blen;
+	    if (r)
+		m_data.slice(m_prompt->data(),m_offset,r);
+	    m_offset += r;
+	}
+	else
+	    r = m_stream ? m_stream->readData(m_data.data(),m_data.length()) : m_data.length();
 	if (r < 0) {
-	    if (m_stream->canRetry()) {
-		if (looping(noChan)) {
-		    r = 1;
-		    continue;
-		}
-		r = 0;
-	    }
+	    // try again on next tick if possible
+	    if (m_stream->canRetry())
+		return Thread::idleUsec();
 	    break;
 	}
 	// start counting time after the first successful read
-	if (!tpos)
-	    m_time = tpos = Time::now();
+	if (!m_time)
+	    m_time = Time::now();
 	if (!r) {
 	    if (m_repeatPos >= 0) {
 		DDebug(&__plugin,DebugAll,"Autorepeating from offset " FMT64 " [%p]",
 		    m_repeatPos,this);
-		m_stream->seek(m_repeatPos);
-		m_data.assign(0,blen);
-		r = 1;
+		if (m_prompt)
+		    m_offset = 0;
+		else {
+		    m_stream->seek(m_repeatPos);
+		    m_data.assign(0,blen);
+		}
 		continue;
 	    }
-	    break;
+	    Debug(&__plugin,DebugAll,"WaveSource '%s' end of data (%u played) chan=%p [%p]",
+		m_id.c_str(),m_total,m_chan,this);
+	    notify(this,"eof");
+	    return 0;
 	}
 	if (r < (int)m_data.length()) {
 	    // if desired and possible extend last byte to fill buffer
@@ -444,25 +689,13 @@ void WaveSource::run()
 		++p;
 	    }
 	}
-	int64_t dly = tpos - Time::now();
-	if (dly > 0) {
-	    XDebug(&__plugin,DebugAll,"WaveSource sleeping for " FMT64 " usec",dly);
-	    Thread::usleep((unsigned long)dly);
-	}
-	if (!looping(noChan))
-	    break;
-	Forward(m_data,ts);
-	ts += m_data.length()*m_rate/m_brate;
+	Forward(m_data,m_ts);
+	m_ts += m_data.length()*m_rate/m_brate;
 	m_total += r;
-	tpos += (r*(u_int64_t)1000000/m_brate);
-    }
-    if (r)
-	notify(0,"replaced");
-    else {
-	Debug(&__plugin,DebugAll,"WaveSource '%s' end of data (%u played) chan=%p [%p]",
-	    m_id.c_str(),m_total,m_chan,this);
-	notify(this,"eof");
+	return r*(u_int64_t)1000000/m_brate;
     }
+    notify(0,"replaced");
+    return 0;
 }
 
 void WaveSource::cleanup()
@@ -1233,6 +1466,7 @@ void WaveFileDriver::statusParams(String& str)
 {
     str.append("play=",",") << s_reading;
     str << ",record=" << s_writing;
+    s_prompts.statusParams(str);
     Driver::statusParams(str);
 }
 
@@ -1248,6 +1482,9 @@ void WaveFileDriver::initialize()
     setup();
     s_dataPadding = Engine::config().getBoolValue("hacks","datapadding",true);
     s_pubReadable = Engine::config().getBoolValue("hacks","wavepubread",false);
+    Configuration cfg(Engine::configFile("wavefile"),false);
+    s_prompts.setLimits(1024 * cfg.getIntValue("general","promptcache",8192,0,1048576),
+	1024 * cfg.getIntValue("general","promptmaxfile",512,1,65536));
     if (!m_handler) {
 	m_handler = new AttachHandler;
 	Engine::install(m_handler);
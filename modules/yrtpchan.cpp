@@ -97,7 +97,9 @@ static bool s_warnFirst = false;
 static bool s_warnLater = false;
 static bool s_monitor   = false;
 static bool s_rtcp  = true;
+static bool s_rtcpXR = false;
 static bool s_drill = false;
+static bool s_reflectRewrite = false;
 
 static Thread::Priority s_priority = Thread::Normal;
 static String s_affinity;
@@ -175,11 +177,13 @@ public:
 			const String& traceId = String::empty());
 private:
     void setupRTP(const char* localip, bool rtcp, bool warnSeq);
-    void setupUDPTL(const char* localip, u_int16_t maxLen = 250, u_int8_t maxSec = 2);
+    void setupUDPTL(const char* localip, u_int16_t maxLen = 250, u_int8_t maxSec = 2,
+	unsigned int fecSpan = 0, unsigned int fecEntries = 1);
     bool bindLocal(const char* localip, bool rtcp);
     bool startRTP(const char* raddr, unsigned int rport, Message& msg);
     bool startUDPTL(const char* raddr, unsigned int rport, Message& msg);
     bool setupSRTP(Message& msg, bool buildMaster);
+    bool setupDTLS(Message& msg, bool start);
     bool startSRTP(const String& suite, const String& keyParams, const ObjList* paramList);
     bool setupUDPTL(Message& msg);
     void setTimeout(const Message& msg, int timeOut);
@@ -222,6 +226,7 @@ public:
     virtual void rtpNewSSRC(u_int32_t newSsrc, bool marker);
     virtual Cipher* createCipher(const String& name, Cipher::Direction dir);
     virtual bool checkCipher(const String& name);
+    virtual RTPDtls* createDtls();
     inline void resync()
 	{ m_resync = true; }
     inline void anySSRC(bool acceptAny = true)
@@ -285,32 +290,7 @@ private:
     bool m_splitable;
 };
 
-class YRTPMonitor : public RTPProcessor
-{
-public:
-    inline YRTPMonitor(const String* id = 0)
-	: m_id(id),
-	  m_rtpPackets(0), m_rtcpPackets(0), m_rtpBytes(0),
-	  m_payload(-1), m_start(0), m_last(0)
-	{ }
-    virtual void rtpData(const void* data, int len);
-    virtual void rtcpData(const void* data, int len);
-    void startup();
-    void saveStats(Message& msg) const;
-protected:
-    void updateTimes(u_int64_t when);
-    void timerTick(const Time& when);
-    void timeout(bool initial);
-    const String* m_id;
-    unsigned int m_rtpPackets;
-    unsigned int m_rtcpPackets;
-    unsigned int m_rtpBytes;
-    int m_payload;
-    u_int64_t m_start;
-    u_int64_t m_last;
-};
-
-class YRTPReflector : public GenObject
+class YRTPReflector : public RTPRelay
 {
 public:
     YRTPReflector(const String& id, bool passiveA, bool passiveB);
@@ -320,23 +300,21 @@ public:
     inline const String& idB() const
 	{ return m_idB; }
     inline RTPTransport& rtpA() const
-	{ return *m_rtpA; }
+	{ return legA(); }
     inline RTPTransport& rtpB() const
-	{ return *m_rtpB; }
-    inline YRTPMonitor& monA() const
-	{ return *m_monA; }
-    inline YRTPMonitor& monB() const
-	{ return *m_monB; }
+	{ return legB(); }
     inline void setA(const String& id)
 	{ m_idA = id; }
     inline void setB(const String& id)
 	{ m_idB = id; }
+    inline void startup()
+	{ RTPRelay::startup(!m_passiveA,!m_passiveB); }
+    void saveStats(Message& msg, bool legA) const;
+protected:
+    virtual void timeout(bool legA, bool initial);
 private:
-    RTPGroup* m_group;
-    RTPTransport* m_rtpA;
-    RTPTransport* m_rtpB;
-    YRTPMonitor* m_monA;
-    YRTPMonitor* m_monB;
+    bool m_passiveA;
+    bool m_passiveB;
     String m_idA;
     String m_idB;
 };
@@ -357,6 +335,22 @@ private:
     Cipher* m_cipher;
 };
 
+class DtlsHolder : public RefObject
+{
+public:
+    inline DtlsHolder()
+	: m_dtls(0)
+	{ }
+    virtual ~DtlsHolder()
+	{ TelEngine::destruct(m_dtls); }
+    virtual void* getObject(const String& name) const
+	{ return (name == YATOM("RTPDtls*")) ? (void*)&m_dtls : RefObject::getObject(name); }
+    inline RTPDtls* dtls()
+	{ RTPDtls* tmp = m_dtls; m_dtls = 0; return tmp; }
+private:
+    RTPDtls* m_dtls;
+};
+
 class YRTPPlugin : public Module
 {
 public:
@@ -367,6 +361,7 @@ public:
     virtual void statusParams(String& str);
     virtual void statusDetail(String& str);
     virtual void genUpdate(Message& msg);
+    virtual void msgTimer(Message& msg);
 
 private:
     bool reflectSetup(Message& msg, const char* id, RTPTransport& rtp, const char* rHost, const char* leg);
@@ -406,8 +401,17 @@ static ObjList s_mirrors;
 static Mutex s_mutex(false,"YRTPChan");
 static Mutex s_refMutex(false,"YRTPChan::reflect");
 static Mutex s_srcMutex(false,"YRTPChan::source");
+static Mutex s_portMutex(false,"YRTPChan::ports");
+static RTPPortAllocator* s_ports = 0;    // Allocator of ports in minport-maxport range
 static bool s_rtpWarnSeq = true;         // Warn on invalid rtp sequence number
 
+// Retrieve a reference to the current port allocator
+static RTPPortAllocator* portAllocator()
+{
+    Lock lck(s_portMutex);
+    return (s_ports && s_ports->ref()) ? s_ports : 0;
+}
+
 
 YRTPWrapper::YRTPWrapper(const char* localip, CallEndpoint* conn, const char* media,
     RTPSession::Direction direction, Message& msg, bool udptl, bool ipv6)
@@ -438,8 +442,12 @@ YRTPWrapper::YRTPWrapper(const char* localip, CallEndpoint* conn, const char* me
 	    ms = 0;
 	else if (ms > 16)
 	    ms = 16;
+	// parity FEC replaces the secondary IFPs if a span is set
+	int fs = (ec && (*ec == YSTRING("t38UDPFEC"))) ? 3 : 0;
+	fs = msg.getIntValue(YSTRING("t38fec"),fs,0,15);
+	int fe = msg.getIntValue(YSTRING("t38fec_entries"),3,1,15);
 	m_format = "t38";
-	setupUDPTL(localip,md,ms);
+	setupUDPTL(localip,md,ms,fs,fe);
     }
     else
 	setupRTP(localip,msg.getBoolValue(YSTRING("rtcp"),s_rtcp),
@@ -533,11 +541,15 @@ void YRTPWrapper::setupRTP(const char* localip, bool rtcp, bool warnSeq)
     bindLocal(localip,rtcp);
 }
 
-void YRTPWrapper::setupUDPTL(const char* localip, u_int16_t maxLen, u_int8_t maxSec)
+void YRTPWrapper::setupUDPTL(const char* localip, u_int16_t maxLen, u_int8_t maxSec,
+    unsigned int fecSpan, unsigned int fecEntries)
 {
-    TraceDebug(m_traceId,&splugin,DebugAll,"YRTPWrapper::setupUDPTL(\"%s\",%u,%u) [%p]",
-	localip,maxLen,maxSec,this);
+    TraceDebug(m_traceId,&splugin,DebugAll,"YRTPWrapper::setupUDPTL(\"%s\",%u,%u,%u,%u) [%p]",
+	localip,maxLen,maxSec,fecSpan,fecEntries,this);
     m_udptl = new YUDPTLSession(this,maxLen,maxSec);
+    if (fecSpan && !m_udptl->setFec(fecSpan,fecEntries))
+	TraceDebug(m_traceId,&splugin,DebugMild,"Wrapper cannot use UDPTL FEC span=%u entries=%u [%p]",
+	    fecSpan,fecEntries,this);
     m_udptl->initTransport();
     bindLocal(localip,false);
 }
@@ -552,44 +564,38 @@ bool YRTPWrapper::setupUDPTL(Message& msg)
     msg.setParam("t38maxdatagram",tmp);
     msg.setParam("osdp_T38FaxMaxDatagram",tmp);
     msg.setParam("t38redundancy",String(m_udptl->maxSec()));
-    if (m_udptl->maxSec())
+    if (m_udptl->fecSpan()) {
+	msg.setParam("t38fec",String(m_udptl->fecSpan()));
+	msg.setParam("t38fec_entries",String(m_udptl->fecEntries()));
+	msg.setParam("osdp_T38FaxUdpEC","t38UDPFEC");
+    }
+    else if (m_udptl->maxSec())
 	msg.setParam("osdp_T38FaxUdpEC","t38UDPRedundancy");
     return true;
 }
 
 bool YRTPWrapper::bindLocal(const char* localip, bool rtcp)
 {
-    int minport = s_minport;
-    int maxport = s_maxport;
-    int attempt = 10;
-    if (minport > maxport) {
-	int tmp = maxport;
-	maxport = minport;
-	minport = tmp;
-    }
-    else if (minport == maxport) {
-	maxport++;
-	attempt = 1;
-    }
     SocketAddr addr(m_ipv6 ? SocketAddr::Unknown : SocketAddr::IPv4);
     if (!addr.host(localip)) {
 	TraceDebug(m_traceId,&splugin,DebugWarn,"Wrapper '%s' could not parse address '%s' [%p]",
 	    m_id.c_str(),localip,this);
 	return false;
     }
-    for (; attempt; attempt--) {
-	int lport = (minport + (Random::random() % (maxport - minport))) & 0xfffe;
-	addr.port(lport);
-	if (m_rtp ? m_rtp->localAddr(addr,rtcp) : m_udptl->localAddr(addr)) {
-	    m_host = addr.host();
-	    m_port = lport;
-	    TraceDebug(m_traceId,&splugin,DebugInfo,"Session '%s' %p bound to %s%s [%p]",
-		m_id.c_str(),session(),addr.addr().c_str(),(rtcp ? " +RTCP" : ""),this);
-	    return true;
-	}
+    RTPTransport* trans = session() ? session()->transport() : 0;
+    RTPPortAllocator* ports = portAllocator();
+    if (trans && ports && ports->bind(*trans,addr,rtcp)) {
+	m_host = addr.host();
+	m_port = addr.port();
+	TraceDebug(m_traceId,&splugin,DebugInfo,"Session '%s' %p bound to %s%s [%p]",
+	    m_id.c_str(),session(),addr.addr().c_str(),(rtcp ? " +RTCP" : ""),this);
+	TelEngine::destruct(ports);
+	return true;
     }
     TraceDebug(m_traceId,&splugin,DebugWarn,"YRTPWrapper '%s' bind failed in range %d-%d on '%s' [%p]",
-	m_id.c_str(),minport,maxport,localip,this);
+	m_id.c_str(),(ports ? ports->minPort() : s_minport),(ports ? ports->maxPort() : s_maxport),
+	localip,this);
+    TelEngine::destruct(ports);
     return false;
 }
 
@@ -599,8 +605,11 @@ bool YRTPWrapper::setParams(const char* rip, Message& msg)
     int rport = msg.getIntValue(YSTRING("remoteport"));
     if (rip && (rport > 0))
 	return m_udptl ? startUDPTL(rip,rport,msg) : startRTP(rip,rport,msg);
-    else
-	return m_udptl ? setupUDPTL(msg) : setupSRTP(msg,msg.getBoolValue(YSTRING("secure")));
+    if (m_udptl)
+	return setupUDPTL(msg);
+    if (msg.getParam(YSTRING("dtls_setup")))
+	return setupDTLS(msg,false);
+    return setupSRTP(msg,msg.getBoolValue(YSTRING("secure")));
 }
 
 bool YRTPWrapper::setRemote(const char* raddr, unsigned int rport, const Message& msg)
@@ -745,7 +754,9 @@ bool YRTPWrapper::startRTP(const char* raddr, unsigned int rport, Message& msg)
 
     m_rtp->initDebugData(msg);
     bool secure = false;
-    const String* sec = msg.getParam(YSTRING("crypto_suite"));
+    // DTLS keying replaces any keys exchanged in signaling
+    bool dtls = msg.getParam(YSTRING("dtls_setup")) ? setupDTLS(msg,true) : m_rtp->dtlsActive();
+    const String* sec = dtls ? 0 : msg.getParam(YSTRING("crypto_suite"));
     if (sec && *sec) {
 	// separate crypto parameters
 	const String* key = msg.getParam(YSTRING("crypto_key"));
@@ -760,11 +771,21 @@ bool YRTPWrapper::startRTP(const char* raddr, unsigned int rport, Message& msg)
 	msg.clearParam("crypto_suite");
     }
     secure = secure && setupSRTP(msg,true);
-    if (!secure)
+    if (!(secure || dtls))
 	m_rtp->security(0);
 
     m_rtp->dataPayload(payload);
     m_rtp->eventPayload(evpayload);
+    if (m_rtp->receiver()) {
+	// clock used for jitter, RFC 3551 keeps 8kHz for G.722 and 90kHz for video
+	unsigned int rate = 90000;
+	if (isAudio()) {
+	    const FormatInfo* fi = FormatRepository::getFormat(m_format);
+	    rate = (fi && (payload != 9)) ? fi->sampleRate : 8000;
+	}
+	m_rtp->receiver()->clockRate(rate);
+	m_rtp->receiver()->quality().codec(m_format);
+    }
     m_rtp->setTOS(tos);
     if (buflen > 0)
 	m_rtp->setBuffer(buflen);
@@ -776,7 +797,8 @@ bool YRTPWrapper::startRTP(const char* raddr, unsigned int rport, Message& msg)
 	    (ok ? "opened" : "failed to open"),this);
     }
     setTimeout(msg,s_timeout);
-    m_rtp->setReports(msg.getIntValue(YSTRING("rtcp_interval"),s_interval));
+    m_rtp->setReports(msg.getIntValue(YSTRING("rtcp_interval"),s_interval),
+	msg.getBoolValue(YSTRING("rtcp_xr"),s_rtcpXR));
     // dejittering is only meaningful for audio
     if (isAudio()){
 	int minJitter = msg.getIntValue(YSTRING("minjitter"),s_minJitter);
@@ -850,6 +872,29 @@ bool YRTPWrapper::setupSRTP(Message& msg, bool buildMaster)
     return true;
 }
 
+// Start DTLS-SRTP keying or just report the local certificate fingerprint
+bool YRTPWrapper::setupDTLS(Message& msg, bool start)
+{
+    TraceDebug(m_traceId,&splugin,DebugAll,"YRTPWrapper::setupDTLS(%s) [%p]",
+	String::boolText(start),this);
+    if (!m_rtp)
+	return false;
+    const String& remote = msg[YSTRING("dtls_fingerprint")];
+    if (start && remote.null()) {
+	TraceDebug(m_traceId,&splugin,DebugWarn,"Refusing DTLS-SRTP, the peer sent no certificate fingerprint [%p]",this);
+	return false;
+    }
+    // RFC 5763, the side with the active setup role is the DTLS client
+    bool ok = !start || m_rtp->dtlsSetup(msg[YSTRING("dtls_setup")] == YSTRING("active"),remote);
+    String fp;
+    if (ok && m_rtp->dtlsFingerprint(fp)) {
+	msg.setParam("odtls_fingerprint",fp);
+	return true;
+    }
+    TraceDebug(m_traceId,&splugin,DebugWarn,"DTLS-SRTP is not available, is the openssl module loaded? [%p]",this);
+    return false;
+}
+
 bool YRTPWrapper::startSRTP(const String& suite, const String& keyParams, const ObjList* paramList)
 {
     TraceDebug(m_traceId,&splugin,DebugAll,"YRTPWrapper::startSRTP('%s','%s',%p) [%p]",
@@ -984,6 +1029,15 @@ void YRTPWrapper::terminate(Message& msg)
 	m_udptl->getStats(stats);
     if (stats)
 	msg.setParam("stats",stats);
+    RTPReceiver* recv = m_rtp ? m_rtp->receiver() : 0;
+    if (recv && recv->quality().packets()) {
+	String quality;
+	recv->qualityStats(quality);
+	msg.setParam("quality",quality);
+	NamedList metrics("");
+	recv->qualityStats(metrics);
+	msg.copyParams(metrics,"rfactor,mos");
+    }
     m_valid = false;
 }
 
@@ -1041,8 +1095,11 @@ bool YRTPSession::rtpRecvData(bool marker, unsigned int timestamp, const void* d
 	m_lastLost = lost;
     }
     // the source will not be destroyed until we reset the busy flag
+    // forward a slice of the received packet if possible so consumers can keep it
     DataBlock block;
-    block.assign((void*)data, len, false);
+    RTPReceiver* recv = receiver();
+    if (!(recv && recv->packetSlice(block,data,len)))
+	block.assign((void*)data, len, false);
     source->Forward(block,timestamp,flags);
     block.clear(false);
     source->busy(false);
@@ -1117,6 +1174,15 @@ bool YRTPSession::checkCipher(const String& name)
     return Engine::dispatch(msg);
 }
 
+RTPDtls* YRTPSession::createDtls()
+{
+    Message msg("engine.dtls");
+    DtlsHolder* dHold = new DtlsHolder;
+    msg.userData(dHold);
+    dHold->deref();
+    return Engine::dispatch(msg) ? dHold->dtls() : 0;
+}
+
 
 YUDPTLSession::~YUDPTLSession()
 {
@@ -1259,113 +1325,52 @@ unsigned long YRTPConsumer::Consume(const DataBlock &data, unsigned long tStamp,
 }
 
 
-void YRTPMonitor::updateTimes(u_int64_t when)
-{
-    if (!m_start)
-	m_start = when;
-    m_last = when;
-}
-
-void YRTPMonitor::rtpData(const void* data, int len)
-{
-    updateTimes(Time::now());
-    m_rtpPackets++;
-    m_rtpBytes += len;
-    // we already know data is at least 12 bytes (RTP header) long
-    m_payload = 0x7f & ((const unsigned char*)data)[1];
-}
-
-void YRTPMonitor::rtcpData(const void* data, int len)
+YRTPReflector::YRTPReflector(const String& id, bool passiveA, bool passiveB)
+    : RTPRelay(&splugin),
+      m_passiveA(passiveA), m_passiveB(passiveB), m_idA(id)
 {
-    updateTimes(Time::now());
-    m_rtcpPackets++;
+    DDebug(&splugin,DebugInfo,"YRTPReflector::YRTPReflector('%s') [%p]",id.c_str(),this);
+    setTimeout(s_timeout);
+    start(s_sleep,s_priority);
 }
 
-void YRTPMonitor::timerTick(const Time& when)
+YRTPReflector::~YRTPReflector()
 {
-    if (!(m_id && m_last))
-	return;
-    u_int64_t tout = 1000 * s_timeout;
-    if (tout && ((m_last + tout) < when.usec()))
-	timeout(0 == m_start);
+    DDebug(&splugin,DebugInfo,"YRTPReflector::~YRTPReflector() [%p]",this);
+    s_mutex.lock();
+    splugin.changed();
+    s_mutex.unlock();
 }
 
-void YRTPMonitor::timeout(bool initial)
+void YRTPReflector::timeout(bool legA, bool initial)
 {
-    if (null(m_id))
+    const String& id = legA ? m_idA : m_idB;
+    if (id.null())
 	return;
     if (!(initial ? s_warnFirst : s_warnLater))
 	return;
     Debug(&splugin,DebugWarn,"%s timeout in '%s' reflector [%p]",
-	(initial ? "Initial" : "Later"),m_id->c_str(),this);
+	(initial ? "Initial" : "Later"),id.c_str(),this);
     if (s_notifyMsg) {
 	Message* m = new Message(s_notifyMsg);
-	m->addParam("id",m_id->c_str());
+	m->addParam("id",id);
 	m->addParam("reason","nomedia");
 	m->addParam("event","timeout");
 	m->addParam("initial",String::boolText(initial));
 	Engine::enqueue(m);
     }
-    // been there, done that, enough
-    m_id = 0;
-}
-
-void YRTPMonitor::startup()
-{
-    if (0 == m_last)
-	m_last = Time::now();
 }
 
-void YRTPMonitor::saveStats(Message& msg) const
+void YRTPReflector::saveStats(Message& msg, bool legA) const
 {
-    uint64_t d = m_start ? ((m_last - m_start + 500000) / 1000000) : 0;
-    msg.addParam("rtp_rx_packets",String(m_rtpPackets));
-    msg.addParam("rtcp_rx_packets",String(m_rtcpPackets));
-    msg.addParam("rtp_rx_bytes",String(m_rtpBytes));
+    const RTPRelayCounters& c = counters(legA);
+    uint64_t d = c.first ? ((c.last - c.first + 500000) / 1000000) : 0;
+    msg.addParam("rtp_rx_packets",String(c.rtpPackets));
+    msg.addParam("rtcp_rx_packets",String(c.rtcpPackets));
+    msg.addParam("rtp_rx_bytes",String(c.rtpBytes));
     msg.addParam("rtp_rx_duration",String(d));
-    if (m_payload >= 0)
-	msg.addParam("rtp_rx_payload",String(m_payload));
-}
-
-
-YRTPReflector::YRTPReflector(const String& id, bool passiveA, bool passiveB)
-    : m_idA(id)
-{
-    DDebug(&splugin,DebugInfo,"YRTPReflector::YRTPReflector('%s') [%p]",id.c_str(),this);
-    m_group = new RTPGroup(s_sleep,s_priority);
-    m_rtpA = new RTPTransport;
-    m_rtpB = new RTPTransport;
-    m_rtpA->setProcessor(m_rtpB);
-    m_rtpB->setProcessor(m_rtpA);
-    m_monA = new YRTPMonitor(passiveA ? 0 : &m_idA);
-    m_rtpA->setMonitor(m_monA);
-    m_monB = new YRTPMonitor(passiveB ? 0 : &m_idB);
-    m_rtpB->setMonitor(m_monB);
-    m_group->join(m_rtpA);
-    m_group->join(m_rtpB);
-    m_group->join(m_monA);
-    m_group->join(m_monB);
-}
-
-YRTPReflector::~YRTPReflector()
-{
-    DDebug(&splugin,DebugInfo,"YRTPReflector::~YRTPReflector() [%p]",this);
-    m_rtpA->setProcessor();
-    m_rtpA->setMonitor();
-    m_rtpB->setProcessor();
-    m_rtpB->setMonitor();
-    m_group->part(m_rtpA);
-    m_group->part(m_monA);
-    m_group->part(m_rtpB);
-    m_group->part(m_monB);
-    m_group = 0;
-    TelEngine::destruct(m_rtpA);
-    TelEngine::destruct(m_rtpB);
-    TelEngine::destruct(m_monA);
-    TelEngine::destruct(m_monB);
-    s_mutex.lock();
-    splugin.changed();
-    s_mutex.unlock();
+    if (c.payload >= 0)
+	msg.addParam("rtp_rx_payload",String(c.payload));
 }
 
 
@@ -1610,6 +1615,8 @@ YRTPPlugin::~YRTPPlugin()
     Output("Unloading module YRTP");
     s_calls.clear();
     s_mirrors.clear();
+    RTPGroup::stopPool();
+    TelEngine::destruct(s_ports);
 }
 
 void YRTPPlugin::genUpdate(Message& msg)
@@ -1630,6 +1637,24 @@ void YRTPPlugin::statusParams(String& str)
     s_refMutex.lock();
     str.append("mirrors=",",") << s_mirrors.count();
     s_refMutex.unlock();
+    RTPRelay::relayStatus(str);
+    RTPGroup::poolStatus(str);
+    RTPPortAllocator* ports = portAllocator();
+    if (ports) {
+	ports->stats(str);
+	TelEngine::destruct(ports);
+    }
+}
+
+void YRTPPlugin::msgTimer(Message& msg)
+{
+    Module::msgTimer(msg);
+    // bind the spare sockets used since last timer
+    RTPPortAllocator* ports = portAllocator();
+    if (ports) {
+	ports->refill();
+	TelEngine::destruct(ports);
+    }
 }
 
 void YRTPPlugin::statusDetail(String& str)
@@ -1674,6 +1699,20 @@ bool YRTPPlugin::reflectSetup(Message& msg, const char* id, RTPTransport& rtp,
 
     int minport = msg.getIntValue(YSTRING("rtp_minport"),s_minport);
     int maxport = msg.getIntValue(YSTRING("rtp_maxport"),s_maxport);
+    bool rtcp = msg.getBoolValue(YSTRING("rtp_rtcp"),s_rtcp);
+    if ((minport == s_minport) && (maxport == s_maxport)) {
+	RTPPortAllocator* ports = portAllocator();
+	bool ok = ports && ports->bind(rtp,addr,rtcp);
+	TelEngine::destruct(ports);
+	if (ok)
+	    Debug(this,DebugInfo,"Reflector %s for '%s' bound to %s:%d%s",
+		leg,id,lip.c_str(),addr.port(),(rtcp ? " +RTCP" : ""));
+	else
+	    Debug(this,DebugWarn,"Could not bind reflector %s for '%s' in range %d - %d",
+		leg,id,minport,maxport);
+	return ok;
+    }
+    // custom port range for this call
     int attempt = 10;
     if (minport > maxport) {
 	int tmp = maxport;
@@ -1684,7 +1723,6 @@ bool YRTPPlugin::reflectSetup(Message& msg, const char* id, RTPTransport& rtp,
 	maxport++;
 	attempt = 1;
     }
-    bool rtcp = msg.getBoolValue(YSTRING("rtp_rtcp"),s_rtcp);
     for (;;) {
 	int lport = (minport + (Random::random() % (maxport - minport))) & 0xfffe;
 	addr.port(lport);
@@ -1754,6 +1792,17 @@ void YRTPPlugin::reflectExecute(Message& msg)
     const char* bHost = msg.getValue(YSTRING("rtp_remoteip"),aHost);
     YRTPReflector* r = new YRTPReflector(*id,
 	(sdp->find("a=recvonly") >= 0),(sdp->find("a=sendonly") >= 0));
+    bool rewrite = msg.getBoolValue(YSTRING("rtp_reflect_rewrite"),s_reflectRewrite);
+    // SRTP authenticates the SSRC and sequence numbers, rewriting them breaks it
+    if (rewrite && (sdp->find("/SAVP") >= 0)) {
+	Debug(this,DebugNote,"Not rewriting secure RTP reflected for '%s'",id->c_str());
+	rewrite = false;
+    }
+    r->rewrite(rewrite);
+    // end to end DTLS-SRTP keying shares the RTP ports
+    bool dtls = (sdp->find("a=fingerprint:") >= 0);
+    r->rtpA().acceptDtls(dtls);
+    r->rtpB().acceptDtls(dtls);
     if (!(reflectSetup(msg,id->c_str(),r->rtpA(),aHost,"A") &&
 	reflectStart(msg,id->c_str(),r->rtpA(),ra) &&
 	reflectSetup(msg,id->c_str(),r->rtpB(),bHost,"B"))) {
@@ -1831,8 +1880,7 @@ void YRTPPlugin::reflectAnswer(Message& msg, bool ignore)
 	reflectDrop(r,mylock);
 	return;
     }
-    r->monA().startup();
-    r->monB().startup();
+    r->startup();
     String templ;
     templ << "\\1" << r->rtpA().localAddr().host();
     templ << "\\3" << r->rtpA().localAddr().host();
@@ -1853,7 +1901,7 @@ void YRTPPlugin::reflectHangup(Message& msg)
 	    DDebug(this,DebugAll,"YRTPPlugin::reflectHangup() A='%s' B='%s'",
 		id->c_str(),r->idB().c_str());
 	    r->setA(String::empty());
-	    r->monA().saveStats(msg);
+	    r->saveStats(msg,true);
 	    if (r->idB())
 		return;
 	}
@@ -1861,7 +1909,7 @@ void YRTPPlugin::reflectHangup(Message& msg)
 	    DDebug(this,DebugAll,"YRTPPlugin::reflectHangup() B='%s' A='%s'",
 		id->c_str(),r->idA().c_str());
 	    r->setB(String::empty());
-	    r->monB().saveStats(msg);
+	    r->saveStats(msg,false);
 	    if (r->idA())
 		return;
 	}
@@ -1901,25 +1949,51 @@ void YRTPPlugin::initialize()
     Configuration cfg(Engine::configFile("yrtpchan"));
     s_ipv6 = SocketAddr::supports(SocketAddr::IPv6) &&
 	cfg.getBoolValue("general","ipv6_support",false);
-    s_minport = cfg.getIntValue("general","minport",MIN_PORT);
-    s_maxport = cfg.getIntValue("general","maxport",MAX_PORT);
+    int minport = cfg.getIntValue("general","minport",MIN_PORT);
+    int maxport = cfg.getIntValue("general","maxport",MAX_PORT);
+    unsigned int spares = cfg.getIntValue("general","port_spares",0,0,4096);
     s_bufsize = cfg.getIntValue("general","buffer",BUF_SIZE);
     s_minJitter = cfg.getIntValue("general","minjitter",50);
     s_maxJitter = cfg.getIntValue("general","maxjitter",Engine::clientMode() ? 120 : 0);
     s_tos = cfg.getIntValue("general","tos",Socket::tosValues());
     s_udpbuf = cfg.getIntValue("general","udpbuf",0);
     s_localip = cfg.getValue("general","localip");
+    s_portMutex.lock();
+    if (s_ports && (minport == s_minport) && (maxport == s_maxport))
+	s_ports->spares(spares);
+    else {
+	// transports still hold the old allocator until they are released
+	TelEngine::destruct(s_ports);
+	s_ports = new RTPPortAllocator(minport,maxport,spares);
+    }
+    s_minport = minport;
+    s_maxport = maxport;
+    if (spares && s_localip) {
+	SocketAddr addr(s_ipv6 ? SocketAddr::Unknown : SocketAddr::IPv4);
+	if (addr.host(s_localip))
+	    s_ports->prepare(addr);
+    }
+    s_portMutex.unlock();
     s_autoaddr = cfg.getBoolValue("general","autoaddr",true);
     s_anyssrc = cfg.getBoolValue("general","anyssrc",true);
     s_padding = cfg.getIntValue("general","padding",0);
     s_rtcp = cfg.getBoolValue("general","rtcp",true);
     s_interval = cfg.getIntValue("general","rtcp_interval",4500);
+    s_rtcpXR = cfg.getBoolValue("general","rtcp_xr");
     s_drill = cfg.getBoolValue("general","drillhole",Engine::clientMode());
+    s_reflectRewrite = cfg.getBoolValue("general","reflect_rewrite",false);
+    RTPSecure::fastPath(cfg.getBoolValue("general","srtp_fast",true));
     s_monitor = cfg.getBoolValue("general","monitoring",false);
     s_sleep = cfg.getIntValue("general","defsleep",5);
     RTPGroup::setMinSleep(cfg.getIntValue("general","minsleep"));
     s_priority = Thread::priority(cfg.getValue("general","thread"));
     s_affinity = cfg.getValue("general","affinity");
+    bool ready = cfg.getBoolValue("general","readiness",false);
+    if (!RTPGroup::setReadiness(ready))
+	Debug(this,DebugWarn,"Waiting for RTP socket readiness is not supported");
+    String pool = cfg.getValue("general","pool");
+    RTPGroup::setupPool((pool == YSTRING("auto")) ? -1 : pool.toInteger(0),s_sleep,s_priority,
+	cfg.getValue("general","pool_affinity"));
     s_rtpWarnSeq = cfg.getBoolValue("general","rtp_warn_seq",true);
     s_timeout = cfg.getIntValue("timeouts","timeout",3000);
     s_udptlTimeout = cfg.getIntValue("timeouts","udptl_timeout",25000);
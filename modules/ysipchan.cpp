@@ -33,6 +33,8 @@ class YateSIPListener;                   // Base class for listeners (need bindi
 class YateSIPPartyHolder;                // A SIPParty holder
 class YateSIPTransport;                  // SIP transport: keeps a socket, read/send data
 class YateSIPUDPTransport;               // UDP transport
+class YateSIPUDPReader;                  // UDP batch reader with statistics
+class YateSIPUDPShard;                   // Additional UDP listener socket with its own reader
 class YateSIPTCPTransport;               // TCP/TLS transport
 class YateSIPTransportWorker;            // A transport worker
 class YateSIPTCPListener;                // A TCP listener
@@ -63,6 +65,17 @@ class SIPDriver;
 // 1 minute
 #define BIND_RETRY_MAX 60000
 
+// Maximum and default number of UDP datagrams read in one operation
+#define UDP_BATCH_MAX 32
+#define UDP_BATCH_DEF 16
+
+// Maximum number of sockets sharing the same UDP listener address
+#define UDP_SHARDS_MAX 16
+
+// Time in microseconds a shard reader blocks on its socket before checking
+//  if it should terminate, 100ms
+#define UDP_SHARD_WAIT 100000
+
 static const TokenDict dict_errors[] = {
     { "incomplete", 484 },
     { "noroute", 404 },
@@ -389,7 +402,7 @@ protected:
     bool updateRtpAddr(const NamedList& params, String& buf, Mutex* mutex = 0);
     // Initialize a socket
     Socket* initSocket(SocketAddr& addr, Mutex* mutex, int backLogBuffer, bool forceBind,
-	String& reason);
+	String& reason, bool reusePort = false);
     void initialize(const NamedList& params, bool first);
 
     unsigned int m_bindInterval;         // Interval to try binding
@@ -459,7 +472,9 @@ public:
     void printSendMsg(const SIPMessage* msg, const SocketAddr* addr = 0);
     // Print received messages to output
     // For TCP transports the function will assume 'buf' is not null terminated
-    void printRecvMsg(const char* buf, int len, const String& traceId = String::empty());
+    // For UDP transports 'addr' is the address the message was received from
+    void printRecvMsg(const char* buf, int len, const String& traceId = String::empty(),
+	const SocketAddr* addr = 0);
     // Add transport data yate message
     void fillMessage(Message& msg, bool addRoute = false);
     // Transport descendents
@@ -493,7 +508,8 @@ protected:
     void changeStatus(int stat);
     // Handle received messages, set party, add to engine
     // Consume the message
-    void receiveMsg(SIPMessage*& msg);
+    // UDP transports must provide the address the message was received from
+    void receiveMsg(SIPMessage*& msg, const SocketAddr* addr = 0);
     // Print socket read error to output
     void printReadError();
     // Print socket write error to output
@@ -523,11 +539,44 @@ private:
     YateSIPTransport() : ProtocolHolder(Udp) {} // No default constructor
 };
 
+// UDP batch reader, keeps read buffers and statistics of a listener socket
+class YateSIPUDPReader
+{
+public:
+    YateSIPUDPReader();
+    // Read up to 'batch' datagrams of at most 'maxpkt' bytes
+    // Each buffer has room for a terminating null after data
+    // Return the number of datagrams read, negative on error
+    int read(Socket* sock, unsigned int batch, unsigned int maxpkt);
+    inline char* data(int idx) const
+	{ return (char*)m_dgrams[idx].buffer; }
+    inline int length(int idx) const
+	{ return m_dgrams[idx].result; }
+    inline void remote(int idx, SocketAddr& addr) const
+	{ addr.assign(m_dgrams[idx].addr,m_dgrams[idx].addrLen); }
+    // Count a datagram dropped after being read
+    inline void dropped()
+	{ m_dropped++; }
+    // Append statistics as packets|bytes|dropped|reads|maxbatch
+    void dumpStats(String& buf) const;
+private:
+    DataBlock m_buffer;                  // Read buffer, one slot per datagram
+    SocketDatagram m_dgrams[UDP_BATCH_MAX]; // Batch read descriptors
+    struct sockaddr_storage m_addrs[UDP_BATCH_MAX]; // Batch read remote addresses
+    u_int64_t m_packets;                 // Received datagrams
+    u_int64_t m_bytes;                   // Received bytes
+    u_int64_t m_dropped;                 // Datagrams dropped (short, flood protection)
+    u_int64_t m_reads;                   // Successful read operations
+    unsigned int m_maxBatch;             // Maximum datagrams returned by a read
+};
+
 // UDP transport
 class YateSIPUDPTransport : public YateSIPTransport, public YateSIPListener
 {
     YCLASS(YateSIPUDPTransport,YateSIPTransport);
     friend class YateSIPTransport;
+    friend class YateSIPUDPShard;
+    friend class SIPDriver;
 public:
     YateSIPUDPTransport(const String& id);
     inline bool isDefault() const
@@ -542,10 +591,46 @@ public:
     // Process data (read)
     virtual int process();
 protected:
+    // Status changed notification: start or stop the shards
+    virtual void statusChanged();
+    // Process a datagram received from 'addr'. Return false if dropped
+    bool processDatagram(char* b, int res, const SocketAddr& addr);
+    // Open the additional sockets and start their readers
+    void startShards();
+    // Stop shard readers and wait for them to terminate
+    void stopShards();
+    // Append shards statistics
+    void dumpShards(String& buf);
     bool m_default;
     bool m_forceBind;
     bool m_errored;
     int m_bufferReq;
+    unsigned int m_batch;                // Datagrams to read in one operation
+    unsigned int m_shardCount;           // Sockets sharing the listener address
+    Thread::Priority m_shardPrio;        // Shard readers priority
+    YateSIPUDPReader m_reader;           // Main socket reader
+    ObjList m_shards;                    // Running shards (not owned)
+};
+
+// Additional SO_REUSEPORT socket of an UDP transport, read by its own thread
+class YateSIPUDPShard : public Thread, public GenObject
+{
+    friend class YateSIPUDPTransport;
+public:
+    YateSIPUDPShard(YateSIPUDPTransport* trans, unsigned int index, Socket* sock,
+	Thread::Priority prio, bool blocking);
+    ~YateSIPUDPShard();
+    virtual void run();
+    inline unsigned int index() const
+	{ return m_index; }
+    inline const YateSIPUDPReader& reader() const
+	{ return m_reader; }
+private:
+    YateSIPUDPTransport* m_transport;
+    unsigned int m_index;
+    Socket* m_sock;
+    bool m_blocking;                     // Socket is blocking with a receive timeout
+    YateSIPUDPReader m_reader;
 };
 
 // TCP/TLS transport
@@ -1448,6 +1533,7 @@ static const String s_noAutoAuth = "noautoauth";
 static const String s_username = "username";
 
 static u_int64_t s_printFloodTime = 0;
+static Mutex s_udpRecvMutex(false,"SIPUDPRecv"); // Protects UDP receive warnings and flood state
 
 int YateSIPEndPoint::s_evCount = 0;
 bool SIPDriver::s_trace = false;
@@ -3074,7 +3160,7 @@ bool YateSIPListener::updateRtpAddr(const NamedList& params, String& buf, Mutex*
 
 // Initialize a socket
 Socket* YateSIPListener::initSocket(SocketAddr& lAddr, Mutex* mutex,
-    int backLogBuffer, bool forceBind, String& reason)
+    int backLogBuffer, bool forceBind, String& reason, bool reusePort)
 {
     reason = "";
     Lock lck(mutex);
@@ -3122,6 +3208,9 @@ Socket* YateSIPListener::initSocket(SocketAddr& lAddr, Mutex* mutex,
 	}
 	if (!udp)
 	    sock->setReuse();
+	else if (reusePort && !sock->setReusePort())
+	    Debug(&plugin,DebugWarn,"Listener(%s,'%s') could not enable port sharing",
+		type,lName());
 #ifdef SO_RCVBUF
 	// Set UDP buffer size
 	if (udp && backLogBuffer > 0) {
@@ -3426,17 +3515,20 @@ void YateSIPTransport::printSendMsg(const SIPMessage* msg, const SocketAddr* add
 }
 
 // Print received messages to output
-void YateSIPTransport::printRecvMsg(const char* buf, int len, const String& traceId)
+void YateSIPTransport::printRecvMsg(const char* buf, int len, const String& traceId,
+    const SocketAddr* addr)
 {
     if (!buf)
 	return;
     if (!plugin.debugAt(DebugInfo))
 	return;
-    if (!plugin.filterDebug(m_remote.addr()))
+    if (!addr)
+	addr = &m_remote;
+    if (!plugin.filterDebug(addr->addr()))
 	return;
     String raddr;
     if (udpTransport())
-	raddr = " from " + m_remote.addr();
+	raddr = " from " + addr->addr();
     String tmp;
     tmp.assign(buf,len);
     TraceDebug(traceId,&plugin,DebugInfo,
@@ -3556,7 +3648,7 @@ void YateSIPTransport::changeStatus(int stat)
 }
 
 // Handle received messages, set party, add to engine
-void YateSIPTransport::receiveMsg(SIPMessage*& msg)
+void YateSIPTransport::receiveMsg(SIPMessage*& msg, const SocketAddr* addr)
 {
     if (!msg)
 	return;
@@ -3570,8 +3662,10 @@ void YateSIPTransport::receiveMsg(SIPMessage*& msg)
 	YateSIPUDPTransport* udp = udpTransport();
 	YateSIPTCPTransport* tcp = tcpTransport();
 	if (udp) {
+	    if (!addr)
+		addr = &m_remote;
 	    URI uri(msg->uri);
-	    YateSIPLine* line = plugin.findLine(m_remote.host(),m_remote.port(),uri.getUser());
+	    YateSIPLine* line = plugin.findLine(addr->host(),addr->port(),uri.getUser());
 	    const char* host = 0;
 	    int port = -1;
 	    if (line && line->getLocalPort()) {
@@ -3582,7 +3676,7 @@ void YateSIPTransport::receiveMsg(SIPMessage*& msg)
 		host = m_local.host();
 	    if (port <= 0)
 		port = m_local.port();
-	    party = new YateUDPParty(udp,m_remote,&port,host);
+	    party = new YateUDPParty(udp,*addr,&port,host);
 	}
 	else if (tcp) {
 	    party = tcp->getParty();
@@ -3650,7 +3744,8 @@ void YateSIPTransport::setProtoAddr(bool set)
 
 YateSIPUDPTransport::YateSIPUDPTransport(const String& id)
     : YateSIPTransport(Udp,id,0,Idle), YateSIPListener(id,Udp),
-    m_default(false), m_forceBind(true), m_errored(false), m_bufferReq(0)
+    m_default(false), m_forceBind(true), m_errored(false), m_bufferReq(0),
+    m_batch(UDP_BATCH_DEF), m_shardCount(1), m_shardPrio(Thread::Normal)
 {
     Debug(&plugin,DebugAll,"Transport(%s) created [%p]",m_id.c_str(),this);
 }
@@ -3664,6 +3759,17 @@ bool YateSIPUDPTransport::init(const NamedList& params, const NamedList& defs, b
     m_default = params.getBoolValue("default",toString() == YSTRING("general"));
     m_forceBind = params.getBoolValue("udp_force_bind",true);
     m_bufferReq = params.getIntValue("buffer",defs.getIntValue("buffer"));
+    m_batch = params.getIntValue("udp_batch",defs.getIntValue("udp_batch",UDP_BATCH_DEF),
+	1,UDP_BATCH_MAX);
+    unsigned int shards = params.getIntValue("udp_shards",1,1,UDP_SHARDS_MAX);
+    if (shards != m_shardCount) {
+	// Sockets must be re-created to change port sharing
+	Lock lck(this);
+	if (!first)
+	    m_bind = true;
+	m_shardCount = shards;
+    }
+    m_shardPrio = prio;
     if (first) {
 	const String& addr = params["addr"];
 	setAddr(addr,params.getIntValue("port",5060),
@@ -3721,7 +3827,7 @@ int YateSIPUDPTransport::process()
 	    return Thread::idleUsec();
 	String reason;
 	SocketAddr addr;
-	Socket* sock = initSocket(addr,this,m_bufferReq,m_forceBind,reason);
+	Socket* sock = initSocket(addr,this,m_bufferReq,m_forceBind,reason,m_shardCount > 1);
 	if (!sock) {
 	    changeStatus(Idle);
 	    Lock lck(this);
@@ -3796,55 +3902,326 @@ int YateSIPUDPTransport::process()
     }
     else
 	retVal = Thread::idleUsec();
-    // We can read the data
-    m_buffer.resize(m_maxpkt + 1);
-    int res = m_sock->recvFrom((void*)m_buffer.data(),m_buffer.length() - 1,m_remote);
-    if (res <= 0) {
+    // We can read the data, get as many datagrams as available up to batch size
+    int n = m_reader.read(m_sock,m_batch,m_maxpkt);
+    if (n <= 0) {
 	printReadError();
 	return retVal;
     }
+    SocketAddr addr;
+    for (int i = 0; i < n; i++) {
+	m_reader.remote(i,addr);
+	if (!processDatagram(m_reader.data(i),m_reader.length(i),addr))
+	    m_reader.dropped();
+    }
+    return 0;
+}
+
+// Status changed notification: start or stop the shards
+void YateSIPUDPTransport::statusChanged()
+{
+    if (status() == Connected)
+	startShards();
+    else
+	stopShards();
+}
+
+// Open the additional sockets and start their readers
+// Each socket is bound to the address of the main one, the kernel
+//  distributes datagrams by remote address hash keeping dialog affinity
+void YateSIPUDPTransport::startShards()
+{
+    Lock lck(this);
+    if (m_shardCount < 2 || !m_sock || m_shards.skipNull() || m_local.isNullAddr())
+	return;
+    for (unsigned int i = 1; i < m_shardCount; i++) {
+	Socket* sock = new Socket(m_local.family(),SOCK_DGRAM,IPPROTO_UDP);
+	const char* error = 0;
+	if (!sock->valid())
+	    error = "create socket failed";
+	else if (m_local.family() == SocketAddr::IPv6 && !sock->setIpv6OnlyOption(true))
+	    error = "failed to set option IPv6 only";
+	else if (!sock->setReusePort())
+	    error = "failed to enable port sharing";
+	else {
+#ifdef SO_RCVBUF
+	    if (m_bufferReq > 0) {
+		int buflen = m_bufferReq;
+		if (buflen < 4096)
+		    buflen = 4096;
+		sock->setOption(SOL_SOCKET,SO_RCVBUF,&buflen,sizeof(buflen));
+	    }
+#endif
+	    if (!sock->bind(m_local))
+		error = "bind failed";
+	}
+	if (error) {
+	    String tmp;
+	    addSockError(tmp,*sock);
+	    Debug(&plugin,DebugWarn,"Transport(%s) shard %u %s%s [%p]",
+		m_id.c_str(),i,error,tmp.c_str(),this);
+	    YateSIPTransport::resetSocket(sock,-1);
+	    break;
+	}
+	if (m_capture && !sock->installFilter(m_capture))
+	    Debug(&plugin,DebugNote,"Transport(%s) failed to install capture filter on shard %u [%p]",
+		m_id.c_str(),i,this);
+	// Readers block in receive, the timeout lets them notice termination
+	// Fall back to waiting in select if the timeout can't be set
+	bool blocking = false;
+#ifndef _WINDOWS
+	struct timeval tv;
+	tv.tv_sec = UDP_SHARD_WAIT / 1000000;
+	tv.tv_usec = UDP_SHARD_WAIT % 1000000;
+	blocking = sock->setBlocking(true) && sock->setOption(SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+#endif
+	if (!(blocking || sock->setBlocking(false))) {
+	    String tmp;
+	    addSockError(tmp,*sock);
+	    Debug(&plugin,DebugWarn,"Transport(%s) shard %u set non blocking mode failed%s [%p]",
+		m_id.c_str(),i,tmp.c_str(),this);
+	    YateSIPTransport::resetSocket(sock,-1);
+	    break;
+	}
+	YateSIPUDPShard* shard = new YateSIPUDPShard(this,i,sock,m_shardPrio,blocking);
+	m_shards.append(shard)->setDelete(false);
+	if (!shard->startup()) {
+	    Debug(&plugin,DebugWarn,"Transport(%s) failed to start shard %u thread [%p]",
+		m_id.c_str(),i,this);
+	    delete shard;
+	    break;
+	}
+    }
+    Debug(&plugin,DebugInfo,"Transport(%s) sharing '%s' between %u sockets [%p]",
+	m_id.c_str(),m_local.addr().c_str(),m_shards.count() + 1,this);
+}
+
+// Stop shard readers and wait for them to terminate
+void YateSIPUDPTransport::stopShards()
+{
+    Lock lck(this);
+    if (!m_shards.skipNull())
+	return;
+    Thread* crt = Thread::current();
+    YateSIPUDPShard* self = 0;
+    for (ObjList* o = m_shards.skipNull(); o; o = o->skipNext()) {
+	YateSIPUDPShard* shard = static_cast<YateSIPUDPShard*>(o->get());
+	if (static_cast<Thread*>(shard) == crt)
+	    self = shard;
+	shard->cancel();
+    }
+    // Don't wait for ourselves
+    if (self) {
+	self->m_transport = 0;
+	m_shards.remove(self,false);
+    }
+    lck.drop();
+    for (unsigned int n = 500; n; n--) {
+	lck.acquire(this);
+	if (!m_shards.skipNull())
+	    return;
+	lck.drop();
+	Thread::idle();
+    }
+    lck.acquire(this);
+    Debug(&plugin,DebugFail,"Transport(%s) stopping with %u shards running [%p]",
+	m_id.c_str(),m_shards.count(),this);
+    for (ObjList* o = m_shards.skipNull(); o; o = o->skipNext())
+	static_cast<YateSIPUDPShard*>(o->get())->m_transport = 0;
+    m_shards.clear();
+}
+
+// Append shards statistics
+void YateSIPUDPTransport::dumpShards(String& buf)
+{
+    Lock lck(this);
+    buf << ",shards=" << (m_shards.count() + 1);
+    buf << ",shardformat=Packets|Bytes|Dropped|Reads|MaxBatch";
+    m_reader.dumpStats(buf << ",shard.0=");
+    for (ObjList* o = m_shards.skipNull(); o; o = o->skipNext()) {
+	YateSIPUDPShard* shard = static_cast<YateSIPUDPShard*>(o->get());
+	shard->reader().dumpStats(buf << ",shard." << shard->index() << "=");
+    }
+}
+
+// Process a datagram received from 'addr'
+// The buffer must have room for a terminating null after data
+bool YateSIPUDPTransport::processDatagram(char* b, int res, const SocketAddr& addr)
+{
+    int& evc = YateSIPEndPoint::s_evCount;
     if (res < 72) {
 	DDebug(&plugin,DebugInfo,
 	    "Transport(%s) received short SIP message of %d bytes from %s [%p]",
-	    m_id.c_str(),res,m_remote.addr().c_str(),this);
-	return 0;
+	    m_id.c_str(),res,addr.addr().c_str(),this);
+	return false;
     }
-    if (res == (int)m_maxpkt && s_warnPacketUDP) {
-	s_warnPacketUDP = false;
-	Alarm(&plugin,"config",DebugConf,
-	    "Transport(%s) received likely truncated packet with length %d, try to increase maxpkt [%p]",
-	    m_id.c_str(),res,this);
+    // Shard readers process datagrams concurrently
+    if (res == (int)m_maxpkt) {
+	Lock lck(s_udpRecvMutex);
+	if (s_warnPacketUDP) {
+	    s_warnPacketUDP = false;
+	    Alarm(&plugin,"config",DebugConf,
+		"Transport(%s) received likely truncated packet with length %d, try to increase maxpkt [%p]",
+		m_id.c_str(),res,this);
+	}
     }
-    char* b = (char*)m_buffer.data();
     b[res] = 0;
     bool print = true;
     if (s_printMsg && !plugin.traceActive()) {
 	print = false;
-	printRecvMsg(b,res);
+	printRecvMsg(b,res,String::empty(),&addr);
     }
 
     if (s_floodProtection && s_floodEvents && evc >= s_floodEvents) {
+	s_udpRecvMutex.lock();
 	if (!s_printFloodTime)
 	    Alarm(&plugin,"performance",DebugWarn,
 		"Flood detected, dropping INVITE/REGISTER/SUBSCRIBE/OPTIONS, allowing reINVITES");
 	s_printFloodTime = Time::now() + 10000000;
+	s_udpRecvMutex.unlock();
 	if (!msgIsAllowed(b,res)) {
 	    if (s_printMsg && print)
-		printRecvMsg(b,res);
-	    return 0;
+		printRecvMsg(b,res,String::empty(),&addr);
+	    return false;
 	}
     }
-    else if (s_printFloodTime && s_printFloodTime < Time::now()) {
-	s_printFloodTime = 0;
-	Alarm(&plugin,"performance",DebugNote,"Flood drop cleared, resumed normal message processing");
+    else {
+	Lock lck(s_udpRecvMutex);
+	if (s_printFloodTime && s_printFloodTime < Time::now()) {
+	    s_printFloodTime = 0;
+	    Alarm(&plugin,"performance",DebugNote,"Flood drop cleared, resumed normal message processing");
+	}
     }
 
     SIPMessage* msg = SIPMessage::fromParsing(0,b,res);
     if (msg) {
 	msg->msgPrint = print;
-	receiveMsg(msg);
+	receiveMsg(msg,&addr);
     }
-    return 0;
+    return true;
+}
+
+
+YateSIPUDPReader::YateSIPUDPReader()
+    : m_packets(0), m_bytes(0), m_dropped(0), m_reads(0), m_maxBatch(0)
+{
+}
+
+// Read up to 'batch' datagrams of at most 'maxpkt' bytes
+int YateSIPUDPReader::read(Socket* sock, unsigned int batch, unsigned int maxpkt)
+{
+    if (!sock)
+	return -1;
+    if (batch > UDP_BATCH_MAX)
+	batch = UDP_BATCH_MAX;
+    unsigned int slot = maxpkt + 1;
+    m_buffer.resize(batch * slot);
+    char* buf = (char*)m_buffer.data();
+    for (unsigned int i = 0; i < batch; i++) {
+	m_dgrams[i].buffer = buf + i * slot;
+	m_dgrams[i].length = maxpkt;
+	m_dgrams[i].addr = (struct sockaddr*)&m_addrs[i];
+	m_dgrams[i].addrLen = sizeof(m_addrs[i]);
+	m_dgrams[i].result = 0;
+    }
+    int n = sock->recvBatch(m_dgrams,batch);
+    if (n <= 0)
+	return n;
+    m_reads++;
+    m_packets += n;
+    if ((unsigned int)n > m_maxBatch)
+	m_maxBatch = n;
+    for (int i = 0; i < n; i++)
+	m_bytes += m_dgrams[i].result;
+    return n;
+}
+
+// Append statistics as packets|bytes|dropped|reads|maxbatch
+void YateSIPUDPReader::dumpStats(String& buf) const
+{
+    buf << m_packets << "|" << m_bytes << "|" << m_dropped << "|" << m_reads << "|" << m_maxBatch;
+}
+
+
+YateSIPUDPShard::YateSIPUDPShard(YateSIPUDPTransport* trans, unsigned int index,
+    Socket* sock, Thread::Priority prio, bool blocking)
+    : Thread("YSIP Shard",prio), m_transport(trans), m_index(index), m_sock(sock),
+      m_blocking(blocking)
+{
+    XDebug(&plugin,DebugAll,"YateSIPUDPShard(%p,%u) [%p]",trans,index,this);
+}
+
+YateSIPUDPShard::~YateSIPUDPShard()
+{
+    if (m_transport) {
+	Lock lock(m_transport);
+	m_transport->m_shards.remove(this,false);
+	m_transport = 0;
+    }
+    YateSIPTransport::resetSocket(m_sock,-1);
+    XDebug(&plugin,DebugAll,"~YateSIPUDPShard() [%p]",this);
+}
+
+void YateSIPUDPShard::run()
+{
+    DDebug(&plugin,DebugAll,"YateSIPUDPShard %u started [%p]",m_index,this);
+    int& evc = YateSIPEndPoint::s_evCount;
+    SocketAddr addr;
+    while (m_sock && !Thread::check(false)) {
+	// Do nothing if the endpoint is flooded with events or terminating
+	if (!(YateSIPEndPoint::canRead() || ((evc & 3) == 0))) {
+	    Thread::idle();
+	    continue;
+	}
+	// A blocking socket waits in receive, otherwise wait in select
+	if (!m_blocking && m_sock->canSelect()) {
+	    bool ok = false;
+	    if (!m_sock->select(&ok,0,0,UDP_SHARD_WAIT)) {
+		if (!m_sock->canRetry())
+		    Debug(&plugin,DebugWarn,"YateSIPUDPShard %u select failed: %d [%p]",
+			m_index,m_sock->error(),this);
+		Thread::idle();
+		continue;
+	    }
+	    if (!ok)
+		continue;
+	}
+	// Keep the transport alive while processing data
+	RefPointer<YateSIPUDPTransport> trans = m_transport;
+	if (!trans)
+	    break;
+	unsigned int batch = trans->m_batch;
+	unsigned int maxpkt = trans->m_maxpkt;
+	// Don't hold the transport while blocked in receive
+	if (m_blocking)
+	    trans = 0;
+	int n = m_reader.read(m_sock,batch,maxpkt);
+	if (n <= 0) {
+	    trans = 0;
+	    // Timeouts of blocking receive end up here too
+	    if (m_sock->canRetry()) {
+		if (!(m_blocking || m_sock->canSelect()))
+		    Thread::idle();
+		continue;
+	    }
+	    Debug(&plugin,DebugWarn,"YateSIPUDPShard %u read failed: %d [%p]",
+		m_index,m_sock->error(),this);
+	    Thread::idle();
+	    continue;
+	}
+	if (!trans) {
+	    trans = m_transport;
+	    if (!trans)
+		break;
+	}
+	for (int i = 0; i < n; i++) {
+	    m_reader.remote(i,addr);
+	    if (!trans->processDatagram(m_reader.data(i),m_reader.length(i),addr))
+		m_reader.dropped();
+	}
+	trans = 0;
+    }
+    DDebug(&plugin,DebugAll,"YateSIPUDPShard %u terminated [%p]",m_index,this);
 }
 
 
@@ -5224,8 +5601,10 @@ void YateSIPEngine::traceMsg(SIPMessage* message, bool incoming)
     if (incoming) {
 	DataBlock d(message->getBuffer().data(),message->getBuffer().length(),false,1);
 	*((uint8_t*)d.data() + (d.length() - 1)) = 0;
+	YateUDPParty* udp = trans->udpTransport() ?
+	    static_cast<YateUDPParty*>(message->getParty()) : 0;
 	trans->printRecvMsg ((const char*)d.data(),
-		    d.length(),message->traceId());
+		    d.length(),message->traceId(),udp ? &udp->addr() : 0);
 	d.clear(false);
       }
     else
@@ -7444,6 +7823,13 @@ void YateSIPConnection::mediaChanged(const SDPMedia& media)
 	if (stats) {
 	    paramMutex().lock();
 	    parameters().setParam("rtp_stats"+media.suffix(),stats);
+	    // receive quality estimate, ends up in chan.hangup
+	    const char* quality = m.getValue(YSTRING("quality"));
+	    if (quality) {
+		parameters().setParam("rtp_quality"+media.suffix(),quality);
+		parameters().setParam("rtp_rfactor"+media.suffix(),m.getValue(YSTRING("rfactor")));
+		parameters().setParam("rtp_mos"+media.suffix(),m.getValue(YSTRING("mos")));
+	    }
 	    paramMutex().unlock();
 	}
     }
@@ -10857,6 +11243,8 @@ void SIPDriver::msgStatusTransport(Message& msg, const String& id)
 	    msg.retValue() << ",remote=" << t->remote().addr();
 	    msg.retValue() << ",outgoing=" << String::boolText(tcp->outgoing());
 	}
+	else if (t->udpTransport())
+	    t->udpTransport()->dumpShards(msg.retValue());
 	String lines;
 	for (ObjList* ol = s_lines.skipNull(); ol; ol = ol->skipNext()) {
 	    YateSIPLine* line = static_cast<YateSIPLine*>(ol->get());
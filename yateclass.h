@@ -5765,8 +5765,61 @@ private:
     u_int32_t m_random;
 };
 
+/**
+ * A fixed size, reference counted memory area. Several DataBlock objects can
+ *  hold slices of the same buffer so data is passed around without copying.
+ * Free space left before and after a slice can be used to grow it in place.
+ * @short Reference counted memory buffer
+ */
+class YATE_API DataBuffer : public RefObject
+{
+    YNOCOPY(DataBuffer); // no automatic copies please
+public:
+    /**
+     * Constructor, allocates the memory area
+     * @param size Size of the memory area in bytes
+     */
+    explicit DataBuffer(unsigned int size);
+
+    /**
+     * Destructor, releases the memory area
+     */
+    virtual ~DataBuffer();
+
+    /**
+     * Get a pointer to the start of the memory area
+     * @return Pointer to the memory area, NULL if allocation failed
+     */
+    inline unsigned char* data() const
+	{ return m_data; }
+
+    /**
+     * Get the size of the memory area
+     * @return Size of the memory area in bytes, zero if allocation failed
+     */
+    inline unsigned int size() const
+	{ return m_size; }
+
+    /**
+     * Check if a memory range lies entirely inside this buffer
+     * @param ptr Pointer to the start of the range
+     * @param len Length of the range in bytes
+     * @return True if the whole range is inside the buffer
+     */
+    inline bool contains(const void* ptr, unsigned int len) const
+	{
+	    const unsigned char* p = static_cast<const unsigned char*>(ptr);
+	    return m_data && p >= m_data && p <= m_data + m_size && len <= (unsigned int)(m_data + m_size - p);
+	}
+
+private:
+    unsigned char* m_data;
+    unsigned int m_size;
+};
+
 /**
  * The DataBlock holds a data buffer with no specific formatting.
+ * The data can also be a slice of a shared DataBuffer, see share() and slice().
  * @short A class that holds just a block of raw data
  */
 class YATE_API DataBlock : public GenObject
@@ -5800,6 +5853,14 @@ public:
      */
     DataBlock(void* value, unsigned int len, bool copyData = true, unsigned int overAlloc = 0);
 
+    /**
+     * Constructs a data block holding a slice of a shared buffer, no data is copied
+     * @param buffer Buffer to hold a reference to, may be NULL
+     * @param offs Offset of the slice inside the buffer
+     * @param len Length of the slice, will be limited to the buffer size
+     */
+    DataBlock(DataBuffer* buffer, unsigned int offs, unsigned int len);
+
     /**
      * Destroys the data, disposes the memory.
      */
@@ -5870,6 +5931,75 @@ public:
     inline void overAlloc(unsigned int bytes)
 	{ m_overAlloc = bytes; }
 
+    /**
+     * Get the shared buffer holding the data
+     * @return Pointer to the shared buffer, NULL if data is privately owned
+     */
+    inline DataBuffer* buffer() const
+	{ return m_buffer; }
+
+    /**
+     * Check if the data is held in a buffer referenced by other objects too.
+     * Shared data must not be modified in place.
+     * @return True if the buffer holding the data is shared
+     */
+    inline bool shared() const
+	{ return m_buffer && (m_buffer->refcount() > 1); }
+
+    /**
+     * Get the free space available in the shared buffer before the data
+     * @return Number of bytes before data, always zero for private data
+     */
+    unsigned int headroom() const;
+
+    /**
+     * Get the free space available after the data without reallocation
+     * @return Number of bytes available after data
+     */
+    inline unsigned int tailroom() const
+	{ return m_allocated - m_length; }
+
+    /**
+     * Make this block hold the same data as another one.
+     * The buffer is shared if the other block holds one, data is copied otherwise
+     * @param value Data block to share data with
+     * @return True if the buffer was shared, false if data was copied
+     */
+    inline bool share(const DataBlock& value)
+	{ return slice(value,0,value.length()); }
+
+    /**
+     * Make this block hold a range of data from another one.
+     * The buffer is shared if the other block holds one, data is copied otherwise
+     * @param value Data block to take data from, may be this object
+     * @param offs Offset of the range inside the other block's data
+     * @param len Length of the range, will be limited to available data
+     * @return True if the buffer was shared, false if data was copied
+     */
+    bool slice(const DataBlock& value, unsigned int offs, unsigned int len);
+
+    /**
+     * Make sure the data is privately owned so it can be changed in place.
+     * Data held in a shared buffer is copied to newly allocated memory
+     */
+    void unshare();
+
+    /**
+     * Grow the data at start using the shared buffer's headroom.
+     * This is possible only if the buffer is not shared with other objects
+     * @param len Number of bytes to prepend, their content is undefined
+     * @return True on success, false if there is not enough headroom
+     */
+    bool push(unsigned int len);
+
+    /**
+     * Grow the data at end using the shared buffer's tailroom.
+     * This is possible only if the buffer is not shared with other objects
+     * @param len Number of bytes to append, their content is undefined
+     * @return True on success, false if there is not enough tailroom
+     */
+    bool put(unsigned int len);
+
     /**
      * Clear the data and optionally free the memory
      * @param deleteData True to free the deta block, false to just forget it
@@ -6033,13 +6163,14 @@ public:
 	}
 
     /**
-     * Truncate the data block
+     * Truncate the data block. Data held in a shared buffer is not copied
      * @param len The maximum length to keep
      */
     void truncate(unsigned int len);
 
     /**
-     * Cut off a number of bytes from the data block
+     * Cut off a number of bytes from the data block.
+     * Data held in a shared buffer is not copied
      * @param len Amount to cut, positive to cut from end, negative to cut from start of block
      */
     void cut(int len);
@@ -6247,6 +6378,7 @@ private:
     unsigned int m_length;
     unsigned int m_allocated;
     unsigned int m_overAlloc;
+    DataBuffer* m_buffer;
 };
 
 /**
@@ -10029,6 +10161,37 @@ private:
     Socket* m_socket;
 };
 
+/**
+ * A structure describing one datagram of a batched socket operation.
+ * Buffers are owned by the caller of the batch operation
+ */
+struct SocketDatagram {
+    /**
+     * Data buffer
+     */
+    void* buffer;
+
+    /**
+     * Size of the buffer on receive, length of data to send on send
+     */
+    int length;
+
+    /**
+     * Remote address buffer, may be NULL
+     */
+    struct sockaddr* addr;
+
+    /**
+     * Length of the address buffer, updated with actual address length on receive
+     */
+    socklen_t addrLen;
+
+    /**
+     * Number of bytes actually transferred
+     */
+    int result;
+};
+
 /**
  * Base class for encapsulating system dependent stream capable objects
  * @short An abstract stream class capable of reading and writing
@@ -10576,6 +10739,7 @@ public:
 	FBindToIface         = 0x0004, // Bind to specific interface for non IPv6
 	FEfficientSelect     = 0x0008, // Efficient select() is available
 	FExclusiveAddrUse    = 0x0010, // Exclusive access may be indicated in reuse
+	FBatchIO             = 0x0020, // Several datagrams can be transferred in one system call
     };
 
     /**
@@ -10763,6 +10927,17 @@ public:
      */
     virtual bool setReuse(bool reuse = true, bool exclusive = false);
 
+    /**
+     * Set the port sharing (SO_REUSEPORT) flag of the socket.
+     * All sockets bound to the same address+port must set it before bind().
+     * Incoming datagrams and connections are distributed by the kernel
+     *  among the sockets using a hash of the remote address.
+     * @param reuse True to allow other sockets to bind and share the same address+port
+     * @return True if operation was successfull, false if an error occured
+     *  or the option is not supported on this platform
+     */
+    virtual bool setReusePort(bool reuse = true);
+
     /**
      * Set the way closing a socket is handled
      * @param seconds How much to block waiting for socket to close,
@@ -11030,6 +11205,28 @@ public:
      */
     virtual int readData(void* buffer, int length);
 
+    /**
+     * Receive a batch of datagrams from a connected or unconnected socket.
+     * The method returns as soon as at least one datagram was received.
+     * Datagrams claimed by installed filters are moved after the returned ones
+     * @param dgrams Array of datagram descriptors to fill
+     * @param count Number of descriptors in the array
+     * @param flags Operating system specific bit flags that change the behaviour
+     * @return Number of datagrams received, @ref socketError() if an error occurred
+     */
+    virtual int recvBatch(SocketDatagram* dgrams, unsigned int count, int flags = 0);
+
+    /**
+     * Send a batch of datagrams over a connected or unconnected socket.
+     * Sending stops at the first datagram that failed
+     * @param dgrams Array of datagrams to send, a NULL address sends to connected peer
+     * @param count Number of datagrams in the array
+     * @param flags Operating system specific bit flags that change the behaviour
+     * @return Number of datagrams sent, @ref socketError() if an error occurred
+     *  and nothing was sent
+     */
+    virtual int sendBatch(SocketDatagram* dgrams, unsigned int count, int flags = 0);
+
     /**
      * Determines the availability to perform synchronous I/O of the socket
      * @param readok Address of a boolean variable to fill with readability status
@@ -11277,6 +11474,217 @@ private:
     void* m_socket;
 };
 
+class ReactorLoop;
+
+/**
+ * Interface to an object that receives socket readiness and timer
+ *  notifications from a @ref SocketReactor
+ * @short Socket reactor notification receiver
+ */
+class YATE_API ReactorClient
+{
+    friend class ReactorLoop;
+    friend class SocketReactor;
+public:
+    /**
+     * Constructor
+     */
+    ReactorClient();
+
+    /**
+     * Do-nothing destructor, the client must be removed from the reactor first
+     */
+    virtual ~ReactorClient();
+
+    /**
+     * Notification that a registered socket changed its readiness state.
+     * Sockets are watched edge triggered so the client must read or write
+     *  until the operation would block or it will not be notified again
+     * @param sock Reference to the registered socket
+     * @param events Combination of @ref SocketReactor::Event flags
+     */
+    virtual void socketEvent(Socket& sock, unsigned int events) = 0;
+
+    /**
+     * Notification that a timer of this client expired
+     * @param id Timer identifier returned by @ref SocketReactor::addTimer()
+     * @param when Time of the current reactor run
+     */
+    virtual void timerEvent(unsigned int id, const Time& when);
+
+private:
+    ReactorLoop* m_reactorLoop;          // Loop holding the client's registrations
+    unsigned int m_reactorRegs;          // Registrations held in that loop
+};
+
+/**
+ * A socket reactor multiplexes readiness of many sockets and many timers over
+ *  a small set of threads, each running its own event loop.
+ * Notifications for all sockets and timers of a client that are placed in the
+ *  same loop are serialized by that loop's thread.
+ * The reactor is available only on platforms providing epoll().
+ * @short Multi threaded socket readiness and timer multiplexer
+ */
+class YATE_API SocketReactor : public GenObject
+{
+    friend class ReactorLoop;
+    YNOCOPY(SocketReactor); // no automatic copies please
+public:
+    /**
+     * Socket readiness events
+     */
+    enum Event {
+	Readable = 0x01,
+	Writable = 0x02,
+	Failure  = 0x04,
+    };
+
+    /**
+     * Constructor
+     * @param name Static name of the reactor, also used for its threads
+     * @param threads Number of event loop threads, at least one
+     * @param prio Priority of the event loop threads
+     */
+    SocketReactor(const char* name = "Reactor", unsigned int threads = 1,
+	Thread::Priority prio = Thread::Normal);
+
+    /**
+     * Destructor, stops the event loops and releases all registrations.
+     * If called from a notification the loop running it is released by its
+     *  own thread after the notification returns
+     */
+    virtual ~SocketReactor();
+
+    /**
+     * Get the name of this reactor
+     * @return Name of the reactor as given in constructor
+     */
+    inline const char* name() const
+	{ return m_name; }
+
+    /**
+     * Get the number of event loops of this reactor
+     * @return Number of event loop threads
+     */
+    inline unsigned int threads() const
+	{ return m_count; }
+
+    /**
+     * Start the event loop threads if not already running
+     * @return True if all event loops are running
+     */
+    bool start();
+
+    /**
+     * Stop the event loop threads and wait for them to terminate.
+     * A loop stopped from its own thread terminates after the current notification
+     */
+    void stop();
+
+    /**
+     * Check if the event loops of this reactor are running
+     * @return True if at least one event loop is running
+     */
+    bool running() const;
+
+    /**
+     * Start watching a socket. The socket handle must be valid and should be
+     *  in non-blocking mode. The socket must be removed before being closed
+     * @param sock Reference to the socket pointer, the reactor will keep a reference
+     * @param client Client to notify about socket events
+     * @param events Combination of Event flags to watch, Failure is always watched
+     * @param thread Index of the event loop to use, negative to use the loop
+     *  already serving the client or the least loaded one
+     * @return True if the socket was added to the reactor
+     */
+    bool addSocket(SocketRef* sock, ReactorClient* client, unsigned int events = Readable,
+	int thread = -1);
+
+    /**
+     * Change the set of events watched on a socket
+     * @param sock Reference to a previously added socket
+     * @param events New combination of Event flags to watch
+     * @return True if the socket was found and modified
+     */
+    bool updateSocket(SocketRef* sock, unsigned int events);
+
+    /**
+     * Stop watching a socket. If called from another thread while the
+     *  socket's client is being notified it will wait for the notification to end
+     *  so it must not be called while holding a lock the notification may need
+     * @param sock Reference to a previously added socket
+     * @return True if the socket was found and removed
+     */
+    bool removeSocket(SocketRef* sock);
+
+    /**
+     * Add a timer to the reactor
+     * @param client Client to notify when the timer expires
+     * @param interval Timer interval in microseconds
+     * @param repeat True to rearm the timer after each expiration
+     * @param thread Index of the event loop to use, negative to use the loop
+     *  already serving the client or the least loaded one
+     * @return Timer identifier, zero on failure
+     */
+    unsigned int addTimer(ReactorClient* client, u_int64_t interval, bool repeat = false,
+	int thread = -1);
+
+    /**
+     * Cancel a timer. If called from another thread while the timer's
+     *  client is being notified it will wait for the notification to end
+     *  so it must not be called while holding a lock the notification may need
+     * @param id Timer identifier returned by @ref addTimer()
+     * @return True if the timer was found and cancelled
+     */
+    bool removeTimer(unsigned int id);
+
+    /**
+     * Remove all sockets and timers of a client, waiting for any pending
+     *  notification of the client to end. It must not be called while
+     *  holding a lock the notification may need
+     * @param client Client to remove from the reactor
+     */
+    void removeClient(ReactorClient* client);
+
+    /**
+     * Retrieve statistics of the reactor's event loops
+     * @param dest List to fill with per loop counters
+     */
+    void getStats(NamedList& dest) const;
+
+    /**
+     * Check if the reactor can be used on this platform
+     * @return True if the reactor is supported
+     */
+    static bool supported();
+
+    /**
+     * Retrieve the engine wide shared reactor, start it if not already running
+     * @return Pointer to the shared reactor, NULL if not supported
+     */
+    static SocketReactor* global();
+
+    /**
+     * Set the number of event loops of the engine wide shared reactor.
+     * This has effect only before the shared reactor is first used
+     * @param threads Number of event loop threads
+     */
+    static void setGlobalThreads(unsigned int threads);
+
+    /**
+     * Stop and destroy the engine wide shared reactor
+     */
+    static void destroyGlobal();
+
+private:
+    ReactorLoop* pickLoop(ReactorClient* client, int thread, bool timers) const;
+    const char* m_name;
+    Thread::Priority m_priority;
+    unsigned int m_count;
+    ReactorLoop** m_loops;
+    unsigned int m_timerId;
+};
+
 /**
  * This class holds a DNS (resolver) record
  * @short A DNS record
@@ -11532,8 +11940,13 @@ private:
     NaptrRecord() {}                     // No default contructor
 };
 
+class ResolverClient;
+
 /**
- * This class offers DNS query services
+ * This class offers DNS query services.
+ * Besides the blocking system resolver wrappers it provides an asynchronous
+ *  engine that talks directly to name servers over UDP, caches positive and
+ *  negative answers according to their TTL and coalesces identical queries
  * @short DNS services
  */
 class YATE_API Resolver
@@ -11622,12 +12035,102 @@ public:
      */
     static int txtQuery(const char* dname, ObjList& result, String* error = 0);
 
+    /**
+     * Configure the asynchronous resolver engine.
+     * Handled parameters: servers, timeout, retries, cache_size, min_ttl,
+     *  max_ttl, negative_ttl. If no server is configured the name servers
+     *  listed in the system resolver configuration are used
+     * @param params Configuration parameters
+     */
+    static void setup(const NamedList& params);
+
+    /**
+     * Check if the asynchronous resolver engine can be used
+     * @return True if at least one name server is known
+     */
+    static bool asyncAvailable();
+
+    /**
+     * Start an asynchronous query. Identical queries in progress are coalesced.
+     * The client is notified from the resolver thread or, if the answer is
+     *  already cached, before this method returns
+     * @param type Query type
+     * @param dname Domain to query
+     * @param client Client to notify when the query completes
+     * @param userData Opaque data passed back to the client
+     * @return True if the query was started or answered from cache,
+     *  false if the client will not be notified
+     */
+    static bool asyncQuery(Type type, const char* dname, ResolverClient* client,
+	void* userData = 0);
+
+    /**
+     * Cancel all pending notifications of a client.
+     * This method must be called before destroying a client with queries in progress.
+     * It waits for a notification of the client already running in another thread to end
+     * @param client Client to cancel
+     * @return Number of cancelled notifications
+     */
+    static unsigned int cancelQuery(ResolverClient* client);
+
+    /**
+     * Make a blocking query using the asynchronous engine and its cache.
+     * Falls back to the system resolver if the engine is not available
+     * @param type Query type as enumeration
+     * @param dname Domain to query
+     * @param result List of resulting record items
+     * @param error Optional string to be filled with error string
+     * @return 0 on success, error code otherwise (h_errno value on Linux)
+     */
+    static int resolve(Type type, const char* dname, ObjList& result, String* error = 0);
+
+    /**
+     * Remove all answers from the asynchronous resolver cache
+     */
+    static void flushCache();
+
+    /**
+     * Retrieve asynchronous resolver statistics
+     * @param params List to fill with statistics parameters
+     */
+    static void getStats(NamedList& params);
+
+    /**
+     * Stop the asynchronous resolver engine, fail all pending queries and flush the cache
+     */
+    static void cleanup();
+
     /**
      * Resolver type names
      */
     static const TokenDict s_types[];
 };
 
+/**
+ * Interface of objects receiving asynchronous DNS query results
+ * @short Asynchronous resolver client
+ */
+class YATE_API ResolverClient
+{
+public:
+    /**
+     * Destructor
+     */
+    virtual ~ResolverClient()
+	{ }
+
+    /**
+     * Notification of a finished query
+     * @param type Query type
+     * @param dname Domain that was queried
+     * @param code 0 on success, error code otherwise (h_errno compatible value)
+     * @param result List of resulting record items, the client may take ownership of them
+     * @param userData Opaque data given when the query was started
+     */
+    virtual void resolved(Resolver::Type type, const String& dname, int code,
+	ObjList& result, void* userData) = 0;
+};
+
 /**
  * The Cipher class provides an abstraction for data encryption classes
  * @short An abstract cipher
@@ -310,6 +310,7 @@ public:
 	DataSilent  = 0x0008,
 	DataMissed  = 0x0010,
 	DataError   = 0x0020,
+	DataDtmf    = 0x0040,
 	DataPrivate = 0x0100
     };
 
@@ -318,7 +319,8 @@ public:
      * @param format Description of the data format, default none
      */
     inline explicit DataNode(const char* format = 0)
-	: m_format(format), m_timestamp(0)
+	: m_format(format), m_timestamp(0),
+	  m_statPackets(0), m_statDrops(0), m_statBytes(0), m_statTime(0), m_statMaxTime(0)
 	{ }
 
     /**
@@ -381,15 +383,259 @@ public:
     virtual void attached(bool added)
 	{ }
 
+    /**
+     * Get the number of data packets that went through this node
+     * @return Count of packets processed since the statistics were reset
+     */
+    inline unsigned int statPackets() const
+	{ return m_statPackets; }
+
+    /**
+     * Get the number of data packets this node lost or refused
+     * @return Count of packets dropped since the statistics were reset
+     */
+    inline unsigned int statDrops() const
+	{ return m_statDrops; }
+
+    /**
+     * Get the amount of data that went through this node
+     * @return Count of bytes processed since the statistics were reset
+     */
+    inline u_int64_t statBytes() const
+	{ return m_statBytes; }
+
+    /**
+     * Get the average time spent processing a packet, including the nodes downstream
+     * @return Average processing time in microseconds
+     */
+    inline unsigned int statAvgTime() const
+	{ return m_statPackets ? (unsigned int)(m_statTime / m_statPackets) : 0; }
+
+    /**
+     * Get the longest time spent processing a packet, including the nodes downstream
+     * @return Maximum processing time in microseconds
+     */
+    inline unsigned int statMaxTime() const
+	{ return m_statMaxTime; }
+
+    /**
+     * Get the total time spent processing packets, including the nodes downstream
+     * @return Processing time in microseconds since the statistics were reset
+     */
+    inline u_int64_t statTime() const
+	{ return m_statTime; }
+
+    /**
+     * Reset all the data flow statistics of this node
+     */
+    void resetStats();
+
 protected:
+    /**
+     * Account a processed packet in the data flow statistics.
+     * Counters are not locked, concurrent updates may make them slightly off
+     * @param bytes Length of the packet
+     * @param usec Time spent processing the packet in microseconds
+     */
+    inline void statData(unsigned int bytes, u_int64_t usec)
+	{
+	    m_statPackets++;
+	    m_statBytes += bytes;
+	    m_statTime += usec;
+	    if (usec > m_statMaxTime)
+		m_statMaxTime = (unsigned int)usec;
+	}
+
+    /**
+     * Account a dropped packet in the data flow statistics
+     */
+    inline void statDrop()
+	{ m_statDrops++; }
+
     DataFormat m_format;
     unsigned long m_timestamp;
+
+private:
+    unsigned int m_statPackets;
+    unsigned int m_statDrops;
+    u_int64_t m_statBytes;
+    u_int64_t m_statTime;
+    unsigned int m_statMaxTime;
 };
 
 class DataSource;
 class DataTranslator;
 class TranslatorFactory;
 class ThreadedSourcePrivate;
+class MediaClockEntry;
+class TranscodeQueue;
+
+/**
+ * A frame of media data along with its format, timestamp and flags.
+ * Frames are taken from a pool and go back to it when the last reference
+ *  is released, keeping their payload memory if nobody else shares it.
+ * The payload is a DataBlock that can share a reference counted DataBuffer.
+ * @short A pooled frame of media data
+ */
+class YATE_API DataFrame : public RefObject
+{
+    YNOCOPY(DataFrame); // no automatic copies please
+public:
+    /**
+     * Get a frame from the pool with a payload of requested length.
+     * The payload content is undefined, it must be filled by the caller
+     * @param format Format of the data, may be NULL if unknown
+     * @param length Length of the payload in bytes
+     * @param tStamp Timestamp of the data - typically samples
+     * @param flags Indicator flags associated with the data
+     * @return Pointer to a new frame, must be released by the caller
+     */
+    static DataFrame* build(const FormatInfo* format, unsigned int length,
+	unsigned long tStamp = DataNode::invalidStamp(), unsigned long flags = 0);
+
+    /**
+     * Get a frame from the pool holding existing data.
+     * The data buffer is shared if the block holds one, data is copied otherwise
+     * @param format Format of the data, may be NULL if unknown
+     * @param data Data to put in the frame
+     * @param tStamp Timestamp of the data - typically samples
+     * @param flags Indicator flags associated with the data
+     * @return Pointer to a new frame, must be released by the caller
+     */
+    static DataFrame* build(const FormatInfo* format, const DataBlock& data,
+	unsigned long tStamp = DataNode::invalidStamp(), unsigned long flags = 0);
+
+    /**
+     * Get a frame from the pool with the same data and properties as this one.
+     * The payload is shared so neither frame will be writable
+     * @param tStamp Timestamp of the new frame
+     * @return Pointer to a new frame, must be released by the caller
+     */
+    DataFrame* copy(unsigned long tStamp) const;
+
+    /**
+     * Get the format of the data
+     * @return Pointer to the format information, NULL if unknown
+     */
+    inline const FormatInfo* format() const
+	{ return m_format; }
+
+    /**
+     * Set the format of the data, typically after converting it in place
+     * @param format Pointer to the new format information
+     */
+    inline void format(const FormatInfo* format)
+	{ m_format = format; }
+
+    /**
+     * Access the payload of the frame
+     * @return Reference to the data block holding the payload
+     */
+    inline DataBlock& data()
+	{ return m_data; }
+
+    /**
+     * Constant access to the payload of the frame
+     * @return Reference to the data block holding the payload
+     */
+    inline const DataBlock& data() const
+	{ return m_data; }
+
+    /**
+     * Get the number of samples in the frame
+     * @return Number of samples per channel, zero if unknown
+     */
+    inline unsigned int samples() const
+	{ return m_samples; }
+
+    /**
+     * Set the number of samples in the frame
+     * @param count Number of samples per channel
+     */
+    inline void samples(unsigned int count)
+	{ m_samples = count; }
+
+    /**
+     * Get the timestamp of the frame
+     * @return Timestamp of data - typically samples
+     */
+    inline unsigned long timeStamp() const
+	{ return m_timeStamp; }
+
+    /**
+     * Set the timestamp of the frame
+     * @param tStamp Timestamp of data - typically samples
+     */
+    inline void timeStamp(unsigned long tStamp)
+	{ m_timeStamp = tStamp; }
+
+    /**
+     * Get the flags of the frame
+     * @return Flags from DataNode::DataFlags
+     */
+    inline unsigned long flags() const
+	{ return m_flags; }
+
+    /**
+     * Set the flags of the frame
+     * @param flags New flags from DataNode::DataFlags
+     */
+    inline void flags(unsigned long flags)
+	{ m_flags = flags; }
+
+    /**
+     * Check if the frame starts a talkspurt or is otherwise marked
+     * @return True if the DataMark flag is set
+     */
+    inline bool marker() const
+	{ return 0 != (m_flags & DataNode::DataMark); }
+
+    /**
+     * Get the DTMF tone carried by the frame
+     * @return DTMF character, zero if the frame carries no DTMF
+     */
+    inline char dtmf() const
+	{ return (m_flags & DataNode::DataDtmf) ? m_dtmf : 0; }
+
+    /**
+     * Set or clear the DTMF tone carried by the frame
+     * @param tone DTMF character, zero to clear
+     */
+    void dtmf(char tone);
+
+    /**
+     * Check if the frame can be changed in place by its holder.
+     * This is true only if nobody else references the frame or its payload
+     * @return True if the frame and its payload are not shared
+     */
+    inline bool writable() const
+	{ return (refcount() == 1) && !m_data.shared(); }
+
+    /**
+     * Retrieve statistics of the frame pool
+     * @param pooled Number of frames currently in the pool
+     * @param allocated Number of frames allocated, in use or pooled
+     */
+    static void getStats(unsigned int& pooled, unsigned int& allocated);
+
+protected:
+    /**
+     * Put the frame back in the pool instead of deleting it
+     */
+    virtual void zeroRefs();
+
+private:
+    DataFrame();
+    void resize(unsigned int length);
+    static DataFrame* take();
+    const FormatInfo* m_format;
+    unsigned int m_samples;
+    unsigned long m_timeStamp;
+    unsigned long m_flags;
+    char m_dtmf;
+    DataBlock m_data;
+    DataFrame* m_next;
+};
 
 /**
  * A data consumer
@@ -432,6 +678,17 @@ public:
      */
     virtual unsigned long Consume(const DataBlock& data, unsigned long tStamp, unsigned long flags) = 0;
 
+    /**
+     * Consumes a frame of data sent to it from a source.
+     * The default implementation calls the block based @ref Consume().
+     * The frame may be changed in place only if it is @ref DataFrame::writable()
+     * @param frame The frame of data to process
+     * @return Number of samples actually consumed,
+     *  use invalidStamp() to indicate that all data was consumed,
+     *  return zero for consumers that become invalid
+     */
+    virtual unsigned long ConsumeFrame(DataFrame& frame);
+
     /**
      * Get the data source of this object if it's connected
      * @return A pointer to the DataSource object or NULL
@@ -461,9 +718,20 @@ protected:
      */
     virtual bool synchronize(DataSource* source);
 
+    /**
+     * Helper for frame based consumers, puts a data block in a pooled frame
+     *  and passes it to @ref ConsumeFrame(). Call it from @ref Consume()
+     * @param data The raw data block to process
+     * @param tStamp Timestamp of data - typically samples
+     * @param flags Indicator flags associated with the data block
+     * @return Number of samples actually consumed
+     */
+    unsigned long consumeBlock(const DataBlock& data, unsigned long tStamp, unsigned long flags);
+
 private:
     unsigned long Consume(const DataBlock& data, unsigned long tStamp,
 	unsigned long flags, DataSource* source);
+    unsigned long ConsumeFrame(DataFrame& frame, DataSource* source);
     DataSource* m_source;
     DataSource* m_override;
     long m_regularTsDelta;
@@ -522,6 +790,16 @@ public:
     unsigned long Forward(const DataBlock& data, unsigned long tStamp = invalidStamp(),
 	unsigned long flags = 0);
 
+    /**
+     * Forwards a frame of data to its consumers.
+     * A missing timestamp or sample count is filled in the frame.
+     * The caller should not use the frame content after this call, consumers
+     *  may change it in place if the caller holds the only reference
+     * @param frame The frame of data to forward
+     * @return Number of samples actually forwarded to all consumers
+     */
+    unsigned long ForwardFrame(DataFrame& frame);
+
     /**
      * Attach a data consumer
      * @param consumer Data consumer to attach
@@ -562,6 +840,19 @@ public:
     inline unsigned long nextStamp() const
 	{ return m_nextStamp; }
 
+    /**
+     * Describe the data flow graph starting at this source.
+     * Each node gets a set of node.N parameters holding its role, format,
+     *  the index of its parent node and its statistics
+     * @param params List to add node parameters to, nodes holds their count
+     * @param text String to append a human readable tree to
+     * @param reset True to reset the statistics of the nodes after reporting them
+     * @param parent Index of the node feeding this source, negative for none
+     * @param level Depth of this source in the tree, used for indenting text
+     */
+    void dumpFlow(NamedList& params, String& text, bool reset = false,
+	int parent = -1, unsigned int level = 0);
+
 protected:
     unsigned long m_nextStamp;
     ObjList m_consumers;
@@ -581,6 +872,7 @@ private:
 class YATE_API ThreadedSource : public DataSource
 {
     friend class ThreadedSourcePrivate;
+    friend class MediaClock;
 public:
     /**
      * The destruction notification, checks that the thread is gone
@@ -588,15 +880,21 @@ public:
     virtual void destroyed();
 
     /**
-     * Starts the worker thread
+     * Starts the worker thread or attaches the source to the shared media clock.
+     * Clocked sources must implement tick(), they get their own thread
+     *  running the default run() only if the media clock has no threads
      * @param name Static name of this thread
      * @param prio Thread's priority
+     * @param clocked True to have tick() called by the shared media clock
      * @return True if started, false if an error occured
      */
-    bool start(const char* name = "ThreadedSource", Thread::Priority prio = Thread::Normal);
+    bool start(const char* name = "ThreadedSource", Thread::Priority prio = Thread::Normal,
+	bool clocked = false);
 
     /**
-     * Stops and destroys the worker thread if running
+     * Stops and destroys the worker thread if running or detaches the source
+     *  from the shared media clock, waiting for a tick() in progress to return
+     *  unless called from that tick()
      */
     void stop();
 
@@ -612,19 +910,52 @@ public:
      */
     bool running() const;
 
+    /**
+     * Set the number of threads of the shared media clock
+     * @param threads Number of clock threads, zero to start a thread per source
+     */
+    static void setClockThreads(unsigned int threads);
+
+    /**
+     * Get the number of threads of the shared media clock
+     * @return Number of clock threads requested
+     */
+    static unsigned int clockThreads();
+
+    /**
+     * Retrieve statistics of the shared media clock threads
+     * @param dest List to fill with one parameter for each thread
+     */
+    static void getClockStats(NamedList& dest);
+
+    /**
+     * Stop the shared media clock threads, called by the engine on exit
+     */
+    static void stopClock();
+
 protected:
     /**
      * Threaded Source constructor
      * @param format Name of the data format, default "slin" (Signed Linear)
      */
     inline explicit ThreadedSource(const char* format = "slin")
-	: DataSource(format), m_thread(0)
+	: DataSource(format), m_thread(0), m_clock(0)
 	{ }
 
     /**
-     * The worker method. You have to reimplement it as you need
+     * The worker method. You have to reimplement it as you need.
+     * The default implementation calls tick() on schedule
+     */
+    virtual void run();
+
+    /**
+     * Produce the data of one packet period, called on schedule by the shared
+     *  media clock or by the default run(). It must return promptly and should
+     *  use looping() to check if the source is still needed
+     * @param when Time in microseconds this call was scheduled for
+     * @return Microseconds until the next call, zero to stop the source
      */
-    virtual void run() = 0;
+    virtual unsigned int tick(u_int64_t when);
 
     /**
      * The cleanup after thread method, deletes the source if already
@@ -641,6 +972,7 @@ protected:
 
 private:
     ThreadedSourcePrivate* m_thread;
+    MediaClockEntry* m_clock;
 };
 
 /**
@@ -651,6 +983,8 @@ private:
 class YATE_API DataTranslator : public DataConsumer
 {
     friend class TranslatorFactory;
+    friend class TranslatorReader;
+    friend class TranscodeWorker;
 public:
     /**
      * Construct a data translator.
@@ -792,7 +1126,55 @@ public:
      */
     static void setMaxChain(unsigned int maxChain);
 
+    /**
+     * Set the number of threads of the shared transcoding pool.
+     * Translators that use @ref transcode() queue their data to the pool
+     *  instead of converting it in the thread that forwards it
+     * @param threads Number of worker threads, zero to convert inline
+     */
+    static void setTranscodeThreads(unsigned int threads);
+
+    /**
+     * Get the number of threads of the shared transcoding pool
+     * @return Number of worker threads, zero if data is converted inline
+     */
+    static unsigned int transcodeThreads();
+
+    /**
+     * Retrieve per codec statistics of the transcoding pool.
+     * Each source>destination codec gets a parameter with the values
+     *  blocks|bytes|usec|batches|queued|maxqueued|avgwait|dropped
+     * @param dest List to fill with threads count and one parameter per codec
+     */
+    static void getTranscodeStats(NamedList& dest);
+
+    /**
+     * Stop the transcoding pool threads and drop any data still queued
+     */
+    static void stopTranscoding();
+
 protected:
+    /**
+     * Convert a block of data and forward the result to the translator's source.
+     * Translators that use the transcoding pool do their work here
+     * @param data The raw received data
+     * @param tStamp Timestamp of data - typically samples
+     * @param flags Indicator flags associated with the data block
+     * @return Number of samples actually consumed
+     */
+    virtual unsigned long process(const DataBlock& data, unsigned long tStamp, unsigned long flags);
+
+    /**
+     * Call @ref process() directly or queue data for the transcoding pool.
+     * Blocks of the same translator are always processed in order, one at a time
+     * @param data The raw received data
+     * @param tStamp Timestamp of data - typically samples
+     * @param flags Indicator flags associated with the data block
+     * @return Number of samples consumed or queued, invalidStamp() if the samples
+     *  in queued data can't be guessed from its format, zero if the translator is dying
+     */
+    unsigned long transcode(const DataBlock& data, unsigned long tStamp, unsigned long flags);
+
     /**
      * Get access to the list of consumers of the data source
      * @return Pointer to list entry of first consumer, NULL if none attached
@@ -823,8 +1205,10 @@ private:
     DataTranslator(); // No default constructor please
     static void compose();
     static void compose(TranslatorFactory* factory);
+    static void refresh();
     static bool canConvert(const FormatInfo* fmt1, const FormatInfo* fmt2);
     DataSource* m_tsource;
+    TranscodeQueue* m_transcode;
     static Mutex s_mutex;
     static ObjList s_factories;
     static unsigned int s_maxChain;
@@ -1100,6 +1484,16 @@ public:
      */
     virtual bool control(NamedList& params);
 
+    /**
+     * Describe the data flow graphs of this endpoint with node statistics.
+     * The graphs fed by the endpoint's source and the ones feeding its
+     *  consumers, starting from the original sources, are reported
+     * @param params List to add node parameters to, see DataSource::dumpFlow()
+     * @param text String to append a human readable description to
+     * @param reset True to reset the statistics of the nodes after reporting them
+     */
+    void dumpFlow(NamedList& params, String& text, bool reset = false);
+
 protected:
     /**
      * Attempt to connect the endpoint to a peer of the same type
@@ -1499,6 +1893,8 @@ protected:
 	Control	   = 0x00080000,
 	// Instant messaging related
 	MsgExecute = 0x00100000,
+	// Diagnostics
+	DataFlow   = 0x00200000,
 	// Last possible public ID
 	PubLast    = 0x00ffffff,
 	// Private messages base ID
@@ -1866,6 +2262,13 @@ public:
      */
     virtual bool msgControl(Message& msg);
 
+    /**
+     * Data flow query handler, describes the media graphs of the channel
+     * @param msg Data flow query message
+     * @return True to stop processing the message, false to let it flow
+     */
+    virtual bool msgDataFlow(Message& msg);
+
     /**
      * Timer check method, by default handles channel timeouts
      * @param msg Timer message